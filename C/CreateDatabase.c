@@ -34,8 +34,11 @@ sequentially.
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "CreateDatabase.h"
+#include "dbcache.h"
+#include "hugepage.h"
 #include "grayscale.h"
 #include "ppm.h"
 
@@ -58,10 +61,16 @@ database_t *CreateDatabase(char TrainPath[])
     double *Tp; // used for allocating the memory used in T
     Pixel *pix_ptr; // pointer to a pixel
     database_t *final;
+    dbcache_t *cache; // decoded database of a previous run, if any
+    dbcache_entry_t *entries; // name, size and mtime of each image
+    int *cached; // column of each image in the cache, -1 if it must be decoded
+    int stale = 0; // number of images that were decoded again
+    struct stat st;
 
     int i = 0;
     int j = 0;
     char *FullPath; // path of file, e.g., ../LDAIMAGES/Train2/1.ppm
+    char *name; // file name within TrainPath, e.g., 1.ppm
 
     // read in all filenames
     struct dirent **namelist;
@@ -77,14 +86,53 @@ database_t *CreateDatabase(char TrainPath[])
 
     // T is num_pixels high and ImageCount wide
     T = (double **) malloc (num_pixels * sizeof(double *)); // each element of T points to start of a row
-    Tp = (double *) malloc (num_pixels * ImageCount * sizeof(double)); // ensures memory is contiguous
+    Tp = (double *) hugepage_alloc ((size_t) num_pixels * ImageCount * sizeof(double)); // ensures memory is contiguous
     // point elements of T to the start of each row
     for(i = 0; i < num_pixels; i++){
         T[i] = &Tp[i * ImageCount];
     }
 
-    // for each image (each image being a column of T)
+    // look up every image in the ingestion cache of the previous run
+    cache = dbcache_open(TrainPath, num_pixels);
+    entries = (dbcache_entry_t *) calloc(ImageCount, sizeof(dbcache_entry_t));
+    cached = (int *) malloc(ImageCount * sizeof(int));
+
     for (j = 0; j < ImageCount; j++) {
+        sprintf(FullPath, "%s/%d.ppm", TrainPath, j+1);
+        name = FullPath + strlen(TrainPath) + 1;
+
+        cached[j] = -1;
+        if (stat(FullPath, &st) == 0) {
+            dbcache_entry(&entries[j], name, &st);
+            if (cache != NULL) {
+                cached[j] = dbcache_find(cache, &entries[j], j);
+            }
+        } else {
+            perror(FullPath);
+        }
+        if (cached[j] < 0) {
+            stale++;
+        }
+    }
+
+    // copy the images that did not change straight out of the mapping,
+    // one row (pixel) at a time so both sides are walked sequentially
+    if (cache != NULL && stale < ImageCount) {
+        for (i = 0; i < num_pixels; i++) {
+            const unsigned char *row = cache->data + (size_t) i * cache->images;
+            for (j = 0; j < ImageCount; j++) {
+                if (cached[j] >= 0) {
+                    T[i][j] = (double) row[cached[j]];
+                }
+            }
+        }
+    }
+
+    // for each image that is new or changed (each image being a column of T)
+    for (j = 0; j < ImageCount; j++) {
+        if (cached[j] >= 0) {
+            continue;
+        }
         sprintf(FullPath, "%s/%d.ppm", TrainPath, j+1);
         // FullPath is now the entire path to image in question
 
@@ -125,6 +173,16 @@ database_t *CreateDatabase(char TrainPath[])
     final->images = ImageCount;
     final->pixels = num_pixels;
 
+    // refresh the cache when anything had to be decoded or was removed
+    if (stale > 0 || cache == NULL || cache->images != ImageCount) {
+        dbcache_write(TrainPath, final, entries);
+    } else {
+        printf("%d images loaded from %s/%s\n", ImageCount, TrainPath, DBCACHE_NAME);
+    }
+    dbcache_close(cache);
+    free(entries);
+    free(cached);
+
 //    printf("created database:\n");
 //    for(i = 0; i < final->pixels; i++)
 //    {
@@ -144,7 +202,7 @@ database_t *CreateDatabase(char TrainPath[])
  */
 void DestroyDatabase(database_t *D)
 {
-    free(*D->data);
+    hugepage_free(*D->data);
     free(D->data);
     free(D);
 }
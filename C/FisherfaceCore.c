@@ -16,6 +16,7 @@
     D                             - ((M*N)xP) A 2D matrix, containing all 1D image vectors.
                                      All of 1D column vectors have the same length of M*N,
                                      and 'D' will be a MNxP 2D matrix.
+    ModelPath                     - File the outputs are saved to (see model.h), or NULL
 
  Returns:
     M                             - MATRIX ** consisting of the following 4 entries:
@@ -41,26 +42,47 @@
 #include "ppm.h"
 #include "CreateDatabase.h"
 #include "matrix.h"
+#include "model.h"
 #include "FisherfaceCore.h"
-
-MATRIX **FisherfaceCore(const database_t *Database)
+#include "centroid.h"
+#include "gallery.h"
+#include "quant.h"
+#include "srp.h"
+
+// sections of the model file: the outputs, the projection, the int8 mode,
+// the projected mean, the gallery norms, blocked gallery, the class
+// centroids and the sign-random-projection codes
+#define MODEL_SECTIONS (FISHER_OUTPUTS + 1 + QUANT_SECTIONS + 2 + GALLERY_SECTIONS \
+                        + CENTROID_SECTIONS + SRP_SECTIONS)
+
+// Names of the FisherfaceCore outputs in the model file
+const char * const FisherNames[FISHER_OUTPUTS] = {
+    "m_database",
+    "V_PCA",
+    "V_Fisher",
+    "ProjectedImages_Fisher"
+};
+
+MATRIX **FisherfaceCore(const database_t *Database, const char *ModelPath)
 {
     int Class_population = 4; //Set value according to database (Images per person)
     int P = Database->images; //Total Number of training images
     int pixels = Database->pixels; //total pixels per image (i.e., width * height)
     int Class_number = P / Class_population; //Number of classes (or persons)
-    int i, j, k, l;
+    int PCA_dims = P - Class_number; //dimension of the PCA subspace
+    int Fisher_dims = Class_number - 1; //dimension of the Fisher subspace
+    int i, j, k;
     // debug print flags
     int p_database = 0;
     int p_mean = 0;
     int p_dev = 0;
     int p_cov = 0;
-    int p_eig = 1;
+    int p_eig = 0;
     int p_vpca = 0;
-    int p_pipca = 1;
-    int p_mPCA = 1;
-    double *work, *info;    // Array of doubles containing intermediate values for dggev
-    double temp_double;
+    int p_pipca = 0;
+    int p_mPCA = 0;
+    int p_fisher = 0;
+    int *order; // eigenvalues of J sorted in descending order
 
     // MATRIX types
     MATRIX **M; //What the function returns
@@ -74,13 +96,24 @@ MATRIX **FisherfaceCore(const database_t *Database)
     MATRIX *V_PCA; //
     MATRIX *ProjectedImages_PCA;
     MATRIX *m_PCA; //mean of ProjectedImages_PCA
-    MATRIX *tempMean; //temporary matrix to store the mean of ProjectedImages_PCA
-    MATRIX *tempMat;
-    MATRIX *S;
-    MATRIX *J_eig_vec;
-    MATRIX *alphai, *alphar, *beta;
-
-    M = (MATRIX **) malloc(4 * sizeof(MATRIX *));
+    MATRIX *m; //mean of each class in eigenspace
+    MATRIX *Sw; //Within scatter matrix
+    MATRIX *Sb; //Between scatter matrix
+    MATRIX *tempMat; //deviation of one image (or class mean) in eigenspace
+    MATRIX *J_eig_vec; //Generalized eigenvectors of (Sb, Sw)
+    MATRIX *alphai, *alphar, *beta; //Generalized eigenvalues are alphar / beta
+    MATRIX *V_Fisher;
+    MATRIX *ProjectedImages_Fisher;
+    MATRIX *Projection; //V_Fisher' * V_PCA', saved for Recognition
+    MATRIX *Variances; //gallery variance along each Fisher dimension
+    quant_t *Quantized; //int8 projection and gallery
+    MATRIX *Derived; //projected mean and gallery norms, for the model
+    gallery_t *Gallery; //ProjectedImages_Fisher in scan order, for the model
+    centroid_t *Centroids; //class means in Fisher space, for the model
+    srp_t *Codes; //256-bit codes of the gallery, for the model
+    model_entry_t entries[MODEL_SECTIONS]; //sections of the model file
+
+    M = (MATRIX **) malloc(FISHER_OUTPUTS * sizeof(MATRIX *));
 
     // Convert Database to MATRIX
     Database_matrix = matrix_constructor(pixels, Database->images);
@@ -160,9 +193,11 @@ MATRIX **FisherfaceCore(const database_t *Database)
 
     L_eig_vec = matrix_constructor(P, P - Class_number);
 
+    // dsyev returns the eigenvalues in ascending order; keep the P - C
+    // eigenvectors with the largest eigenvalues
     for (i = 0; i < L_eig_vec->rows; i++) {
         for (j = 0; j < L_eig_vec->cols; j++) {
-            L_eig_vec->data[i][j] = V->data[i][j];
+            L_eig_vec->data[i][j] = V->data[i][j + Class_number];
         }
     }
 
@@ -203,107 +238,186 @@ MATRIX **FisherfaceCore(const database_t *Database)
 
     //**************************************************************************
     //Calculating the mean of each class in eigenspace
-    //<.m: 64>
-//    m_PCA = mean(ProjectedImages_PCA,2); % Total mean in eigenspace
-//    m = zeros(P-Class_number,Class_number);
-//    Sw = zeros(P-Class_number,P-Class_number); % Initialization of Within Scatter Matrix
-//    Sb = zeros(P-Class_number,P-Class_number); % Initialization of Between Scatter Matrix
-//
-//    for i = 1 : Class_number
-//        m(:,i) = mean( ( ProjectedImages_PCA(:,((i-1)*Class_population+1):i*Class_population) ), 2 )';
-//
-//        S  = zeros(P-Class_number,P-Class_number);
-//        for j = ( (i-1)*Class_population+1 ) : ( i*Class_population )
-//            S = S + (ProjectedImages_PCA(:,j)-m(:,i))*(ProjectedImages_PCA(:,j)-m(:,i))';
-//        end
-//
-//        Sw = Sw + S; % Within Scatter Matrix
-//        Sb = Sb + (m(:,i)-m_PCA) * (m(:,i)-m_PCA)'; % Between Scatter Matrix
-//    end
+    //<.m: 64-79>
 
     m_PCA = matrix_mean(ProjectedImages_PCA);
 
-    m = matrix_constructor(P-Class_number,Class_number);
-    Sw = matrix_constructor(P-Class_number, P-Class_number);
-    Sb = matrix_constructor(P-Class_number, P-Class_number);
-    S = matrix_constructor(P-Class_number,P-Class_number);
-
-    
-    for (i = 1; i <= Class_number; i++)
-    {
-        tempMean = matrix_bounded_mean(ProjectedImages_PCA, 0, ProjectedImages_PCA->rows-1, (i-1)*Class_population+1, i*Class_population);
-        
-        for (j = 0; j < m->rows; j++)
-        {
-           m->data[j][i] = tempMean->data[j][1];
+    m = matrix_constructor(PCA_dims, Class_number);
+    Sw = matrix_constructor(PCA_dims, PCA_dims);
+    Sb = matrix_constructor(PCA_dims, PCA_dims);
+    tempMat = matrix_constructor(PCA_dims, 1);
+    memset(*Sw->data, 0, PCA_dims * PCA_dims * sizeof(double));
+    memset(*Sb->data, 0, PCA_dims * PCA_dims * sizeof(double));
+
+    for (i = 0; i < Class_number; i++) {
+        for (k = 0; k < PCA_dims; k++) {
+            m->data[k][i] = 0;
+            for (j = i * Class_population; j < (i + 1) * Class_population; j++) {
+                m->data[k][i] += ProjectedImages_PCA->data[k][j];
+            }
+            m->data[k][i] /= Class_population;
         }
-        
-        matrix_destructor(tempMean);
-        
-        for (j = ((i-1)*Class_population+1); j <= (i*Class_population); j++)
-        {
-            tempMat = matrix_constructor(P-Class_number, 1);
-            
-            for (k = 0; k < (P-Class_number); k++)
-            {
+
+        // Sw = Sw + (ProjectedImages_PCA(:,j)-m(:,i))*(ProjectedImages_PCA(:,j)-m(:,i))'
+        for (j = i * Class_population; j < (i + 1) * Class_population; j++) {
+            for (k = 0; k < PCA_dims; k++) {
                 tempMat->data[k][0] = ProjectedImages_PCA->data[k][j] - m->data[k][i];
             }
-                
-            cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, tempMat->rows, 1, 1, 1, 
-                        *tempMat->data, tempMat->cols, *tempMat->data, tempMat->cols, 1, *S->data, S->cols);  
-                        
+            cblas_dsyr(CblasRowMajor, CblasUpper, PCA_dims, 1, *tempMat->data, 1, *Sw->data, Sw->cols);
         }
-        
-        for (j = 0; j < Sw->rows; j++)
-        {
-           for (k = 0; k < Sw->rows; k++)
-           {
-               Sw->data[j][k] += S->data[j][k];
-           }
+
+        // Sb = Sb + (m(:,i)-m_PCA) * (m(:,i)-m_PCA)'
+        for (k = 0; k < PCA_dims; k++) {
+            tempMat->data[k][0] = m->data[k][i] - m_PCA->data[k][0];
         }
-        
-        for (k = 0; k < Sb->rows; k++)
-        {
-            tempMat->data[k][0] = m[k][i] - m_PCA[k][0];
+        cblas_dsyr(CblasRowMajor, CblasUpper, PCA_dims, 1, *tempMat->data, 1, *Sb->data, Sb->cols);
+    }
+
+    // dsyr only updates the upper triangle; mirror it for dggev
+    for (j = 0; j < PCA_dims; j++) {
+        for (k = 0; k < j; k++) {
+            Sw->data[j][k] = Sw->data[k][j];
+            Sb->data[j][k] = Sb->data[k][j];
         }
-        
-        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, tempMat->rows, 1, 1, 1, 
-                        *tempMat->data, tempMat->cols, *tempMat->data, tempMat->cols, 1, *Sb->data, Sb->cols); 
     }
-    
+
     if (p_mPCA) {
         printf("m_PCA:\n");
         matrix_print(m_PCA, 16);
     }
-    
-    J_eig_vec = matrix_construct(P-Class_number,P-Class_number);
-    alphai = matrix_construct(P-Class_number,1);
-    alphar = matrix_construct(P-Class_number,1);
-    beta = matrix_construct(P-Class_number,1);
-    
-    // 'N' - do not compute left eig. values
-    // 'V' - compute right eig. values
-    // Sb->cols - the size of the matrices (square)
-    // Sb->data - the matrix A in eig(A,B)
-    // Sb->rows - the leading dimension of A
-    // Sw->data - the matrix B in eig(A,B)
-    // Sw->rows - the leading dimension of B
-    // alphai, alphar, beta - dummy values
-    // J_eig_vec - matrix to output eigenvectors
-    // work - integer array output containing intermediate values
-    // -1 - automatically determine the size of work
-    // info - array containing informataion about dggev performance
-    
-    ddgev('N', 'V', Sb->cols, Sb->data, Sb->rows, Sw->data, Sw->rows, alphar, alphai, beta, NULL, 1, J_eig_vec, J_eig_vec->rows, work, -1, info);
-
-    for (i = 0; i < P-ClassNumber; i++)
-    {
-        for (j = 0; j < P-ClassNumber / 2; j++)
-        {
-            temp_double = J_eig_vec->data[i][j];
-            J_eig_vec->data[i][j] = J_eig_vec->data[i][P-ClassNumber-j];
-            J_eig_vec->data[i][P-ClassNumber-j] = temp_double;
+
+    //**************************************************************************
+    //Calculating Fisher discriminant basis's
+    //<.m: 83-89>
+    //Cost function J = inv(Sw) * Sb, solved as the generalized problem Sb*v = lambda*Sw*v
+
+    J_eig_vec = matrix_constructor(PCA_dims, PCA_dims);
+    alphar = matrix_constructor(PCA_dims, 1);
+    alphai = matrix_constructor(PCA_dims, 1);
+    beta = matrix_constructor(PCA_dims, 1);
+
+    // 'N' - do not compute left eigenvectors
+    // 'V' - compute right eigenvectors
+    // Sb, Sw - the matrices A and B in eig(A,B); both are overwritten
+    // alphar, alphai, beta - eigenvalue j is (alphar[j] + i*alphai[j]) / beta[j]
+    LAPACKE_dggev(LAPACK_ROW_MAJOR, 'N', 'V', PCA_dims, *Sb->data, Sb->cols, *Sw->data, Sw->cols,
+                  *alphar->data, *alphai->data, *beta->data, NULL, 1, *J_eig_vec->data, J_eig_vec->cols);
+
+    // Eliminating zero eigens and sorting in descend order
+    order = (int *) malloc(PCA_dims * sizeof(int));
+    for (i = 0; i < PCA_dims; i++) {
+        // eigenvalue is stored in alphar for sorting; infinite ones go last
+        alphar->data[i][0] = beta->data[i][0] != 0 ? alphar->data[i][0] / beta->data[i][0] : -HUGE_VAL;
+        order[i] = i;
+    }
+    for (i = 1; i < PCA_dims; i++) {
+        k = order[i];
+        for (j = i; j > 0 && alphar->data[order[j - 1]][0] < alphar->data[k][0]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = k;
+    }
+
+    // Largest (C-1) eigen vectors of matrix J
+    V_Fisher = matrix_constructor(PCA_dims, Fisher_dims);
+    for (i = 0; i < PCA_dims; i++) {
+        for (j = 0; j < Fisher_dims; j++) {
+            V_Fisher->data[i][j] = J_eig_vec->data[i][order[j]];
+        }
+    }
+
+    if (p_fisher) {
+        printf("J eigenvalues:\n");
+        for (j = 0; j < Fisher_dims; j++) {
+            printf("%12.4lf\n", alphar->data[order[j]][0]);
+        }
+    }
+
+    //**************************************************************************
+    //Projecting images onto Fisher linear space
+    //<.m: 91-94>
+    //Yi = V_Fisher' * V_PCA' * (Ti - m_database)
+
+    ProjectedImages_Fisher = matrix_constructor(Fisher_dims, P);
+
+    //cblas_dgemm(Order,       TransA,     TransB,       M,           N, K,        alpha, A,               lda,            B,                         ldb,                       beta, C,                              ldc);
+    cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, Fisher_dims, P, PCA_dims, 1,     *V_Fisher->data, V_Fisher->cols, *ProjectedImages_PCA->data, ProjectedImages_PCA->cols, 0,    *ProjectedImages_Fisher->data, ProjectedImages_Fisher->cols);
+
+    M[1] = V_PCA;
+    M[2] = V_Fisher;
+    M[3] = ProjectedImages_Fisher;
+
+    //**************************************************************************
+    //Save the model so later runs can skip training
+    //Recognition only needs the mean, the training projections and the fused
+    //projection matrix v_fisherT_x_v_pcaT = V_Fisher' * V_PCA', which is
+    //computed once here instead of for every test image.
+    //The int8 copies of the projection and gallery (quant.h) follow, then
+    //everything LoadRecognizer derives from the model, so that processes
+    //serving it map one shared copy instead of each computing their own,
+    //the class centroids for the two-stage search (centroid.h) and the
+    //codes of the Hamming prefilter (srp.h)
+
+    if (ModelPath != NULL) {
+        Projection = matrix_constructor(Fisher_dims, pixels);
+
+        //cblas_dgemm(Order,       TransA,     TransB,     M,           N,      K,        alpha, A,               lda,            B,            ldb,         beta, C,                 ldc);
+        cblas_dgemm(CblasRowMajor, CblasTrans, CblasTrans, Fisher_dims, pixels, PCA_dims, 1,     *V_Fisher->data, V_Fisher->cols, *V_PCA->data, V_PCA->cols, 0,    *Projection->data, Projection->cols);
+
+        for (i = 0; i < FISHER_OUTPUTS; i++) {
+            entries[i].name = FisherNames[i];
+            entries[i].dtype = MODEL_F64;
+            entries[i].rows = M[i]->rows;
+            entries[i].cols = M[i]->cols;
+            entries[i].data = *M[i]->data;
         }
+        entries[i].name = PROJECTION_NAME;
+        entries[i].dtype = MODEL_F64;
+        entries[i].rows = Projection->rows;
+        entries[i].cols = Projection->cols;
+        entries[i].data = *Projection->data;
+
+        Quantized = quant_create(Projection, M[0], M[3]);
+        quant_entries(Quantized, &entries[FISHER_OUTPUTS + 1]);
+        i = FISHER_OUTPUTS + 1 + QUANT_SECTIONS;
+
+        //row 0: Projection * m_database (Fisher_dims), row 1: norms (P)
+        Derived = matrix_constructor(2, Fisher_dims > P ? Fisher_dims : P);
+        cblas_dgemv(CblasRowMajor, CblasNoTrans, Fisher_dims, pixels, 1, *Projection->data,
+                    Projection->cols, *M[0]->data, 1, 0, Derived->data[0], 1);
+        gallery_norms(ProjectedImages_Fisher, Derived->data[1]);
+        entries[i].name = PROJECTED_MEAN_NAME;
+        entries[i].dtype = MODEL_F64;
+        entries[i].rows = Fisher_dims;
+        entries[i].cols = 1;
+        entries[i].data = Derived->data[0];
+        i++;
+        entries[i].name = GALLERY_NORMS_NAME;
+        entries[i].dtype = MODEL_F64;
+        entries[i].rows = P;
+        entries[i].cols = 1;
+        entries[i].data = Derived->data[1];
+
+        //the dimensions along which the gallery spreads most go first
+        Variances = matrix_constructor(Fisher_dims, 1);
+        gallery_variances(ProjectedImages_Fisher, *Variances->data);
+        Gallery = gallery_create(ProjectedImages_Fisher, *Variances->data);
+        gallery_entries(Gallery, &entries[i + 1]);
+        Centroids = centroid_create(ProjectedImages_Fisher, Class_population, Gallery);
+        centroid_entries(Centroids, &entries[i + 1 + GALLERY_SECTIONS]);
+        Codes = srp_create(ProjectedImages_Fisher);
+        srp_entries(Codes, &entries[i + 1 + GALLERY_SECTIONS + CENTROID_SECTIONS]);
+
+        if (model_write(ModelPath, entries, MODEL_SECTIONS) == 0) {
+            printf("Model saved to %s\n", ModelPath);
+        }
+        matrix_destructor(Projection);
+        matrix_destructor(Variances);
+        matrix_destructor(Derived);
+        quant_destroy(Quantized);
+        gallery_destroy(Gallery);
+        centroid_destroy(Centroids);
+        srp_destroy(Codes);
     }
 
     //**************************************************************************
@@ -314,17 +428,37 @@ MATRIX **FisherfaceCore(const database_t *Database)
     matrix_destructor(V);
     matrix_destructor(D);
     matrix_destructor(L_eig_vec);
-    matrix_destructor(V_PCA);
     matrix_destructor(ProjectedImages_PCA);
+    matrix_destructor(m_PCA);
+    matrix_destructor(m);
+    matrix_destructor(Sw);
+    matrix_destructor(Sb);
+    matrix_destructor(tempMat);
+    matrix_destructor(J_eig_vec);
+    matrix_destructor(alphar);
+    matrix_destructor(alphai);
+    matrix_destructor(beta);
+    free(order);
 
     return M;
 }
 
+/*
+ * Loads a model saved by FisherfaceCore
+ * ModelPath: the model file
+ * returns: the same 4 entries FisherfaceCore returns, or NULL on error
+ */
+MATRIX **LoadFisher(const char *ModelPath)
+{
+    return model_load(ModelPath, FisherNames, FISHER_OUTPUTS);
+}
+
 void DestroyFisher(MATRIX **M)
 {
-    matrix_destructor(M[0]);
-//    matrix_destructor(M[1]);
-//    matrix_destructor(M[2]);
-//    matrix_destructor(M[3]);
+    int i;
+
+    for (i = 0; i < FISHER_OUTPUTS; i++) {
+        matrix_destructor(M[i]);
+    }
     free(M);
 }
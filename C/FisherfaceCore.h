@@ -3,9 +3,25 @@
 #ifndef __FISHERFACECORE_H__
 #define __FISHERFACECORE_H__
 
+#include "CreateDatabase.h"
 #include "matrix.h"
 
-MATRIX **FisherfaceCore(const database_t *D);
+// number of matrices returned by FisherfaceCore / LoadFisher
+#define FISHER_OUTPUTS 4
+
+extern const char * const FisherNames[FISHER_OUTPUTS];
+
+// model section holding the fused projection V_Fisher' * V_PCA'
+#define PROJECTION_NAME "v_fisherT_x_v_pcaT"
+
+// model sections holding what LoadRecognizer would otherwise compute in
+// every process: Projection * m_database and the squared gallery norms
+#define PROJECTED_MEAN_NAME "projected_mean"
+#define GALLERY_NORMS_NAME "ProjectedImages_Fisher_norms"
+
+MATRIX **FisherfaceCore(const database_t *D, const char *ModelPath);
+
+MATRIX **LoadFisher(const char *ModelPath);
 
 void DestroyFisher(MATRIX **D);
 
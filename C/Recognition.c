@@ -4,7 +4,7 @@
  Description: This function compares two faces by projecting the images into
  facespace and measuring the Euclidean distance between them.
 
- Argument:      TestImage              - Path of the input test image
+ Argument:      TestImage              - Input test image, converted to grayscale
 
                 m_database             - (M*Nx1) Mean of the training database
                                          database, which is output of
@@ -20,342 +20,657 @@
                 ProjectedImages_Fisher - ((C-1)xP) Training images, which
                                          are projected onto Fisher linear space
 
- Returns:       OutputName             - Name of the recognized image in the
+ Returns:       OutputName             - Index of the recognized image in the
                                          training database.
 
+ m_database, ProjectedImages_Fisher and the fused projection
+ v_fisherT_x_v_pcaT = V_Fisher' * V_PCA' are mapped from the model file
+ written by FisherfaceCore (see model.h) instead of being read from separate
+ .mat files.
+
  See also: RESHAPE, STRCAT
 
  Original version by Amir Hossein Omidvarnia, October 2007
                      Email: aomidvar@ece.ut.ac.ir
  ****************************************/
-#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-#include "ppm.h"
-#include "matrix.h"
 #include <cblas.h>
-#include <lapacke.h>
+#include "FisherfaceCore.h"
+#include "Recognition.h"
+#include "gallery.h"
+#include "ivf.h"
+#include "matrix.h"
+#include "model.h"
+#include "ppm.h"
+#include "quant.h"
+#include "topk.h"
+
+/*
+ * Maps the sections of a model file that Recognition uses. Nothing is read
+ * here beyond what the views point at; V_PCA and V_Fisher are never touched.
+ * The projected mean, gallery norms and blocked gallery are used in place
+ * from the file too, so every process serving the model shares one copy
+ * in the page cache; only models saved without them are derived here.
+ * ModelPath: model file written by FisherfaceCore
+ * returns: NULL on error
+ */
+recognizer_t *LoadRecognizer(const char *ModelPath)
+{
+    recognizer_t *R = (recognizer_t *) calloc(1, sizeof(recognizer_t));
+    double *variances;
+    int dims, count, rows[2], cols[2];
+
+    R->model = model_map(ModelPath);
+    if (R->model == NULL) {
+        free(R);
+        return NULL;
+    }
+
+    R->m_database = model_matrix(R->model, FisherNames[0]);
+    R->ProjectedImages_Fisher = model_matrix(R->model, FisherNames[3]);
+    R->v_fisherT_x_v_pcaT = model_matrix(R->model, PROJECTION_NAME);
+
+    if (R->m_database == NULL || R->ProjectedImages_Fisher == NULL
+            || R->v_fisherT_x_v_pcaT == NULL
+            || R->v_fisherT_x_v_pcaT->cols != R->m_database->rows
+            || R->v_fisherT_x_v_pcaT->rows != R->ProjectedImages_Fisher->rows) {
+        fprintf(stderr, "%s: not a usable recognition model\n", ModelPath);
+        DestroyRecognizer(R);
+        return NULL;
+    }
+
+    dims = R->ProjectedImages_Fisher->rows;
+    count = R->ProjectedImages_Fisher->cols;
+
+    // Batch recognition uses
+    //   Projection * (x - m) = Projection * x - Projection * m
+    //   ||y - g||^2 = ||y||^2 + ||g||^2 - 2 * y'g
+    // so the projected mean and the gallery norms are computed once, at
+    // training time for current models
+    R->projected_mean = (const double *) model_data(R->model, PROJECTED_MEAN_NAME, MODEL_F64,
+            &rows[0], &cols[0]);
+    R->gallery_norms = (const double *) model_data(R->model, GALLERY_NORMS_NAME, MODEL_F64,
+            &rows[1], &cols[1]);
+    if (R->projected_mean == NULL || R->gallery_norms == NULL
+            || rows[0] * cols[0] != dims || rows[1] * cols[1] != count) {
+        R->derived = (double *) malloc((dims + count) * sizeof(double));
+        cblas_dgemv(CblasRowMajor, CblasNoTrans, dims, R->v_fisherT_x_v_pcaT->cols,
+                    1, *R->v_fisherT_x_v_pcaT->data, R->v_fisherT_x_v_pcaT->cols,
+                    *R->m_database->data, 1, 0, R->derived, 1);
+        gallery_norms(R->ProjectedImages_Fisher, R->derived + dims);
+        R->projected_mean = R->derived;
+        R->gallery_norms = R->derived + dims;
+    }
+
+    // single-probe scans read the gallery in blocks instead of by column,
+    // the dimensions it varies most along first so that the top-k search
+    // can abandon candidates early. Older models lack the blocked layout
+    R->gallery = gallery_map(R->model, dims, count);
+    if (R->gallery == NULL) {
+        variances = (double *) malloc(dims * sizeof(double));
+        gallery_variances(R->ProjectedImages_Fisher, variances);
+        R->gallery = gallery_create(R->ProjectedImages_Fisher, variances);
+        free(variances);
+    }
+
+    return R;
+}
+
+/*
+ * Replaces the exact gallery scan of the single-probe paths with an IVF
+ * index. RecognitionBatch stays exact: its GEMM scores the whole gallery.
+ * IndexPath: file written by ivf_save for this model's gallery
+ * nprobe: lists scanned per probe, at least 1
+ * returns: 0 on success, -1 if the index is missing or does not fit the
+ *          model's dimensions and image count
+ */
+int AttachIVF(recognizer_t *R, const char *IndexPath, int nprobe)
+{
+    ivf_t *ivf;
+
+    if (nprobe < 1) {
+        fprintf(stderr, "AttachIVF: nprobe is %d, must be at least 1\n", nprobe);
+        return -1;
+    }
+    ivf = ivf_load(IndexPath);
+    if (ivf == NULL) {
+        return -1;
+    }
+    if (ivf->dims != R->ProjectedImages_Fisher->rows) {
+        fprintf(stderr, "%s: index is for %d dimensions, model has %d\n", IndexPath,
+                ivf->dims, R->ProjectedImages_Fisher->rows);
+        ivf_destroy(ivf);
+        return -1;
+    }
+    if (ivf->count != R->ProjectedImages_Fisher->cols) {
+        fprintf(stderr, "%s: index holds %d images, model has %d; rebuild it\n", IndexPath,
+                ivf->count, R->ProjectedImages_Fisher->cols);
+        ivf_destroy(ivf);
+        return -1;
+    }
+    if (R->ivf != NULL) {
+        ivf_destroy(R->ivf);
+    }
+    R->ivf = ivf;
+    R->nprobe = nprobe;
+    return 0;
+}
 
-MATRIX m_database; //ends up being a 1d matrix
-MATRIX Inverse_V_Fisher;
-MATRIX Inverse_V_PCA;
-MATRIX ProjectedImages_Fisher;
-MATRIX Difference;
-MATRIX v_fisherT_x_v_pcaT;
-MATRIX ProjectedTestImage;
+/*
+ * Replaces the exact gallery scan of the single-probe paths with the
+ * two-stage search through the class centroids saved in the model.
+ * RecognitionBatch stays exact.
+ * shortlist: classes whose templates are scored per probe, 0 for
+ *            CENTROID_SHORTLIST
+ * returns: 0 on success, -1 if the model was saved without centroids
+ */
+int AttachCentroids(recognizer_t *R, int shortlist)
+{
+    centroid_t *K = centroid_map(R->model, R->gallery);
 
-int MatrixRead_Binary(); // This version reads using fread() assumption:
-// matrix was written binary
+    if (K == NULL) {
+        fprintf(stderr, "the model has no class centroids\n");
+        return -1;
+    }
+    if (R->centroids != NULL) {
+        centroid_destroy(R->centroids);
+    }
+    R->centroids = K;
+    R->shortlist = shortlist > 0 ? shortlist : CENTROID_SHORTLIST;
+    return 0;
+}
 
-int main()
+/*
+ * Replaces the exact gallery scan of the single-probe paths with the
+ * Hamming prefilter on the codes saved in the model and an exact re-rank
+ * of its candidates. RecognitionBatch stays exact.
+ * candidates: images re-ranked per probe, 0 for SRP_CANDIDATES
+ * returns: 0 on success, -1 if the model was saved without codes
+ */
+int AttachSRP(recognizer_t *R, int candidates)
 {
-    char filename[255] = {}; // filename of the test image
-
-    // We need to load the data structures that were created by the
-    // CreateDatabase step
-    if (MatrixRead_Binary() != 0) { //Load structures
-        printf("Error!!!\n");
-        exit(-1);
-    }
-    printf("Database Files Loaded From Disk...\n");
-    PPMImage *TestImage; // pointer to the structure of our loaded test image
-
-    int pass = 0, fail = 0, iterations; // Let's keep a few stats
-    int i, j, k, x; // loop variables
-
-    for (iterations = 1; iterations <= 30; iterations++) {
-        /* 994 is the number of test images that we have sequentially numbered */
-        // concat our filename together
-        sprintf(filename, "../LDAIMAGES/Test2/%d.ppm", iterations);
-        TestImage = ppm_image_constructor(filename);
-        printf("Test Image Loaded From Disk and converted to grayscale...\n");
-
-        // First let's allocate our difference array
-        Difference = matrix_constructor(m_database.rows, 1);
-        //Difference.rows = m_database.rows;
-        //Difference.cols = 1;
-        //Difference.data = (double**) malloc(Difference.rows * sizeof (double*));
-        //for (i = 0; i < Difference.rows; i++) {
-        //    Difference.data[i] = (double*) malloc(Difference.cols
-        //            * sizeof (double));
-        //}
-
-        for (i = 0; i < m_database.rows; i++) {
-            Difference.data[i][0] = TestImage->pixels[i].r
-                    - m_database.data[i][0]; // mean database is a 1d vector
-            // (using red channel for gray)
+    srp_t *S = srp_map(R->model, R->gallery->dims, R->gallery->count);
+
+    if (S == NULL) {
+        fprintf(stderr, "the model has no sign-random-projection codes\n");
+        return -1;
+    }
+    if (R->srp != NULL) {
+        srp_destroy(R->srp);
+    }
+    R->srp = S;
+    R->candidates = candidates > 0 ? candidates : SRP_CANDIDATES;
+    return 0;
+}
+
+/*
+ * Switches the single-probe paths to the int8 sections of the model: the
+ * projection reads a byte per weight instead of eight and the gallery
+ * distances are exact int32 sums. RecognitionBatch stays in double.
+ * returns: 0 on success, -1 if the model was saved without them
+ */
+int AttachInt8(recognizer_t *R)
+{
+    quant_t *Q = quant_map(R->model);
+    int pixels = R->m_database->rows;
+
+    if (Q == NULL) {
+        return -1;
+    }
+    if (Q->rows != R->ProjectedImages_Fisher->rows || Q->count != R->ProjectedImages_Fisher->cols
+            || Q->stride != (pixels + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN) {
+        fprintf(stderr, "int8 sections do not match the model\n");
+        quant_destroy(Q);
+        return -1;
+    }
+    Q->cols = pixels;
+    if (R->quant != NULL) {
+        quant_destroy(R->quant);
+    }
+    R->quant = Q;
+    return 0;
+}
+
+/*
+ * Copies the sections the recognition paths read for every probe into
+ * memory bound to one node, so threads pinned there never read them across
+ * the interconnect. The copy is written here, once; the policy set by
+ * topology_alloc places the pages whichever CPU this runs on.
+ * node: index into T->ids, or TOPOLOGY_INTERLEAVE for one copy spread
+ *       over all nodes
+ * returns: NULL if the memory cannot be mapped
+ */
+recognizer_t *ReplicateRecognizer(const recognizer_t *R, const topology_t *T, int node)
+{
+    const MATRIX *Projection = R->v_fisherT_x_v_pcaT, *G = R->ProjectedImages_Fisher;
+    size_t sizes[5], offset = 0;
+    recognizer_t *copy;
+    char *memory;
+    int i;
+
+    sizes[0] = (size_t) Projection->rows * Projection->cols * sizeof(double);
+    sizes[1] = (size_t) G->rows * G->cols * sizeof(double);
+    sizes[2] = G->rows * sizeof(double);
+    sizes[3] = G->cols * sizeof(double);
+    sizes[4] = gallery_bytes(R->gallery);
+    for (i = 0; i < 5; i++) {
+        sizes[i] = (sizes[i] + 63) / 64 * 64;
+        offset += sizes[i];
+    }
+
+    memory = (char *) topology_alloc(T, offset, node);
+    if (memory == NULL) {
+        return NULL;
+    }
+    copy = (recognizer_t *) malloc(sizeof(recognizer_t));
+    *copy = *R;
+    copy->derived = NULL;
+    copy->replica = memory;
+    copy->replica_bytes = offset;
+
+    memcpy(memory, *Projection->data, (size_t) Projection->rows * Projection->cols * sizeof(double));
+    copy->v_fisherT_x_v_pcaT = matrix_view((double *) memory, Projection->rows, Projection->cols);
+    memory += sizes[0];
+    memcpy(memory, *G->data, (size_t) G->rows * G->cols * sizeof(double));
+    copy->ProjectedImages_Fisher = matrix_view((double *) memory, G->rows, G->cols);
+    memory += sizes[1];
+    memcpy(memory, R->projected_mean, G->rows * sizeof(double));
+    copy->projected_mean = (const double *) memory;
+    memory += sizes[2];
+    memcpy(memory, R->gallery_norms, G->cols * sizeof(double));
+    copy->gallery_norms = (const double *) memory;
+    memory += sizes[3];
+    copy->gallery = gallery_place(R->gallery, memory);
+
+    return copy;
+}
+
+/*
+ * Recognizes one test image
+ * R: the loaded model
+ * TestImage: grayscale image of the same size as the training images
+ * distance: set to the squared Euclidean distance of the match (may be NULL)
+ * returns: index of the closest training image, -1 on error
+ */
+int Recognition(const recognizer_t *R, const PPMImage *TestImage, double *distance)
+{
+    match_t Recognized;
+
+    if (RecognitionTopK(R, TestImage, 1, &Recognized) != 0) {
+        return -1;
+    }
+    if (distance != NULL) {
+        *distance = Recognized.distance;
+    }
+    return Recognized.index;
+}
+
+/*
+ * Finds the k training images closest to a test image
+ * R: the loaded model
+ * TestImage: grayscale image of the same size as the training images
+ * k: matches to return
+ * matches: k entries, best first; index -1 past the size of the gallery
+ * returns: 0 on success, -1 on error
+ */
+int RecognitionTopK(const recognizer_t *R, const PPMImage *TestImage, int k, match_t *matches)
+{
+    const MATRIX *m_database = R->m_database;
+    const MATRIX *v_fisherT_x_v_pcaT = R->v_fisherT_x_v_pcaT;
+    MATRIX *Difference;
+    MATRIX *ProjectedTestImage;
+    int i, j, l; // loop variables
+
+    if (k < 1) {
+        fprintf(stderr, "RecognitionTopK: k is %d, must be at least 1\n", k);
+        return -1;
+    }
+
+    if ((int) (TestImage->width * TestImage->height) != m_database->rows) {
+        fprintf(stderr, "%s: image is %ux%u, model expects %d pixels\n",
+                TestImage->filename, TestImage->width, TestImage->height,
+                m_database->rows);
+        return -1;
+    }
+
+    if (R->quant != NULL) {
+        unsigned char bytes[R->quant->stride];
+        double projected[R->quant->rows];
+
+        memset(bytes, 0, R->quant->stride);
+        for (i = 0; i < m_database->rows; i++) {
+            bytes[i] = TestImage->pixels[i].intensity;
         }
-        // Now let's multiply in the last matrix to calculate our ProjectedTestImage
-        //v_fisherT_x_v_pcaT * Difference
-        // Why is this commented out?
-
-        ProjectedTestImage = matrix_constructor(rows, cols);
-//        ProjectedTestImage.rows = v_fisherT_x_v_pcaT.rows;
-//        ProjectedTestImage.cols = Difference.cols;
-//        ProjectedTestImage.data = (double**) malloc(ProjectedTestImage.rows
-//                * sizeof (double*));
-        // allocate memory for our new array
-//        for (i = 0; i < ProjectedTestImage.rows; i++) {
-//            ProjectedTestImage.data[i] = (double*) malloc(ProjectedTestImage.cols
-//                    * sizeof (double));
-//            if (ProjectedTestImage.data[i] == 0) {
-//                printf("Dynamic Allocation Failed!!!\n");
-//                return -1;
-//            }
-//        }
-
-        // clbas_dgemm();
-        for (i = 0; i < v_fisherT_x_v_pcaT.rows; i++) { // perform matrix mult.
-            // computation
-            for (j = 0; j < Difference.cols; j++) { // This loop executes once
-                ProjectedTestImage.data[i][j] = 0.0;
-                for (k = 0; k < v_fisherT_x_v_pcaT.cols; k++) {
-                    ProjectedTestImage.data[i][j] +=
-                            v_fisherT_x_v_pcaT.data[i][k] * Difference.data[k][j];
-                }
+        quant_project(R->quant, bytes, projected);
+        quant_search(R->quant, projected, k, matches);
+        return 0;
+    }
+
+    // First let's allocate our difference array
+    Difference = matrix_constructor(m_database->rows, 1);
+
+    for (i = 0; i < m_database->rows; i++) {
+        Difference->data[i][0] = TestImage->pixels[i].intensity
+                - m_database->data[i][0]; // mean database is a 1d vector
+    }
+
+    // Now let's multiply in the last matrix to calculate our ProjectedTestImage
+    //v_fisherT_x_v_pcaT * Difference
+    ProjectedTestImage = matrix_constructor(v_fisherT_x_v_pcaT->rows, Difference->cols);
+
+    for (i = 0; i < v_fisherT_x_v_pcaT->rows; i++) { // perform matrix mult.
+        // computation
+        for (j = 0; j < Difference->cols; j++) { // This loop executes once
+            ProjectedTestImage->data[i][j] = 0.0;
+            for (l = 0; l < v_fisherT_x_v_pcaT->cols; l++) {
+                ProjectedTestImage->data[i][j] +=
+                        v_fisherT_x_v_pcaT->data[i][l] * Difference->data[l][j];
             }
         }
+    }
 
-        unsigned long int Train_Number = 0;
-        Train_Number = ProjectedImages_Fisher.cols; // Satisfies line 27
-        double * q = 0; // Holds a column vector
-        q = (double *) malloc(ProjectedImages_Fisher.rows * sizeof (double));
-
-        double * Euc_dist = (double *)
-                malloc(sizeof (double) * ProjectedImages_Fisher.cols);
-        double temp = 0;
-
-        for (i = 0; i < Train_Number; i++) { // line 44 Recognition.m
-            for (j = 0; j < ProjectedImages_Fisher.rows; j++) { // create q
-                q[j] = ProjectedImages_Fisher.data[j][i];
-            } //q has been populated
-
-            // At this point, ProjectedTestImage is 99x1 and q is 99x1
-                    // (Based on testing database)
-            for (x = 0; x < ProjectedImages_Fisher.rows; x++) {
-                temp += ((ProjectedTestImage.data[x][0] - q[x]) *
-                        (ProjectedTestImage.data[x][0] - q[x])); //line 46
-            }
-            Euc_dist[i] = temp;
-            temp = 0; //reset our running count
+    // Nearest training images (line 44-47 Recognition.m); the gallery is
+    // stored in blocks so there is no per-column gather, and the search
+    // drops a block as soon as it cannot beat the k-th best image so far.
+    // With an IVF index only the lists near the probe are scanned, with
+    // centroids only the templates of the nearest classes, with codes
+    // only the images whose codes are nearest
+    RecognizeProjected(R, *ProjectedTestImage->data, NULL, k, matches);
+
+    matrix_destructor(Difference);
+    matrix_destructor(ProjectedTestImage);
+
+    return 0;
+}
+
+/*
+ * Recomputes the distances of selected matches directly. The expansion
+ * ||y||^2 + ||g||^2 - 2y'g loses the low digits when the norms are large
+ * compared to the distance (e.g. a probe that is also in the gallery), so
+ * the few selected candidates are re-scored and re-sorted exactly.
+ * G: the gallery, (C-1)xP
+ * y: projected probe, element i at y[i * ystride]
+ * k: number of matches
+ */
+static void refine_matches(const MATRIX *G, const double *y, int ystride, int k, match_t *matches)
+{
+    match_t temp;
+    double d;
+    int i, j;
+
+    for (j = 0; j < k && matches[j].index >= 0; j++) {
+        matches[j].distance = 0;
+        for (i = 0; i < G->rows; i++) {
+            d = y[(size_t) i * ystride] - G->data[i][matches[j].index];
+            matches[j].distance += d * d;
+        }
+        for (i = j; i > 0 && matches[i - 1].distance > matches[i].distance; i--) {
+            temp = matches[i];
+            matches[i] = matches[i - 1];
+            matches[i - 1] = temp;
         }
-        // at this point, Euc_dist should be populated
-
-        // we need to find the min euc_dist and its index
-        //int Euc_dist_len = sizeof(*Euc_dist) / sizeof(double);
-        int Euc_dist_len = ProjectedImages_Fisher.cols; // the length of euc_dist
-        double min = Euc_dist[0];
-
-        int Recognized_index = 0;
-        for (i = 0; i < Euc_dist_len; i++) {
-            if (Euc_dist[i] < min) { // reassign min
-                min = Euc_dist[i];
-                Recognized_index = i;
+    }
+}
+
+/*
+ * Recognizes many test images at once. Each block of RECOGNITION_BATCH
+ * probes is projected with a single GEMM, and its distances to the whole
+ * gallery come from a second GEMM:
+ *   Y = v_fisherT_x_v_pcaT * X - projected_mean    ((C-1) x N)
+ *   Dist = ||Y||^2 + ||G||^2 - 2 * Y'G              (N x P)
+ * R: the loaded model
+ * Probes: (M*N)xN matrix, one probe per column (see ProbeMatrix)
+ * k: matches to return per probe
+ * matches: N*k entries; probe j's matches start at matches[j*k], best first
+ * returns: 0 on success, -1 on error
+ */
+int RecognitionBatch(const recognizer_t *R, const MATRIX *Probes, int k, match_t *matches)
+{
+    const MATRIX *G = R->ProjectedImages_Fisher;
+    int dims = R->v_fisherT_x_v_pcaT->rows;
+    int P = G->cols;
+    int N = Probes->cols;
+    int block = N < RECOGNITION_BATCH ? N : RECOGNITION_BATCH;
+    double *Y; // dims x block projected probes
+    double *Dist; // block x P distances
+    double *norms; // ||y||^2 of each probe in the block
+    topk_t T;
+    int start, nb, i, j;
+
+    if (Probes->rows != R->m_database->rows || k < 1 || N < 1) {
+        fprintf(stderr, "RecognitionBatch: probes are %dx%d, model expects %d pixels\n",
+                Probes->rows, Probes->cols, R->m_database->rows);
+        return -1;
+    }
+
+    Y = (double *) malloc((size_t) dims * block * sizeof(double));
+    Dist = (double *) malloc((size_t) block * P * sizeof(double));
+    norms = (double *) malloc(block * sizeof(double));
+
+    for (start = 0; start < N; start += nb) {
+        nb = N - start < block ? N - start : block;
+
+        // Y = v_fisherT_x_v_pcaT * X(:, start:start+nb)
+        //cblas_dgemm(Order,       TransA,       TransB,       M,    N,  K,                  alpha, A,                               lda,                             B,                         ldb,          beta, C, ldc);
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, dims, nb, Probes->rows, 1,     *R->v_fisherT_x_v_pcaT->data, R->v_fisherT_x_v_pcaT->cols, &Probes->data[0][start], Probes->cols, 0,    Y, nb);
+
+        for (j = 0; j < nb; j++) {
+            norms[j] = 0;
+        }
+        for (i = 0; i < dims; i++) {
+            for (j = 0; j < nb; j++) {
+                Y[i * nb + j] -= R->projected_mean[i];
+                norms[j] += Y[i * nb + j] * Y[i * nb + j];
             }
         }
-        int filename_index = Recognized_index + 1; // because our files are
-        // named starting at 1 and not 0. Arrays start at 0 in C
-
-        printf("Test %d : %d.ppm == %d.ppm\n", iterations, iterations,
-                filename_index);
-        printf("-----------------------------------\n");
-
-        ////////////// for statistic tracking
-        if (iterations == ((Recognized_index - 1) / 4 + 1)) {
-            pass++;
-        } else {
-            fail++;
+
+        // Dist = -2 * Y' * G, then add the norms
+        cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, nb, P, dims, -2, Y, nb, *G->data, G->cols, 0, Dist, P);
+
+        for (j = 0; j < nb; j++) {
+            double *row = &Dist[(size_t) j * P];
+            topk_init(&T, &matches[(size_t) (start + j) * k], k);
+            for (i = 0; i < P; i++) {
+                row[i] += norms[j] + R->gallery_norms[i];
+                if (row[i] < 0) { // rounding when the probe is in the gallery
+                    row[i] = 0;
+                }
+                topk_push(&T, i, row[i]);
+            }
+            topk_sort(&T);
+            refine_matches(G, &Y[j], nb, k, &matches[(size_t) (start + j) * k]);
         }
-        //////////////
-        ppm_image_destructor(TestImage, 0); // Free the loaded image
-        // Need to free the memory that was allocated...
-
-        // free Difference matrix
-        matrix_destructor(Difference);
-//        for (i = 0; i < Difference.rows; i++) {
-//            free(Difference.data[i]);
-//        }
-//        free(Difference.data);
-
-        // Free ProjectedTestImage matrix...
-        matrix_destructor(ProjectedTestImage);
-//        for (i = 0; i < ProjectedTestImage.rows; i++) {
-//            free(ProjectedTestImage.data[i]);
-//        }
-//        free(ProjectedTestImage.data);
-
-        // Free q vector
-        free(q); // wha? why exactly did i use malloc?
-
-        // Free Euc_dist
-        free(Euc_dist); // huh?
-        ///////////Allocated Memory Freed//////////////////////
-    }
-    printf("%d Correct %d Wrong\n", pass, fail);
+    }
+
+    free(Y);
+    free(Dist);
+    free(norms);
     return 0;
 }
 
-/*MatrixRead_Binary() returns 0 on error and 1 on success*/
-int MatrixRead_Binary() //Reads in all required matrices
+/*
+ * Allocates the working memory RecognizeProbe needs for one thread
+ */
+scratch_t *CreateScratch(const recognizer_t *R)
 {
-    int rows, cols;
-    int i, j;
-    FILE *fin = 0;
-    /**********************Read In The m.mat*************************/
-    fin = fopen("m.mat", "rb");
-    if (fin == NULL) {
-        printf("Unable to Open m.mat!!!\n");
-        return (0);
-    }
-    fread(&rows, sizeof (int), 1, fin);
-    fread(&cols, sizeof (int), 1, fin);
-    printf("m.mat [%d %d]\n", rows, cols);
-    m_database = matrix_constructor(rows, cols);
-    //m_database.data = (double**) malloc(rows * sizeof (double*));
-    //for (i = 0; i < rows; i++) {
-    //    m_database.data[i] = (double*) malloc(cols * sizeof (double));
-    //}
-    for (i = 0; i < rows; i++) {
-        for (j = 0; j < cols; j++) {
-            fread(&(m_database.data[i][j]), sizeof (double), 1, fin);
-            /*printf("data verify (%lf)\n", m_database.data[i][j]);
-            while(1) {
-                if(getchar() == 'n') break;
-            }*/
-        }
+    scratch_t *S = (scratch_t *) malloc(sizeof(scratch_t));
+    size_t bytes = (R->m_database->rows + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN;
+    size_t P = R->ProjectedImages_Fisher->cols;
+
+    // the prefilter buffers take 6 bytes per gallery image, against (C-1)
+    // doubles for the image itself, and are there whether or not it is used
+    if (posix_memalign((void **) &S->pixels, 64, R->m_database->rows * sizeof(double)) != 0
+            || posix_memalign((void **) &S->projected, 64,
+                    R->v_fisherT_x_v_pcaT->rows * sizeof(double)) != 0
+            || posix_memalign((void **) &S->bytes, 64, bytes) != 0
+            || posix_memalign((void **) &S->hamming, 64, P * sizeof(unsigned short)) != 0
+            || posix_memalign((void **) &S->ids, 64, P * sizeof(int)) != 0) {
+        fprintf(stderr, "CreateScratch: out of memory\n");
+        exit(1);
     }
-    printf("read m.mat!!!\n");
-    //m_database.rows = rows;
-    //m_database.cols = cols;
-    fclose(fin);
-    fin = 0;
-    /**************************************************************/
-
-    /**************Read In The Inverse_V_Fisher.mat****************/
-    fin = fopen("Inverse_V_Fisher.mat", "rb");
-    if (fin == NULL) {
-        printf("Unable to Open Inverse_V_Fisher.mat!!!\n");
-        return (0);
-    }
-    fread(&rows, sizeof (int), 1, fin);
-    fread(&cols, sizeof (int), 1, fin);
-    printf("Inverse_V_Fisher.mat [%d %d]\n", rows, cols);
-    Inverse_V_Fisher = matrix_constructor(rows, cols);
-    //Inverse_V_Fisher.data = (double**) malloc(rows * sizeof (double*));
-    //for (i = 0; i < rows; i++) {
-    //    Inverse_V_Fisher.data[i] = (double*) malloc(cols * sizeof (double));
-    //}
-    for (i = 0; i < rows; i++) {
-        for (j = 0; j < cols; j++) {
-            fread(&(Inverse_V_Fisher.data[i][j]), sizeof (double), 1, fin);
-            /*printf("data verify (%.20lf)\n", Inverse_V_Fisher.data[i][j]);
-            while(1)
-            {
-                if(getchar() == 'n') break;
-            }*/
-        }
+    memset(S->bytes, 0, bytes);
+
+    return S;
+}
+
+void DestroyScratch(scratch_t *S)
+{
+    free(S->pixels);
+    free(S->projected);
+    free(S->bytes);
+    free(S->hamming);
+    free(S->ids);
+    free(S);
+}
+
+/*
+ * Recognizes one probe without allocating; safe to call from several
+ * threads at once as long as each has its own scratch
+ * R: the loaded model (read only)
+ * pixels: first intensity of the probe
+ * stride: bytes from one intensity to the next
+ * S: this thread's working memory
+ * k: matches to return
+ * matches: k entries, best first
+ * returns: dimensions scored by the gallery, IVF or int8 search, -1 if k < 1
+ */
+long RecognizeProbe(const recognizer_t *R, const unsigned char *pixels, int stride,
+        scratch_t *S, int k, match_t *matches)
+{
+    const MATRIX *Projection = R->v_fisherT_x_v_pcaT;
+    int i;
+
+    if (k < 1) {
+        return -1;
     }
-    printf("read Inverse_V_Fisher.mat!!!\n");
-    //Inverse_V_Fisher.rows = rows;
-    //Inverse_V_Fisher.cols = cols;
-    fclose(fin);
-    fin = 0;
-    /**************************************************************/
-
-
-    /**************Read In The Inverse_V_PCA.mat****************/
-    fin = fopen("Inverse_V_PCA.mat", "rb");
-    if (fin == NULL) {
-        printf("Unable to Open Inverse_V_PCA!!!\n");
-        return (0);
-    }
-    fread(&rows, sizeof (int), 1, fin);
-    fread(&cols, sizeof (int), 1, fin);
-    printf("Inverse_V_PCA.mat [%d %d]\n", rows, cols);
-    Inverse_V_PCA = matrix_constructor(rows, cols);
-    //Inverse_V_PCA.data = (double**) malloc(rows * sizeof (double*));
-    //for (i = 0; i < rows; i++) {
-        Inverse_V_PCA.data[i] = (double*) malloc(cols * sizeof (double));
-    //}
-    for (i = 0; i < rows; i++) {
-        for (j = 0; j < cols; j++) {
-            fread(&(Inverse_V_PCA.data[i][j]), sizeof (double), 1, fin);
-            /*printf("data verify (%.20lf) total read - %d\n",
-                    Inverse_V_PCA.data[i][j], ((i*cols)+j+1));
-            while (1) {
-                if(getchar() == '\n') break;
-            }*/
+
+    if (R->quant != NULL) {
+        for (i = 0; i < Projection->cols; i++) {
+            S->bytes[i] = pixels[(size_t) i * stride];
         }
+        quant_project(R->quant, S->bytes, S->projected);
+        return quant_search(R->quant, S->projected, k, matches);
     }
-    printf("read Inverse_V_PCA.mat!!!\n");
-    //Inverse_V_PCA.rows = rows;
-    //Inverse_V_PCA.cols = cols;
-    fclose(fin);
-    fin = 0;
-    /**************************************************************/
-
-    /**************Read In The ProjectedImages_Fisher.mat****************/
-    fin = fopen("ProjectedImages_Fisher.mat", "rb");
-    if (fin == NULL) {
-        printf("Unable to Open ProjectedImages_Fisher.mat!!!\n");
-        return (0);
-    }
-    fread(&rows, sizeof (int), 1, fin);
-    fread(&cols, sizeof (int), 1, fin);
-    printf("ProjectedImages_Fisher.mat [%d %d]\n", rows, cols);
-    ProjectedImages_Fisher = matrix_constructor(rows, cols);
-    //ProjectedImages_Fisher.data = (double**) malloc(rows * sizeof (double*));
-    //for (i = 0; i < rows; i++) {
-    //    ProjectedImages_Fisher.data[i] = (double*) malloc(cols * sizeof (double));
-    //}
-    for (i = 0; i < rows; i++) {
-        for (j = 0; j < cols; j++) {
-            fread(&(ProjectedImages_Fisher.data[i][j]), sizeof (double), 1, fin);
-        }
+
+    for (i = 0; i < Projection->cols; i++) {
+        S->pixels[i] = pixels[(size_t) i * stride];
+    }
+
+    // y = v_fisherT_x_v_pcaT * x - projected_mean
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, Projection->rows, Projection->cols,
+                1, *Projection->data, Projection->cols, S->pixels, 1, 0, S->projected, 1);
+    for (i = 0; i < Projection->rows; i++) {
+        S->projected[i] -= R->projected_mean[i];
+    }
+
+    return RecognizeProjected(R, S->projected, S, k, matches);
+}
+
+/*
+ * Searches for a probe given in Fisher space
+ * projected: (C-1) values, v_fisherT_x_v_pcaT * x - projected_mean
+ * S: working memory of the Hamming prefilter, NULL to allocate it
+ * returns: dimensions scored by the gallery or IVF search
+ */
+long RecognizeProjected(const recognizer_t *R, const double *projected, scratch_t *S, int k,
+        match_t *matches)
+{
+    topk_t T;
+    long work;
+
+    if (R->ivf != NULL) {
+        return ivf_search(R->ivf, projected, k, R->nprobe, matches);
+    }
+    if (R->centroids != NULL) {
+        return centroid_search(R->centroids, R->gallery, projected, R->shortlist, k, matches);
+    }
+    if (R->srp != NULL) {
+        return srp_search(R->srp, R->gallery, projected, R->candidates, k, matches,
+                S != NULL ? S->hamming : NULL, S != NULL ? S->ids : NULL);
     }
-    printf("read ProjectedImages_Fisher.mat!!!\n");
-    fflush(stdout);
-    //ProjectedImages_Fisher.rows = rows;
-    //ProjectedImages_Fisher.cols = cols;
-    fclose(fin);
-
-    /**************************************************************/
-
-    /**************Read In The v_fisherT_x_v_pcaT.mat****************/
-    fin = fopen("v_fisherT_x_v_pcaT.mat", "rb");
-    if (fin == NULL) {
-        printf("Unable to Open v_fisherT_x_v_pcaT.mat!!!\n");
-        return (0);
-    }
-    fread(&rows, sizeof (int), 1, fin);
-    fread(&cols, sizeof (int), 1, fin);
-    printf("v_fisherT_x_v_pcaT.mat [%d %d]\n", rows, cols);
-    v_fisherT_x_v_pcaT = matrix_constructor(rows, cols);
-    //v_fisherT_x_v_pcaT.data = (double**) malloc(rows * sizeof (double*));
-    //for (i = 0; i < rows; i++) {
-    //    v_fisherT_x_v_pcaT.data[i] = (double*) malloc(cols * sizeof (double));
-    //}
-    for (i = 0; i < rows; i++) {
-        for (j = 0; j < cols; j++) {
-            fread(&(v_fisherT_x_v_pcaT.data[i][j]), sizeof (double), 1, fin);
 
+    // exact distances, one block of gallery images per pass, keeping the k
+    // best in a heap and abandoning blocks that cannot enter it
+    topk_init(&T, matches, k);
+    work = gallery_search(R->gallery, projected, &T);
+    topk_sort(&T);
+
+    return work;
+}
+
+/*
+ * Builds the probe matrix for RecognitionBatch
+ * images: n grayscale images, all the size of the training images
+ * returns: (width*height) x n matrix, NULL if n < 1 or the sizes differ
+ */
+MATRIX *ProbeMatrix(PPMImage * const *images, int n)
+{
+    int pixels;
+    MATRIX *X;
+    int i, j;
+
+    if (n < 1) {
+        return NULL;
+    }
+    pixels = images[0]->width * images[0]->height;
+    X = matrix_constructor(pixels, n);
+
+    for (j = 0; j < n; j++) {
+        if ((int) (images[j]->width * images[j]->height) != pixels) {
+            fprintf(stderr, "%s: size differs from %s\n", images[j]->filename, images[0]->filename);
+            matrix_destructor(X);
+            return NULL;
+        }
+        for (i = 0; i < pixels; i++) {
+            X->data[i][j] = images[j]->pixels[i].intensity;
         }
     }
-    printf("read v_fisherT_x_v_pcaT.mat!!!\n");
-    fflush(stdout);
-    //v_fisherT_x_v_pcaT.rows = rows;
-    //v_fisherT_x_v_pcaT.cols = cols;
-    fclose(fin);
-    /**************************************************************/
-
-    //Now make sure everything is opened properly
-    if (m_database.data == NULL || Inverse_V_Fisher.data == NULL
-            || Inverse_V_PCA.data == NULL || ProjectedImages_Fisher.data == NULL
-            || v_fisherT_x_v_pcaT.data == NULL) {
-        return 1; //Memory not allocated properly somewhere
-    } else {
-        return 0;
+
+    return X;
+}
+
+/*
+ * Releases the views and unmaps the model; a replica only releases its own
+ * copy
+ */
+void DestroyRecognizer(recognizer_t *R)
+{
+    if (R->replica != NULL) {
+        matrix_view_destructor(R->v_fisherT_x_v_pcaT);
+        matrix_view_destructor(R->ProjectedImages_Fisher);
+        gallery_destroy(R->gallery);
+        topology_free(R->replica, R->replica_bytes);
+        free(R);
+        return;
+    }
+    if (R->m_database != NULL) {
+        matrix_view_destructor(R->m_database);
+    }
+    if (R->ProjectedImages_Fisher != NULL) {
+        matrix_view_destructor(R->ProjectedImages_Fisher);
+    }
+    if (R->v_fisherT_x_v_pcaT != NULL) {
+        matrix_view_destructor(R->v_fisherT_x_v_pcaT);
+    }
+    free(R->derived);
+    if (R->gallery != NULL) {
+        gallery_destroy(R->gallery);
+    }
+    if (R->ivf != NULL) {
+        ivf_destroy(R->ivf);
+    }
+    if (R->quant != NULL) {
+        quant_destroy(R->quant);
+    }
+    if (R->centroids != NULL) {
+        centroid_destroy(R->centroids);
+    }
+    if (R->srp != NULL) {
+        srp_destroy(R->srp);
     }
+    model_unmap(R->model);
+    free(R);
 }
@@ -0,0 +1,122 @@
+//Function Prototypes
+
+#ifndef __RECOGNITION_H__
+#define __RECOGNITION_H__
+
+#include "centroid.h"
+#include "gallery.h"
+#include "ivf.h"
+#include "matrix.h"
+#include "model.h"
+#include "ppm.h"
+#include "quant.h"
+#include "srp.h"
+#include "topk.h"
+#include "topology.h"
+
+// Everything Recognition needs from a trained model; all MATRIX members
+// are zero-copy views into the mapped model file
+typedef struct {
+    model_t *model;
+    MATRIX *m_database;             // (M*N)x1 mean of the training database
+    MATRIX *ProjectedImages_Fisher; // (C-1)xP training images in Fisher space
+    MATRIX *v_fisherT_x_v_pcaT;     // (C-1)x(M*N) fused projection
+    const double *projected_mean;   // v_fisherT_x_v_pcaT * m_database
+    const double *gallery_norms;    // ||ProjectedImages_Fisher(:,i)||^2
+    double *derived;                // holds the two above when the model
+                                    // was saved without them, else NULL
+    gallery_t *gallery;             // ProjectedImages_Fisher in scan order
+    ivf_t *ivf;                     // if set, searched instead of the gallery
+    int nprobe;                     // IVF lists scanned per probe
+    centroid_t *centroids;          // if set, the gallery is searched
+    int shortlist;                  // through the shortlist nearest classes
+    srp_t *srp;                     // if set, the gallery is searched
+    int candidates;                 // through the candidates nearest codes
+    quant_t *quant;                 // if set, probes are projected and
+                                    // scored with the int8 sections
+    void *replica;                  // in a replica, its node-local copy of
+    size_t replica_bytes;           // the sections above it reads
+} recognizer_t;
+
+// per-thread working memory for RecognizeProbe; each buffer is 64 byte
+// aligned so threads never share a cache line
+typedef struct {
+    double *pixels;                 // (M*N) probe intensities
+    double *projected;              // (C-1) projected probe
+    unsigned char *bytes;           // (M*N) intensities, zero padded to
+                                    // QUANT_ALIGN, for the int8 projection
+    unsigned short *hamming;        // P code distances and P candidate
+    int *ids;                       // indices, for the Hamming prefilter
+} scratch_t;
+
+// probes projected and scored per BLAS call in RecognitionBatch
+#define RECOGNITION_BATCH 256
+
+// maps a model saved by FisherfaceCore; NULL on error
+recognizer_t *LoadRecognizer(const char *ModelPath);
+
+// makes RecognitionTopK / RecognizeProbe search the IVF index saved at
+// IndexPath, scanning nprobe (>= 1) lists per probe. Returns 0 on
+// success, -1 if the index was built for another gallery
+int AttachIVF(recognizer_t *R, const char *IndexPath, int nprobe);
+
+// makes RecognitionTopK / RecognizeProbe search only the templates of the
+// shortlist classes whose centroids are nearest the probe (centroid.h).
+// Returns 0 on success, -1 if the model has no centroids
+int AttachCentroids(recognizer_t *R, int shortlist);
+
+// makes RecognitionTopK / RecognizeProbe re-rank only the candidates
+// gallery images whose 256-bit codes are nearest the probe's in Hamming
+// distance (srp.h). Returns 0 on success, -1 if the model has no codes
+int AttachSRP(recognizer_t *R, int candidates);
+
+// makes RecognitionTopK / RecognizeProbe use the int8 projection and
+// gallery stored in the model. Returns 0 on success, -1 if it has none
+int AttachInt8(recognizer_t *R);
+
+// copy of R whose projection, gallery, projected mean and gallery norms
+// live in memory on one NUMA node (index into T, or TOPOLOGY_INTERLEAVE);
+// the rest is shared with R, which must outlive the copy. Free it with
+// DestroyRecognizer
+recognizer_t *ReplicateRecognizer(const recognizer_t *R, const topology_t *T, int node);
+
+// index (0-based) of the training image closest to a grayscale test image;
+// its squared distance is stored in *distance if not NULL. -1 on error
+int Recognition(const recognizer_t *R, const PPMImage *TestImage, double *distance);
+
+// the k training images closest to a grayscale test image, best first;
+// returns 0 on success, -1 on error (including k < 1)
+int RecognitionTopK(const recognizer_t *R, const PPMImage *TestImage, int k, match_t *matches);
+
+// recognizes the probes stored as the columns of Probes ((M*N)xN); the k
+// best matches of probe j go to matches[j*k] ... matches[j*k+k-1], best
+// first. Returns 0 on success
+int RecognitionBatch(const recognizer_t *R, const MATRIX *Probes, int k, match_t *matches);
+
+// allocates / frees the working memory of one thread
+scratch_t *CreateScratch(const recognizer_t *R);
+void DestroyScratch(scratch_t *S);
+
+// recognizes one probe given as 8-bit intensities, stride bytes apart
+// (sizeof(Pixel) for PPMImage pixels, 1 for a plain grayscale buffer),
+// using only S for working memory; fills k matches, best first. Returns
+// the work done by the search in dimensions scored (see gallery_search),
+// -1 if k < 1
+long RecognizeProbe(const recognizer_t *R, const unsigned char *pixels, int stride,
+        scratch_t *S, int k, match_t *matches);
+
+// the search half of RecognizeProbe: k matches for a probe already in
+// Fisher space (projected mean subtracted), from the IVF index, the
+// centroid shortlist, the Hamming prefilter or the gallery, using S (may be
+// NULL, then the prefilter allocates) for working memory. Not for int8
+// recognizers, whose search takes the int8 projection
+long RecognizeProjected(const recognizer_t *R, const double *projected, scratch_t *S, int k,
+        match_t *matches);
+
+// (M*N)xN matrix whose columns are the pixels of n grayscale images; NULL
+// if n < 1 or the images differ in size
+MATRIX *ProbeMatrix(PPMImage * const *images, int n);
+
+void DestroyRecognizer(recognizer_t *R);
+
+#endif
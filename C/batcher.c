@@ -0,0 +1,228 @@
+/*******************************************************************************
+ Micro-batching recognition scheduler
+
+ Requests live on the stack of the thread that waits for them and are
+ queued as a linked list, so queueing never allocates. The dispatcher
+ times the window from the arrival of the oldest queued probe, so a probe
+ never waits longer than window_us for company, however long the
+ dispatcher was busy with the previous batch.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Recognition.h"
+#include "matrix.h"
+#include "batcher.h"
+#include "registry.h"
+
+struct batcher_request {
+    const unsigned char *pixels;
+    int stride;
+    int k;
+    match_t *matches;
+    int status;                     // RecognitionBatch result
+    int done;
+    struct timespec arrival;
+    batcher_request_t *next;
+};
+
+static void *batcher_main(void *arg);
+
+/*
+ * Creates a scheduler and starts its dispatcher
+ * models: registry of the model to use; must outlive the scheduler
+ * max_batch: most probes recognized together, at least 1
+ * window_us: longest time the oldest probe waits for the batch to fill
+ */
+batcher_t *batcher_create(registry_t *models, int max_batch, long window_us)
+{
+    batcher_t *S = (batcher_t *) calloc(1, sizeof(batcher_t));
+    // a reload keeps the image size, so X fits every model the registry serves
+    int pixels = atomic_load(&models->current)->m_database->rows;
+    pthread_condattr_t attr;
+
+    S->models = models;
+    S->reader = registry_reader(models);
+    S->max_batch = max_batch < 1 ? 1 : max_batch;
+    S->window_us = window_us < 0 ? 0 : window_us;
+    S->batch = (batcher_request_t **) malloc(S->max_batch * sizeof(batcher_request_t *));
+    S->X = (double *) malloc((size_t) pixels * S->max_batch * sizeof(double));
+
+    pthread_mutex_init(&S->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&S->arrived, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&S->finished, NULL);
+
+    pthread_create(&S->thread, NULL, batcher_main, S);
+    return S;
+}
+
+/*
+ * Queues a probe and waits for the batch it joins
+ * pixels, stride: the probe (see RecognizeProbe)
+ * k: matches to return
+ * matches: k entries, best first
+ * returns: 0 on success, -1 on error
+ */
+int batcher_recognize(batcher_t *S, const unsigned char *pixels, int stride, int k,
+        match_t *matches)
+{
+    batcher_request_t request;
+
+    request.pixels = pixels;
+    request.stride = stride;
+    request.k = k;
+    request.matches = matches;
+    request.done = 0;
+    request.next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &request.arrival);
+
+    pthread_mutex_lock(&S->lock);
+    if (S->tail != NULL) {
+        S->tail->next = &request;
+    } else {
+        S->head = &request;
+    }
+    S->tail = &request;
+    // the dispatcher only needs waking for the first probe of a batch and
+    // when the batch is full
+    if (++S->queued == 1 || S->queued == S->max_batch) {
+        pthread_cond_signal(&S->arrived);
+    }
+    while (!request.done) {
+        pthread_cond_wait(&S->finished, &S->lock);
+    }
+    pthread_mutex_unlock(&S->lock);
+
+    return request.status;
+}
+
+/*
+ * Stops the dispatcher once the queue is drained and frees the scheduler
+ */
+void batcher_destroy(batcher_t *S)
+{
+    pthread_mutex_lock(&S->lock);
+    S->stop = 1;
+    pthread_cond_signal(&S->arrived);
+    pthread_mutex_unlock(&S->lock);
+    pthread_join(S->thread, NULL);
+
+    pthread_mutex_destroy(&S->lock);
+    pthread_cond_destroy(&S->arrived);
+    pthread_cond_destroy(&S->finished);
+    free(S->batch);
+    free(S->X);
+    registry_reader_release(S->reader);
+    free(S);
+}
+
+/*
+ * Recognizes n probes of S->batch with one RecognitionBatch call; the
+ * probes may ask for different k, so the batch uses the largest. A lone
+ * probe gains nothing from a GEMM and takes the single-probe path
+ */
+static void batcher_run(batcher_t *S, int n)
+{
+    scratch_t *scratch;
+    const recognizer_t *R = registry_enter(S->reader, &scratch);
+    int pixels = R->m_database->rows;
+    batcher_request_t *request;
+    MATRIX *Probes;
+    match_t *results;
+    int i, j, l, k = 1, status;
+
+    if (n == 1) {
+        request = S->batch[0];
+        RecognizeProbe(R, request->pixels, request->stride, scratch, request->k,
+                request->matches);
+        request->status = 0;
+        registry_exit(S->reader);
+        return;
+    }
+
+    for (j = 0; j < n; j++) {
+        if (S->batch[j]->k > k) {
+            k = S->batch[j]->k;
+        }
+    }
+    // row by row, so X is written sequentially
+    for (i = 0; i < pixels; i++) {
+        for (j = 0; j < n; j++) {
+            S->X[(size_t) i * n + j] = S->batch[j]->pixels[(size_t) i * S->batch[j]->stride];
+        }
+    }
+
+    Probes = matrix_view(S->X, pixels, n);
+    results = (match_t *) malloc((size_t) n * k * sizeof(match_t));
+    status = RecognitionBatch(R, Probes, k, results);
+    registry_exit(S->reader);
+    matrix_view_destructor(Probes);
+
+    for (j = 0; j < n; j++) {
+        request = S->batch[j];
+        request->status = status;
+        for (l = 0; l < request->k; l++) {
+            request->matches[l] = results[(size_t) j * k + l];
+        }
+    }
+    free(results);
+}
+
+/*
+ * Dispatcher: waits for a batch to fill or its window to close, recognizes
+ * it outside the lock and wakes its callers
+ */
+static void *batcher_main(void *arg)
+{
+    batcher_t *S = (batcher_t *) arg;
+    struct timespec deadline;
+    int n, j;
+
+    pthread_mutex_lock(&S->lock);
+    for (;;) {
+        while (S->queued == 0 && !S->stop) {
+            pthread_cond_wait(&S->arrived, &S->lock);
+        }
+        if (S->queued == 0) {
+            break;
+        }
+
+        deadline = S->head->arrival;
+        deadline.tv_nsec += S->window_us * 1000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (S->queued < S->max_batch && !S->stop
+                && pthread_cond_timedwait(&S->arrived, &S->lock, &deadline) != ETIMEDOUT) {
+        }
+
+        for (n = 0; n < S->max_batch && S->head != NULL; n++) {
+            S->batch[n] = S->head;
+            S->head = S->head->next;
+        }
+        if (S->head == NULL) {
+            S->tail = NULL;
+        }
+        S->queued -= n;
+        pthread_mutex_unlock(&S->lock);
+
+        batcher_run(S, n);
+
+        pthread_mutex_lock(&S->lock);
+        for (j = 0; j < n; j++) {
+            S->batch[j]->done = 1;
+        }
+        S->batches++;
+        S->probes += n;
+        pthread_cond_broadcast(&S->finished);
+    }
+    pthread_mutex_unlock(&S->lock);
+
+    return NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * Micro-batching recognition scheduler
+ *
+ * Callers on any number of threads hand in one probe each and block until
+ * it is recognized. A dispatcher thread collects the probes that arrive
+ * within window_us of the oldest waiting one, or max_batch of them if that
+ * comes first, and recognizes the whole batch with RecognitionBatch: one
+ * GEMM streams the projection matrix once for all of them instead of once
+ * per probe, and a second GEMM scores the batch against the gallery. Each
+ * caller gets its own matches back. A batch of one goes through
+ * RecognizeProbe, so the registry should have no int8 or IVF mode if
+ * results must not depend on the load. Every batch runs on the registry's
+ * current model, so a hot reload takes effect from the next batch.
+ *
+ * A wider window forms bigger batches (more throughput under load) at the
+ * cost of up to window_us of extra latency per probe; window_us = 0 only
+ * batches probes that are already queued when the dispatcher gets to them.
+ */
+
+#ifndef __BATCHER_H__
+#define __BATCHER_H__
+
+#include <pthread.h>
+
+#include "Recognition.h"
+#include "registry.h"
+
+// defaults for fisherd -B / -w
+#define BATCHER_SIZE 32
+#define BATCHER_WINDOW_US 200
+
+typedef struct batcher_request batcher_request_t;
+
+typedef struct {
+    registry_t *models;
+    registry_reader_t *reader;      // the dispatcher's reader slot
+    int max_batch;                  // probes per RecognitionBatch call
+    long window_us;                 // longest wait for a batch to fill
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;         // signalled when a probe is queued
+    pthread_cond_t finished;        // broadcast when a batch completes
+    batcher_request_t *head;          // oldest queued probe
+    batcher_request_t *tail;
+    int queued;
+    int stop;
+
+    batcher_request_t **batch;        // max_batch probes being recognized
+    double *X;                      // (M*N) x max_batch probe pixels
+    long batches;                   // RecognitionBatch calls so far
+    long probes;                    // probes recognized so far
+} batcher_t;
+
+// starts the dispatcher; models must outlive the scheduler
+batcher_t *batcher_create(registry_t *models, int max_batch, long window_us);
+
+// recognizes one probe (see RecognizeProbe for pixels / stride), blocking
+// until its batch is done; fills k matches, best first. Returns 0 on success
+int batcher_recognize(batcher_t *S, const unsigned char *pixels, int stride, int k,
+        match_t *matches);
+
+// recognizes the probes still queued, then stops the dispatcher
+void batcher_destroy(batcher_t *S);
+
+#endif
@@ -0,0 +1,2275 @@
+/******************************************************************************
+ Benchmarks for the recognition paths
+
+ Usage: bench <name> [args]   (run "bench" for the list)
+
+ All benchmarks use the model written by example (fisherface.model) and the
+ images of TestDatabasePath, so run example once first. Paths only work if
+ working in the LDA/C folder.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cblas.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "FisherfaceCore.h"
+#include "Recognition.h"
+#include "batcher.h"
+#include "centroid.h"
+#include "delta.h"
+#include "gallery.h"
+#include "grayscale.h"
+#include "hnsw.h"
+#include "hugepage.h"
+#include "ivf.h"
+#include "matrix.h"
+#include "mpmc.h"
+#include "pool.h"
+#include "pq.h"
+#include "ppm.h"
+#include "quant.h"
+#include "registry.h"
+#include "scan.h"
+#include "shmring.h"
+#include "stream.h"
+#include "team.h"
+#include "topk.h"
+#include "topology.h"
+
+#define ModelPath "fisherface.model"
+#define TestDatabasePath "../LDAIMAGES/Test3"
+#define TestCount 30
+#define Class_population 4
+
+typedef struct {
+    const char *name;
+    int (*run)(int argc, char *argv[]);
+    const char *usage;
+} bench_t;
+
+static int bench_pool(int argc, char *argv[]);
+static int bench_scan(int argc, char *argv[]);
+static int bench_topk(int argc, char *argv[]);
+static int bench_hnsw(int argc, char *argv[]);
+static int bench_ivf(int argc, char *argv[]);
+static int bench_pq(int argc, char *argv[]);
+static int bench_int8(int argc, char *argv[]);
+static int bench_batch(int argc, char *argv[]);
+static int bench_mpmc(int argc, char *argv[]);
+static int bench_reload(int argc, char *argv[]);
+static int bench_procs(int argc, char *argv[]);
+static int bench_numa(int argc, char *argv[]);
+static int bench_tlb(int argc, char *argv[]);
+static int bench_latency(int argc, char *argv[]);
+static int bench_shm(int argc, char *argv[]);
+static int bench_delta(int argc, char *argv[]);
+static int bench_window(int argc, char *argv[]);
+static int bench_centroid(int argc, char *argv[]);
+static int bench_srp(int argc, char *argv[]);
+
+static const bench_t benches[] = {
+    { "pool", bench_pool, "[max_threads] [probes]  probe throughput of the worker pool" },
+    { "scan", bench_scan, "[gallery] [dims]  column-gather scan vs blocked gallery kernels" },
+    { "topk", bench_topk, "[gallery] [dims] [k]  full scan vs early-abandon top-k search" },
+    { "hnsw", bench_hnsw, "[gallery] [M] [efConstruction] [threads]  HNSW recall vs latency" },
+    { "ivf", bench_ivf, "[gallery] [nlist] [replicas] [threads]  IVF recall vs latency, appends" },
+    { "pq", bench_pq, "[gallery] [M] [threads]  product-quantized scan, recall with re-rank" },
+    { "int8", bench_int8, "[probes]  int8 vs double projection: footprint, time, recognition rate" },
+    { "mpmc", bench_mpmc, "[max_threads] [ops]  lock-free ring vs mutex ring under contention" },
+    { "batch", bench_batch, "[clients] [probes] [batch]  per-probe calls vs micro-batching windows" },
+    { "reload", bench_reload, "[clients] [probes] [reloads]  request latency while the model is hot-swapped" },
+    { "procs", bench_procs, "[max_procs]  memory of N worker processes: shared mapping vs private copies" },
+    { "numa", bench_numa, "[threads] [probes]  pinned workers: interleaved, single-node, replicated model" },
+    { "tlb", bench_tlb, "[pixels] [images]  training kernels with 4 KB, transparent and explicit huge pages" },
+    { "latency", bench_latency, "[max_threads] [probes]  single-probe latency split over a pinned thread team" },
+    { "shm", bench_shm, "[frames]  frame ingest: PGM over a pipe vs the shared-memory ring, with and without recognition" },
+    { "delta", bench_delta, "[frames] [threshold]  delta vs full projection of a mostly static video" },
+    { "window", bench_window, "[width] [height] [step] [images]  FFT sliding-window scan vs per-window GEMV" },
+    { "centroid", bench_centroid, "[gallery] [k]  class-centroid shortlist vs full scan: latency, recall" },
+    { "srp", bench_srp, "[gallery] [k]  256-bit Hamming prefilter + re-rank vs full scan: latency, recall" },
+};
+
+static PPMImage *TestImages[TestCount];
+
+/*
+ * Seconds on the monotonic clock
+ */
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Loads and converts the test images once
+ */
+static void load_test_images(const char *path)
+{
+    char filename[255];
+    int i;
+
+    for (i = 0; i < TestCount; i++) {
+        sprintf(filename, "%s/%d.ppm", path, i + 1);
+        TestImages[i] = ppm_image_constructor(filename);
+        grayscale(TestImages[i]);
+    }
+}
+
+/*
+ * Probes per second of the worker pool for 1 .. max_threads workers; the
+ * test images are cycled to make up the probe count
+ */
+static int bench_pool(int argc, char *argv[])
+{
+    int max_threads = argc > 0 ? atoi(argv[0]) : 8;
+    int n = argc > 1 ? atoi(argv[1]) : 3000;
+    const unsigned char **pixels;
+    recognizer_t *R;
+    match_t *matches;
+    pool_t *pool;
+    double t, base = 0;
+    int threads, j;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+
+    pixels = (const unsigned char **) malloc(n * sizeof(unsigned char *));
+    matches = (match_t *) malloc(n * sizeof(match_t));
+    for (j = 0; j < n; j++) {
+        pixels[j] = &TestImages[j % TestCount]->pixels[0].intensity;
+    }
+
+    printf("%8s %12s %8s\n", "threads", "probes/s", "speedup");
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+        pool = pool_create(R, threads, 1);
+        pool_recognize(pool, pixels, sizeof(Pixel), TestCount < n ? TestCount : n, matches); // warm up
+
+        t = now();
+        pool_recognize(pool, pixels, sizeof(Pixel), n, matches);
+        t = now() - t;
+        if (threads == 1) {
+            base = n / t;
+        }
+        printf("%8d %12.1f %8.2f\n", threads, n / t, n / t / base);
+
+        pool_destroy(pool);
+    }
+
+    free(pixels);
+    free(matches);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+/*
+ * Fills a matrix with uniform random values in [-1, 1)
+ */
+static void random_matrix(MATRIX *M, unsigned int seed)
+{
+    int i, j;
+
+    srand(seed);
+    for (i = 0; i < M->rows; i++) {
+        for (j = 0; j < M->cols; j++) {
+            M->data[i][j] = 2.0 * rand() / ((double) RAND_MAX + 1) - 1;
+        }
+    }
+}
+
+/*
+ * Gallery scan time per probe on a synthetic dims x gallery set: the
+ * original column gather (q[j] = G(j, i)) against each blocked kernel
+ */
+static int bench_scan(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 100000;
+    int dims = argc > 1 ? atoi(argv[1]) : 99;
+    const char *kernels[] = { "c", "avx2", "avx512" };
+    int runs = 20;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *probe = matrix_constructor(1, dims);
+    double *q = (double *) malloc(dims * sizeof(double));
+    double *dist;
+    double t, temp, check = 0;
+    gallery_t *blocked;
+    int r, i, j, k;
+
+    random_matrix(G, 1);
+    random_matrix(probe, 2);
+    blocked = gallery_create(G, NULL);
+    dist = (double *) malloc(gallery_padded(blocked) * sizeof(double));
+
+    printf("gallery %d x %d\n", dims, P);
+    t = now();
+    for (r = 0; r < runs; r++) {
+        for (i = 0; i < P; i++) {
+            for (j = 0; j < dims; j++) {
+                q[j] = G->data[j][i];
+            }
+            temp = 0;
+            for (k = 0; k < dims; k++) {
+                temp += (probe->data[0][k] - q[k]) * (probe->data[0][k] - q[k]);
+            }
+            dist[i] = temp;
+        }
+    }
+    t = (now() - t) / runs;
+    check = dist[P - 1];
+    printf("%-8s %10.3f ms/probe %8.2f GB/s\n", "gather", t * 1e3,
+            (double) P * dims * sizeof(double) / t * 1e-9);
+
+    for (k = 0; k < 3; k++) {
+        if (gallery_use(blocked, kernels[k]) != 0) {
+            printf("%-8s not supported\n", kernels[k]);
+            continue;
+        }
+        gallery_distances(blocked, *probe->data, dist);
+        t = now();
+        for (r = 0; r < runs; r++) {
+            gallery_distances(blocked, *probe->data, dist);
+        }
+        t = (now() - t) / runs;
+        printf("%-8s %10.3f ms/probe %8.2f GB/s  (|diff| %.1e)\n", kernels[k], t * 1e3,
+                (double) P * dims * sizeof(double) / t * 1e-9, dist[P - 1] - check);
+    }
+
+    gallery_destroy(blocked);
+    matrix_destructor(G);
+    matrix_destructor(probe);
+    free(q);
+    free(dist);
+    return 0;
+}
+
+/*
+ * Top-k search on a synthetic gallery whose dimensions have decaying spread,
+ * like Fisher space: dimension d has scale 1/(1+d), so its variance (the
+ * weight gallery_create orders by) falls as 1/(1+d)^2. Each probe is a gallery image plus noise. Compares scoring
+ * everything and keeping the best k against gallery_search with the
+ * dimensions stored largest weight first and, for contrast, last
+ */
+static int bench_topk(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 100000;
+    int dims = argc > 1 ? atoi(argv[1]) : 99;
+    int k = argc > 2 ? atoi(argv[2]) : 10;
+    int probes = 50;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *Y = matrix_constructor(probes, dims);
+    double *weights = (double *) malloc(dims * sizeof(double));
+    double *dist;
+    match_t *full = (match_t *) malloc(k * sizeof(match_t));
+    match_t *found = (match_t *) malloc(k * sizeof(match_t));
+    gallery_t *blocked;
+    topk_t T;
+    double t, work;
+    int order, r, i, j, mismatches;
+
+    random_matrix(G, 1);
+    random_matrix(Y, 2);
+    for (i = 0; i < dims; i++) {
+        for (j = 0; j < P; j++) {
+            G->data[i][j] /= 1.0 + i;
+        }
+    }
+    for (r = 0; r < probes; r++) {
+        j = (int) ((long) r * 7919 % P);
+        for (i = 0; i < dims; i++) {
+            Y->data[r][i] = G->data[i][j] + 0.05 * Y->data[r][i] / (1.0 + i);
+        }
+    }
+
+    printf("gallery %d x %d, k %d\n", dims, P, k);
+    gallery_variances(G, weights);
+    blocked = gallery_create(G, weights);
+    dist = (double *) malloc(gallery_padded(blocked) * sizeof(double));
+
+    t = now();
+    for (r = 0; r < probes; r++) {
+        gallery_distances(blocked, Y->data[r], dist);
+        topk_init(&T, full, k);
+        for (i = 0; i < P; i++) {
+            topk_push(&T, i, dist[i]);
+        }
+    }
+    t = (now() - t) / probes;
+    printf("%-10s %10.3f ms/probe %6.1f%% of dims\n", "full", t * 1e3, 100.0);
+
+    for (order = 0; order < 2; order++) {
+        if (order == 1) {
+            // smallest variance first: the abandon check has little to go on
+            gallery_destroy(blocked);
+            for (i = 0; i < dims; i++) {
+                weights[i] = -weights[i];
+            }
+            blocked = gallery_create(G, weights);
+        }
+        work = 0;
+        mismatches = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            topk_init(&T, found, k);
+            work += gallery_search(blocked, Y->data[r], &T);
+        }
+        t = (now() - t) / probes;
+
+        // same results as the full scan, checked outside the timing
+        for (r = 0; r < probes; r++) {
+            gallery_distances(blocked, Y->data[r], dist);
+            topk_init(&T, full, k);
+            for (i = 0; i < P; i++) {
+                topk_push(&T, i, dist[i]);
+            }
+            topk_sort(&T);
+            topk_init(&T, found, k);
+            gallery_search(blocked, Y->data[r], &T);
+            topk_sort(&T);
+            for (i = 0; i < k; i++) {
+                mismatches += full[i].index != found[i].index;
+            }
+        }
+        printf("%-10s %10.3f ms/probe %6.1f%% of dims  (%d mismatches)\n",
+                order == 0 ? "descending" : "ascending", t * 1e3,
+                100.0 * work / ((double) probes * blocked->blocks * dims), mismatches);
+    }
+
+    gallery_destroy(blocked);
+    matrix_destructor(G);
+    matrix_destructor(Y);
+    free(weights);
+    free(dist);
+    free(full);
+    free(found);
+    return 0;
+}
+
+/*
+ * Synthetic Fisher-space gallery: P / 4 people with 4 images each, every
+ * image its person's centre plus noise. Dimension d has spread 1/(1+d).
+ * probes (may be NULL) gets one new image of a random person per row
+ */
+static void synthetic_gallery(MATRIX *G, MATRIX *probes)
+{
+    MATRIX *centres = matrix_constructor(G->rows, (G->cols + 3) / 4);
+    MATRIX *noise = matrix_constructor(G->rows, G->cols);
+    int i, j, person;
+
+    random_matrix(centres, 1);
+    random_matrix(noise, 2);
+    for (i = 0; i < G->rows; i++) {
+        for (j = 0; j < G->cols; j++) {
+            G->data[i][j] = (centres->data[i][j / 4] + 0.2 * noise->data[i][j]) / (1.0 + i);
+        }
+    }
+    if (probes != NULL) {
+        random_matrix(probes, 3);
+        for (j = 0; j < probes->rows; j++) {
+            person = rand() % centres->cols;
+            for (i = 0; i < G->rows; i++) {
+                probes->data[j][i] = (centres->data[i][person] + 0.2 * probes->data[j][i]) / (1.0 + i);
+            }
+        }
+    }
+    matrix_destructor(centres);
+    matrix_destructor(noise);
+}
+
+/*
+ * Recall@k of approximate matches against exact ones
+ */
+static double recall(const match_t *found, const match_t *exact, int k)
+{
+    int hits = 0;
+    int i, j;
+
+    for (i = 0; i < k; i++) {
+        for (j = 0; j < k; j++) {
+            hits += found[i].index >= 0 && found[i].index == exact[j].index;
+        }
+    }
+    return (double) hits / k;
+}
+
+/*
+ * HNSW on a synthetic gallery: build time, then recall@k and latency for a
+ * range of ef against the exact top-k scan, then a save / load round trip
+ */
+static int bench_hnsw(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 20000;
+    int M = argc > 1 ? atoi(argv[1]) : HNSW_M;
+    int efConstruction = argc > 2 ? atoi(argv[2]) : HNSW_EF_CONSTRUCTION;
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+    const char *path = "bench.hnsw";
+    const int efs[] = { 10, 20, 40, 80, 160, 320 };
+    int dims = 99, probes = 200, k = 10;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *Y = matrix_constructor(probes, dims);
+    match_t *exact = (match_t *) malloc((size_t) probes * k * sizeof(match_t));
+    match_t *found = (match_t *) malloc(k * sizeof(match_t));
+    gallery_t *blocked;
+    hnsw_t *H, *loaded;
+    hnsw_scratch_t *S;
+    topk_t T;
+    double t, hits;
+    int e, r, i, same;
+
+    synthetic_gallery(G, Y);
+    printf("gallery %d x %d, k %d, M %d, efConstruction %d\n", dims, P, k, M, efConstruction);
+
+    blocked = gallery_create(G, NULL);
+    t = now();
+    for (r = 0; r < probes; r++) {
+        topk_init(&T, &exact[(size_t) r * k], k);
+        gallery_search(blocked, Y->data[r], &T);
+        topk_sort(&T);
+    }
+    t = (now() - t) / probes;
+    printf("%-8s %10.3f ms/probe  recall 1.000\n", "exact", t * 1e3);
+
+    t = now();
+    H = hnsw_build(G, M, efConstruction, threads);
+    printf("build    %10.3f s  (%d levels)\n", now() - t, H->max_level + 1);
+
+    S = hnsw_scratch_create(H);
+    for (e = 0; e < (int) (sizeof(efs) / sizeof(efs[0])); e++) {
+        hits = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            hnsw_search(H, Y->data[r], k, efs[e], S, found);
+            hits += recall(found, &exact[(size_t) r * k], k);
+        }
+        t = (now() - t) / probes;
+        printf("ef %-5d %10.3f ms/probe  recall %.3f\n", efs[e], t * 1e3, hits / probes);
+    }
+
+    // the loaded graph must answer exactly like the built one
+    hnsw_save(H, path);
+    t = now();
+    loaded = hnsw_load(path, G);
+    t = now() - t;
+    same = loaded != NULL;
+    for (r = 0; same && r < probes; r++) {
+        hnsw_search(H, Y->data[r], k, HNSW_EF, S, found);
+        hnsw_search(loaded, Y->data[r], k, HNSW_EF, S, &exact[(size_t) r * k]);
+        for (i = 0; i < k; i++) {
+            same &= found[i].index == exact[(size_t) r * k + i].index;
+        }
+    }
+    printf("load     %10.3f s  (%s)\n", t, same ? "same results" : "RESULTS DIFFER");
+    remove(path);
+
+    if (loaded != NULL) {
+        hnsw_destroy(loaded);
+    }
+    hnsw_scratch_destroy(S);
+    hnsw_destroy(H);
+    gallery_destroy(blocked);
+    matrix_destructor(G);
+    matrix_destructor(Y);
+    free(exact);
+    free(found);
+    return 0;
+}
+
+/*
+ * IVF on a synthetic gallery: k-means training time, recall@k and latency
+ * for a range of nprobe against the exact scan, the cost of enrolling the
+ * last 10% of the gallery into an index trained on the first 90%, and a
+ * save / load round trip
+ */
+static int bench_ivf(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 20000;
+    int nlist = argc > 1 ? atoi(argv[1]) : 128;
+    int replicas = argc > 2 ? atoi(argv[2]) : 1;
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+    const char *path = "bench.ivf";
+    const int nprobes[] = { 1, 2, 4, 8, 16, 32 };
+    int dims = 99, probes = 200, k = 10;
+    int enrolled = P - P / 10;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *First = matrix_constructor(dims, enrolled);
+    MATRIX *Y = matrix_constructor(probes, dims);
+    match_t *exact = (match_t *) malloc((size_t) probes * k * sizeof(match_t));
+    match_t *found = (match_t *) malloc(k * sizeof(match_t));
+    match_t *again = (match_t *) malloc(k * sizeof(match_t));
+    double *vector = (double *) malloc(dims * sizeof(double));
+    gallery_t *blocked;
+    ivf_t *ivf, *loaded;
+    topk_t T;
+    double t, hits;
+    long work;
+    int e, r, i, d, same;
+
+    synthetic_gallery(G, Y);
+    printf("gallery %d x %d, k %d, nlist %d, replicas %d\n", dims, P, k, nlist, replicas);
+
+    blocked = gallery_create(G, NULL);
+    t = now();
+    for (r = 0; r < probes; r++) {
+        topk_init(&T, &exact[(size_t) r * k], k);
+        gallery_search(blocked, Y->data[r], &T);
+        topk_sort(&T);
+    }
+    t = (now() - t) / probes;
+    printf("%-10s %10.3f ms/probe  recall 1.000\n", "exact", t * 1e3);
+
+    t = now();
+    ivf = ivf_build(G, nlist, replicas, threads);
+    if (ivf == NULL) {
+        fprintf(stderr, "gallery smaller than nlist\n");
+        return 1;
+    }
+    printf("train      %10.3f s\n", now() - t);
+
+    for (e = 0; e < (int) (sizeof(nprobes) / sizeof(nprobes[0])) && nprobes[e] <= nlist; e++) {
+        hits = 0;
+        work = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            work += ivf_search(ivf, Y->data[r], k, nprobes[e], found);
+            hits += recall(found, &exact[(size_t) r * k], k);
+        }
+        t = (now() - t) / probes;
+        printf("nprobe %-3d %10.3f ms/probe  recall %.3f  %5.1f%% of dims\n", nprobes[e],
+                t * 1e3, hits / probes, 100.0 * work / ((double) probes * P * dims));
+    }
+
+    // enroll the last 10% into an index trained without them
+    for (d = 0; d < dims; d++) {
+        memcpy(First->data[d], G->data[d], enrolled * sizeof(double));
+    }
+    ivf_destroy(ivf);
+    ivf = ivf_build(First, nlist, replicas, threads);
+    t = now();
+    for (i = enrolled; i < P; i++) {
+        for (d = 0; d < dims; d++) {
+            vector[d] = G->data[d][i];
+        }
+        ivf_add(ivf, vector, i);
+    }
+    t = (now() - t) / (P - enrolled);
+    hits = 0;
+    for (r = 0; r < probes; r++) {
+        ivf_search(ivf, Y->data[r], k, IVF_NPROBE, found);
+        hits += recall(found, &exact[(size_t) r * k], k);
+    }
+    printf("append     %10.3f us/vector  recall %.3f at nprobe %d\n", t * 1e6,
+            hits / probes, IVF_NPROBE);
+
+    // the loaded index must answer exactly like the one in memory
+    ivf_save(ivf, path);
+    t = now();
+    loaded = ivf_load(path);
+    t = now() - t;
+    same = loaded != NULL;
+    for (r = 0; same && r < probes; r++) {
+        ivf_search(ivf, Y->data[r], k, IVF_NPROBE, found);
+        ivf_search(loaded, Y->data[r], k, IVF_NPROBE, again);
+        for (i = 0; i < k; i++) {
+            same &= found[i].index == again[i].index;
+        }
+    }
+    printf("load       %10.3f s  (%s)\n", t, same ? "same results" : "RESULTS DIFFER");
+    remove(path);
+
+    if (loaded != NULL) {
+        ivf_destroy(loaded);
+    }
+    ivf_destroy(ivf);
+    gallery_destroy(blocked);
+    matrix_destructor(G);
+    matrix_destructor(First);
+    matrix_destructor(Y);
+    free(exact);
+    free(found);
+    free(again);
+    free(vector);
+    return 0;
+}
+
+/*
+ * Product quantization on a synthetic gallery: bytes per template,
+ * training time, then latency and recall@k of the table scan with each
+ * kernel and with exact re-ranking of more and more candidates
+ */
+static int bench_pq(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 20000;
+    int M = argc > 1 ? atoi(argv[1]) : PQ_M;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    const char *path = "bench.pq";
+    const char *kernels[] = { "c", "avx2" };
+    const int reranks[] = { 0, 20, 50, 100, 200 };
+    int dims = 99, probes = 200, k = 10;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *Y = matrix_constructor(probes, dims);
+    match_t *exact = (match_t *) malloc((size_t) probes * k * sizeof(match_t));
+    match_t *found = (match_t *) malloc(k * sizeof(match_t));
+    match_t *again = (match_t *) malloc(k * sizeof(match_t));
+    gallery_t *blocked;
+    pq_t *pq, *loaded;
+    topk_t T;
+    double t, hits;
+    int e, r, i, same;
+
+    synthetic_gallery(G, Y);
+    blocked = gallery_create(G, NULL);
+    t = now();
+    for (r = 0; r < probes; r++) {
+        topk_init(&T, &exact[(size_t) r * k], k);
+        gallery_search(blocked, Y->data[r], &T);
+        topk_sort(&T);
+    }
+    t = (now() - t) / probes;
+
+    printf("gallery %d x %d, k %d, M %d: %d bytes per template instead of %d\n", dims, P, k, M,
+            M < dims ? M : dims, (int) (dims * sizeof(double)));
+    printf("%-14s %10.3f ms/probe  recall 1.000\n", "exact", t * 1e3);
+
+    t = now();
+    pq = pq_build(G, M, threads);
+    printf("train          %10.3f s\n", now() - t);
+
+    for (e = 0; e < 2; e++) {
+        if (pq_use(pq, kernels[e]) != 0) {
+            printf("%-14s not supported\n", kernels[e]);
+            continue;
+        }
+        hits = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            pq_search(pq, Y->data[r], k, 0, NULL, found);
+            hits += recall(found, &exact[(size_t) r * k], k);
+        }
+        t = (now() - t) / probes;
+        printf("%-14s %10.3f ms/probe  recall %.3f\n", kernels[e], t * 1e3, hits / probes);
+    }
+
+    for (e = 1; e < (int) (sizeof(reranks) / sizeof(reranks[0])); e++) {
+        hits = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            pq_search(pq, Y->data[r], k, reranks[e], G, found);
+            hits += recall(found, &exact[(size_t) r * k], k);
+        }
+        t = (now() - t) / probes;
+        printf("rerank %-7d %10.3f ms/probe  recall %.3f\n", reranks[e], t * 1e3, hits / probes);
+    }
+
+    // the loaded codes must answer exactly like the ones in memory
+    pq_save(pq, path);
+    loaded = pq_load(path);
+    same = loaded != NULL;
+    for (r = 0; same && r < probes; r++) {
+        pq_search(pq, Y->data[r], k, 0, NULL, found);
+        pq_search(loaded, Y->data[r], k, 0, NULL, again);
+        for (i = 0; i < k; i++) {
+            same &= found[i].index == again[i].index;
+        }
+    }
+    printf("save / load    %s\n", same ? "same results" : "RESULTS DIFFER");
+    remove(path);
+
+    if (loaded != NULL) {
+        pq_destroy(loaded);
+    }
+    pq_destroy(pq);
+    gallery_destroy(blocked);
+    matrix_destructor(G);
+    matrix_destructor(Y);
+    free(exact);
+    free(found);
+    free(again);
+    return 0;
+}
+
+/*
+ * Time per probe and recognition rate of RecognizeProbe on the loaded
+ * TestImages, in whatever mode R is in. Test image i shows the person of
+ * training images 4(i-1) .. 4i-1
+ */
+static double time_probes(const recognizer_t *R, scratch_t *S, int n, int *correct, int *recognized)
+{
+    match_t best;
+    double t;
+    int j;
+
+    *correct = 0;
+    for (j = 0; j < TestCount; j++) {
+        RecognizeProbe(R, &TestImages[j]->pixels[0].intensity, sizeof(Pixel), S, 1, &best);
+        recognized[j] = best.index;
+        *correct += j + 1 == best.index / Class_population + 1;
+    }
+
+    t = now();
+    for (j = 0; j < n; j++) {
+        RecognizeProbe(R, &TestImages[j % TestCount]->pixels[0].intensity, sizeof(Pixel), S, 1, &best);
+    }
+    return (now() - t) / n;
+}
+
+/*
+ * Int8 recognition against the double path on the bundled test sets:
+ * bytes of projection and gallery, time per probe with each int8 kernel,
+ * and the recognition rate of both. Test2 holds copies of Train3 images,
+ * so both sets are scored against the Train3 model example writes
+ */
+static int bench_int8(int argc, char *argv[])
+{
+    int n = argc > 0 ? atoi(argv[0]) : 300;
+    const char *sets[] = { "../LDAIMAGES/Test2", "../LDAIMAGES/Test3" };
+    const char *kernels[] = { "c", "avx2" };
+    int exact[TestCount], quantized[TestCount];
+    int e, s, i, correct, base, agree;
+    size_t full, small;
+    recognizer_t *R;
+    quant_t *Q;
+    scratch_t *S;
+    double t;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    if (AttachInt8(R) != 0) {
+        fprintf(stderr, "%s has no int8 sections; run example to retrain\n", ModelPath);
+        DestroyRecognizer(R);
+        return 1;
+    }
+    Q = R->quant;
+    S = CreateScratch(R);
+
+    full = ((size_t) Q->rows * Q->cols + (size_t) Q->rows * Q->count) * sizeof(double);
+    small = (size_t) Q->rows * Q->stride + (size_t) Q->count * Q->gstride
+            + (2 * Q->rows + 1) * sizeof(double);
+    printf("projection + gallery: %zu bytes double, %zu bytes int8 (%.1fx smaller)\n",
+            full, small, (double) full / small);
+
+    for (s = 0; s < 2; s++) {
+        load_test_images(sets[s]);
+        printf("%s\n", sets[s]);
+
+        R->quant = NULL;
+        t = time_probes(R, S, n, &base, exact);
+        printf("  %-9s %9.3f ms/probe  %2d/%d correct\n", "double", t * 1e3, base, TestCount);
+
+        R->quant = Q;
+        for (e = 0; e < 2; e++) {
+            if (quant_use(Q, kernels[e]) != 0) {
+                printf("  int8 %-4s not supported\n", kernels[e]);
+                continue;
+            }
+            t = time_probes(R, S, n, &correct, quantized);
+            agree = 0;
+            for (i = 0; i < TestCount; i++) {
+                agree += exact[i] == quantized[i];
+            }
+            printf("  int8 %-4s %9.3f ms/probe  %2d/%d correct (%+d), %d/%d same match\n",
+                    kernels[e], t * 1e3, correct, TestCount, correct - base, agree, TestCount);
+        }
+
+        for (i = 0; i < TestCount; i++) {
+            ppm_image_destructor(TestImages[i], 1);
+        }
+    }
+
+    DestroyScratch(S);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+typedef struct {
+    pthread_t thread;
+    registry_t *models;
+    batcher_t *batcher;               // NULL for RecognizeProbe on this thread
+    int id;
+    int n;
+    double *latency;
+} batch_client_t;
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void *batch_client(void *arg)
+{
+    batch_client_t *c = (batch_client_t *) arg;
+    registry_reader_t *reader = c->batcher == NULL ? registry_reader(c->models) : NULL;
+    const recognizer_t *R;
+    const unsigned char *pixels;
+    scratch_t *S;
+    match_t best;
+    double t;
+    int j;
+
+    for (j = 0; j < c->n; j++) {
+        pixels = &TestImages[(c->id + j) % TestCount]->pixels[0].intensity;
+        t = now();
+        if (c->batcher != NULL) {
+            batcher_recognize(c->batcher, pixels, sizeof(Pixel), 1, &best);
+        } else {
+            R = registry_enter(reader, &S);
+            RecognizeProbe(R, pixels, sizeof(Pixel), S, 1, &best);
+            registry_exit(reader);
+        }
+        c->latency[j] = now() - t;
+    }
+
+    if (reader != NULL) {
+        registry_reader_release(reader);
+    }
+    return NULL;
+}
+
+/*
+ * clients threads each recognizing probes one after the other, first with
+ * a GEMV per probe on their own thread, then through the micro-batching
+ * scheduler for a range of windows: throughput, latency percentiles and
+ * the mean batch formed
+ */
+static int bench_batch(int argc, char *argv[])
+{
+    int clients = argc > 0 ? atoi(argv[0]) : 16;
+    int n = argc > 1 ? atoi(argv[1]) : 200;
+    int batch = argc > 2 ? atoi(argv[2]) : BATCHER_SIZE;
+    const long windows[] = { -1, 0, 50, 200, 1000 };
+    batch_client_t *c = (batch_client_t *) calloc(clients, sizeof(batch_client_t));
+    double *all = (double *) malloc((size_t) clients * n * sizeof(double));
+    registry_t *models;
+    batcher_t *batcher;
+    double t;
+    int w, i;
+
+    models = registry_open(ModelPath, 0);
+    if (models == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+
+    printf("%d clients x %d probes, batches of up to %d\n", clients, n, batch);
+    printf("%-12s %10s %10s %10s %8s\n", "window", "probes/s", "p50 us", "p99 us", "batch");
+    for (w = 0; w < (int) (sizeof(windows) / sizeof(windows[0])); w++) {
+        batcher = windows[w] < 0 ? NULL : batcher_create(models, batch, windows[w]);
+        t = now();
+        for (i = 0; i < clients; i++) {
+            c[i].models = models;
+            c[i].batcher = batcher;
+            c[i].id = i;
+            c[i].n = n;
+            c[i].latency = &all[(size_t) i * n];
+            pthread_create(&c[i].thread, NULL, batch_client, &c[i]);
+        }
+        for (i = 0; i < clients; i++) {
+            pthread_join(c[i].thread, NULL);
+        }
+        t = now() - t;
+        qsort(all, (size_t) clients * n, sizeof(double), compare_double);
+
+        if (batcher == NULL) {
+            printf("%-12s", "per probe");
+        } else {
+            printf("%-9ld us", windows[w]);
+        }
+        printf(" %10.1f %10.1f %10.1f %8.1f\n", clients * n / t, all[clients * n / 2] * 1e6,
+                all[(size_t) clients * n * 99 / 100] * 1e6,
+                batcher == NULL ? 1.0 : (double) batcher->probes / batcher->batches);
+        if (batcher != NULL) {
+            batcher_destroy(batcher);
+        }
+    }
+
+    for (i = 0; i < TestCount; i++) {
+        ppm_image_destructor(TestImages[i], 1);
+    }
+    registry_close(models);
+    free(c);
+    free(all);
+    return 0;
+}
+
+// the pool's job queue before the lock-free ring: a mutex around a ring
+typedef struct {
+    pthread_mutex_t lock;
+    long items[POOL_QUEUE];
+    int head;
+    int count;
+} locked_ring_t;
+
+typedef struct {
+    pthread_t thread;
+    int locked;                     // use the mutex ring
+    long push;                      // items to push
+    long pop;                       // items to pop
+} ring_client_t;
+
+static mpmc_t lockfree;
+static locked_ring_t locked;
+
+static int ring_push(int use_lock, long item)
+{
+    int full;
+
+    if (!use_lock) {
+        return mpmc_push(&lockfree, &item);
+    }
+    pthread_mutex_lock(&locked.lock);
+    full = locked.count == POOL_QUEUE;
+    if (!full) {
+        locked.items[(locked.head + locked.count++) % POOL_QUEUE] = item;
+    }
+    pthread_mutex_unlock(&locked.lock);
+    return full ? -1 : 0;
+}
+
+static int ring_pop(int use_lock, long *item)
+{
+    int empty;
+
+    if (!use_lock) {
+        return mpmc_pop(&lockfree, item);
+    }
+    pthread_mutex_lock(&locked.lock);
+    empty = locked.count == 0;
+    if (!empty) {
+        *item = locked.items[locked.head];
+        locked.head = (locked.head + 1) % POOL_QUEUE;
+        locked.count--;
+    }
+    pthread_mutex_unlock(&locked.lock);
+    return empty ? -1 : 0;
+}
+
+/*
+ * Pushes and pops its share, alternating when it has both, yielding when
+ * the ring is full or empty
+ */
+static void *ring_client(void *arg)
+{
+    ring_client_t *c = (ring_client_t *) arg;
+    long pushed = 0, popped = 0, item;
+
+    while (pushed < c->push || popped < c->pop) {
+        if (pushed < c->push && ring_push(c->locked, pushed) == 0) {
+            pushed++;
+        } else if (popped < c->pop && ring_pop(c->locked, &item) == 0) {
+            popped++;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Queue operations per second with 1 .. max_threads threads, half of them
+ * producers and half consumers (one thread does both), through the
+ * lock-free ring and through a mutex-protected ring of the same size
+ */
+static int bench_mpmc(int argc, char *argv[])
+{
+    int max_threads = argc > 0 ? atoi(argv[0]) : 64;
+    long ops = argc > 1 ? atol(argv[1]) : 2000000;
+    ring_client_t *c = (ring_client_t *) calloc(max_threads, sizeof(ring_client_t));
+    int threads, producers, consumers, use_lock, i;
+    double t, rate[2];
+
+    mpmc_init(&lockfree, POOL_QUEUE, sizeof(long));
+    pthread_mutex_init(&locked.lock, NULL);
+
+    printf("%8s %8s %8s %14s %14s\n", "threads", "push", "pop", "lock-free op/s", "mutex op/s");
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+        producers = threads > 1 ? threads / 2 : 1;
+        consumers = threads > 1 ? threads - producers : 1;
+        for (use_lock = 0; use_lock < 2; use_lock++) {
+            for (i = 0; i < threads; i++) {
+                c[i].locked = use_lock;
+                c[i].push = threads == 1 || i < producers ? ops / producers : 0;
+                c[i].pop = threads == 1 || i >= producers ? ops / producers * producers / consumers : 0;
+            }
+            // the last consumer takes what does not divide evenly
+            c[threads - 1].pop += ops / producers * producers % consumers;
+
+            t = now();
+            for (i = 0; i < threads; i++) {
+                pthread_create(&c[i].thread, NULL, ring_client, &c[i]);
+            }
+            for (i = 0; i < threads; i++) {
+                pthread_join(c[i].thread, NULL);
+            }
+            // a push and a pop per item
+            rate[use_lock] = 2.0 * (ops / producers * producers) / (now() - t);
+        }
+        printf("%8d %8d %8d %14.0f %14.0f\n", threads, producers, consumers, rate[0], rate[1]);
+    }
+
+    mpmc_destroy(&lockfree);
+    pthread_mutex_destroy(&locked.lock);
+    free(c);
+    return 0;
+}
+
+typedef struct {
+    registry_t *models;
+    int reloads;
+    double *seconds;                // time of each registry_reload
+} reloader_t;
+
+static void *reload_loop(void *arg)
+{
+    reloader_t *r = (reloader_t *) arg;
+    double t;
+    int j;
+
+    for (j = 0; j < r->reloads; j++) {
+        t = now();
+        if (registry_reload(r->models, NULL) != 0) {
+            r->reloads = j;
+            break;
+        }
+        r->seconds[j] = now() - t;
+    }
+    return NULL;
+}
+
+/*
+ * clients threads recognizing probes through the registry, once with the
+ * model left alone and once while another thread reloads it back to back:
+ * request latency percentiles, and how long each reload takes from the
+ * start of the load to freeing the old model
+ */
+static int bench_reload(int argc, char *argv[])
+{
+    int clients = argc > 0 ? atoi(argv[0]) : 8;
+    int n = argc > 1 ? atoi(argv[1]) : 500;
+    int reloads = argc > 2 ? atoi(argv[2]) : 50;
+    batch_client_t *c = (batch_client_t *) calloc(clients, sizeof(batch_client_t));
+    double *all = (double *) malloc((size_t) clients * n * sizeof(double));
+    reloader_t r;
+    pthread_t thread;
+    registry_t *models;
+    double t;
+    int pass, i;
+
+    models = registry_open(ModelPath, 0);
+    if (models == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    r.models = models;
+    r.seconds = (double *) malloc(reloads * sizeof(double));
+
+    printf("%d clients x %d probes\n", clients, n);
+    printf("%-16s %10s %10s %10s %10s\n", "", "probes/s", "p50 us", "p99 us", "max us");
+    for (pass = 0; pass < 2; pass++) {
+        r.reloads = pass == 0 ? 0 : reloads;
+        t = now();
+        for (i = 0; i < clients; i++) {
+            c[i].models = models;
+            c[i].batcher = NULL;
+            c[i].id = i;
+            c[i].n = n;
+            c[i].latency = &all[(size_t) i * n];
+            pthread_create(&c[i].thread, NULL, batch_client, &c[i]);
+        }
+        pthread_create(&thread, NULL, reload_loop, &r);
+        for (i = 0; i < clients; i++) {
+            pthread_join(c[i].thread, NULL);
+        }
+        pthread_join(thread, NULL);
+        t = now() - t;
+        qsort(all, (size_t) clients * n, sizeof(double), compare_double);
+
+        printf("%-16s %10.1f %10.1f %10.1f %10.1f\n", pass == 0 ? "steady" : "reloading",
+                clients * n / t, all[clients * n / 2] * 1e6,
+                all[(size_t) clients * n * 99 / 100] * 1e6, all[clients * n - 1] * 1e6);
+    }
+
+    if (r.reloads > 0) {
+        qsort(r.seconds, r.reloads, sizeof(double), compare_double);
+        printf("%d reloads: p50 %.2f ms, max %.2f ms, model version %ld\n", r.reloads,
+                r.seconds[r.reloads / 2] * 1e3, r.seconds[r.reloads - 1] * 1e3,
+                atomic_load(&models->version));
+    }
+
+    for (i = 0; i < TestCount; i++) {
+        ppm_image_destructor(TestImages[i], 1);
+    }
+    registry_close(models);
+    free(r.seconds);
+    free(c);
+    free(all);
+    return 0;
+}
+
+typedef struct {
+    double start;                   // seconds to load and answer a probe
+    long pss;                       // KB added: own pages, share of the model
+    long private;                   // KB only this process holds
+    long huge;                      // KB of the model mapped with huge pages
+} worker_memory_t;
+
+/*
+ * Memory of the calling process that can hold the model, in KB: pages of
+ * the heap and of anonymous mappings that are its own (pages still shared
+ * with the parent after fork are left out), and its share of the mappings
+ * of ModelPath. Shared libraries are left out too
+ */
+static void read_memory(worker_memory_t *m)
+{
+    FILE *in = fopen("/proc/self/smaps", "r");
+    char line[512], path[256];
+    unsigned long start, end;
+    int mapping = 0;                // 0 not counted, 1 heap or anonymous, 2 model
+    long kb;
+
+    m->pss = m->private = m->huge = 0;
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        // a mapping header: "start-end perms offset dev inode [path]"
+        if (sscanf(line, "%lx-%lx", &start, &end) == 2) {
+            path[0] = '\0';
+            sscanf(line, "%*s %*s %*s %*s %*s %255s", path);
+            mapping = path[0] == '\0' || strcmp(path, "[heap]") == 0;
+            if (strlen(path) >= strlen(ModelPath)
+                    && strcmp(path + strlen(path) - strlen(ModelPath), ModelPath) == 0) {
+                mapping = 2;
+            }
+        } else if (mapping == 2 && sscanf(line, "Pss: %ld", &kb) == 1) {
+            m->pss += kb;
+        } else if (mapping != 0 && (sscanf(line, "Private_Clean: %ld", &kb) == 1
+                || sscanf(line, "Private_Dirty: %ld", &kb) == 1)) {
+            m->pss += mapping == 1 ? kb : 0;
+            m->private += kb;
+        } else if (mapping == 2 && sscanf(line, "FilePmdMapped: %ld", &kb) == 1) {
+            m->huge += kb;
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+}
+
+/*
+ * One worker process: loads the model the way mode says, recognizes every
+ * test image, reports how long that took, then waits for go to close so
+ * that all workers hold their memory when it is measured, and for done to
+ * close before exiting so that none lets go of it too early
+ * mode: 0 private copies (model_load), 1 shared mapping, 2 shared mapping
+ *       with huge pages
+ */
+static void memory_worker(int mode, int ready, int go, int results, int done)
+{
+    const char *names[] = { FisherNames[0], FisherNames[3], PROJECTION_NAME };
+    worker_memory_t before, after;
+    recognizer_t *R = NULL;
+    MATRIX **copies = NULL;
+    scratch_t *S = NULL;
+    match_t best;
+    double sum = 0;
+    char byte;
+    int i, j;
+
+    read_memory(&before);
+    after.start = now();
+    if (mode == 0) {
+        // what every process did before the model was mapped: fread its
+        // own copy of each matrix recognition reads
+        copies = model_load(ModelPath, names, 3);
+        for (i = 0; copies != NULL && i < 3; i++) {
+            for (j = 0; j < copies[i]->rows; j++) {
+                sum += copies[i]->data[j][0];
+            }
+        }
+    } else {
+        model_use_hugepages(mode == 2);
+        R = LoadRecognizer(ModelPath);
+        S = R != NULL ? CreateScratch(R) : NULL;
+        for (i = 0; R != NULL && i < TestCount; i++) {
+            RecognizeProbe(R, &TestImages[i]->pixels[0].intensity, sizeof(Pixel), S, 1, &best);
+            sum += best.distance;
+        }
+    }
+    after.start = now() - after.start + 0 * sum;
+
+    byte = R != NULL || copies != NULL;
+    write(ready, &byte, 1);
+    read(go, &byte, 1);
+
+    read_memory(&after);
+    after.pss -= before.pss;
+    after.private -= before.private;
+    after.huge -= before.huge;
+    write(results, &after, sizeof(after));
+    read(done, &byte, 1);
+    _exit(0);
+}
+
+/*
+ * 1 .. max_procs worker processes holding the model at once: the memory
+ * they add together, what each holds privately and how long each took to
+ * load it and answer the test set (all at once, so this grows with procs
+ * past the core count), with private copies of the model against the
+ * shared mapping, with and without huge pages
+ */
+static int bench_procs(int argc, char *argv[])
+{
+    int max_procs = argc > 0 ? atoi(argv[0]) : 8;
+    const char *modes[] = { "copies", "shared", "shared huge" };
+    int ready[2], go[2], results[2], done[2];
+    worker_memory_t m, total;
+    int procs, mode, i, loaded;
+    char byte;
+
+    load_test_images(TestDatabasePath);
+    printf("%-12s %6s %12s %14s %10s %12s\n", "model", "procs", "total MB", "private MB/proc",
+            "huge MB", "ready ms");
+    for (mode = 0; mode < 3; mode++) {
+        for (procs = 1; procs <= max_procs; procs *= 2) {
+            if (pipe(ready) != 0 || pipe(go) != 0 || pipe(results) != 0 || pipe(done) != 0) {
+                perror("pipe");
+                return 1;
+            }
+            for (i = 0; i < procs; i++) {
+                if (fork() == 0) {
+                    close(go[1]);
+                    close(done[1]);
+                    memory_worker(mode, ready[1], go[0], results[1], done[0]);
+                }
+            }
+            close(go[0]);
+            close(done[0]);
+            loaded = 0;
+            for (i = 0; i < procs; i++) {
+                if (read(ready[0], &byte, 1) == 1) {
+                    loaded += byte;
+                }
+            }
+            close(go[1]);
+
+            memset(&total, 0, sizeof(total));
+            for (i = 0; i < procs; i++) {
+                if (read(results[0], &m, sizeof(m)) == sizeof(m)) {
+                    total.pss += m.pss;
+                    total.private += m.private;
+                    total.huge += m.huge;
+                    total.start += m.start;
+                }
+            }
+            close(done[1]);
+            while (wait(NULL) > 0) {
+            }
+            close(ready[0]);
+            close(ready[1]);
+            close(results[0]);
+            close(results[1]);
+
+            if (loaded != procs) {
+                fprintf(stderr, "%d of %d workers could not load %s\n", procs - loaded, procs,
+                        ModelPath);
+                return 1;
+            }
+            printf("%-12s %6d %12.1f %14.1f %10.1f %12.2f\n", modes[mode], procs,
+                    total.pss / 1024.0, total.private / 1024.0 / procs, total.huge / 1024.0 / procs,
+                    total.start / procs * 1e3);
+        }
+    }
+
+    for (i = 0; i < TestCount; i++) {
+        ppm_image_destructor(TestImages[i], 1);
+    }
+    return 0;
+}
+
+/*
+ * Counts the pages of a range on each node, through move_pages with no
+ * target nodes (which only reports where each page is)
+ * counts: T->nodes entries, plus pages whose node is unknown in the last
+ */
+static void count_pages(const topology_t *T, const void *memory, size_t bytes, long *counts)
+{
+    size_t page = sysconf(_SC_PAGESIZE), n = bytes / page, i;
+    void **pages = (void **) malloc(n * sizeof(void *));
+    int *status = (int *) malloc(n * sizeof(int));
+    int node;
+
+    memset(counts, 0, (T->nodes + 1) * sizeof(long));
+    for (i = 0; i < n; i++) {
+        pages[i] = (char *) memory + i * page;
+    }
+    if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) {
+        counts[T->nodes] = n;
+        n = 0;
+    }
+    for (i = 0; i < n; i++) {
+        for (node = 0; node < T->nodes && T->ids[node] != status[i]; node++) {
+        }
+        counts[node]++;
+    }
+    free(pages);
+    free(status);
+}
+
+/*
+ * Probes per second of a pool pinned across the NUMA nodes for each
+ * placement of the hot model sections: the shared file mapping (wherever
+ * the page cache put it), one copy interleaved over all nodes, one copy on
+ * node 0 read by every node, and one replica per node read only by the
+ * workers of that node
+ */
+static int bench_numa(int argc, char *argv[])
+{
+    int threads = argc > 0 ? atoi(argv[0]) : 0;
+    int n = argc > 1 ? atoi(argv[1]) : 3000;
+    const char *placements[] = { "mapped", "interleaved", "single node", "replicated" };
+    topology_t *T = topology_detect();
+    recognizer_t **replicas = (recognizer_t **) calloc(T->nodes, sizeof(recognizer_t *));
+    recognizer_t *shared = NULL;
+    const unsigned char **pixels;
+    recognizer_t *R;
+    match_t *matches;
+    pool_t *pool;
+    long *counts = (long *) malloc((T->nodes + 1) * sizeof(long));
+    double t;
+    int p, node, j;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+
+    for (node = 0; node < T->nodes; node++) {
+        printf("node %d: %d CPUs (%d", T->ids[node], T->count[node], T->cpus[node][0]);
+        for (j = 1; j < T->count[node] && j < 8; j++) {
+            printf(",%d", T->cpus[node][j]);
+        }
+        printf("%s)\n", T->count[node] > 8 ? ",..." : "");
+    }
+
+    pixels = (const unsigned char **) malloc(n * sizeof(unsigned char *));
+    matches = (match_t *) malloc(n * sizeof(match_t));
+    for (j = 0; j < n; j++) {
+        pixels[j] = &TestImages[j % TestCount]->pixels[0].intensity;
+    }
+
+    printf("%-12s %12s  pages per node\n", "placement", "probes/s");
+    for (p = 0; p < 4; p++) {
+        if (p == 1 || p == 2) {
+            shared = ReplicateRecognizer(R, T, p == 1 ? TOPOLOGY_INTERLEAVE : 0);
+        }
+        for (node = 0; node < T->nodes; node++) {
+            replicas[node] = p == 0 ? R : p == 3 ? ReplicateRecognizer(R, T, node) : shared;
+        }
+
+        pool = pool_create_pinned((const recognizer_t * const *) replicas, T, threads, 1);
+        pool_recognize(pool, pixels, sizeof(Pixel), TestCount < n ? TestCount : n, matches); // warm up
+        t = now();
+        pool_recognize(pool, pixels, sizeof(Pixel), n, matches);
+        t = now() - t;
+        pool_destroy(pool);
+
+        printf("%-12s %12.1f ", placements[p], n / t);
+        for (node = 0; p > 0 && node < T->nodes; node++) {
+            count_pages(T, replicas[node]->replica, replicas[node]->replica_bytes, counts);
+            for (j = 0; j <= T->nodes; j++) {
+                printf("%s%ld", j == 0 ? " " : "/", counts[j]);
+            }
+            if (p != 3) {
+                break;
+            }
+        }
+        printf("\n");
+
+        for (node = 0; p == 3 && node < T->nodes; node++) {
+            DestroyRecognizer(replicas[node]);
+        }
+        if (p == 1 || p == 2) {
+            DestroyRecognizer(shared);
+        }
+    }
+    printf("(pages per node: one count per node, then pages not placed yet or unknown)\n");
+
+    for (j = 0; j < TestCount; j++) {
+        ppm_image_destructor(TestImages[j], 1);
+    }
+    free(pixels);
+    free(matches);
+    free(replicas);
+    free(counts);
+    topology_destroy(T);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+/*
+ * Opens a counter of the data-TLB load misses of this process (user space
+ * only, so it works with perf_event_paranoid up to 2)
+ * returns: the counter, -1 if the kernel or the CPU does not offer it
+ */
+static int open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * AnonHugePages of the process in kB, from /proc/self/smaps_rollup
+ */
+static long anon_huge_kb(void)
+{
+    FILE *in = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+
+    if (in == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "AnonHugePages: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(in);
+    return kb;
+}
+
+/*
+ * Time and dTLB misses of the training kernels over a synthetic database
+ * of the real shape (pixels x images) for each allocation policy:
+ *   A'A          the GEMM behind the PCA eigenproblem
+ *   projection   V_PCA' a_i, one strided column of A at a time
+ *   column walk  per-image mean, reading A one column at a time
+ * The column walks touch a new 4 KB page every few rows, which is what
+ * huge pages are for
+ */
+static int bench_tlb(int argc, char *argv[])
+{
+    int pixels = argc > 0 ? atoi(argv[0]) : 128 * 192;
+    int P = argc > 1 ? atoi(argv[1]) : 120;
+    int dims = P - P / Class_population;
+    const char *kernels[] = { "A'A", "projection", "column walk" };
+    int runs = 5;
+    MATRIX *A, *V, *L, *W;
+    double t, sum, check;
+    long long misses;
+    long base_kb = anon_huge_kb();
+    int fd = open_dtlb_counter();
+    int policy, k, r, i, j;
+
+    if (fd < 0) {
+        printf("(no dTLB-load-misses counter: perf_event_open refused, misses shown as n/a)\n");
+    }
+    printf("database %d x %d (%.1f MB), V_PCA %d x %d\n", pixels, P,
+            (double) pixels * P * sizeof(double) / (1 << 20), pixels, dims);
+    printf("%-8s %-12s %10s %14s %12s\n", "pages", "kernel", "ms", "dTLB misses", "huge kB");
+
+    for (policy = HUGEPAGE_OFF; policy <= HUGEPAGE_HUGETLB; policy++) {
+        hugepage_policy(policy);
+        A = matrix_constructor(pixels, P);
+        V = matrix_constructor(pixels, dims);
+        L = matrix_constructor(P, P);
+        W = matrix_constructor(dims, P);
+        random_matrix(A, 1);
+        random_matrix(V, 2);
+
+        for (k = 0; k < 3; k++) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            t = now();
+            check = 0;
+            for (r = 0; r < runs; r++) {
+                if (k == 0) {
+                    cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, P, P, pixels, 1,
+                            *A->data, P, *A->data, P, 0, *L->data, P);
+                    check += L->data[P - 1][P - 1];
+                } else if (k == 1) {
+                    for (i = 0; i < P; i++) {
+                        cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, dims, 1, pixels, 1,
+                                *V->data, dims, &A->data[0][i], P, 0, &W->data[0][i], P);
+                    }
+                    check += W->data[dims - 1][P - 1];
+                } else {
+                    for (i = 0; i < P; i++) {
+                        sum = 0;
+                        for (j = 0; j < pixels; j++) {
+                            sum += A->data[j][i];
+                        }
+                        check += sum / pixels;
+                    }
+                }
+            }
+            t = (now() - t) / runs;
+            misses = -1;
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+                    misses = -1;
+                }
+            }
+
+            printf("%-8s %-12s %10.3f ", hugepage_name(policy), kernels[k], t * 1e3);
+            if (misses >= 0) {
+                printf("%14lld", misses / runs);
+            } else {
+                printf("%14s", "n/a");
+            }
+            printf(" %12ld  (%.3g)\n", anon_huge_kb() - base_kb, check);
+        }
+
+        matrix_destructor(A);
+        matrix_destructor(V);
+        matrix_destructor(L);
+        matrix_destructor(W);
+    }
+    printf("(misses per run; huge kB: anonymous memory on transparent huge pages)\n");
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return 0;
+}
+
+/*
+ * Latency of one probe at a time: RecognizeProbe on one core, then a
+ * team of 1 .. max_threads members splitting each probe. Also checks that
+ * the team finds the same best match
+ */
+static int bench_latency(int argc, char *argv[])
+{
+    int max_threads = argc > 0 ? atoi(argv[0]) : 0;
+    int n = argc > 1 ? atoi(argv[1]) : 2000;
+    topology_t *T = topology_detect();
+    double *latency = (double *) malloc(n * sizeof(double));
+    int *expected = (int *) malloc(TestCount * sizeof(int));
+    const unsigned char *pixels;
+    match_t matches[1];
+    recognizer_t *R;
+    scratch_t *S;
+    team_t *team;
+    double t;
+    int threads, j, differ;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    if (max_threads <= 0) {
+        max_threads = T->count[0] > 0 ? T->count[0] : 1;
+    }
+    // the caller is member 0 of every team
+    topology_pin(topology_cpu(T, 0, 0));
+
+    S = CreateScratch(R);
+    for (j = 0; j < TestCount; j++) {
+        RecognizeProbe(R, &TestImages[j]->pixels[0].intensity, sizeof(Pixel), S, 1, matches);
+        expected[j] = matches[0].index;
+    }
+
+    printf("%-10s %10s %10s %10s %8s\n", "threads", "p50 us", "p99 us", "mean us", "differ");
+    // serial, then teams of 1, 2, 4, ... and max_threads members
+    for (threads = 0; threads <= max_threads;
+            threads = threads < max_threads && threads * 2 > max_threads ? max_threads
+                    : threads == 0 ? 1 : threads * 2) {
+        team = threads == 0 ? NULL : team_create(R, T, threads, 1);
+        differ = 0;
+        for (j = 0; j < n + TestCount; j++) {
+            pixels = &TestImages[j % TestCount]->pixels[0].intensity;
+            t = now();
+            if (team == NULL) {
+                RecognizeProbe(R, pixels, sizeof(Pixel), S, 1, matches);
+            } else {
+                team_recognize(team, pixels, sizeof(Pixel), matches);
+            }
+            t = now() - t;
+            // the first pass over the images warms up
+            if (j >= TestCount) {
+                latency[j - TestCount] = t;
+            }
+            differ += matches[0].index != expected[j % TestCount];
+        }
+        if (team != NULL) {
+            team_destroy(team);
+        }
+
+        t = 0;
+        for (j = 0; j < n; j++) {
+            t += latency[j];
+        }
+        qsort(latency, n, sizeof(double), compare_double);
+        if (threads == 0) {
+            printf("%-10s", "serial");
+        } else {
+            printf("%-10d", threads);
+        }
+        printf(" %10.1f %10.1f %10.1f %8d\n", latency[n / 2] * 1e6,
+                latency[(size_t) n * 99 / 100] * 1e6, t / n * 1e6, differ);
+    }
+
+    for (j = 0; j < TestCount; j++) {
+        ppm_image_destructor(TestImages[j], 1);
+    }
+    DestroyScratch(S);
+    free(latency);
+    free(expected);
+    topology_destroy(T);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+#define ShmBenchRing "/fisher.bench"
+
+/*
+ * Producer process of bench_shm: writes frames test image after test image
+ * as fast as the consumer takes them, as P5 frames into fd or, if fd < 0,
+ * into a new ring, and writes a byte to ready once it may be read
+ */
+static void shm_producer(int fd, int ready, int width, int height, int frames)
+{
+    unsigned char *pixels = (unsigned char *) malloc((size_t) TestCount * width * height);
+    shmring_t *ring = NULL;
+    unsigned char *frame;
+    char header[64];
+    int f, i, n, length;
+
+    // intensities ready to send, so the producer costs only the transfer
+    for (f = 0; f < TestCount; f++) {
+        for (i = 0; i < width * height; i++) {
+            pixels[(size_t) f * width * height + i] = TestImages[f]->pixels[i].intensity;
+        }
+    }
+    if (fd < 0) {
+        ring = shmring_create(ShmBenchRing, width, height, SHMRING_SLOTS);
+    }
+    if (write(ready, "", 1) != 1 || (fd < 0 && ring == NULL)) {
+        _exit(1);
+    }
+    length = sprintf(header, "P5\n%d %d\n255\n", width, height);
+    for (f = 0; f < frames; f++) {
+        frame = pixels + (size_t) (f % TestCount) * width * height;
+        if (ring != NULL) {
+            memcpy(shmring_acquire(ring, 1), frame, width * height);
+            shmring_publish(ring);
+            continue;
+        }
+        if (write(fd, header, length) != length) {
+            _exit(1);
+        }
+        for (i = 0; i < width * height; i += n) {
+            n = write(fd, frame + i, width * height - i);
+            if (n <= 0) {
+                _exit(1);
+            }
+        }
+    }
+    if (ring != NULL) {
+        while (atomic_load(&ring->header->tail) != atomic_load(&ring->header->head)) {
+            sched_yield();
+        }
+        shmring_close(ring);
+    }
+    free(pixels);
+    _exit(0);
+}
+
+/*
+ * Frames per second from a producer process to the recognizer, the frames
+ * sent as PGM through a pipe and decoded by stream.c, or written into the
+ * shared-memory ring and read in place. "ingest" only reads one byte of
+ * every cache line of each frame; "recognize" runs RecognizeProbe on it.
+ * No frame is dropped
+ */
+static int bench_shm(int argc, char *argv[])
+{
+    int frames = argc > 0 ? atoi(argv[0]) : 3000;
+    const char *transports[] = { "pipe", "shm" };
+    const unsigned char *pixels;
+    recognizer_t *R;
+    scratch_t *S;
+    match_t match;
+    stream_t *s = NULL;
+    shmring_t *ring = NULL;
+    frame_t *frame;
+    char path[64], byte;
+    int width, height, size;
+    int ready[2], data[2];
+    long n, checksum;
+    double t;
+    pid_t child;
+    int transport, recognize, i;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    width = TestImages[0]->width;
+    height = TestImages[0]->height;
+    size = width * height;
+    S = CreateScratch(R);
+
+    printf("%d frames of %dx%d\n", frames, width, height);
+    printf("%-6s %-10s %12s %10s\n", "", "", "frames/s", "MB/s");
+    for (transport = 0; transport < 2; transport++) {
+        for (recognize = 0; recognize < 2; recognize++) {
+            if (pipe(ready) != 0 || (transport == 0 && pipe(data) != 0)) {
+                perror("pipe");
+                return 1;
+            }
+            fflush(stdout);
+            child = fork();
+            if (child == 0) {
+                close(ready[0]);
+                if (transport == 0) {
+                    close(data[0]);
+                }
+                shm_producer(transport == 0 ? data[1] : -1, ready[1], width, height, frames);
+            }
+            close(ready[1]);
+            if (read(ready[0], &byte, 1) != 1) {
+                fprintf(stderr, "producer failed\n");
+                return 1;
+            }
+            close(ready[0]);
+            if (transport == 0) {
+                close(data[1]);
+                sprintf(path, "/dev/fd/%d", data[0]);
+                s = stream_open(path, size, STREAM_BLOCK);
+                close(data[0]);
+            } else {
+                ring = shmring_attach(ShmBenchRing);
+            }
+            if ((transport == 0 && s == NULL) || (transport == 1 && ring == NULL)) {
+                return 1;
+            }
+
+            t = now();
+            checksum = 0;
+            for (n = 0; ; n++) {
+                if (transport == 0) {
+                    pixels = stream_next(s, &frame) == 0 ? frame->pixels : NULL;
+                } else {
+                    pixels = shmring_next(ring, NULL);
+                }
+                if (pixels == NULL) {
+                    break;
+                }
+                if (recognize) {
+                    RecognizeProbe(R, pixels, 1, S, 1, &match);
+                    checksum += match.index;
+                } else {
+                    for (i = 0; i < size; i += 64) {
+                        checksum += pixels[i];
+                    }
+                }
+                if (transport == 0) {
+                    stream_release(s);
+                } else {
+                    shmring_release(ring);
+                }
+            }
+            t = now() - t;
+            waitpid(child, NULL, 0);
+            if (transport == 0) {
+                stream_close(s);
+            } else {
+                shmring_close(ring);
+            }
+
+            printf("%-6s %-10s %12.1f %10.1f  (%ld frames, checksum %ld)\n", transports[transport],
+                    recognize ? "recognize" : "ingest", n / t, n * (double) size / t / (1 << 20),
+                    n, checksum);
+        }
+    }
+
+    for (i = 0; i < TestCount; i++) {
+        ppm_image_destructor(TestImages[i], 1);
+    }
+    DestroyScratch(S);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+/*
+ * Delta projection of a synthetic video: a test image where a given
+ * fraction of the tiles changes every frame, projected in full and by
+ * delta_project. Reports the time per frame, the projection columns read,
+ * the largest difference between the two projections and how often their
+ * best matches differ
+ */
+static int bench_delta(int argc, char *argv[])
+{
+    int n = argc > 0 ? atoi(argv[0]) : 256;
+    int threshold = argc > 1 ? atoi(argv[1]) : 0;
+    const int percents[] = { 0, 1, 5, 25, 100 };
+    unsigned char *video, *frame;
+    double *full, *projected;
+    match_t expected, match;
+    recognizer_t *R;
+    delta_t *D, *F;
+    int width, height, dims, tiles, across, changed;
+    int p, f, t, x, y, i, differ;
+    double t_full, t_delta, drift, error;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    if (R->quant != NULL) {
+        fprintf(stderr, "delta projection is for double models\n");
+        DestroyRecognizer(R);
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    width = TestImages[0]->width;
+    height = TestImages[0]->height;
+    dims = R->v_fisherT_x_v_pcaT->rows;
+    across = (width + DELTA_TILE - 1) / DELTA_TILE;
+    tiles = across * ((height + DELTA_TILE - 1) / DELTA_TILE);
+    video = (unsigned char *) malloc((size_t) n * width * height);
+    full = (double *) malloc(dims * sizeof(double));
+    projected = (double *) malloc(dims * sizeof(double));
+
+    printf("%dx%d frames, %d tiles of %d pixels, threshold %d, refresh every %d frames\n",
+            width, height, tiles, DELTA_TILE, threshold, DELTA_REFRESH);
+    printf("%-8s %12s %12s %10s %10s %8s\n", "changed", "full us", "delta us", "columns",
+            "drift", "differ");
+    for (p = 0; p < (int) (sizeof(percents) / sizeof(percents[0])); p++) {
+        // a run of tiles that moves along the image from frame to frame
+        changed = (tiles * percents[p] + 99) / 100;
+        for (f = 0; f < n; f++) {
+            frame = video + (size_t) f * width * height;
+            for (i = 0; i < width * height; i++) {
+                frame[i] = TestImages[0]->pixels[i].intensity;
+            }
+            for (t = 0; t < changed; t++) {
+                i = (f * 7 + t) % tiles;
+                for (y = i / across * DELTA_TILE; y < (i / across + 1) * DELTA_TILE && y < height; y++) {
+                    for (x = i % across * DELTA_TILE; x < (i % across + 1) * DELTA_TILE && x < width; x++) {
+                        frame[y * width + x] += 1 + f % 50;
+                    }
+                }
+            }
+        }
+
+        // a refresh of 1 recomputes every frame: the full projection
+        F = delta_create(R, width, height, threshold, 1);
+        t_full = now();
+        for (f = 0; f < n; f++) {
+            delta_project(F, video + (size_t) f * width * height, 1, full);
+        }
+        t_full = now() - t_full;
+
+        D = delta_create(R, width, height, threshold, DELTA_REFRESH);
+        t_delta = now();
+        for (f = 0; f < n; f++) {
+            delta_project(D, video + (size_t) f * width * height, 1, projected);
+        }
+        t_delta = now() - t_delta;
+
+        // the same again, frame by frame, to compare the results
+        delta_destroy(D);
+        D = delta_create(R, width, height, threshold, DELTA_REFRESH);
+        drift = 0;
+        differ = 0;
+        for (f = 0; f < n; f++) {
+            frame = video + (size_t) f * width * height;
+            delta_project(F, frame, 1, full);
+            delta_project(D, frame, 1, projected);
+            for (i = 0; i < dims; i++) {
+                error = full[i] > projected[i] ? full[i] - projected[i] : projected[i] - full[i];
+                drift = error > drift ? error : drift;
+            }
+            RecognizeProjected(R, full, NULL, 1, &expected);
+            RecognizeProjected(R, projected, NULL, 1, &match);
+            differ += match.index != expected.index;
+        }
+
+        printf("%7d%% %12.1f %12.1f %9.1f%% %10.2g %8d\n", percents[p], t_full / n * 1e6,
+                t_delta / n * 1e6, 100.0 * D->columns / D->frames / (width * height), drift, differ);
+        delta_destroy(D);
+        delta_destroy(F);
+    }
+    printf("(columns: share of the projection matrix read per frame; drift: largest\n"
+           " difference from the full projection)\n");
+
+    for (i = 0; i < TestCount; i++) {
+        ppm_image_destructor(TestImages[i], 1);
+    }
+    free(video);
+    free(full);
+    free(projected);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+/*
+ * Sliding-window scan of scenes made of noise with a test image pasted in
+ * the middle: time of the FFT scan and of the matching against the time a
+ * GEMV per window would take (timed on a sample of windows), the largest
+ * difference between the features at the face and its RecognizeProbe
+ * projection, and whether the face's best match and position are found.
+ * A second scan of each scene with the face brightened and SCAN_NORMALIZE
+ * checks the brightness correction
+ */
+static int bench_window(int argc, char *argv[])
+{
+    int width = argc > 0 ? atoi(argv[0]) : 320;
+    int height = argc > 1 ? atoi(argv[1]) : 256;
+    int step = argc > 2 ? atoi(argv[2]) : 1;
+    int n = argc > 3 ? atoi(argv[3]) : 5;
+    int face_width, face_height, ox, oy, at, best, found, bright;
+    unsigned char *scene, *lit;
+    double *window;
+    double t_scan, t_match, t_gemv, error, drift;
+    match_t expected;
+    recognizer_t *R;
+    scratch_t *Sc;
+    scan_t *S, *N;
+    int j, x, y, p, d;
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    face_width = TestImages[0]->width;
+    face_height = TestImages[0]->height;
+    S = scan_create(R, face_width, width, height, step, 0);
+    N = scan_create(R, face_width, width, height, step, SCAN_NORMALIZE);
+    if (S == NULL || N == NULL) {
+        return 1;
+    }
+    Sc = CreateScratch(R);
+    scene = (unsigned char *) malloc((size_t) width * height);
+    lit = (unsigned char *) malloc((size_t) width * height);
+    window = (double *) malloc((size_t) face_width * face_height * sizeof(double));
+    ox = (width - face_width) / 2 / step * step;
+    oy = (height - face_height) / 2 / step * step;
+    at = oy / step * S->columns + ox / step;
+
+    printf("%dx%d scenes, %d positions (step %d), FFT %dx%d, filter spectra %s\n", width, height,
+            S->rows * S->columns, step, S->nx, S->ny, S->spectra != NULL ? "cached" : "per scan");
+    printf("%-6s %10s %10s %12s %10s %6s %6s %6s\n", "image", "scan ms", "match ms", "GEMV ms",
+            "error", "match", "found", "bright");
+    srand(1);
+    for (j = 0; j < n && j < TestCount; j++) {
+        for (p = 0; p < width * height; p++) {
+            scene[p] = rand() % 256;
+        }
+        for (y = 0; y < face_height; y++) {
+            for (x = 0; x < face_width; x++) {
+                scene[(oy + y) * width + ox + x] = TestImages[j]->pixels[y * face_width + x].intensity;
+            }
+        }
+        for (p = 0; p < width * height; p++) {
+            lit[p] = scene[p] < 215 ? scene[p] + 40 : 255;
+        }
+        RecognizeProbe(R, &TestImages[j]->pixels[0].intensity, sizeof(Pixel), Sc, 1, &expected);
+
+        t_scan = now();
+        scan_image(S, scene, 1);
+        t_scan = now() - t_scan;
+        t_match = now();
+        scan_match(S);
+        t_match = now() - t_match;
+
+        // a GEMV per window, timed on 32 windows
+        t_gemv = now();
+        for (p = 0; p < 32; p++) {
+            for (y = 0; y < face_height; y++) {
+                for (x = 0; x < face_width; x++) {
+                    window[y * face_width + x] = scene[(p % S->rows * step + y) * width + x];
+                }
+            }
+            cblas_dgemv(CblasRowMajor, CblasNoTrans, S->dims, face_width * face_height, 1,
+                        *R->v_fisherT_x_v_pcaT->data, face_width * face_height, window, 1, 0,
+                        Sc->pixels, 1);
+        }
+        t_gemv = (now() - t_gemv) / 32 * S->rows * S->columns;
+
+        drift = 0;
+        for (d = 0; d < S->dims; d++) {
+            error = S->features[(size_t) at * S->dims + d] - Sc->projected[d];
+            drift = error > drift ? error : -error > drift ? -error : drift;
+        }
+        for (p = 0, best = 0; p < S->rows * S->columns; p++) {
+            best = S->distance[p] < S->distance[best] ? p : best;
+        }
+        found = best == at;
+
+        scan_image(N, lit, 1);
+        scan_match(N);
+        bright = N->index[at] == expected.index;
+
+        printf("%-6d %10.1f %10.1f %12.1f %10.2g %6s %6s %6s\n", j + 1, t_scan * 1e3, t_match * 1e3,
+                t_gemv * 1e3, drift, S->index[at] == expected.index ? "yes" : "no",
+                found ? "yes" : "no", bright ? "yes" : "no");
+    }
+    printf("(GEMV ms: estimated for all positions; error: largest difference from the\n"
+           " RecognizeProbe projection; found: the face's position has the best distance)\n");
+
+    for (j = 0; j < TestCount; j++) {
+        ppm_image_destructor(TestImages[j], 1);
+    }
+    free(scene);
+    free(lit);
+    free(window);
+    scan_destroy(S);
+    scan_destroy(N);
+    DestroyScratch(Sc);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+/*
+ * Two-stage search on a synthetic gallery of Class_population images per
+ * person: latency and recall@1 / recall@k against the exact top-k scan for
+ * a range of shortlists, then the recognition rate of the real model on
+ * the test images with each shortlist
+ */
+static int bench_centroid(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 40000;
+    int k = argc > 1 ? atoi(argv[1]) : 10;
+    const int shortlists[] = { 1, 2, 4, 8, 16, 32 };
+    int dims = 99, probes = 200;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *Y = matrix_constructor(probes, dims);
+    match_t *exact = (match_t *) malloc((size_t) probes * k * sizeof(match_t));
+    match_t *found = (match_t *) malloc(k * sizeof(match_t));
+    double t, t_exact, hits, first;
+    gallery_t *blocked;
+    centroid_t *K;
+    recognizer_t *R;
+    scratch_t *S;
+    topk_t T;
+    long work;
+    int e, r, correct;
+
+    synthetic_gallery(G, Y);
+    blocked = gallery_create(G, NULL);
+    K = centroid_create(G, Class_population, blocked);
+    printf("gallery %d x %d, %d classes of %d, k %d\n", dims, P, K->classes, Class_population, k);
+
+    t_exact = now();
+    for (r = 0; r < probes; r++) {
+        topk_init(&T, &exact[(size_t) r * k], k);
+        gallery_search(blocked, Y->data[r], &T);
+        topk_sort(&T);
+    }
+    t_exact = (now() - t_exact) / probes;
+    printf("%-13s %10.3f ms/probe  recall@1 1.000  recall@%d 1.000\n", "exact", t_exact * 1e3, k);
+
+    for (e = 0; e < (int) (sizeof(shortlists) / sizeof(shortlists[0])); e++) {
+        hits = 0;
+        first = 0;
+        work = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            work += centroid_search(K, blocked, Y->data[r], shortlists[e], k, found);
+            hits += recall(found, &exact[(size_t) r * k], k);
+            first += found[0].index == exact[(size_t) r * k].index;
+        }
+        t = (now() - t) / probes;
+        printf("shortlist %-3d %10.3f ms/probe  recall@1 %.3f  recall@%d %.3f  %5.1f%% of dims"
+                "  %5.1fx\n", shortlists[e], t * 1e3, first / probes, k, hits / probes,
+                100.0 * work / ((double) probes * P * dims), t_exact / t);
+    }
+    gallery_destroy(blocked);
+    centroid_destroy(K);
+    matrix_destructor(G);
+    matrix_destructor(Y);
+    free(exact);
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    S = CreateScratch(R);
+    printf("\n%s, %d test images:\n", ModelPath, TestCount);
+    for (e = -1; e < 4; e++) {
+        if (e >= 0 && AttachCentroids(R, shortlists[e]) != 0) {
+            break;
+        }
+        correct = 0;
+        for (r = 0; r < TestCount; r++) {
+            RecognizeProbe(R, &TestImages[r]->pixels[0].intensity, sizeof(Pixel), S, 1, found);
+            correct += found[0].index / Class_population == r;
+        }
+        if (e < 0) {
+            printf("%-13s %d / %d correct\n", "exact", correct, TestCount);
+        } else {
+            printf("shortlist %-3d %d / %d correct\n", shortlists[e], correct, TestCount);
+        }
+    }
+
+    for (r = 0; r < TestCount; r++) {
+        ppm_image_destructor(TestImages[r], 1);
+    }
+    free(found);
+    DestroyScratch(S);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+/*
+ * Sign-random-projection prefilter on a synthetic gallery: the exact
+ * top-k scan, the Hamming pass alone with each kernel, then latency and
+ * recall@1 / recall@k against the exact scan for a range of candidate
+ * counts, and the recognition rate of the real model on the test images
+ */
+static int bench_srp(int argc, char *argv[])
+{
+    int P = argc > 0 ? atoi(argv[0]) : 100000;
+    int k = argc > 1 ? atoi(argv[1]) : 10;
+    const int candidates[] = { 16, 64, 256, 1024, 4096 };
+    const char * const kernels[] = { "c", "popcnt", "avx2" };
+    int dims = 99, probes = 200;
+    MATRIX *G = matrix_constructor(dims, P);
+    MATRIX *Y = matrix_constructor(probes, dims);
+    match_t *exact = (match_t *) malloc((size_t) probes * k * sizeof(match_t));
+    match_t *found = (match_t *) malloc(k * sizeof(match_t));
+    unsigned short *distances = (unsigned short *) malloc(P * sizeof(unsigned short));
+    int *ids = (int *) malloc(P * sizeof(int));
+    double t, t_exact, hits, first;
+    const char *picked;
+    gallery_t *blocked;
+    srp_t *Sr;
+    recognizer_t *R;
+    scratch_t *S;
+    topk_t T;
+    int e, r, correct;
+
+    synthetic_gallery(G, Y);
+    blocked = gallery_create(G, NULL);
+    Sr = srp_create(G);
+    printf("gallery %d x %d, %d-bit codes: %d bytes per image instead of %d, k %d\n", dims, P,
+            SRP_BITS, (int) sizeof(srp_code_t), dims * (int) sizeof(double), k);
+    picked = Sr->kernel;
+
+    t_exact = now();
+    for (r = 0; r < probes; r++) {
+        topk_init(&T, &exact[(size_t) r * k], k);
+        gallery_search(blocked, Y->data[r], &T);
+        topk_sort(&T);
+    }
+    t_exact = (now() - t_exact) / probes;
+    printf("%-15s %10.3f ms/probe  recall@1 1.000  recall@%d 1.000\n", "exact", t_exact * 1e3, k);
+
+    for (e = 0; e < (int) (sizeof(kernels) / sizeof(kernels[0])); e++) {
+        if (srp_use(Sr, kernels[e]) != 0) {
+            printf("hamming %-7s not supported\n", kernels[e]);
+            continue;
+        }
+        t = now();
+        for (r = 0; r < probes; r++) {
+            srp_distances(Sr, Y->data[r], distances);
+        }
+        t = (now() - t) / probes;
+        printf("hamming %-7s %10.3f ms/probe  %6.2f GB/s of codes%s\n", kernels[e], t * 1e3,
+                (double) P * sizeof(srp_code_t) / t / 1e9,
+                strcmp(kernels[e], picked) == 0 ? "  (picked)" : "");
+    }
+    srp_use(Sr, picked);
+
+    for (e = 0; e < (int) (sizeof(candidates) / sizeof(candidates[0])); e++) {
+        hits = 0;
+        first = 0;
+        t = now();
+        for (r = 0; r < probes; r++) {
+            srp_search(Sr, blocked, Y->data[r], candidates[e], k, found, distances, ids);
+            hits += recall(found, &exact[(size_t) r * k], k);
+            first += found[0].index == exact[(size_t) r * k].index;
+        }
+        t = (now() - t) / probes;
+        printf("candidates %-4d %10.3f ms/probe  recall@1 %.3f  recall@%d %.3f  %5.1fx\n",
+                candidates[e], t * 1e3, first / probes, k, hits / probes, t_exact / t);
+    }
+    gallery_destroy(blocked);
+    srp_destroy(Sr);
+    matrix_destructor(G);
+    matrix_destructor(Y);
+    free(exact);
+    free(distances);
+    free(ids);
+
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        return 1;
+    }
+    load_test_images(TestDatabasePath);
+    S = CreateScratch(R);
+    printf("\n%s, %d test images:\n", ModelPath, TestCount);
+    for (e = -1; e < 3; e++) {
+        if (e >= 0 && AttachSRP(R, candidates[e]) != 0) {
+            break;
+        }
+        correct = 0;
+        for (r = 0; r < TestCount; r++) {
+            RecognizeProbe(R, &TestImages[r]->pixels[0].intensity, sizeof(Pixel), S, 1, found);
+            correct += found[0].index / Class_population == r;
+        }
+        if (e < 0) {
+            printf("%-15s %d / %d correct\n", "exact", correct, TestCount);
+        } else {
+            printf("candidates %-4d %d / %d correct\n", candidates[e], correct, TestCount);
+        }
+    }
+
+    for (r = 0; r < TestCount; r++) {
+        ppm_image_destructor(TestImages[r], 1);
+    }
+    free(found);
+    DestroyScratch(S);
+    DestroyRecognizer(R);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    for (i = 0; argc > 1 && i < (int) (sizeof(benches) / sizeof(benches[0])); i++) {
+        if (strcmp(argv[1], benches[i].name) == 0) {
+            return benches[i].run(argc - 2, argv + 2);
+        }
+    }
+
+    fprintf(stderr, "usage: %s <name> [args]\n", argv[0]);
+    for (i = 0; i < (int) (sizeof(benches) / sizeof(benches[0])); i++) {
+        fprintf(stderr, "  %-8s %s\n", benches[i].name, benches[i].usage);
+    }
+    return 1;
+}
@@ -0,0 +1,154 @@
+/*******************************************************************************
+ Class-centroid prefilter
+
+ The centroids are a (C-1) x C matrix like the gallery itself, blocked with
+ the gallery's dimension order when they are created or mapped, so the
+ first stage is a gallery_search over C images keeping the shortlist best.
+
+ The second stage scores the shortlisted templates with gallery_rerank,
+ which reads them from the blocked gallery and abandons a template as soon
+ as its partial distance passes the k-th best.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "centroid.h"
+#include "gallery.h"
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+/*
+ * Builds K->blocked from K->data in the dimension order of G
+ */
+static void centroid_block(centroid_t *K, const gallery_t *G)
+{
+    MATRIX *view = matrix_view((double *) K->data, K->dims, K->classes);
+    double weights[K->dims];
+    int d;
+
+    // descending weights reproduce G's order
+    for (d = 0; d < K->dims; d++) {
+        weights[G->order[d]] = K->dims - d;
+    }
+    K->blocked = gallery_create(view, weights);
+    matrix_view_destructor(view);
+}
+
+/*
+ * Computes the class means
+ * ProjectedImages_Fisher: (C-1)xP gallery, population images per class
+ * population: images per class (Class_population)
+ * G: ProjectedImages_Fisher in blocked layout
+ */
+centroid_t *centroid_create(const MATRIX *ProjectedImages_Fisher, int population,
+        const gallery_t *G)
+{
+    const MATRIX *Y = ProjectedImages_Fisher;
+    centroid_t *K = (centroid_t *) malloc(sizeof(centroid_t));
+    double *data;
+    int c, d, i, n;
+
+    K->classes = (Y->cols + population - 1) / population;
+    K->dims = Y->rows;
+    K->population = population;
+    K->owned = 1;
+    data = (double *) calloc((size_t) K->dims * K->classes, sizeof(double));
+    for (d = 0; d < K->dims; d++) {
+        for (c = 0; c < K->classes; c++) {
+            n = c * population + population <= Y->cols ? population : Y->cols - c * population;
+            for (i = c * population; i < c * population + n; i++) {
+                data[(size_t) d * K->classes + c] += Y->data[d][i];
+            }
+            data[(size_t) d * K->classes + c] /= n;
+        }
+    }
+    K->data = data;
+    centroid_block(K, G);
+    return K;
+}
+
+void centroid_entries(const centroid_t *K, model_entry_t *entries)
+{
+    entries[0].name = CENTROID_NAME;
+    entries[0].dtype = MODEL_F64;
+    entries[0].rows = K->dims;
+    entries[0].cols = K->classes;
+    entries[0].data = K->data;
+    entries[1].name = CENTROID_POPULATION_NAME;
+    entries[1].dtype = MODEL_I32;
+    entries[1].rows = 1;
+    entries[1].cols = 1;
+    entries[1].data = &K->population;
+}
+
+/*
+ * Maps the centroids saved with a model
+ * G: the model's gallery
+ * returns: NULL if the model was saved without them or for another shape
+ */
+centroid_t *centroid_map(model_t *model, const gallery_t *G)
+{
+    centroid_t *K = (centroid_t *) calloc(1, sizeof(centroid_t));
+    const int *population;
+    int rows, cols;
+
+    K->data = (const double *) model_data(model, CENTROID_NAME, MODEL_F64, &K->dims, &K->classes);
+    population = (const int *) model_data(model, CENTROID_POPULATION_NAME, MODEL_I32, &rows,
+            &cols);
+    // classes of population images, the last one possibly short
+    if (K->data == NULL || population == NULL || rows != 1 || cols != 1 || *population < 1
+            || K->dims != G->dims || K->classes != (G->count + *population - 1) / *population) {
+        free(K);
+        return NULL;
+    }
+    K->population = *population;
+    centroid_block(K, G);
+    return K;
+}
+
+/*
+ * Searches the templates of the nearest classes
+ * K: class centroids of G
+ * G: the gallery
+ * probe: (C-1) values in Fisher space
+ * shortlist: classes whose templates are scored
+ * k, matches: the k best templates, best first
+ * returns: dimensions scored
+ */
+long centroid_search(const centroid_t *K, const gallery_t *G, const double *probe, int shortlist,
+        int k, match_t *matches)
+{
+    match_t classes[shortlist];
+    int ids[K->population];
+    topk_t Classes, Best;
+    long work;
+    int c, i, n;
+
+    // stage 1: the shortlist nearest centroids
+    topk_init(&Classes, classes, shortlist);
+    work = gallery_search(K->blocked, probe, &Classes) * GALLERY_LANES; // per image
+    topk_sort(&Classes);
+
+    // stage 2: exact distances to their templates
+    topk_init(&Best, matches, k);
+    for (c = 0; c < shortlist && classes[c].index >= 0; c++) {
+        for (i = classes[c].index * K->population, n = 0;
+                n < K->population && i < G->count; i++, n++) {
+            ids[n] = i;
+        }
+        work += gallery_rerank(G, probe, ids, n, &Best);
+    }
+    topk_sort(&Best);
+    return work;
+}
+
+void centroid_destroy(centroid_t *K)
+{
+    gallery_destroy(K->blocked);
+    if (K->owned) {
+        free((void *) K->data);
+    }
+    free(K);
+}
@@ -0,0 +1,66 @@
+/*
+ * Two-stage search through class centroids
+ *
+ * The gallery holds Class_population images per person, stored class by
+ * class: images c*population ... (c+1)*population-1 are person c. The
+ * first stage scores the probe against the C class means in Fisher space
+ * (C vectors instead of P), laid out as a small gallery of their own so
+ * the blocked kernels and early abandoning of gallery_search apply; the
+ * second computes exact distances to the templates of the shortlist
+ * nearest classes only and returns their k best. Fisher space is built
+ * to pull a class's images together around its mean, so a small shortlist
+ * keeps the true match in almost every case while touching
+ * shortlist*population templates.
+ *
+ * FisherfaceCore saves the centroids and the class population in the
+ * model (centroid_entries);
+ * AttachCentroids maps them and makes RecognizeProjected use this search.
+ */
+
+#ifndef __CENTROID_H__
+#define __CENTROID_H__
+
+#include "gallery.h"
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+// model sections holding the class centroids, (C-1) x C, and the images
+// per class they were computed from (the last class may have fewer)
+#define CENTROID_NAME "class_centroids"
+#define CENTROID_POPULATION_NAME "class_population"
+#define CENTROID_SECTIONS 2
+
+// classes whose templates are re-ranked when no count is given
+#define CENTROID_SHORTLIST 4
+
+typedef struct {
+    int classes;                    // C
+    int dims;                       // C-1
+    int population;                 // gallery images per class
+    const double *data;             // dims x classes, a class per column
+    int owned;                      // data was allocated by centroid_create
+    gallery_t *blocked;             // data in G's blocked layout and order
+} centroid_t;
+
+// means of each class of a (C-1)xP gallery stored population images per
+// class, class by class; G is its blocked layout
+centroid_t *centroid_create(const MATRIX *ProjectedImages_Fisher, int population,
+        const gallery_t *G);
+
+// model sections holding K; entries must have room for CENTROID_SECTIONS
+void centroid_entries(const centroid_t *K, model_entry_t *entries);
+
+// centroids from a model, which must outlive them, for its gallery G;
+// NULL if the model has none for G's shape or no class population
+centroid_t *centroid_map(model_t *model, const gallery_t *G);
+
+// k best gallery images among the templates of the shortlist classes
+// nearest to probe ((C-1) values, Fisher space), best first, index -1 past
+// the candidates. Returns the dimensions scored, centroids included
+long centroid_search(const centroid_t *K, const gallery_t *G, const double *probe, int shortlist,
+        int k, match_t *matches);
+
+void centroid_destroy(centroid_t *K);
+
+#endif
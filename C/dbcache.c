@@ -0,0 +1,219 @@
+/*******************************************************************************
+ Ingestion cache for CreateDatabase
+
+ Decoding every PPM in the training directory dominates startup once the set
+ grows past a few thousand images. The decoded grayscale intensities fit in a
+ byte each, so the whole database is cached as an 8-bit pixels x images block
+ next to the images it came from. The cache is mmapped on later runs; an image
+ is only decoded again when its name, size or mtime no longer match.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CreateDatabase.h"
+#include "dbcache.h"
+
+#define DBCACHE_ALIGN 64
+
+static char *dbcache_path(const char *TrainPath, const char *suffix);
+
+/*
+ * Fills the key of a cached image
+ * E: entry to fill
+ * name: file name relative to the training directory
+ * st: stat() of the file
+ */
+void dbcache_entry(dbcache_entry_t *E, const char *name, const struct stat *st)
+{
+    memset(E, 0, sizeof(dbcache_entry_t));
+    strncpy(E->name, name, DBCACHE_NAMELEN - 1);
+    E->size = (long long) st->st_size;
+    E->mtime_sec = (long long) st->st_mtim.tv_sec;
+    E->mtime_nsec = (long long) st->st_mtim.tv_nsec;
+}
+
+/*
+ * Maps the cache of a training directory
+ * TrainPath: training directory
+ * pixels: expected pixels per image; a cache of another size is ignored
+ * returns: NULL if there is no usable cache
+ */
+dbcache_t *dbcache_open(const char *TrainPath, int pixels)
+{
+    char *path = dbcache_path(TrainPath, "");
+    const dbcache_header_t *header;
+    dbcache_t *C;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(dbcache_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = (const dbcache_header_t *) map;
+    if (memcmp(header->magic, DBCACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != DBCACHE_VERSION
+            || header->pixels != (unsigned int) pixels
+            || header->data_offset < sizeof(dbcache_header_t)
+                    + header->images * sizeof(dbcache_entry_t)
+            || header->data_offset + (unsigned long long) header->pixels
+                    * header->images > (unsigned long long) st.st_size) {
+        fprintf(stderr, "dbcache: ignoring incompatible cache in %s\n", TrainPath);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    // the pixel block is read row by row, front to back
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    C = (dbcache_t *) malloc(sizeof(dbcache_t));
+    C->map = map;
+    C->length = st.st_size;
+    C->pixels = header->pixels;
+    C->images = header->images;
+    C->entries = (const dbcache_entry_t *) (header + 1);
+    C->data = (const unsigned char *) map + header->data_offset;
+
+    return C;
+}
+
+/*
+ * Looks up an image in the cache
+ * C: the cache
+ * E: key of the image as it is on disk now
+ * hint: column to try first (images are usually in the same order as before)
+ * returns: column of the cached image, or -1 if missing or stale
+ */
+int dbcache_find(const dbcache_t *C, const dbcache_entry_t *E, int hint)
+{
+    int i;
+
+    if (hint < 0 || hint >= C->images
+            || strncmp(C->entries[hint].name, E->name, DBCACHE_NAMELEN) != 0) {
+        for (hint = -1, i = 0; i < C->images; i++) {
+            if (strncmp(C->entries[i].name, E->name, DBCACHE_NAMELEN) == 0) {
+                hint = i;
+                break;
+            }
+        }
+        if (hint < 0) {
+            return -1;
+        }
+    }
+
+    if (C->entries[hint].size != E->size
+            || C->entries[hint].mtime_sec != E->mtime_sec
+            || C->entries[hint].mtime_nsec != E->mtime_nsec) {
+        return -1;
+    }
+
+    return hint;
+}
+
+/*
+ * Unmaps the cache
+ */
+void dbcache_close(dbcache_t *C)
+{
+    if (C == NULL) {
+        return;
+    }
+    munmap(C->map, C->length);
+    free(C);
+}
+
+/*
+ * Writes the cache of a training directory. The file is written under a
+ * temporary name and renamed into place so a concurrent reader never maps a
+ * half-written cache.
+ * TrainPath: training directory
+ * D: the decoded database
+ * entries: key of every image (D->images of them)
+ * returns: 0 on success
+ */
+int dbcache_write(const char *TrainPath, const database_t *D,
+        const dbcache_entry_t *entries)
+{
+    char *path = dbcache_path(TrainPath, "");
+    char *tmp = dbcache_path(TrainPath, ".tmp");
+    static const char zeros[DBCACHE_ALIGN];
+    dbcache_header_t header;
+    unsigned char *row;
+    size_t offset;
+    FILE *out;
+    int i, j;
+    int ok = 1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DBCACHE_MAGIC, sizeof(header.magic));
+    header.version = DBCACHE_VERSION;
+    header.pixels = D->pixels;
+    header.images = D->images;
+    offset = sizeof(header) + D->images * sizeof(dbcache_entry_t);
+    header.data_offset = (offset + DBCACHE_ALIGN - 1) & ~(size_t) (DBCACHE_ALIGN - 1);
+
+    out = fopen(tmp, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "dbcache: unable to write %s: %s\n", tmp, strerror(errno));
+        free(path);
+        free(tmp);
+        return -1;
+    }
+
+    ok &= fwrite(&header, sizeof(header), 1, out) == 1;
+    ok &= fwrite(entries, sizeof(dbcache_entry_t), D->images, out) == (size_t) D->images;
+    ok &= fwrite(zeros, 1, header.data_offset - offset, out) == header.data_offset - offset;
+
+    row = (unsigned char *) malloc(D->images);
+    for (i = 0; ok && i < D->pixels; i++) {
+        for (j = 0; j < D->images; j++) {
+            row[j] = (unsigned char) D->data[i][j];
+        }
+        ok &= fwrite(row, 1, D->images, out) == (size_t) D->images;
+    }
+    free(row);
+
+    ok &= fclose(out) == 0;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "dbcache: unable to write %s\n", path);
+        unlink(tmp);
+        ok = 0;
+    }
+
+    free(path);
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Builds "<TrainPath>/<DBCACHE_NAME><suffix>"; the caller frees the result
+ */
+static char *dbcache_path(const char *TrainPath, const char *suffix)
+{
+    char *path = (char *) malloc(strlen(TrainPath) + strlen(DBCACHE_NAME)
+            + strlen(suffix) + 2);
+
+    sprintf(path, "%s/%s%s", TrainPath, DBCACHE_NAME, suffix);
+    return path;
+}
@@ -0,0 +1,71 @@
+/*
+ * Ingestion cache for CreateDatabase
+ *
+ * The decoded grayscale database is written to a single binary file inside
+ * the training directory. Each image is keyed by its file name, size and
+ * modification time; on the next run the cache is mmapped and only images
+ * whose key no longer matches are decoded again.
+ *
+ * File layout:
+ *     dbcache_header_t
+ *     dbcache_entry_t[images]
+ *     padding up to a 64 byte boundary (header.data_offset)
+ *     unsigned char[pixels][images]  - same row/column layout as database_t
+ */
+
+#ifndef __DBCACHE_H__
+#define __DBCACHE_H__
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "CreateDatabase.h"
+
+// Name of the cache file, relative to the training directory
+#define DBCACHE_NAME ".database.cache"
+#define DBCACHE_MAGIC "LDADBC\0"
+#define DBCACHE_VERSION 1
+#define DBCACHE_NAMELEN 64
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int pixels;            // pixels per image
+    unsigned int images;            // number of cached images
+    unsigned int reserved;
+    unsigned long long data_offset; // byte offset of the pixel block
+} dbcache_header_t;
+
+typedef struct {
+    char name[DBCACHE_NAMELEN];     // file name relative to the training path
+    long long size;                 // st_size of the source image
+    long long mtime_sec;            // st_mtim of the source image
+    long long mtime_nsec;
+} dbcache_entry_t;
+
+typedef struct {
+    void *map;                      // whole file, read-only
+    size_t length;
+    int pixels;
+    int images;
+    const dbcache_entry_t *entries;
+    const unsigned char *data;      // pixels x images, row-major
+} dbcache_t;
+
+// fills an entry from a file name and its stat() result
+void dbcache_entry(dbcache_entry_t *E, const char *name, const struct stat *st);
+
+// maps the cache of a training directory; NULL if missing or unusable
+dbcache_t *dbcache_open(const char *TrainPath, int pixels);
+
+// column of the cache holding an image with key E, or -1 if it is stale
+int dbcache_find(const dbcache_t *C, const dbcache_entry_t *E, int hint);
+
+// unmaps the cache
+void dbcache_close(dbcache_t *C);
+
+// (re)writes the cache of a training directory; returns 0 on success
+int dbcache_write(const char *TrainPath, const database_t *D,
+        const dbcache_entry_t *entries);
+
+#endif
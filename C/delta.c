@@ -0,0 +1,166 @@
+/*******************************************************************************
+ Delta projection for video
+
+ Pixel i of a frame is column i of v_fisherT_x_v_pcaT, and the frame is
+ stored row by row, so one row of a tile is a run of adjacent columns. The
+ update for it is one GEMV over that column slice (leading dimension the
+ full row length) with beta = 1, accumulating into y.
+*******************************************************************************/
+
+#include <cblas.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Recognition.h"
+#include "delta.h"
+
+/*
+ * Creates a projector; the first frame is always projected in full
+ * R: the loaded model, without int8 sections
+ * width, height: frame size; width*height must be the model's image size
+ * threshold: largest per-pixel change a tile may have and still be skipped
+ * refresh: frames between full recomputations
+ */
+delta_t *delta_create(const recognizer_t *R, int width, int height, int threshold, int refresh)
+{
+    const MATRIX *Projection = R->v_fisherT_x_v_pcaT;
+    delta_t *D;
+
+    if (width * height != Projection->cols || R->quant != NULL) {
+        fprintf(stderr, "delta_create: %dx%d frames do not fit the %s projection\n", width, height,
+                R->quant != NULL ? "int8" : "model's");
+        return NULL;
+    }
+    D = (delta_t *) calloc(1, sizeof(delta_t));
+    D->R = R;
+    D->width = width;
+    D->height = height;
+    D->threshold = threshold;
+    D->refresh = refresh > 0 ? refresh : 1;
+    D->reference = (unsigned char *) malloc(width * height);
+    D->pending = (int *) malloc((width / DELTA_TILE + 1) * (height / DELTA_TILE + 1) * sizeof(int));
+    if (posix_memalign((void **) &D->y, 64, Projection->rows * sizeof(double)) != 0
+            || posix_memalign((void **) &D->difference, 64,
+                    (size_t) width * height * sizeof(double)) != 0) {
+        fprintf(stderr, "delta_create: out of memory\n");
+        exit(1);
+    }
+    return D;
+}
+
+/*
+ * Recomputes y from the whole frame, which becomes the reference
+ */
+static long delta_full(delta_t *D, const unsigned char *pixels, int stride)
+{
+    const MATRIX *Projection = D->R->v_fisherT_x_v_pcaT;
+    int i;
+
+    for (i = 0; i < Projection->cols; i++) {
+        D->reference[i] = pixels[(size_t) i * stride];
+        D->difference[i] = D->reference[i];
+    }
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, Projection->rows, Projection->cols,
+                1, *Projection->data, Projection->cols, D->difference, 1, 0, D->y, 1);
+    return Projection->cols;
+}
+
+/*
+ * Compares one tile with the reference
+ * returns: its pixel count if some pixel changed by more than threshold, else 0
+ */
+static long delta_changed(const delta_t *D, const unsigned char *pixels, int stride, int x0, int y0)
+{
+    int x1 = x0 + DELTA_TILE < D->width ? x0 + DELTA_TILE : D->width;
+    int y1 = y0 + DELTA_TILE < D->height ? y0 + DELTA_TILE : D->height;
+    int row, x, i;
+
+    for (row = y0; row < y1; row++) {
+        for (x = x0; x < x1; x++) {
+            i = row * D->width + x;
+            if (abs(pixels[(size_t) i * stride] - D->reference[i]) > D->threshold) {
+                return (long) (x1 - x0) * (y1 - y0);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Applies the changes of one tile to y; it becomes the reference
+ */
+static void delta_apply(delta_t *D, const unsigned char *pixels, int stride, int x0, int y0)
+{
+    const MATRIX *Projection = D->R->v_fisherT_x_v_pcaT;
+    int x1 = x0 + DELTA_TILE < D->width ? x0 + DELTA_TILE : D->width;
+    int y1 = y0 + DELTA_TILE < D->height ? y0 + DELTA_TILE : D->height;
+    int row, x, i;
+
+    // y += Projection(:, i .. i+x1-x0-1) * (new - reference), row by row
+    for (row = y0; row < y1; row++) {
+        i = row * D->width + x0;
+        for (x = 0; x < x1 - x0; x++) {
+            D->difference[x] = (double) pixels[(size_t) (i + x) * stride] - D->reference[i + x];
+            D->reference[i + x] = pixels[(size_t) (i + x) * stride];
+        }
+        cblas_dgemv(CblasRowMajor, CblasNoTrans, Projection->rows, x1 - x0,
+                    1, *Projection->data + i, Projection->cols, D->difference, 1, 1, D->y, 1);
+    }
+}
+
+/*
+ * Projects the next frame of the video
+ * pixels, stride: the frame (see RecognizeProbe)
+ * projected: receives (C-1) values in Fisher space
+ * returns: projection columns read (width*height for a full recompute)
+ */
+long delta_project(delta_t *D, const unsigned char *pixels, int stride, double *projected)
+{
+    const recognizer_t *R = D->R;
+    int dims = R->v_fisherT_x_v_pcaT->rows;
+    int across = (D->width + DELTA_TILE - 1) / DELTA_TILE;
+    int tiles = across * ((D->height + DELTA_TILE - 1) / DELTA_TILE);
+    long columns = 0, work;
+    int changed = 0, t;
+    int d;
+
+    if (D->frames % D->refresh != 0) {
+        for (t = 0; t < tiles; t++) {
+            work = delta_changed(D, pixels, stride, t % across * DELTA_TILE, t / across * DELTA_TILE);
+            if (work > 0) {
+                D->pending[changed++] = t;
+                columns += work;
+            }
+        }
+        D->changed += changed;
+        D->tiles += tiles;
+    }
+
+    // the tile updates are narrow GEMVs; past half the frame one full
+    // GEMV reads less
+    if (D->frames % D->refresh == 0 || columns > (long) D->width * D->height / 2) {
+        columns = delta_full(D, pixels, stride);
+    } else {
+        for (t = 0; t < changed; t++) {
+            delta_apply(D, pixels, stride, D->pending[t] % across * DELTA_TILE,
+                    D->pending[t] / across * DELTA_TILE);
+        }
+    }
+    D->frames++;
+    D->columns += columns;
+
+    for (d = 0; d < dims; d++) {
+        projected[d] = D->y[d] - R->projected_mean[d];
+    }
+    return columns;
+}
+
+void delta_destroy(delta_t *D)
+{
+    free(D->reference);
+    free(D->pending);
+    free(D->y);
+    free(D->difference);
+    free(D);
+}
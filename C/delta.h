@@ -0,0 +1,60 @@
+/*
+ * Delta projection for video
+ *
+ * The projection y = v_fisherT_x_v_pcaT * x is linear, so when a frame
+ * differs from the last one projected only in some pixels,
+ *
+ *     y' = y + v_fisherT_x_v_pcaT(:, changed) * (x'(changed) - x(changed))
+ *
+ * touches only the projection columns of the changed pixels. The frame is
+ * compared with the reference (the pixels behind y) in square tiles of
+ * DELTA_TILE pixels; a tile whose pixels all lie within threshold of the
+ * reference counts as unchanged and is skipped, otherwise its differences
+ * are applied and it becomes the new reference. For a static camera most
+ * tiles are skipped and the projection cost falls with the moving area;
+ * when more than half the frame changed, it is projected in full.
+ *
+ * Every refresh frames y is recomputed from scratch, which bounds the
+ * rounding error the updates accumulate. With threshold 0 the result is
+ * the exact projection up to that rounding; a threshold above the
+ * camera's noise trades a bounded per-pixel error for fewer updates.
+ */
+
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include "Recognition.h"
+
+// tile side in pixels
+#define DELTA_TILE 16
+
+// frames between full recomputations
+#define DELTA_REFRESH 64
+
+typedef struct {
+    const recognizer_t *R;
+    int width, height;              // frame size
+    int threshold;                  // intensity change a tile ignores
+    int refresh;
+    unsigned char *reference;       // width*height pixels behind y
+    double *y;                      // v_fisherT_x_v_pcaT * reference
+    double *difference;             // a frame, or one tile row of changes
+    int *pending;                   // changed tiles of the current frame
+    long frames;                    // projected so far
+
+    long tiles, changed;            // tiles compared / applied
+    long columns;                   // projection columns read
+} delta_t;
+
+// delta projector over R's projection for width x height frames; R must
+// outlive it and have no int8 sections attached
+delta_t *delta_create(const recognizer_t *R, int width, int height, int threshold, int refresh);
+
+// projects a frame (8-bit intensities stride bytes apart, as for
+// RecognizeProbe) into projected ((C-1) values, projected mean already
+// subtracted). Returns the number of projection columns read
+long delta_project(delta_t *D, const unsigned char *pixels, int stride, double *projected);
+
+void delta_destroy(delta_t *D);
+
+#endif
@@ -8,44 +8,179 @@
                      Email: aomidvar@ece.ut.ac.ir
  ******************************************************************************/
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "CreateDatabase.h"
 #include "FisherfaceCore.h"
+#include "Recognition.h"
+#include "grayscale.h"
+#include "hugepage.h"
+#include "ivf.h"
 #include "matrix.h"
 #include "ppm.h"
 
 //These pathnames only work if working in the LDA/C folder
-#define TrainDatabasePath "../LDAIMAGES/Change/ss_tiny_3w"
+#define TrainDatabasePath "../LDAIMAGES/Train3"
 #define TestDatabasePath "../LDAIMAGES/Test3"
+//Trained model written by FisherfaceCore and read back when load_stuff is set
+#define ModelPath "fisherface.model"
+//Test images are named 1.ppm ... TestCount.ppm; image i shows person i
+#define TestCount 30
+#define Class_population 4
 
 int main(int argc, char *argv[])
 {
-    int load_stuff = 0; //Set to 0 if training database needs to be created
-    //int pass = 0;
-    //int fail = 0;
+    int load_stuff = 0; //Set to 0 if training database needs to be created,
+                        //1 to load the model saved by the last training run
+    int batch_mode = 1; //Set to 1 to recognize all test images with one GEMM,
+                        //0 to recognize them one at a time
+    int use_ivf = 0;    //Set to 1 to search the IVF index instead of the whole
+                        //gallery (recognizes one at a time)
+    int use_int8 = 0;   //Set to 1 to project and search with the int8 model
+                        //sections (recognizes one at a time)
+    int use_centroids = 0; //Set to 1 to search only the templates of the
+                           //nearest classes (recognizes one at a time)
+    int use_srp = 0;    //Set to 1 to re-rank only the images whose 256-bit
+                        //codes are nearest (recognizes one at a time)
+    int pass = 0;
+    int fail = 0;
+    int i, Recognized_index;
+    int policy;
+    char filename[255];
 
     database_t *D;
 	MATRIX ** M;
+    recognizer_t *R;
+    PPMImage *TestImages[TestCount];
+    MATRIX *Probes;
+    ivf_t *ivf;
+    match_t matches[TestCount];
+
+    // "example -l" loads the saved model without editing load_stuff,
+    // "example -i" searches the IVF index, "example -q" uses the int8 model,
+    // "example -c" searches through the class centroids,
+    // "example -s" prefilters with the sign-random-projection codes,
+    // "example -t off|thp|hugetlb" picks how the big matrices are backed
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            load_stuff = 1;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            use_ivf = 1;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            use_int8 = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            use_centroids = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            use_srp = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            policy = hugepage_parse(argv[++i]);
+            if (policy < 0) {
+                fprintf(stderr, "unknown page policy %s (off, thp, hugetlb)\n", argv[i]);
+                return 1;
+            }
+            hugepage_policy(policy);
+        }
+    }
 
     if (load_stuff == 0) {
 		D = CreateDatabase(TrainDatabasePath);
-		M = FisherfaceCore(D);
-
-        // save to binary file
-        // save output_faces.mat T m V_PCA V_Fisher ProjectedImages_Fisher;
+		M = FisherfaceCore(D, ModelPath); // also saves the model
 
-        // Recognition?
+        // inverted-file index with about sqrt(P) lists, also next to the model
+        ivf = ivf_build(M[3], (int) sqrt(M[3]->cols), 1, 0);
+        if (ivf != NULL && ivf_save(ivf, ModelPath IVF_SUFFIX) == 0) {
+            printf("Index saved to %s\n", ModelPath IVF_SUFFIX);
+        }
+        if (ivf != NULL) {
+            ivf_destroy(ivf);
+        }
 
 		DestroyFisher(M);
 		DestroyDatabase(D);
+    }
 
-		return 0;
-    } else {
-    	fprintf(stderr, "Load the saved database");
-        // read binary file
-        // load output_faces.mat;
+    // map the saved model; when load_stuff is set this is all the startup
+    // there is
+    R = LoadRecognizer(ModelPath);
+    if (R == NULL) {
+        fprintf(stderr, "Unable to load %s; set load_stuff to 0 to train\n", ModelPath);
         return 1;
     }
+    printf("Model loaded from %s\n", ModelPath);
+
+    if (use_ivf) {
+        if (AttachIVF(R, ModelPath IVF_SUFFIX, IVF_NPROBE) != 0) {
+            fprintf(stderr, "Unable to load %s; set load_stuff to 0 to train\n",
+                    ModelPath IVF_SUFFIX);
+            return 1;
+        }
+        printf("Searching %s, %d lists per probe\n", ModelPath IVF_SUFFIX, IVF_NPROBE);
+        batch_mode = 0;
+    }
+
+    if (use_centroids) {
+        if (AttachCentroids(R, CENTROID_SHORTLIST) != 0) {
+            fprintf(stderr, "set load_stuff to 0 to train\n");
+            return 1;
+        }
+        printf("Searching the templates of the %d nearest classes\n", CENTROID_SHORTLIST);
+        batch_mode = 0;
+    }
+
+    if (use_srp) {
+        if (AttachSRP(R, SRP_CANDIDATES) != 0) {
+            fprintf(stderr, "set load_stuff to 0 to train\n");
+            return 1;
+        }
+        printf("Re-ranking the %d images with the nearest codes\n", SRP_CANDIDATES);
+        batch_mode = 0;
+    }
+
+    if (use_int8) {
+        if (AttachInt8(R) != 0) {
+            fprintf(stderr, "%s has no int8 sections; set load_stuff to 0 to train\n", ModelPath);
+            return 1;
+        }
+        printf("Using the int8 projection and gallery\n");
+        batch_mode = 0;
+    }
+
+    for (i = 0; i < TestCount; i++) {
+        sprintf(filename, "%s/%d.ppm", TestDatabasePath, i + 1);
+        TestImages[i] = ppm_image_constructor(filename);
+        grayscale(TestImages[i]);
+    }
+
+    if (batch_mode) {
+        Probes = ProbeMatrix(TestImages, TestCount);
+        if (Probes == NULL || RecognitionBatch(R, Probes, 1, matches) != 0) {
+            fprintf(stderr, "batch recognition failed\n");
+            return 1;
+        }
+        matrix_destructor(Probes);
+    } else {
+        for (i = 0; i < TestCount; i++) {
+            matches[i].index = Recognition(R, TestImages[i], &matches[i].distance);
+        }
+    }
+
+    for (i = 1; i <= TestCount; i++) {
+        Recognized_index = matches[i - 1].index;
+        printf("Test %d : %d.ppm == %d.ppm\n", i, i, Recognized_index + 1);
+
+        if (i == Recognized_index / Class_population + 1) {
+            pass++;
+        } else {
+            fail++;
+        }
+        ppm_image_destructor(TestImages[i - 1], 1);
+    }
+    printf("%d Correct %d Wrong\n", pass, fail);
+
+    DestroyRecognizer(R);
+
+    return 0;
 }
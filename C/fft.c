@@ -0,0 +1,132 @@
+/*******************************************************************************
+ Mixed-radix complex FFT
+
+ fft_pass computes the transform of n values read stride apart into n
+ contiguous outputs: first the r sub-transforms of length m = n/r, written
+ one after the other, then for every k < m the radix-r butterfly over
+ out[k], out[m+k], ... out[(r-1)m+k], whose inputs are scaled by the
+ twiddles w^(jk) of length n (index j*k*(N/n) into the full-length table).
+ Radix 2 has its own butterfly; 3 and 5 use the direct r-point DFT.
+*******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+/*
+ * Smallest length >= n without prime factors above 5
+ */
+int fft_size(int n)
+{
+    int m;
+
+    for (;; n++) {
+        m = n;
+        while (m % 2 == 0) {
+            m /= 2;
+        }
+        while (m % 3 == 0) {
+            m /= 3;
+        }
+        while (m % 5 == 0) {
+            m /= 5;
+        }
+        if (m == 1) {
+            return n;
+        }
+    }
+}
+
+fft_t *fft_create(int n)
+{
+    const int radices[] = FFT_RADICES;
+    fft_t *F;
+    int m = n, r, t;
+
+    if (n < 1) {
+        return NULL;
+    }
+    F = (fft_t *) calloc(1, sizeof(fft_t));
+    F->n = n;
+    for (r = 0; r < (int) (sizeof(radices) / sizeof(radices[0])); r++) {
+        while (m % radices[r] == 0) {
+            F->factor[F->factors++] = radices[r];
+            m /= radices[r];
+        }
+    }
+    if (m != 1) {
+        fprintf(stderr, "fft_create: %d has a prime factor above 5\n", n);
+        free(F);
+        return NULL;
+    }
+
+    F->twiddle = (double complex *) malloc(n * sizeof(double complex));
+    F->work = (double complex *) malloc(n * sizeof(double complex));
+    for (t = 0; t < n; t++) {
+        F->twiddle[t] = cexp(-2 * M_PI * I * t / n);
+    }
+    return F;
+}
+
+/*
+ * One level: the transform of n inputs stride apart into out[0 .. n-1]
+ * level: index into F->factor of this level's radix
+ * sign: FFT_FORWARD or FFT_INVERSE (conjugated twiddles)
+ */
+static void fft_pass(const fft_t *F, const double complex *in, long stride, double complex *out,
+        int n, int level, int sign)
+{
+    int r, m, j, k, q;
+    long step = F->n / n;
+    double complex t[8], w, sum;
+
+    if (n == 1) {
+        out[0] = in[0];
+        return;
+    }
+    r = F->factor[level];
+    m = n / r;
+    for (j = 0; j < r; j++) {
+        fft_pass(F, in + j * stride, stride * r, out + j * m, m, level + 1, sign);
+    }
+
+    for (k = 0; k < m; k++) {
+        for (j = 0; j < r; j++) {
+            w = F->twiddle[j * k * step];
+            t[j] = out[j * m + k] * (sign == FFT_FORWARD ? w : conj(w));
+        }
+        if (r == 2) {
+            out[k] = t[0] + t[1];
+            out[m + k] = t[0] - t[1];
+            continue;
+        }
+        // exp(-2 pi i jq/r) is twiddle (jq mod r) * (N/r)
+        for (q = 0; q < r; q++) {
+            sum = t[0];
+            for (j = 1; j < r; j++) {
+                w = F->twiddle[(j * q % r) * (F->n / r)];
+                sum += t[j] * (sign == FFT_FORWARD ? w : conj(w));
+            }
+            out[q * m + k] = sum;
+        }
+    }
+}
+
+void fft_run(fft_t *F, double complex *data, long stride, int sign)
+{
+    int i;
+
+    fft_pass(F, data, stride, F->work, F->n, 0, sign);
+    for (i = 0; i < F->n; i++) {
+        data[i * stride] = F->work[i];
+    }
+}
+
+void fft_destroy(fft_t *F)
+{
+    free(F->twiddle);
+    free(F->work);
+    free(F);
+}
@@ -0,0 +1,49 @@
+/*
+ * Complex FFT of lengths 2^a 3^b 5^c
+ *
+ * Recursive mixed-radix decimation in time: a transform of length n = r*m
+ * is r transforms of length m over the inputs r apart, combined by radix-r
+ * butterflies. Twiddle factors for the full length are computed once per
+ * plan and shared by every level. The forward transform uses exp(-2 pi i
+ * jk/n), the inverse exp(+2 pi i jk/n) without the 1/n scaling.
+ *
+ * fft_size rounds a length up to the next one a plan accepts, at most 25%
+ * longer (usually within a few percent).
+ */
+
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <complex.h>
+
+// prime factors a plan accepts
+#define FFT_RADICES { 5, 3, 2 }
+
+// most factors of a length
+#define FFT_MAX_FACTORS 64
+
+#define FFT_FORWARD -1
+#define FFT_INVERSE 1
+
+typedef struct {
+    int n;
+    int factors;
+    int factor[FFT_MAX_FACTORS];    // radix of each level, largest first
+    double complex *twiddle;        // exp(-2 pi i t/n), t < n
+    double complex *work;           // n values
+} fft_t;
+
+// smallest length >= n with no prime factor above 5
+int fft_size(int n);
+
+// plan for length n, NULL if n has another prime factor
+fft_t *fft_create(int n);
+
+// transforms the n values data[0], data[stride], ... in place; sign is
+// FFT_FORWARD or FFT_INVERSE. Uses the plan's work buffer, so a plan is
+// for one thread at a time
+void fft_run(fft_t *F, double complex *data, long stride, int sign);
+
+void fft_destroy(fft_t *F);
+
+#endif
@@ -0,0 +1,100 @@
+/******************************************************************************
+ Recognition client
+
+ Usage: fisherc [-s socket] [-k k] [-p] image.ppm ...
+
+ Asks a running fisherd for the k closest training images of each image.
+ By default the daemon is sent the absolute path and reads the file
+ itself; -p decodes the image here and sends its grayscale pixels instead,
+ for images the daemon cannot see.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grayscale.h"
+#include "ppm.h"
+#include "protocol.h"
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = PROTO_SOCKET;
+    const char * const errors[] = { "ok", "bad request", "unreadable image", "wrong image size" };
+    int k = 1, send_pixels = 0, failed = 0;
+    proto_match_t matches[PROTO_MAX_K];
+    proto_request_t req;
+    char path[PATH_MAX];
+    unsigned char *pixels = NULL;
+    PPMImage *img;
+    int fd, opt, i, n;
+
+    while ((opt = getopt(argc, argv, "s:k:p")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'k': k = atoi(optarg); break;
+        case 'p': send_pixels = 1; break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (optind >= argc || k < 1 || k > PROTO_MAX_K) {
+        fprintf(stderr, "usage: %s [-s socket] [-k 1..%d] [-p] image.ppm ...\n", argv[0], PROTO_MAX_K);
+        return 1;
+    }
+
+    fd = proto_connect(socket_path);
+    if (fd < 0) {
+        return 1;
+    }
+
+    for (; optind < argc; optind++) {
+        memset(&req, 0, sizeof(req));
+        req.k = k;
+        if (send_pixels) {
+            img = ppm_image_constructor(argv[optind]);
+            grayscale(img);
+            req.type = PROTO_PIXELS;
+            req.width = img->width;
+            req.height = img->height;
+            req.length = img->width * img->height;
+            pixels = (unsigned char *) realloc(pixels, req.length);
+            for (i = 0; i < (int) req.length; i++) {
+                pixels[i] = img->pixels[i].intensity;
+            }
+            ppm_image_destructor(img, 1);
+            n = proto_call(fd, &req, pixels, matches);
+        } else {
+            if (realpath(argv[optind], path) == NULL) {
+                perror(argv[optind]);
+                failed++;
+                continue;
+            }
+            req.type = PROTO_PATH;
+            req.length = strlen(path) + 1;
+            n = proto_call(fd, &req, path, matches);
+        }
+
+        if (n == -1) {
+            fprintf(stderr, "%s: connection to %s lost\n", argv[optind], socket_path);
+            return 1;
+        }
+        if (n < 0) {
+            fprintf(stderr, "%s: %s\n", argv[optind], -n < 4 ? errors[-n] : "error");
+            failed++;
+            continue;
+        }
+        printf("%s:", argv[optind]);
+        for (i = 0; i < n; i++) {
+            printf(" %d.ppm (%.4g)", matches[i].index + 1, matches[i].distance);
+        }
+        printf("\n");
+    }
+
+    free(pixels);
+    close(fd);
+    return failed != 0;
+}
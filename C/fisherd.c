@@ -0,0 +1,456 @@
+/******************************************************************************
+ Recognition daemon
+
+ Usage: fisherd [-s socket] [-m model] [-q] [-i] [-B batch] [-w window_us]
+                [-P procs] [-H]
+
+ Maps the model once and serves recognition requests (see protocol.h) on a
+ Unix socket until SIGINT or SIGTERM, so a probe costs one projection and
+ one gallery search instead of a process start and a model load. Every
+ connection gets a thread with its own reader slot and scratch_t; the
+ recognizer is shared read-only between them. -q serves the int8 model
+ sections, -i searches the IVF index saved next to the model.
+
+ SIGHUP reloads the model file in the background (registry.h): requests
+ keep being answered by the old model until the new one is mapped and
+ checked, and the old one is freed once its last request has finished.
+ Write the new model with model_write (or rename it into place) so the
+ file being served is never modified in place.
+
+ With -P procs > 1 the requests are answered by procs worker processes
+ accepting on the same socket, for isolation between cores. The model is
+ mapped MAP_SHARED before they are forked, derived data included, so all
+ of them read the same physical pages: memory stays flat as workers are
+ added and a restarted worker starts warm. -H asks for the mapping to be
+ backed by huge pages (see model_use_hugepages).
+
+ With -B batch > 1 the connection threads hand their probes to a
+ micro-batching scheduler (batcher.h) instead, which recognizes up to batch
+ probes arriving within window_us (default BATCHER_WINDOW_US) of each other
+ with one GEMM. Batches are scored exactly in double, so -B overrides -q
+ and -i.
+
+ Paths only work if working in the LDA/C folder.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "Recognition.h"
+#include "batcher.h"
+#include "model.h"
+#include "protocol.h"
+#include "registry.h"
+
+#define ModelPath "fisherface.model"
+
+typedef struct {
+    registry_t *models;
+    batcher_t *batcher;               // NULL to recognize on this thread
+    int fd;
+} connection_t;
+
+static volatile sig_atomic_t stopping = 0;
+static volatile sig_atomic_t reloading = 0;
+
+static void on_signal(int sig)
+{
+    if (sig == SIGHUP) {
+        reloading = 1;
+    } else {
+        stopping = 1;
+    }
+}
+
+/*
+ * Next number of a PPM header, skipping blanks and comments; -1 at the end
+ * of the file or on anything else
+ */
+static long header_value(FILE *in)
+{
+    long value = 0;
+    int ch = fgetc(in);
+
+    while (ch == '#' || isspace(ch)) {
+        if (ch == '#') {
+            while (ch != '\n' && ch != EOF) {
+                ch = fgetc(in);
+            }
+        }
+        ch = fgetc(in);
+    }
+    if (!isdigit(ch)) {
+        return -1;
+    }
+    while (isdigit(ch) && value < INT_MAX) {
+        value = value * 10 + ch - '0';
+        ch = fgetc(in);
+    }
+    return value;
+}
+
+/*
+ * Loads a probe named by a client in one pass over the file, never
+ * exiting: a bad header, a sample above maxval or a payload shorter than
+ * width*height pixels is an unreadable image. Colour pixels are converted
+ * with the weights of grayscale.c
+ * path: PPM image (P3 or P6) or binary PGM (P5), 8-bit samples
+ * pixels: number of pixels the model expects
+ * image: receives the grayscale intensities
+ * returns: PROTO_OK, PROTO_EIMAGE or PROTO_ESIZE
+ */
+static int read_probe(const char *path, int pixels, unsigned char *image)
+{
+    unsigned char rgb[3];
+    long width, height, maxval, sample[3];
+    int status = PROTO_OK;
+    int i, j, p;
+    FILE *in;
+
+    if ((in = fopen(path, "rb")) == NULL) {
+        return PROTO_EIMAGE;
+    }
+    p = fgetc(in) == 'P' ? fgetc(in) : EOF;
+    width = header_value(in);
+    height = header_value(in);
+    maxval = header_value(in);
+
+    if ((p != '3' && p != '5' && p != '6') || width < 1 || height < 1
+            || maxval < 1 || maxval > 255) {
+        status = PROTO_EIMAGE;
+    } else if (width * height != pixels) {
+        status = PROTO_ESIZE;
+    }
+    for (i = 0; status == PROTO_OK && i < pixels; i++) {
+        if (p == '5') {
+            if ((j = fgetc(in)) == EOF) {
+                status = PROTO_EIMAGE;
+            }
+            image[i] = j;
+            continue;
+        }
+        if (p == '6') {
+            if (fread(rgb, 1, 3, in) != 3) {
+                status = PROTO_EIMAGE;
+            }
+            for (j = 0; j < 3; j++) {
+                sample[j] = rgb[j];
+            }
+        } else {
+            for (j = 0; j < 3; j++) {
+                sample[j] = header_value(in);
+                if (sample[j] < 0 || sample[j] > maxval) {
+                    status = PROTO_EIMAGE;
+                }
+            }
+        }
+        image[i] = (int) round(.2989 * sample[0] + .5870 * sample[1] + .1140 * sample[2]);
+    }
+    fclose(in);
+    return status;
+}
+
+/*
+ * Answers the requests of one connection until the client hangs up or
+ * sends something malformed
+ */
+static void *serve(void *arg)
+{
+    connection_t *C = (connection_t *) arg;
+    registry_reader_t *reader = registry_reader(C->models);
+    // reloads keep the image size, so this holds for every model served
+    int pixels = atomic_load(&C->models->current)->m_database->rows;
+    size_t capacity = pixels > PATH_MAX ? pixels : PATH_MAX;
+    unsigned char *payload = (unsigned char *) malloc(capacity);
+    unsigned char *image = (unsigned char *) malloc(pixels);
+    const recognizer_t *R;
+    scratch_t *S;
+    match_t matches[PROTO_MAX_K];
+    proto_match_t out[PROTO_MAX_K];
+    proto_request_t req;
+    proto_reply_t reply;
+    const unsigned char *probe;
+    int i;
+
+    if (reader == NULL) {
+        close(C->fd);
+        free(payload);
+        free(image);
+        free(C);
+        return NULL;
+    }
+
+    while (proto_read(C->fd, &req, sizeof(req)) == 0) {
+        reply.magic = PROTO_MAGIC;
+        reply.status = PROTO_OK;
+        reply.count = 0;
+        probe = image;
+
+        if (req.magic != PROTO_MAGIC || req.k < 1 || req.k > PROTO_MAX_K
+                || req.length > capacity) {
+            reply.status = PROTO_EREQUEST;
+            proto_write(C->fd, &reply, sizeof(reply));
+            break;
+        }
+        if (proto_read(C->fd, payload, req.length) != 0) {
+            break;
+        }
+
+        if (req.type == PROTO_PATH && req.length > 0 && payload[req.length - 1] == '\0') {
+            reply.status = read_probe((const char *) payload, pixels, image);
+        } else if (req.type == PROTO_PIXELS && (long) req.width * req.height != pixels) {
+            reply.status = PROTO_ESIZE;
+        } else if (req.type == PROTO_PIXELS && req.length == (uint32_t) pixels) {
+            probe = payload;
+        } else {
+            reply.status = PROTO_EREQUEST;
+        }
+
+        if (reply.status == PROTO_OK) {
+            if (C->batcher != NULL) {
+                batcher_recognize(C->batcher, probe, 1, req.k, matches);
+            } else {
+                R = registry_enter(reader, &S);
+                RecognizeProbe(R, probe, 1, S, req.k, matches);
+                registry_exit(reader);
+            }
+            while (reply.count < req.k && matches[reply.count].index >= 0) {
+                reply.count++;
+            }
+            for (i = 0; i < (int) reply.count; i++) {
+                out[i].index = matches[i].index;
+                out[i].distance = matches[i].distance;
+            }
+        }
+        if (proto_write(C->fd, &reply, sizeof(reply)) != 0
+                || proto_write(C->fd, out, reply.count * sizeof(proto_match_t)) != 0) {
+            break;
+        }
+    }
+
+    close(C->fd);
+    registry_reader_release(reader);
+    free(payload);
+    free(image);
+    free(C);
+    return NULL;
+}
+
+/*
+ * Accepts connections until SIGINT or SIGTERM, one thread each
+ * signals: blocked on entry; unblocked only while this thread waits
+ */
+static void accept_loop(registry_t *models, int batch, long window_us, int listener,
+        const sigset_t *signals)
+{
+    batcher_t *batcher = batch > 1 ? batcher_create(models, batch, window_us) : NULL;
+    pthread_attr_t attr;
+    pthread_t thread;
+    connection_t *C;
+    int fd;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_sigmask(SIG_UNBLOCK, signals, NULL);
+
+    while (!stopping) {
+        if (reloading) {
+            reloading = 0;
+            pthread_sigmask(SIG_BLOCK, signals, NULL);
+            registry_reload_async(models);
+            pthread_sigmask(SIG_UNBLOCK, signals, NULL);
+        }
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        C = (connection_t *) malloc(sizeof(connection_t));
+        C->models = models;
+        C->batcher = batcher;
+        C->fd = fd;
+        pthread_sigmask(SIG_BLOCK, signals, NULL);
+        if (pthread_create(&thread, &attr, serve, C) != 0) {
+            close(fd);
+            free(C);
+        }
+        pthread_sigmask(SIG_UNBLOCK, signals, NULL);
+    }
+
+    // connections still open keep using the registry, so the model stays
+    // mapped until the process exits
+    if (batcher != NULL) {
+        printf("fisherd[%d]: %ld probes in %ld batches\n", (int) getpid(),
+                batcher->probes, batcher->batches);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Starts a worker process sharing the listener; it inherits the mapped
+ * model, so it starts with the pages resident and the checksums verified
+ * returns: its pid, -1 if fork failed
+ */
+static pid_t spawn_worker(registry_t *models, int batch, long window_us, int listener,
+        const sigset_t *signals)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        // a worker must not outlive the supervisor
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        stopping = reloading = 0;
+        accept_loop(models, batch, window_us, listener, signals);
+        fflush(stdout);
+        _exit(0);
+    }
+    if (pid < 0) {
+        perror("fork");
+    }
+    return pid;
+}
+
+/*
+ * Keeps procs workers running until SIGINT or SIGTERM. SIGHUP reloads the
+ * model here first, so workers started later get the new one, and is then
+ * passed on to every worker
+ */
+static void supervise(registry_t *models, int procs, int batch, long window_us, int listener,
+        const sigset_t *signals)
+{
+    pid_t *workers = (pid_t *) malloc(procs * sizeof(pid_t));
+    int i, status;
+    pid_t pid;
+
+    for (i = 0; i < procs; i++) {
+        workers[i] = spawn_worker(models, batch, window_us, listener, signals);
+    }
+    pthread_sigmask(SIG_UNBLOCK, signals, NULL);
+
+    while (!stopping) {
+        if (reloading) {
+            reloading = 0;
+            if (registry_reload(models, NULL) == 0) {
+                for (i = 0; i < procs; i++) {
+                    if (workers[i] > 0) {
+                        kill(workers[i], SIGHUP);
+                    }
+                }
+            }
+        }
+        pid = waitpid(-1, &status, 0);
+        for (i = 0; pid > 0 && !stopping && i < procs; i++) {
+            if (workers[i] == pid) {
+                fprintf(stderr, "fisherd: worker %d exited, restarting it\n", (int) pid);
+                pthread_sigmask(SIG_BLOCK, signals, NULL);
+                workers[i] = spawn_worker(models, batch, window_us, listener, signals);
+                pthread_sigmask(SIG_UNBLOCK, signals, NULL);
+            }
+        }
+    }
+
+    for (i = 0; i < procs; i++) {
+        if (workers[i] > 0) {
+            kill(workers[i], SIGTERM);
+            waitpid(workers[i], &status, 0);
+        }
+    }
+    free(workers);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = PROTO_SOCKET;
+    const char *model_path = ModelPath;
+    int flags = 0;
+    int batch = 1, procs = 1, hugepages = 0;
+    long window_us = BATCHER_WINDOW_US;
+    struct sigaction sa;
+    sigset_t signals;
+    registry_t *models;
+    int listener, opt;
+
+    while ((opt = getopt(argc, argv, "s:m:qiB:w:P:H")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'm': model_path = optarg; break;
+        case 'q': flags |= REGISTRY_INT8; break;
+        case 'i': flags |= REGISTRY_IVF; break;
+        case 'B': batch = atoi(optarg); break;
+        case 'w': window_us = atol(optarg); break;
+        case 'P': procs = atoi(optarg); break;
+        case 'H': hugepages = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-s socket] [-m model] [-q] [-i] [-B batch] [-w window_us]"
+                    " [-P procs] [-H]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // only the accept loop (or the supervisor) takes the signals, so they
+    // always interrupt accept; every thread started from here on inherits
+    // them blocked
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if (batch > 1 && flags != 0) {
+        fprintf(stderr, "fisherd: batches are scored exactly; ignoring -q / -i\n");
+        flags = 0;
+    }
+    model_use_hugepages(hugepages);
+    models = registry_open(model_path, flags);
+    if (models == NULL) {
+        return 1;
+    }
+
+    listener = proto_listen(socket_path);
+    if (listener < 0) {
+        return 1;
+    }
+
+    // no SA_RESTART, so a signal interrupts accept and waitpid
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("fisherd: serving %s on %s", model_path, socket_path);
+    if (procs > 1) {
+        printf(" with %d processes", procs);
+    }
+    if (batch > 1) {
+        printf(", batches of up to %d within %ld us", batch, window_us);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    if (procs > 1) {
+        supervise(models, procs, batch, window_us, listener, &signals);
+    } else {
+        accept_loop(models, batch, window_us, listener, &signals);
+    }
+
+    printf("fisherd: stopping\n");
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/******************************************************************************
+ Face search in a larger image
+
+ Usage: fisherscan [-m model] [-w face_width] [-s step] [-c count] [-n]
+                   [-o map.pgm] [-f features] scene.ppm
+
+ Slides a window the size of the training images over the scene and
+ recognizes it at every position step pixels apart, using FFT correlation
+ for all projections at once (scan.h). Prints the count best positions
+ (default 3) that are at least half a face apart, with their matches.
+
+ -n corrects each window's brightness to that of the mean face. -o writes
+ the map of best distances as a PGM image, one pixel per position, white
+ where a window is closest to some training image. -f writes the feature
+ vectors, (C-1) doubles per position row by row, as raw native doubles.
+
+ Paths only work if working in the LDA/C folder.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Recognition.h"
+#include "grayscale.h"
+#include "ppm.h"
+#include "scan.h"
+
+#define ModelPath "fisherface.model"
+#define FaceWidth 128
+
+/*
+ * Writes the best distance of each position as a PGM, scaled so the
+ * smallest is white and the largest black
+ */
+static int write_map(const scan_t *S, const char *path)
+{
+    long positions = (long) S->rows * S->columns, p;
+    double low = S->distance[0], high = S->distance[0];
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL) {
+        perror(path);
+        return 1;
+    }
+    for (p = 1; p < positions; p++) {
+        low = S->distance[p] < low ? S->distance[p] : low;
+        high = S->distance[p] > high ? S->distance[p] : high;
+    }
+    fprintf(out, "P5\n%d %d\n255\n", S->columns, S->rows);
+    for (p = 0; p < positions; p++) {
+        fputc(high > low ? (int) (255 * (high - S->distance[p]) / (high - low)) : 255, out);
+    }
+    fclose(out);
+    return 0;
+}
+
+/*
+ * Prints the count best positions, skipping any within half a face of a
+ * better one already printed
+ */
+static void print_best(const scan_t *S, int count)
+{
+    long positions = (long) S->rows * S->columns, p, best;
+    int *taken = (int *) malloc(count * sizeof(int));
+    char *used = (char *) calloc(positions, 1);
+    int found = 0, i, near;
+
+    while (found < count) {
+        for (p = 0, best = -1; p < positions; p++) {
+            if (!used[p] && S->index[p] >= 0 && (best < 0 || S->distance[p] < S->distance[best])) {
+                best = p;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        used[best] = 1;
+        for (i = 0, near = 0; i < found; i++) {
+            near |= abs((int) (best % S->columns) - taken[i] % S->columns) * S->step
+                    < S->face_width / 2
+                    && abs((int) (best / S->columns) - taken[i] / S->columns) * S->step
+                    < S->face_height / 2;
+        }
+        if (!near) {
+            taken[found++] = best;
+            printf("(%ld, %ld): %d.ppm (%.4g)\n", best % S->columns * S->step,
+                    best / S->columns * S->step, S->index[best] + 1, S->distance[best]);
+        }
+    }
+    free(taken);
+    free(used);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *model_path = ModelPath, *map = NULL, *features = NULL;
+    int face_width = FaceWidth, step = 1, count = 3, flags = 0;
+    PPMImage *scene;
+    recognizer_t *R;
+    scan_t *S;
+    FILE *out;
+    int opt, status = 0;
+    long p;
+
+    while ((opt = getopt(argc, argv, "m:w:s:c:no:f:")) != -1) {
+        switch (opt) {
+        case 'm': model_path = optarg; break;
+        case 'w': face_width = atoi(optarg); break;
+        case 's': step = atoi(optarg); break;
+        case 'c': count = atoi(optarg); break;
+        case 'n': flags |= SCAN_NORMALIZE; break;
+        case 'o': map = optarg; break;
+        case 'f': features = optarg; break;
+        default:
+            count = -1;
+        }
+    }
+    if (count < 0 || optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-m model] [-w face_width] [-s step] [-c count] [-n]"
+                " [-o map.pgm] [-f features] scene.ppm\n", argv[0]);
+        return 1;
+    }
+
+    R = LoadRecognizer(model_path);
+    if (R == NULL) {
+        return 1;
+    }
+    scene = ppm_image_constructor(argv[optind]);
+    grayscale(scene);
+    S = scan_create(R, face_width, scene->width, scene->height, step, flags);
+    if (S == NULL) {
+        ppm_image_destructor(scene, 1);
+        DestroyRecognizer(R);
+        return 1;
+    }
+
+    scan_image(S, &scene->pixels[0].intensity, sizeof(Pixel));
+    scan_match(S);
+    printf("%s: %dx%d, %d positions\n", argv[optind], scene->width, scene->height,
+            S->rows * S->columns);
+    print_best(S, count);
+
+    if (map != NULL) {
+        status |= write_map(S, map);
+    }
+    if (features != NULL) {
+        out = fopen(features, "wb");
+        p = (long) S->rows * S->columns * S->dims;
+        if (out == NULL || fwrite(S->features, sizeof(double), p, out) != (size_t) p) {
+            perror(features);
+            status = 1;
+        } else {
+            printf("%s: %d x %d positions x %d doubles\n", features, S->rows, S->columns, S->dims);
+        }
+        if (out != NULL) {
+            fclose(out);
+        }
+    }
+
+    scan_destroy(S);
+    ppm_image_destructor(scene, 1);
+    DestroyRecognizer(R);
+    return status;
+}
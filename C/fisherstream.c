@@ -0,0 +1,234 @@
+/******************************************************************************
+ Video-frame recognition
+
+ Usage: fisherstream [-m model] [-k k] [-t threads] [-d threshold] [-b] [-q] [input]
+        fisherstream [-m model] [-k k] [-t threads] [-d threshold] [-q] -S ring
+
+ Recognizes every frame of a stream of concatenated binary PPM (P6) or PGM
+ (P5) images read from input (a file or FIFO, default stdin), e.g.
+
+     ffmpeg -i camera -s 128x192 -f image2pipe -vcodec ppm - | fisherstream
+
+ Frames are decoded on their own thread into a ring of buffers (stream.h)
+ while the previous one is projected and searched, and are dropped when
+ recognition falls behind; -b waits instead, to replay files completely.
+ -t splits each frame over a pinned thread team (team.h) for lower
+ latency per frame. Prints one line per frame (none with -q) and a
+ summary on stderr.
+
+ -d projects each frame by updating the last projection with the tiles
+ that changed by more than threshold (delta.h), which for a static camera
+ reads a small part of the projection matrix per frame.
+
+ -S reads the frames from a shared-memory ring (shmring.h) that a capture
+ process such as shmplay writes to, and recognizes them in place; there
+ is no decoding and no copy. Dropping is then up to the producer.
+
+ Paths only work if working in the LDA/C folder.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Recognition.h"
+#include "delta.h"
+#include "shmring.h"
+#include "stream.h"
+#include "team.h"
+#include "topology.h"
+
+#define ModelPath "fisherface.model"
+
+// how each frame is recognized
+typedef struct {
+    const recognizer_t *R;
+    scratch_t *S;
+    team_t *team;                   // -t: each frame split over a team
+    delta_t *delta;                 // -d: created at the first frame
+    int threshold;                  // -d argument, -1 without -d
+    int k, quiet;
+    match_t *matches;
+} context_t;
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Recognizes one frame and prints its matches
+ */
+static void recognize_frame(context_t *c, const unsigned char *pixels, int width, int height,
+        long sequence)
+{
+    int i;
+
+    if (c->threshold >= 0 && (c->delta == NULL || c->delta->width != width)) {
+        if (c->delta != NULL) {
+            delta_destroy(c->delta);
+        }
+        c->delta = delta_create(c->R, width, height, c->threshold, DELTA_REFRESH);
+        if (c->delta == NULL) {
+            c->threshold = -1;
+        }
+    }
+
+    if (c->delta != NULL) {
+        delta_project(c->delta, pixels, 1, c->S->projected);
+        RecognizeProjected(c->R, c->S->projected, c->S, c->k, c->matches);
+    } else if (c->team != NULL) {
+        team_recognize(c->team, pixels, 1, c->matches);
+    } else {
+        RecognizeProbe(c->R, pixels, 1, c->S, c->k, c->matches);
+    }
+
+    if (!c->quiet) {
+        printf("frame %ld:", sequence);
+        for (i = 0; i < c->k && c->matches[i].index >= 0; i++) {
+            printf(" %d.ppm (%.4g)", c->matches[i].index + 1, c->matches[i].distance);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Recognizes the frames of a PPM / PGM stream as they are decoded
+ * returns: 0, or 1 if the input cannot be opened
+ */
+static int recognize_stream(context_t *c, const char *path, int flags)
+{
+    stream_t *s = stream_open(path, c->R->m_database->rows, flags);
+    stream_stats_t stats;
+    frame_t *frame;
+    double start;
+
+    if (s == NULL) {
+        return 1;
+    }
+
+    start = now();
+    while (stream_next(s, &frame) == 0) {
+        recognize_frame(c, frame->pixels, frame->width, frame->height, frame->sequence);
+        stream_release(s);
+    }
+    start = now() - start;
+
+    stream_stats(s, &stats);
+    fprintf(stderr, "%ld frames recognized in %.2f s (%.1f/s), %ld dropped, %ld rejected, %ld corrupt\n",
+            stats.decoded, start, stats.decoded / start, stats.dropped, stats.rejected, stats.corrupt);
+    stream_close(s);
+    return 0;
+}
+
+/*
+ * Recognizes the frames of a shared-memory ring where they lie
+ * returns: 0, or 1 if the ring cannot be used
+ */
+static int recognize_ring(context_t *c, const char *name)
+{
+    const recognizer_t *R = c->R;
+    shmring_t *ring = shmring_attach(name);
+    const unsigned char *pixels;
+    shmring_slot_t slot;
+    double start, age = 0;
+    long frames = 0;
+
+    if (ring == NULL) {
+        return 1;
+    }
+    if (ring->width * ring->height != R->m_database->rows) {
+        fprintf(stderr, "%s: frames of %dx%d, the model needs %d pixels\n", name,
+                ring->width, ring->height, R->m_database->rows);
+        shmring_close(ring);
+        return 1;
+    }
+
+    start = now();
+    while ((pixels = shmring_next(ring, &slot)) != NULL) {
+        recognize_frame(c, pixels, ring->width, ring->height, slot.sequence);
+        shmring_release(ring);
+        age += now() - slot.timestamp;
+        frames++;
+    }
+    start = now() - start;
+
+    fprintf(stderr, "%ld frames recognized in %.2f s (%.1f/s), %ld dropped by the producer,"
+            " %.0f us from capture to result\n", frames, start, frames / start,
+            atomic_load(&ring->header->dropped), frames > 0 ? age / frames * 1e6 : 0.0);
+    shmring_close(ring);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *model_path = ModelPath;
+    const char *ring = NULL;
+    int threads = 0, flags = 0;
+    topology_t *T = NULL;
+    recognizer_t *R;
+    context_t c;
+    int opt, status;
+
+    memset(&c, 0, sizeof(c));
+    c.k = 1;
+    c.threshold = -1;
+    while ((opt = getopt(argc, argv, "m:k:t:d:bqS:")) != -1) {
+        switch (opt) {
+        case 'm': model_path = optarg; break;
+        case 'k': c.k = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'd': c.threshold = atoi(optarg); break;
+        case 'b': flags |= STREAM_BLOCK; break;
+        case 'q': c.quiet = 1; break;
+        case 'S': ring = optarg; break;
+        default:
+            c.k = 0;
+        }
+    }
+    if (c.k < 1 || optind < argc - (ring == NULL)) {
+        fprintf(stderr, "usage: %s [-m model] [-k k] [-t threads] [-d threshold] [-b] [-q]"
+                " [input | -S ring]\n", argv[0]);
+        return 1;
+    }
+
+    R = LoadRecognizer(model_path);
+    if (R == NULL) {
+        return 1;
+    }
+    c.R = R;
+    c.S = CreateScratch(R);
+    c.matches = (match_t *) malloc(c.k * sizeof(match_t));
+    if (threads > 0) {
+        T = topology_detect();
+        topology_pin(topology_cpu(T, 0, 0));
+        c.team = team_create(R, T, threads, c.k);
+    }
+
+    if (ring != NULL) {
+        status = recognize_ring(&c, ring);
+    } else {
+        status = recognize_stream(&c, optind < argc ? argv[optind] : NULL, flags);
+    }
+
+    if (c.delta != NULL) {
+        fprintf(stderr, "delta: %.1f%% of tiles changed, %.1f%% of the projection read per frame\n",
+                c.delta->tiles > 0 ? 100.0 * c.delta->changed / c.delta->tiles : 0.0,
+                100.0 * c.delta->columns / c.delta->frames / R->m_database->rows);
+        delta_destroy(c.delta);
+    }
+    if (c.team != NULL) {
+        team_destroy(c.team);
+        topology_destroy(T);
+    }
+    free(c.matches);
+    DestroyScratch(c.S);
+    DestroyRecognizer(R);
+    return status;
+}
@@ -0,0 +1,547 @@
+/*******************************************************************************
+ Gallery layout for the distance scan
+
+ The blocked layout lets one pass over a block score GALLERY_LANES gallery
+ images: for each dimension the probe value is broadcast and subtracted from
+ GALLERY_LANES contiguous gallery values. The kernel is picked once at run
+ time from what the CPU supports (AVX-512, AVX2 + FMA, or plain C), so the
+ Makefile does not need -march flags.
+
+ gallery_search is the top-k form of the scan: every GALLERY_CHECK
+ dimensions it compares the block's partial distances with the k-th best
+ distance found so far and drops the block when none of its images can
+ still get in. Partial sums only grow, so the result is exact.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "gallery.h"
+#include "hugepage.h"
+#include "matrix.h"
+
+static void scan_c(const gallery_t *G, const double *probe, double *distances);
+static void scan_avx2(const gallery_t *G, const double *probe, double *distances);
+static void scan_avx512(const gallery_t *G, const double *probe, double *distances);
+static long search_c(const gallery_t *G, const double *probe, topk_t *T);
+static long search_avx2(const gallery_t *G, const double *probe, topk_t *T);
+static long search_avx512(const gallery_t *G, const double *probe, topk_t *T);
+
+static void gallery_pick(gallery_t *G);
+
+static const char * const GalleryNames[GALLERY_SECTIONS] = {
+    "ProjectedImages_Fisher_blocks", "ProjectedImages_Fisher_order"
+};
+
+/*
+ * Rearranges a gallery into blocks of GALLERY_LANES images
+ * ProjectedImages_Fisher: (C-1)xP, one gallery image per column
+ * weights: one value per dimension, stored largest first; NULL keeps the
+ *          original order
+ */
+gallery_t *gallery_create(const MATRIX *ProjectedImages_Fisher, const double *weights)
+{
+    gallery_t *G = (gallery_t *) malloc(sizeof(gallery_t));
+    double *data;
+    int *order;
+    size_t bytes;
+    int b, d, lane, i, j;
+
+    G->dims = ProjectedImages_Fisher->rows;
+    G->count = ProjectedImages_Fisher->cols;
+    G->blocks = (G->count + GALLERY_LANES - 1) / GALLERY_LANES;
+    G->owned = 1;
+
+    bytes = (size_t) G->blocks * G->dims * GALLERY_LANES * sizeof(double);
+    data = (double *) hugepage_alloc(bytes);
+    memset(data, 0, bytes);
+    gallery_pick(G);
+
+    // insertion sort of the dimensions by descending weight
+    order = (int *) malloc(G->dims * sizeof(int));
+    for (d = 0; d < G->dims; d++) {
+        order[d] = d;
+    }
+    for (d = 1; weights != NULL && d < G->dims; d++) {
+        j = order[d];
+        for (i = d; i > 0 && weights[order[i - 1]] < weights[j]; i--) {
+            order[i] = order[i - 1];
+        }
+        order[i] = j;
+    }
+
+    // row by row, so the source is read sequentially
+    for (d = 0; d < G->dims; d++) {
+        for (i = 0; i < G->count; i++) {
+            b = i / GALLERY_LANES;
+            lane = i % GALLERY_LANES;
+            data[((size_t) b * G->dims + d) * GALLERY_LANES + lane] =
+                    ProjectedImages_Fisher->data[order[d]][i];
+        }
+    }
+
+    G->data = data;
+    G->order = order;
+    return G;
+}
+
+/*
+ * Model sections of the blocked layout, in GalleryNames order
+ */
+void gallery_entries(const gallery_t *G, model_entry_t *entries)
+{
+    entries[0].name = GalleryNames[0];
+    entries[0].dtype = MODEL_F64;
+    entries[0].rows = G->blocks * G->dims;
+    entries[0].cols = GALLERY_LANES;
+    entries[0].data = G->data;
+    entries[1].name = GalleryNames[1];
+    entries[1].dtype = MODEL_I32;
+    entries[1].rows = G->dims;
+    entries[1].cols = 1;
+    entries[1].data = G->order;
+}
+
+/*
+ * Zero-copy view of the blocked layout saved with a model
+ * dims, count: shape of the model's ProjectedImages_Fisher
+ * returns: NULL if the model was saved without it or for another shape
+ */
+gallery_t *gallery_map(model_t *model, int dims, int count)
+{
+    gallery_t *G = (gallery_t *) calloc(1, sizeof(gallery_t));
+    int rows[GALLERY_SECTIONS], cols[GALLERY_SECTIONS];
+    int d;
+
+    G->dims = dims;
+    G->count = count;
+    G->blocks = (count + GALLERY_LANES - 1) / GALLERY_LANES;
+    G->data = (const double *) model_data(model, GalleryNames[0], MODEL_F64, &rows[0], &cols[0]);
+    G->order = (const int *) model_data(model, GalleryNames[1], MODEL_I32, &rows[1], &cols[1]);
+
+    if (G->data == NULL || G->order == NULL || rows[0] != G->blocks * dims
+            || cols[0] != GALLERY_LANES || rows[1] * cols[1] != dims) {
+        free(G);
+        return NULL;
+    }
+    for (d = 0; d < dims; d++) {
+        if (G->order[d] < 0 || G->order[d] >= dims) {
+            free(G);
+            return NULL;
+        }
+    }
+    gallery_pick(G);
+    return G;
+}
+
+size_t gallery_bytes(const gallery_t *G)
+{
+    return (size_t) G->blocks * G->dims * GALLERY_LANES * sizeof(double) + G->dims * sizeof(int);
+}
+
+/*
+ * Copies the layout into caller-provided memory; the blocks go first so
+ * they keep its alignment
+ */
+gallery_t *gallery_place(const gallery_t *G, void *memory)
+{
+    gallery_t *copy = (gallery_t *) malloc(sizeof(gallery_t));
+    size_t bytes = (size_t) G->blocks * G->dims * GALLERY_LANES * sizeof(double);
+
+    *copy = *G;
+    copy->owned = 0;
+    memcpy(memory, G->data, bytes);
+    memcpy((char *) memory + bytes, G->order, G->dims * sizeof(int));
+    copy->data = (const double *) memory;
+    copy->order = (const int *) ((char *) memory + bytes);
+    return copy;
+}
+
+/*
+ * Restricts a gallery to a range of blocks, so several threads can search
+ * disjoint parts of it
+ */
+gallery_t *gallery_shard(const gallery_t *G, int first, int blocks)
+{
+    gallery_t *shard = (gallery_t *) malloc(sizeof(gallery_t));
+
+    *shard = *G;
+    shard->owned = 0;
+    shard->data = G->data + (size_t) first * G->dims * GALLERY_LANES;
+    shard->blocks = blocks;
+    shard->count = G->count - first * GALLERY_LANES;
+    if (shard->count > blocks * GALLERY_LANES) {
+        shard->count = blocks * GALLERY_LANES;
+    }
+    if (shard->count < 0) {
+        shard->count = 0;
+    }
+    return shard;
+}
+
+/*
+ * Squared norm of every gallery image
+ * norms: P values
+ */
+void gallery_norms(const MATRIX *ProjectedImages_Fisher, double *norms)
+{
+    int i, j;
+
+    memset(norms, 0, ProjectedImages_Fisher->cols * sizeof(double));
+    for (i = 0; i < ProjectedImages_Fisher->rows; i++) {
+        for (j = 0; j < ProjectedImages_Fisher->cols; j++) {
+            norms[j] += ProjectedImages_Fisher->data[i][j] * ProjectedImages_Fisher->data[i][j];
+        }
+    }
+}
+
+/*
+ * Variance of the gallery along every dimension, the order gallery_create
+ * is given: large spread means large distance terms, so a block can be
+ * abandoned after fewer dimensions
+ * variances: (C-1) values
+ */
+void gallery_variances(const MATRIX *ProjectedImages_Fisher, double *variances)
+{
+    const MATRIX *Y = ProjectedImages_Fisher;
+    double mean, diff;
+    int i, j;
+
+    for (i = 0; i < Y->rows; i++) {
+        mean = 0;
+        for (j = 0; j < Y->cols; j++) {
+            mean += Y->data[i][j];
+        }
+        mean /= Y->cols;
+        variances[i] = 0;
+        for (j = 0; j < Y->cols; j++) {
+            diff = Y->data[i][j] - mean;
+            variances[i] += diff * diff;
+        }
+        variances[i] /= Y->cols;
+    }
+}
+
+int gallery_padded(const gallery_t *G)
+{
+    return G->blocks * GALLERY_LANES;
+}
+
+/*
+ * Squared distance from a probe to every gallery image
+ * probe: dims values in Fisher space
+ * distances: gallery_padded(G) values; entries past G->count are padding
+ */
+void gallery_distances(const gallery_t *G, const double *probe, double *distances)
+{
+    double ordered[G->dims];
+    int d;
+
+    for (d = 0; d < G->dims; d++) {
+        ordered[d] = probe[G->order[d]];
+    }
+    G->scan(G, ordered, distances);
+}
+
+/*
+ * Top-k search with early abandoning
+ * probe: dims values in Fisher space
+ * T: selection to offer the gallery images to; may already hold candidates
+ * returns: block dimensions scored, a measure of the work done
+ */
+long gallery_search(const gallery_t *G, const double *probe, topk_t *T)
+{
+    double ordered[G->dims];
+    int d;
+
+    for (d = 0; d < G->dims; d++) {
+        ordered[d] = probe[G->order[d]];
+    }
+    return G->search(G, ordered, T);
+}
+
+/*
+ * Exact distances to selected gallery images, for re-ranking the
+ * candidates of a prefilter. Image i is lane i % GALLERY_LANES of block
+ * i / GALLERY_LANES; an image is abandoned once its partial distance
+ * exceeds the k-th best in T
+ * probe: dims values in Fisher space
+ * ids, n: the images to score
+ * returns: dimensions scored
+ */
+long gallery_rerank(const gallery_t *G, const double *probe, const int *ids, int n, topk_t *T)
+{
+    double ordered[G->dims];
+    const double *image;
+    double distance, delta;
+    long work = 0;
+    int d, j;
+
+    for (d = 0; d < G->dims; d++) {
+        ordered[d] = probe[G->order[d]];
+    }
+    for (j = 0; j < n; j++) {
+        image = G->data + (size_t) (ids[j] / GALLERY_LANES) * G->dims * GALLERY_LANES
+                + ids[j] % GALLERY_LANES;
+        distance = 0;
+        for (d = 0; d < G->dims; d++) {
+            delta = ordered[d] - image[d * GALLERY_LANES];
+            distance += delta * delta;
+            if ((d + 1) % GALLERY_CHECK == 0 && distance > topk_bound(T)) {
+                break;
+            }
+        }
+        work += d < G->dims ? d + 1 : d;
+        topk_push(T, ids[j], distance);
+    }
+    return work;
+}
+
+/*
+ * Overrides the kernel picked by gallery_create (for benchmarks)
+ * kernel: "c", "avx2" or "avx512"
+ * returns: 0 on success, -1 if unknown or not supported by this CPU
+ */
+int gallery_use(gallery_t *G, const char *kernel)
+{
+    __builtin_cpu_init();
+    if (strcmp(kernel, "c") == 0) {
+        G->scan = scan_c;
+        G->search = search_c;
+    } else if (strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2")
+            && __builtin_cpu_supports("fma")) {
+        G->scan = scan_avx2;
+        G->search = search_avx2;
+    } else if (strcmp(kernel, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+        G->scan = scan_avx512;
+        G->search = search_avx512;
+    } else {
+        return -1;
+    }
+    G->kernel = kernel;
+    return 0;
+}
+
+void gallery_destroy(gallery_t *G)
+{
+    if (G->owned) {
+        free((int *) G->order);
+        hugepage_free((double *) G->data);
+    }
+    free(G);
+}
+
+/*
+ * Chooses the widest kernel the CPU supports
+ */
+static void gallery_pick(gallery_t *G)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        G->kernel = "avx512";
+        G->scan = scan_avx512;
+        G->search = search_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        G->kernel = "avx2";
+        G->scan = scan_avx2;
+        G->search = search_avx2;
+    } else {
+        G->kernel = "c";
+        G->scan = scan_c;
+        G->search = search_c;
+    }
+}
+
+/*
+ * Portable kernel; the inner loop is written over the lanes so compilers
+ * can still vectorize it
+ */
+static void scan_c(const gallery_t *G, const double *probe, double *distances)
+{
+    const double *block = G->data;
+    double acc[GALLERY_LANES];
+    double diff;
+    int b, d, lane;
+
+    for (b = 0; b < G->blocks; b++) {
+        for (lane = 0; lane < GALLERY_LANES; lane++) {
+            acc[lane] = 0;
+        }
+        for (d = 0; d < G->dims; d++, block += GALLERY_LANES) {
+            for (lane = 0; lane < GALLERY_LANES; lane++) {
+                diff = block[lane] - probe[d];
+                acc[lane] += diff * diff;
+            }
+        }
+        memcpy(&distances[b * GALLERY_LANES], acc, sizeof(acc));
+    }
+}
+
+/*
+ * AVX2: a block is two 4-wide registers
+ */
+__attribute__((target("avx2,fma")))
+static void scan_avx2(const gallery_t *G, const double *probe, double *distances)
+{
+    const double *block = G->data;
+    __m256d acc0, acc1, p, d0, d1;
+    int b, d;
+
+    for (b = 0; b < G->blocks; b++) {
+        acc0 = _mm256_setzero_pd();
+        acc1 = _mm256_setzero_pd();
+        for (d = 0; d < G->dims; d++, block += GALLERY_LANES) {
+            p = _mm256_broadcast_sd(&probe[d]);
+            d0 = _mm256_sub_pd(_mm256_load_pd(block), p);
+            d1 = _mm256_sub_pd(_mm256_load_pd(block + 4), p);
+            acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+            acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+        }
+        _mm256_storeu_pd(&distances[b * GALLERY_LANES], acc0);
+        _mm256_storeu_pd(&distances[b * GALLERY_LANES + 4], acc1);
+    }
+}
+
+/*
+ * AVX-512: a block is exactly one 8-wide register
+ */
+__attribute__((target("avx512f")))
+static void scan_avx512(const gallery_t *G, const double *probe, double *distances)
+{
+    const double *block = G->data;
+    __m512d acc, diff;
+    int b, d;
+
+    for (b = 0; b < G->blocks; b++) {
+        acc = _mm512_setzero_pd();
+        for (d = 0; d < G->dims; d++, block += GALLERY_LANES) {
+            diff = _mm512_sub_pd(_mm512_load_pd(block), _mm512_set1_pd(probe[d]));
+            acc = _mm512_fmadd_pd(diff, diff, acc);
+        }
+        _mm512_storeu_pd(&distances[b * GALLERY_LANES], acc);
+    }
+}
+
+/*
+ * Offers the images of a fully scored block to the selection
+ */
+static void offer_block(const gallery_t *G, topk_t *T, int b, const double *acc)
+{
+    int lane;
+
+    for (lane = 0; lane < GALLERY_LANES && b * GALLERY_LANES + lane < G->count; lane++) {
+        topk_push(T, b * GALLERY_LANES + lane, acc[lane]);
+    }
+}
+
+/*
+ * Portable search kernel; a block survives a check while any lane is below
+ * the bound taken when the block started
+ */
+static long search_c(const gallery_t *G, const double *probe, topk_t *T)
+{
+    const double *block;
+    double acc[GALLERY_LANES];
+    double diff, bound;
+    long work = 0;
+    int b, d, end, lane, alive;
+
+    for (b = 0; b < G->blocks; b++) {
+        block = &G->data[(size_t) b * G->dims * GALLERY_LANES];
+        bound = topk_bound(T);
+        for (lane = 0; lane < GALLERY_LANES; lane++) {
+            acc[lane] = 0;
+        }
+        for (d = 0, alive = 1; d < G->dims && alive; ) {
+            end = d + GALLERY_CHECK < G->dims ? d + GALLERY_CHECK : G->dims;
+            for (; d < end; d++, block += GALLERY_LANES) {
+                for (lane = 0; lane < GALLERY_LANES; lane++) {
+                    diff = block[lane] - probe[d];
+                    acc[lane] += diff * diff;
+                }
+            }
+            for (lane = 0, alive = 0; lane < GALLERY_LANES; lane++) {
+                alive |= acc[lane] < bound;
+            }
+        }
+        work += d;
+        if (alive) {
+            offer_block(G, T, b, acc);
+        }
+    }
+    return work;
+}
+
+/*
+ * AVX2 search: the check is one compare per register and a movemask
+ */
+__attribute__((target("avx2,fma")))
+static long search_avx2(const gallery_t *G, const double *probe, topk_t *T)
+{
+    const double *block;
+    double acc[GALLERY_LANES] __attribute__((aligned(32)));
+    __m256d acc0, acc1, p, d0, d1, bound;
+    long work = 0;
+    int b, d, end, alive;
+
+    for (b = 0; b < G->blocks; b++) {
+        block = &G->data[(size_t) b * G->dims * GALLERY_LANES];
+        bound = _mm256_set1_pd(topk_bound(T));
+        acc0 = _mm256_setzero_pd();
+        acc1 = _mm256_setzero_pd();
+        for (d = 0, alive = 1; d < G->dims && alive; ) {
+            end = d + GALLERY_CHECK < G->dims ? d + GALLERY_CHECK : G->dims;
+            for (; d < end; d++, block += GALLERY_LANES) {
+                p = _mm256_broadcast_sd(&probe[d]);
+                d0 = _mm256_sub_pd(_mm256_load_pd(block), p);
+                d1 = _mm256_sub_pd(_mm256_load_pd(block + 4), p);
+                acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+                acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+            }
+            alive = _mm256_movemask_pd(_mm256_or_pd(_mm256_cmp_pd(acc0, bound, _CMP_LT_OQ),
+                    _mm256_cmp_pd(acc1, bound, _CMP_LT_OQ)));
+        }
+        work += d;
+        if (alive) {
+            _mm256_store_pd(acc, acc0);
+            _mm256_store_pd(acc + 4, acc1);
+            offer_block(G, T, b, acc);
+        }
+    }
+    return work;
+}
+
+/*
+ * AVX-512 search: the check is a single compare into a mask register
+ */
+__attribute__((target("avx512f")))
+static long search_avx512(const gallery_t *G, const double *probe, topk_t *T)
+{
+    const double *block;
+    double acc[GALLERY_LANES] __attribute__((aligned(64)));
+    __m512d sum, diff, bound;
+    long work = 0;
+    int b, d, end, alive;
+
+    for (b = 0; b < G->blocks; b++) {
+        block = &G->data[(size_t) b * G->dims * GALLERY_LANES];
+        bound = _mm512_set1_pd(topk_bound(T));
+        sum = _mm512_setzero_pd();
+        for (d = 0, alive = 1; d < G->dims && alive; ) {
+            end = d + GALLERY_CHECK < G->dims ? d + GALLERY_CHECK : G->dims;
+            for (; d < end; d++, block += GALLERY_LANES) {
+                diff = _mm512_sub_pd(_mm512_load_pd(block), _mm512_set1_pd(probe[d]));
+                sum = _mm512_fmadd_pd(diff, diff, sum);
+            }
+            alive = _mm512_cmp_pd_mask(sum, bound, _CMP_LT_OQ);
+        }
+        work += d;
+        if (alive) {
+            _mm512_store_pd(acc, sum);
+            offer_block(G, T, b, acc);
+        }
+    }
+    return work;
+}
@@ -0,0 +1,107 @@
+/*
+ * Gallery layout for the distance scan
+ *
+ * ProjectedImages_Fisher is (C-1)xP row-major, so one gallery image is a
+ * column and reading it is a strided walk across every row. The gallery is
+ * rearranged once at load time into blocks of GALLERY_LANES images
+ * (array-of-structures-of-arrays): block b holds, for every dimension d, the
+ * GALLERY_LANES values of images b*GALLERY_LANES ... in consecutive doubles.
+ * A SIMD kernel then scores a whole block per pass with unit-stride loads.
+ *
+ *     data[(b * dims + d) * GALLERY_LANES + lane] = G(d, b * GALLERY_LANES + lane)
+ *
+ * The last block is padded with zero images; their distances are computed
+ * but never reported.
+ *
+ * Dimensions are stored in descending order of a weight (the variance of
+ * the gallery along them, gallery_variances), so the dimensions that add
+ * the most to a distance come first and gallery_search can abandon a block
+ * after a few of them. The Fisher eigenvalues would not do: V_Fisher is
+ * already sorted by them. Probes are
+ * given in the original order and permuted internally.
+ *
+ * FisherfaceCore saves the blocked layout in the model (gallery_entries),
+ * so a loader can use it in place from the mapping (gallery_map) and
+ * processes serving the same model share its pages.
+ */
+
+#ifndef __GALLERY_H__
+#define __GALLERY_H__
+
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+#define GALLERY_LANES 8
+
+// model sections written by gallery_entries: the blocks and the order
+#define GALLERY_SECTIONS 2
+
+// dimensions scored between two early-abandon checks in gallery_search
+#define GALLERY_CHECK 8
+
+typedef struct gallery {
+    int dims;           // C-1
+    int count;          // P, number of gallery images
+    int blocks;         // ceil(P / GALLERY_LANES)
+    const int *order;   // stored dimension d is original dimension order[d]
+    const double *data; // blocks * dims * GALLERY_LANES, 64 byte aligned
+    int owned;          // order and data were allocated by gallery_create
+    const char *kernel; // name of the distance kernel picked for this CPU
+    void (*scan)(const struct gallery *G, const double *probe, double *distances);
+    long (*search)(const struct gallery *G, const double *probe, topk_t *T);
+} gallery_t;
+
+// builds the blocked layout from a (C-1)xP gallery; weights (dims values,
+// may be NULL to keep the order) sets the dimension order, largest first
+gallery_t *gallery_create(const MATRIX *ProjectedImages_Fisher, const double *weights);
+
+// model sections holding G; entries must have room for GALLERY_SECTIONS
+void gallery_entries(const gallery_t *G, model_entry_t *entries);
+
+// zero-copy gallery from the sections of a model, which must outlive it;
+// NULL if the model has none for a dims x count gallery
+gallery_t *gallery_map(model_t *model, int dims, int count);
+
+// bytes gallery_place needs
+size_t gallery_bytes(const gallery_t *G);
+
+// copy of G whose blocks and order are stored in memory (gallery_bytes(G)
+// bytes, 64 byte aligned), e.g. memory on another NUMA node; memory must
+// outlive the copy
+gallery_t *gallery_place(const gallery_t *G, void *memory);
+
+// view of blocks first .. first+blocks-1 of G, sharing its memory; the
+// view's image i is image first*GALLERY_LANES+i of G. Free it with
+// gallery_destroy before G
+gallery_t *gallery_shard(const gallery_t *G, int first, int blocks);
+
+// ||G(:,i)||^2 for each of the P gallery images of a (C-1)xP gallery
+void gallery_norms(const MATRIX *ProjectedImages_Fisher, double *norms);
+
+// variance of a (C-1)xP gallery along each of its C-1 dimensions
+void gallery_variances(const MATRIX *ProjectedImages_Fisher, double *variances);
+
+// number of distances gallery_distances writes (count rounded up to a block)
+int gallery_padded(const gallery_t *G);
+
+// squared Euclidean distance from probe (dims values) to every gallery image;
+// distances must hold gallery_padded(G) values
+void gallery_distances(const gallery_t *G, const double *probe, double *distances);
+
+// offers every gallery image to T, abandoning a block of images once all of
+// its partial distances exceed the current k-th best. Returns the number of
+// block dimensions scored (G->blocks * G->dims without any abandoning)
+long gallery_search(const gallery_t *G, const double *probe, topk_t *T);
+
+// offers the n gallery images ids[0 .. n-1] to T with their exact
+// distances, abandoning each once it exceeds the current k-th best.
+// Returns the number of dimensions scored
+long gallery_rerank(const gallery_t *G, const double *probe, const int *ids, int n, topk_t *T);
+
+// forces a kernel ("c", "avx2" or "avx512"); -1 if this CPU lacks it
+int gallery_use(gallery_t *G, const char *kernel);
+
+void gallery_destroy(gallery_t *G);
+
+#endif
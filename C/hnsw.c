@@ -0,0 +1,609 @@
+/*******************************************************************************
+ HNSW approximate nearest-neighbour index
+
+ Build: node levels are drawn up front (P(level >= l) = M^-l) so the upper
+ link storage can be laid out before any thread starts. Node 0 becomes the
+ entry point and the worker threads then insert the remaining nodes in
+ parallel, each taking the next node number from a shared counter. A node's
+ link list is only read or written under its own mutex; the global mutex is
+ held for the whole insertion of a node that raises the top layer, as that
+ moves the entry point.
+
+ Neighbours are chosen with the diversity heuristic of the paper: a
+ candidate is kept only if it is closer to the new node than to every
+ neighbour already kept, so links point in different directions instead of
+ all into the nearest cluster.
+
+ Search needs no locks once the build has finished; every thread brings an
+ hnsw_scratch_t with its visit marks and heaps.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hnsw.h"
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+#define HNSW_HEADER 6 // dims, count, M, efConstruction, max_level, entry
+
+static const char * const HnswNames[4] = {
+    "hnsw_header", "hnsw_levels", "hnsw_level0", "hnsw_upper"
+};
+
+typedef struct {
+    hnsw_t *H;
+    int next;                       // next node to insert, taken atomically
+} hnsw_job_t;
+
+static hnsw_t *hnsw_alloc(const MATRIX *ProjectedImages_Fisher);
+static void hnsw_layout(hnsw_t *H);
+static void *hnsw_worker(void *arg);
+static void hnsw_insert(hnsw_t *H, int node, hnsw_scratch_t *S);
+
+/*
+ * Squared Euclidean distance between two vectors of H
+ */
+static inline double hnsw_distance(const double *a, const double *b, int dims)
+{
+    double sum = 0, diff;
+    int d;
+
+    for (d = 0; d < dims; d++) {
+        diff = a[d] - b[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static inline const double *hnsw_vector(const hnsw_t *H, int node)
+{
+    return &H->vectors[(size_t) node * H->dims];
+}
+
+/*
+ * Link list of a node on a layer: a count followed by the neighbours
+ */
+static inline int *hnsw_links(const hnsw_t *H, int node, int level)
+{
+    if (level == 0) {
+        return &H->level0[(size_t) node * (H->M0 + 1)];
+    }
+    return &H->upper[(H->offset[node] + level - 1) * (H->M + 1)];
+}
+
+/*
+ * Copies a link list into S->links, under the node's lock while building
+ */
+static int *hnsw_read_links(const hnsw_t *H, int node, int level, hnsw_scratch_t *S)
+{
+    int *links = hnsw_links(H, node, level);
+
+    if (H->locks == NULL) {
+        return links;
+    }
+    pthread_mutex_lock(&H->locks[node]);
+    memcpy(S->links, links, (links[0] + 1) * sizeof(int));
+    pthread_mutex_unlock(&H->locks[node]);
+    return S->links;
+}
+
+/*
+ * Builds the index
+ * ProjectedImages_Fisher: (C-1)xP gallery, one image per column
+ * M: links per node (2 * M on layer 0); 16 is a good default
+ * efConstruction: search width while inserting; higher builds a better
+ *                 graph more slowly
+ * threads: build threads, <= 0 for one per online CPU
+ */
+hnsw_t *hnsw_build(const MATRIX *ProjectedImages_Fisher, int M, int efConstruction, int threads)
+{
+    hnsw_t *H = hnsw_alloc(ProjectedImages_Fisher);
+    hnsw_job_t job;
+    pthread_t *workers;
+    double mult = 1 / log(M);
+    unsigned int seed = 100;
+    int i;
+
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    H->M = M;
+    H->M0 = 2 * M;
+    H->efConstruction = efConstruction;
+    H->levels = (int *) malloc(H->count * sizeof(int));
+    for (i = 0; i < H->count; i++) {
+        H->levels[i] = (int) (-log((rand_r(&seed) + 1.0) / ((double) RAND_MAX + 1)) * mult);
+    }
+    hnsw_layout(H);
+    H->level0 = (int *) calloc((size_t) H->count * (H->M0 + 1), sizeof(int));
+    H->upper = (int *) calloc(H->offset[H->count] * (H->M + 1) + 1, sizeof(int));
+
+    H->locks = (pthread_mutex_t *) malloc(H->count * sizeof(pthread_mutex_t));
+    for (i = 0; i < H->count; i++) {
+        pthread_mutex_init(&H->locks[i], NULL);
+    }
+    pthread_mutex_init(&H->global, NULL);
+
+    H->entry = 0;
+    H->max_level = H->levels[0];
+
+    job.H = H;
+    job.next = 1;
+    workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    for (i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, hnsw_worker, &job);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    for (i = 0; i < H->count; i++) {
+        pthread_mutex_destroy(&H->locks[i]);
+    }
+    pthread_mutex_destroy(&H->global);
+    free(H->locks);
+    H->locks = NULL;
+
+    return H;
+}
+
+/*
+ * Build thread: inserts nodes until there are none left
+ */
+static void *hnsw_worker(void *arg)
+{
+    hnsw_job_t *job = (hnsw_job_t *) arg;
+    hnsw_scratch_t *S = hnsw_scratch_create(job->H);
+    int node;
+
+    while ((node = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->H->count) {
+        hnsw_insert(job->H, node, S);
+    }
+
+    hnsw_scratch_destroy(S);
+    return NULL;
+}
+
+/*
+ * Allocates an index and copies the gallery into row order
+ */
+static hnsw_t *hnsw_alloc(const MATRIX *ProjectedImages_Fisher)
+{
+    hnsw_t *H = (hnsw_t *) calloc(1, sizeof(hnsw_t));
+    int d, i;
+
+    H->dims = ProjectedImages_Fisher->rows;
+    H->count = ProjectedImages_Fisher->cols;
+    if (posix_memalign((void **) &H->vectors, 64,
+            (size_t) H->count * H->dims * sizeof(double)) != 0) {
+        fprintf(stderr, "hnsw: out of memory\n");
+        exit(1);
+    }
+    for (d = 0; d < H->dims; d++) {
+        for (i = 0; i < H->count; i++) {
+            H->vectors[(size_t) i * H->dims + d] = ProjectedImages_Fisher->data[d][i];
+        }
+    }
+    return H;
+}
+
+/*
+ * Places the upper layers of each node in upper[]; offset[count] is the
+ * total number of rows
+ */
+static void hnsw_layout(hnsw_t *H)
+{
+    int i;
+
+    H->offset = (size_t *) malloc((H->count + 1) * sizeof(size_t));
+    H->offset[0] = 0;
+    for (i = 0; i < H->count; i++) {
+        H->offset[i + 1] = H->offset[i] + H->levels[i];
+    }
+}
+
+/*
+ * Min-heap of candidates to expand, nearest on top
+ */
+static void candidate_push(hnsw_scratch_t *S, int *size, int index, double distance)
+{
+    int i, parent;
+
+    if (*size == S->capacity) {
+        S->capacity *= 2;
+        S->candidates = (match_t *) realloc(S->candidates, S->capacity * sizeof(match_t));
+    }
+    for (i = (*size)++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (S->candidates[parent].distance <= distance) {
+            break;
+        }
+        S->candidates[i] = S->candidates[parent];
+    }
+    S->candidates[i].index = index;
+    S->candidates[i].distance = distance;
+}
+
+static match_t candidate_pop(hnsw_scratch_t *S, int *size)
+{
+    match_t top = S->candidates[0];
+    match_t last = S->candidates[--(*size)];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < *size) {
+        if (child + 1 < *size && S->candidates[child + 1].distance < S->candidates[child].distance) {
+            child++;
+        }
+        if (S->candidates[child].distance >= last.distance) {
+            break;
+        }
+        S->candidates[i] = S->candidates[child];
+        i = child;
+    }
+    S->candidates[i] = last;
+    return top;
+}
+
+/*
+ * Starts a new search: every node becomes unvisited
+ */
+static void hnsw_visit_reset(const hnsw_t *H, hnsw_scratch_t *S)
+{
+    if (++S->epoch == 0) {
+        memset(S->mark, 0, H->count * sizeof(unsigned int));
+        S->epoch = 1;
+    }
+}
+
+/*
+ * Moves *ep to the nearest node reachable greedily on one layer
+ */
+static void hnsw_greedy(const hnsw_t *H, const double *q, int *ep, double *ep_distance,
+        int level, hnsw_scratch_t *S)
+{
+    const int *links;
+    double d;
+    int changed = 1;
+    int j;
+
+    while (changed) {
+        changed = 0;
+        links = hnsw_read_links(H, *ep, level, S);
+        for (j = 1; j <= links[0]; j++) {
+            d = hnsw_distance(q, hnsw_vector(H, links[j]), H->dims);
+            if (d < *ep_distance) {
+                *ep_distance = d;
+                *ep = links[j];
+                changed = 1;
+            }
+        }
+    }
+}
+
+/*
+ * Best-first search of one layer from ep; W must be initialized with the
+ * search width as its k and receives the nearest nodes found
+ */
+static void hnsw_search_layer(const hnsw_t *H, const double *q, int ep, double ep_distance,
+        int level, hnsw_scratch_t *S, topk_t *W)
+{
+    const int *links;
+    match_t c;
+    double d;
+    int size = 0;
+    int j, e;
+
+    hnsw_visit_reset(H, S);
+    S->mark[ep] = S->epoch;
+    candidate_push(S, &size, ep, ep_distance);
+    topk_push(W, ep, ep_distance);
+
+    while (size > 0) {
+        c = candidate_pop(S, &size);
+        if (c.distance > topk_bound(W)) {
+            break; // everything left is further than the worst result
+        }
+        links = hnsw_read_links(H, c.index, level, S);
+        for (j = 1; j <= links[0]; j++) {
+            e = links[j];
+            if (S->mark[e] == S->epoch) {
+                continue;
+            }
+            S->mark[e] = S->epoch;
+            d = hnsw_distance(q, hnsw_vector(H, e), H->dims);
+            if (d < topk_bound(W)) {
+                candidate_push(S, &size, e, d);
+                topk_push(W, e, d);
+            }
+        }
+    }
+}
+
+/*
+ * Diversity heuristic: keeps candidates (sorted nearest first) that are
+ * closer to the base node than to any neighbour kept before them
+ * returns: number of neighbours written to out, at most max
+ */
+static int hnsw_select(const hnsw_t *H, const match_t *candidates, int n, int max, match_t *out)
+{
+    int count = 0;
+    int i, j, keep;
+
+    for (i = 0; i < n && count < max; i++) {
+        keep = 1;
+        for (j = 0; j < count && keep; j++) {
+            keep = hnsw_distance(hnsw_vector(H, candidates[i].index),
+                    hnsw_vector(H, out[j].index), H->dims) >= candidates[i].distance;
+        }
+        if (keep) {
+            out[count++] = candidates[i];
+        }
+    }
+    return count;
+}
+
+/*
+ * Adds the link node -> target on a layer, re-selecting target's
+ * neighbours if its list is full
+ */
+static void hnsw_connect(hnsw_t *H, int node, int target, double distance, int level,
+        hnsw_scratch_t *S)
+{
+    int max = level == 0 ? H->M0 : H->M;
+    int *links;
+    match_t temp;
+    int n, i, j;
+
+    pthread_mutex_lock(&H->locks[node]);
+    links = hnsw_links(H, node, level);
+    if (links[0] < max) {
+        links[++links[0]] = target;
+    } else {
+        // the current neighbours plus target, sorted by distance to node
+        S->pool[0].index = target;
+        S->pool[0].distance = distance;
+        for (n = 1; n <= links[0]; n++) {
+            S->pool[n].index = links[n];
+            S->pool[n].distance = hnsw_distance(hnsw_vector(H, node),
+                    hnsw_vector(H, links[n]), H->dims);
+        }
+        for (i = 1; i < n; i++) {
+            temp = S->pool[i];
+            for (j = i; j > 0 && S->pool[j - 1].distance > temp.distance; j--) {
+                S->pool[j] = S->pool[j - 1];
+            }
+            S->pool[j] = temp;
+        }
+        links[0] = hnsw_select(H, S->pool, n, max, S->selected);
+        for (i = 0; i < links[0]; i++) {
+            links[i + 1] = S->selected[i].index;
+        }
+    }
+    pthread_mutex_unlock(&H->locks[node]);
+}
+
+/*
+ * Inserts one node into the graph under construction
+ */
+static void hnsw_insert(hnsw_t *H, int node, hnsw_scratch_t *S)
+{
+    const double *q = hnsw_vector(H, node);
+    int level = H->levels[node];
+    match_t *selected = S->neighbours;
+    double ep_distance;
+    topk_t W;
+    int top, ep, lc, n, j;
+    int *links;
+
+    pthread_mutex_lock(&H->global);
+    top = H->max_level;
+    ep = H->entry;
+    if (level <= top) {
+        pthread_mutex_unlock(&H->global);
+    }
+
+    ep_distance = hnsw_distance(q, hnsw_vector(H, ep), H->dims);
+    for (lc = top; lc > level; lc--) {
+        hnsw_greedy(H, q, &ep, &ep_distance, lc, S);
+    }
+
+    for (lc = level < top ? level : top; lc >= 0; lc--) {
+        topk_init(&W, S->results, H->efConstruction);
+        hnsw_search_layer(H, q, ep, ep_distance, lc, S, &W);
+        topk_sort(&W);
+        n = hnsw_select(H, W.heap, W.size, H->M, selected);
+
+        pthread_mutex_lock(&H->locks[node]);
+        links = hnsw_links(H, node, lc);
+        links[0] = n;
+        for (j = 0; j < n; j++) {
+            links[j + 1] = selected[j].index;
+        }
+        pthread_mutex_unlock(&H->locks[node]);
+
+        for (j = 0; j < n; j++) {
+            hnsw_connect(H, selected[j].index, node, selected[j].distance, lc, S);
+        }
+        ep = W.heap[0].index;
+        ep_distance = W.heap[0].distance;
+    }
+    if (level > top) {
+        H->entry = node;
+        H->max_level = level;
+        pthread_mutex_unlock(&H->global);
+    }
+}
+
+/*
+ * Allocates the working memory of one searching thread
+ */
+hnsw_scratch_t *hnsw_scratch_create(const hnsw_t *H)
+{
+    hnsw_scratch_t *S = (hnsw_scratch_t *) malloc(sizeof(hnsw_scratch_t));
+
+    S->mark = (unsigned int *) calloc(H->count, sizeof(unsigned int));
+    S->epoch = 0;
+    S->capacity = 256;
+    S->candidates = (match_t *) malloc(S->capacity * sizeof(match_t));
+    S->ef = H->efConstruction > HNSW_EF ? H->efConstruction : HNSW_EF;
+    S->results = (match_t *) malloc(S->ef * sizeof(match_t));
+    S->links = (int *) malloc((H->M0 + 1) * sizeof(int));
+    S->pool = (match_t *) malloc((H->M0 + 1) * sizeof(match_t));
+    S->selected = (match_t *) malloc((H->M0 + 1) * sizeof(match_t));
+    S->neighbours = (match_t *) malloc(H->M * sizeof(match_t));
+    return S;
+}
+
+void hnsw_scratch_destroy(hnsw_scratch_t *S)
+{
+    free(S->mark);
+    free(S->candidates);
+    free(S->results);
+    free(S->links);
+    free(S->pool);
+    free(S->selected);
+    free(S->neighbours);
+    free(S);
+}
+
+/*
+ * Approximate k nearest neighbours
+ * probe: dims values in Fisher space
+ * ef: search width on layer 0; larger is slower and finds more of the true
+ *     neighbours
+ * S: this thread's scratch
+ * matches: k entries, best first; index -1 if the gallery is smaller than k
+ * returns: number of matches found
+ */
+int hnsw_search(const hnsw_t *H, const double *probe, int k, int ef,
+        hnsw_scratch_t *S, match_t *matches)
+{
+    double ep_distance;
+    topk_t W;
+    int ep = H->entry;
+    int lc, j;
+
+    if (ef < k) {
+        ef = k;
+    }
+    if (ef > S->ef) {
+        S->ef = ef;
+        S->results = (match_t *) realloc(S->results, ef * sizeof(match_t));
+    }
+
+    ep_distance = hnsw_distance(probe, hnsw_vector(H, ep), H->dims);
+    for (lc = H->max_level; lc > 0; lc--) {
+        hnsw_greedy(H, probe, &ep, &ep_distance, lc, S);
+    }
+    topk_init(&W, S->results, ef);
+    hnsw_search_layer(H, probe, ep, ep_distance, 0, S, &W);
+    topk_sort(&W);
+
+    for (j = 0; j < k; j++) {
+        matches[j] = W.heap[j];
+    }
+    return W.size < k ? W.size : k;
+}
+
+/*
+ * Writes the graph as MODEL_I32 sections
+ */
+int hnsw_save(const hnsw_t *H, const char *path)
+{
+    int header[HNSW_HEADER] = { H->dims, H->count, H->M, H->efConstruction,
+                                H->max_level, H->entry };
+    model_entry_t entries[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        entries[i].name = HnswNames[i];
+        entries[i].dtype = MODEL_I32;
+    }
+    entries[0].rows = 1;
+    entries[0].cols = HNSW_HEADER;
+    entries[0].data = header;
+    entries[1].rows = H->count;
+    entries[1].cols = 1;
+    entries[1].data = H->levels;
+    entries[2].rows = H->count;
+    entries[2].cols = H->M0 + 1;
+    entries[2].data = H->level0;
+    entries[3].rows = H->offset[H->count];
+    entries[3].cols = H->M + 1;
+    entries[3].data = H->upper;
+
+    return model_write(path, entries, 4);
+}
+
+/*
+ * Maps a saved graph; the link lists stay in the mapping
+ * path: file written by hnsw_save
+ * ProjectedImages_Fisher: the gallery the graph was built over
+ * returns: NULL on error
+ */
+hnsw_t *hnsw_load(const char *path, const MATRIX *ProjectedImages_Fisher)
+{
+    model_t *file = model_map(path);
+    const int *header, *levels, *level0, *upper;
+    int rows[4], cols[4];
+    hnsw_t *H;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    header = (const int *) model_data(file, HnswNames[0], MODEL_I32, &rows[0], &cols[0]);
+    levels = (const int *) model_data(file, HnswNames[1], MODEL_I32, &rows[1], &cols[1]);
+    level0 = (const int *) model_data(file, HnswNames[2], MODEL_I32, &rows[2], &cols[2]);
+    upper = (const int *) model_data(file, HnswNames[3], MODEL_I32, &rows[3], &cols[3]);
+    if (header == NULL || levels == NULL || level0 == NULL || upper == NULL
+            || cols[0] != HNSW_HEADER || header[0] != ProjectedImages_Fisher->rows
+            || header[1] != ProjectedImages_Fisher->cols
+            || rows[1] != header[1] || rows[2] != header[1] || cols[2] != 2 * header[2] + 1) {
+        fprintf(stderr, "%s: not an index of this gallery\n", path);
+        model_unmap(file);
+        return NULL;
+    }
+
+    H = hnsw_alloc(ProjectedImages_Fisher);
+    H->M = header[2];
+    H->M0 = 2 * H->M;
+    H->efConstruction = header[3];
+    H->max_level = header[4];
+    H->entry = header[5];
+    H->file = file;
+    // read only from here on; the casts drop const from the mapping
+    H->levels = (int *) levels;
+    H->level0 = (int *) level0;
+    H->upper = (int *) upper;
+    hnsw_layout(H);
+    if ((size_t) rows[3] != H->offset[H->count]) {
+        fprintf(stderr, "%s: corrupt index\n", path);
+        hnsw_destroy(H);
+        return NULL;
+    }
+
+    return H;
+}
+
+void hnsw_destroy(hnsw_t *H)
+{
+    if (H->file != NULL) {
+        model_unmap(H->file);
+    } else {
+        free(H->levels);
+        free(H->level0);
+        free(H->upper);
+    }
+    free(H->vectors);
+    free(H->offset);
+    free(H);
+}
@@ -0,0 +1,90 @@
+/*
+ * HNSW approximate nearest-neighbour index over the Fisher-space gallery
+ *
+ * Hierarchical navigable small world graph (Malkov & Yashunin): every
+ * gallery vector is a node on layer 0 and, with geometrically decreasing
+ * probability, on the layers above. A query descends greedily from the
+ * single entry point on the top layer and then runs a best-first search of
+ * width ef on layer 0, so it visits O(log P) nodes instead of all P.
+ *
+ * Node i's links on layer 0 are level0[i * (M0 + 1)]: a count followed by
+ * up to M0 = 2 * M neighbours. Layers 1 .. levels[i] use the same
+ * count-then-links form with up to M neighbours in upper[].
+ *
+ * The graph is saved with model_write as four MODEL_I32 sections (see
+ * HNSW_SUFFIX); the vectors themselves are not stored again but taken from
+ * ProjectedImages_Fisher of the model the index belongs to.
+ */
+
+#ifndef __HNSW_H__
+#define __HNSW_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+// index file of a model is ModelPath HNSW_SUFFIX
+#define HNSW_SUFFIX ".hnsw"
+
+// defaults used by bench
+#define HNSW_M 16
+#define HNSW_EF_CONSTRUCTION 200
+#define HNSW_EF 64
+
+typedef struct {
+    int dims;
+    int count;                      // nodes, one per gallery image
+    int M;                          // links per node on layers above 0
+    int M0;                         // links per node on layer 0 (2 * M)
+    int efConstruction;             // search width while inserting
+    int max_level;                  // top layer
+    int entry;                      // node the searches start from
+    double *vectors;                // count x dims, gallery image i in row i
+    int *levels;                    // top layer of each node
+    int *level0;                    // count x (M0 + 1) layer 0 links
+    int *upper;                     // (M + 1) links per node and layer above 0
+    size_t *offset;                 // first upper[] row of each node
+    pthread_mutex_t *locks;         // one per node while building, else NULL
+    pthread_mutex_t global;         // guards entry / max_level while building
+    model_t *file;                  // mapping of a loaded index, else NULL
+} hnsw_t;
+
+// per-thread working memory of a search
+typedef struct {
+    unsigned int *mark;             // visit epoch of each node
+    unsigned int epoch;
+    match_t *candidates;            // min-heap of nodes still to expand
+    int capacity;
+    match_t *results;               // ef best nodes so far
+    int ef;
+    int *links;                     // copy of a link list (M0 + 1)
+    match_t *pool;                  // neighbour selection (M0 + 1)
+    match_t *selected;
+    match_t *neighbours;            // links chosen for the node being inserted
+} hnsw_scratch_t;
+
+// builds the graph over the columns of ProjectedImages_Fisher with threads
+// workers (<= 0 for one per online CPU)
+hnsw_t *hnsw_build(const MATRIX *ProjectedImages_Fisher, int M, int efConstruction, int threads);
+
+// writes the graph; 0 on success
+int hnsw_save(const hnsw_t *H, const char *path);
+
+// maps a saved graph built over ProjectedImages_Fisher; NULL if missing,
+// corrupt or built for another gallery
+hnsw_t *hnsw_load(const char *path, const MATRIX *ProjectedImages_Fisher);
+
+hnsw_scratch_t *hnsw_scratch_create(const hnsw_t *H);
+void hnsw_scratch_destroy(hnsw_scratch_t *S);
+
+// k approximate nearest neighbours of probe, best first, searching layer 0
+// with width max(ef, k); returns the number of matches found
+int hnsw_search(const hnsw_t *H, const double *probe, int k, int ef,
+        hnsw_scratch_t *S, match_t *matches);
+
+void hnsw_destroy(hnsw_t *H);
+
+#endif
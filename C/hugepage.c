@@ -0,0 +1,118 @@
+/*******************************************************************************
+ Huge-page backed allocation for large matrices
+
+ Every buffer starts with a 64 byte header that records how it was
+ obtained, so hugepage_free can hand it back the same way; the caller's
+ data starts right after it and keeps 64 byte alignment. A huge-page
+ buffer is rounded up to whole huge pages, which wastes at most one huge
+ page per matrix.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hugepage.h"
+
+#define HEADER 64
+
+typedef struct {
+    void *base;                     // what malloc / posix_memalign / mmap returned
+    size_t length;                  // bytes at base
+    int policy;                     // how base was obtained
+} header_t;
+
+static int policy = HUGEPAGE_THP;
+static const char * const Names[] = { "off", "thp", "hugetlb" };
+
+void hugepage_policy(int p)
+{
+    policy = p;
+}
+
+int hugepage_parse(const char *name)
+{
+    int p;
+
+    for (p = HUGEPAGE_OFF; p <= HUGEPAGE_HUGETLB; p++) {
+        if (strcmp(name, Names[p]) == 0) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+const char *hugepage_name(int p)
+{
+    return p >= HUGEPAGE_OFF && p <= HUGEPAGE_HUGETLB ? Names[p] : "?";
+}
+
+/*
+ * Allocates a buffer under the current policy
+ * bytes: size the caller needs, not counting the header
+ */
+void *hugepage_alloc(size_t bytes)
+{
+    static int warned = 0;
+    size_t length = bytes + HEADER;
+    header_t *header;
+    void *base = NULL;
+    int used = policy;
+
+    if (length < HUGEPAGE_THRESHOLD) {
+        used = HUGEPAGE_OFF;
+    } else {
+        length = (length + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+    }
+
+    if (used == HUGEPAGE_HUGETLB) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base == MAP_FAILED) {
+            if (!warned) {
+                fprintf(stderr, "hugepage: no explicit huge pages (vm.nr_hugepages), using THP\n");
+                warned = 1;
+            }
+            base = NULL;
+            used = HUGEPAGE_THP;
+        }
+    }
+    if (used == HUGEPAGE_THP) {
+        if (posix_memalign(&base, HUGEPAGE_SIZE, length) != 0) {
+            base = NULL;
+        } else {
+            // before the first touch, so the faults already take huge pages
+            madvise(base, length, MADV_HUGEPAGE);
+        }
+    }
+    if (used == HUGEPAGE_OFF && posix_memalign(&base, HEADER, length) != 0) {
+        base = NULL;
+    }
+    if (base == NULL) {
+        fprintf(stderr, "hugepage_alloc: out of memory (%zu bytes)\n", bytes);
+        exit(1);
+    }
+
+    header = (header_t *) base;
+    header->base = base;
+    header->length = length;
+    header->policy = used;
+    return (char *) base + HEADER;
+}
+
+void hugepage_free(void *memory)
+{
+    header_t *header;
+
+    if (memory == NULL) {
+        return;
+    }
+    header = (header_t *) ((char *) memory - HEADER);
+    if (header->policy == HUGEPAGE_HUGETLB) {
+        munmap(header->base, header->length);
+    } else {
+        free(header->base);
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Huge-page backed allocation for large matrices
+ *
+ * The training database, A, V_PCA, the projection and the gallery are
+ * megabytes each, and the GEMMs and scans over them walk through far more
+ * 4 KB pages than the TLB holds. Buffers of HUGEPAGE_THRESHOLD bytes or
+ * more are therefore allocated according to a process-wide policy:
+ *
+ *     HUGEPAGE_OFF      plain malloc
+ *     HUGEPAGE_THP      2 MB aligned, madvise(MADV_HUGEPAGE), so the
+ *                       kernel backs them with transparent huge pages even
+ *                       when THP is only enabled on request ("madvise")
+ *     HUGEPAGE_HUGETLB  explicit huge pages (MAP_HUGETLB) from the pool in
+ *                       /proc/sys/vm/nr_hugepages; falls back to THP when
+ *                       the pool is empty
+ *
+ * Smaller buffers always come from malloc. hugepage_free releases any of
+ * them, so callers need not know which policy was in force.
+ */
+
+#ifndef __HUGEPAGE_H__
+#define __HUGEPAGE_H__
+
+#include <stddef.h>
+
+#define HUGEPAGE_SIZE (2UL << 20)
+
+// buffers below this size are never huge-page backed
+#define HUGEPAGE_THRESHOLD HUGEPAGE_SIZE
+
+// allocation policies
+#define HUGEPAGE_OFF 0
+#define HUGEPAGE_THP 1
+#define HUGEPAGE_HUGETLB 2
+
+// sets the policy for later allocations (HUGEPAGE_THP by default)
+void hugepage_policy(int policy);
+
+// policy named "off", "thp" or "hugetlb"; -1 if unknown
+int hugepage_parse(const char *name);
+const char *hugepage_name(int policy);
+
+// bytes of memory aligned to 64 bytes; exits when out of memory
+void *hugepage_alloc(size_t bytes);
+void hugepage_free(void *memory);
+
+#endif
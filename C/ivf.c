@@ -0,0 +1,313 @@
+/*******************************************************************************
+ IVF index
+
+ The centroids are trained on at most IVF_TRAIN points per list (a fixed
+ sample of the gallery); more adds little to the quality of the cells and
+ k-means cost grows with every point. Each list keeps its vectors next to
+ their ids so a scan reads one contiguous array.
+
+ With replicas > 1 a vector can be in several of the scanned lists; the
+ selection then only takes an id it does not hold yet.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ivf.h"
+#include "kmeans.h"
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+// training points per list
+#define IVF_TRAIN 256
+
+#define IVF_HEADER 4 // dims, nlist, replicas, count
+
+static const char * const IvfNames[5] = {
+    "ivf_header", "ivf_centroids", "ivf_sizes", "ivf_ids", "ivf_vectors"
+};
+
+static inline double ivf_distance(const double *a, const double *b, int dims)
+{
+    double sum = 0, diff;
+    int d;
+
+    for (d = 0; d < dims; d++) {
+        diff = a[d] - b[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/*
+ * Empty index around trained centroids (copied)
+ */
+static ivf_t *ivf_create(int dims, int nlist, int replicas, const double *centroids)
+{
+    ivf_t *ivf = (ivf_t *) calloc(1, sizeof(ivf_t));
+
+    ivf->dims = dims;
+    ivf->nlist = nlist;
+    ivf->replicas = replicas < 1 ? 1 : replicas > nlist ? nlist : replicas;
+    ivf->centroids = (double *) malloc((size_t) nlist * dims * sizeof(double));
+    memcpy(ivf->centroids, centroids, (size_t) nlist * dims * sizeof(double));
+    ivf->lists = (ivf_list_t *) calloc(nlist, sizeof(ivf_list_t));
+    return ivf;
+}
+
+/*
+ * Appends a vector to one list, doubling its arrays when full
+ */
+static void ivf_append(ivf_t *ivf, ivf_list_t *L, const double *vector, int id)
+{
+    if (L->size == L->capacity) {
+        L->capacity = L->capacity ? 2 * L->capacity : 16;
+        L->ids = (int *) realloc(L->ids, L->capacity * sizeof(int));
+        L->vectors = (double *) realloc(L->vectors, (size_t) L->capacity * ivf->dims * sizeof(double));
+    }
+    L->ids[L->size] = id;
+    memcpy(&L->vectors[(size_t) L->size * ivf->dims], vector, ivf->dims * sizeof(double));
+    L->size++;
+}
+
+/*
+ * Trains the cells and fills the lists
+ * ProjectedImages_Fisher: (C-1)xP gallery, one image per column
+ * nlist: number of cells; around sqrt(P) to 4 * sqrt(P)
+ * replicas: lists each gallery vector goes into (1 for a plain IVF)
+ * threads: k-means threads, <= 0 for one per online CPU
+ * returns: NULL if the gallery has fewer than nlist images
+ */
+ivf_t *ivf_build(const MATRIX *ProjectedImages_Fisher, int nlist, int replicas, int threads)
+{
+    int dims = ProjectedImages_Fisher->rows;
+    int P = ProjectedImages_Fisher->cols;
+    int n = P < nlist * IVF_TRAIN ? P : nlist * IVF_TRAIN;
+    double *X = (double *) malloc((size_t) P * dims * sizeof(double));
+    double *centroids = (double *) malloc((size_t) nlist * dims * sizeof(double));
+    double *sample = (double *) malloc((size_t) n * dims * sizeof(double));
+    ivf_t *ivf = NULL;
+    int i, d;
+
+    // row order, one gallery image per row
+    for (d = 0; d < dims; d++) {
+        for (i = 0; i < P; i++) {
+            X[(size_t) i * dims + d] = ProjectedImages_Fisher->data[d][i];
+        }
+    }
+    // every (P / n)-th image, so the sample covers the whole gallery
+    for (i = 0; i < n; i++) {
+        memcpy(&sample[(size_t) i * dims], &X[(size_t) ((long) i * P / n) * dims],
+                dims * sizeof(double));
+    }
+
+    if (kmeans(sample, n, dims, nlist, IVF_ITERATIONS, threads, centroids, NULL) >= 0) {
+        ivf = ivf_create(dims, nlist, replicas, centroids);
+        for (i = 0; i < P; i++) {
+            ivf_add(ivf, &X[(size_t) i * dims], i);
+        }
+    }
+
+    free(X);
+    free(centroids);
+    free(sample);
+    return ivf;
+}
+
+/*
+ * Enrolls a vector: stored in the lists of its ivf->replicas nearest cells
+ * vector: dims values in Fisher space, copied
+ * id: value reported by ivf_search for this vector
+ */
+void ivf_add(ivf_t *ivf, const double *vector, int id)
+{
+    match_t nearest[ivf->replicas];
+    topk_t T;
+    int c;
+
+    topk_init(&T, nearest, ivf->replicas);
+    for (c = 0; c < ivf->nlist; c++) {
+        topk_push(&T, c, ivf_distance(vector, &ivf->centroids[(size_t) c * ivf->dims], ivf->dims));
+    }
+    for (c = 0; c < T.size; c++) {
+        ivf_append(ivf, &ivf->lists[nearest[c].index], vector, id);
+    }
+    ivf->count++;
+}
+
+/*
+ * Approximate k nearest neighbours
+ * probe: dims values in Fisher space
+ * nprobe: cells to scan; nlist makes the search exact
+ * matches: k entries, best first; index -1 if fewer than k were found
+ * returns: dimensions scored (centroids plus scanned vectors) times dims
+ */
+long ivf_search(const ivf_t *ivf, const double *probe, int k, int nprobe, match_t *matches)
+{
+    match_t cells[nprobe < ivf->nlist ? nprobe : ivf->nlist];
+    const ivf_list_t *L;
+    topk_t C, T;
+    double d;
+    long scored = ivf->nlist;
+    int c, i, j, held;
+
+    topk_init(&C, cells, nprobe < ivf->nlist ? nprobe : ivf->nlist);
+    for (c = 0; c < ivf->nlist; c++) {
+        topk_push(&C, c, ivf_distance(probe, &ivf->centroids[(size_t) c * ivf->dims], ivf->dims));
+    }
+    topk_sort(&C);
+
+    topk_init(&T, matches, k);
+    for (c = 0; c < C.size; c++) {
+        L = &ivf->lists[cells[c].index];
+        scored += L->size;
+        for (i = 0; i < L->size; i++) {
+            d = ivf_distance(probe, &L->vectors[(size_t) i * ivf->dims], ivf->dims);
+            if (d >= topk_bound(&T)) {
+                continue;
+            }
+            // a replicated vector may already have come from another list
+            for (j = 0, held = 0; ivf->replicas > 1 && j < T.size && !held; j++) {
+                held = T.heap[j].index == L->ids[i];
+            }
+            if (!held) {
+                topk_push(&T, L->ids[i], d);
+            }
+        }
+    }
+    topk_sort(&T);
+
+    return scored * ivf->dims;
+}
+
+/*
+ * Writes the centroids and the lists (concatenated) as model sections
+ */
+int ivf_save(const ivf_t *ivf, const char *path)
+{
+    int header[IVF_HEADER] = { ivf->dims, ivf->nlist, ivf->replicas, ivf->count };
+    int *sizes = (int *) malloc(ivf->nlist * sizeof(int));
+    long total = 0, at = 0;
+    model_entry_t entries[5];
+    int *ids;
+    double *vectors;
+    int c, i, status;
+
+    for (c = 0; c < ivf->nlist; c++) {
+        sizes[c] = ivf->lists[c].size;
+        total += sizes[c];
+    }
+    ids = (int *) malloc((total + 1) * sizeof(int));
+    vectors = (double *) malloc(((size_t) total * ivf->dims + 1) * sizeof(double));
+    for (c = 0; c < ivf->nlist; c++) {
+        memcpy(&ids[at], ivf->lists[c].ids, sizes[c] * sizeof(int));
+        memcpy(&vectors[(size_t) at * ivf->dims], ivf->lists[c].vectors,
+                (size_t) sizes[c] * ivf->dims * sizeof(double));
+        at += sizes[c];
+    }
+
+    for (i = 0; i < 5; i++) {
+        entries[i].name = IvfNames[i];
+    }
+    entries[0].dtype = MODEL_I32;
+    entries[0].rows = 1;
+    entries[0].cols = IVF_HEADER;
+    entries[0].data = header;
+    entries[1].dtype = MODEL_F64;
+    entries[1].rows = ivf->nlist;
+    entries[1].cols = ivf->dims;
+    entries[1].data = ivf->centroids;
+    entries[2].dtype = MODEL_I32;
+    entries[2].rows = ivf->nlist;
+    entries[2].cols = 1;
+    entries[2].data = sizes;
+    entries[3].dtype = MODEL_I32;
+    entries[3].rows = total;
+    entries[3].cols = 1;
+    entries[3].data = ids;
+    entries[4].dtype = MODEL_F64;
+    entries[4].rows = total;
+    entries[4].cols = ivf->dims;
+    entries[4].data = vectors;
+
+    status = model_write(path, entries, 5);
+
+    free(sizes);
+    free(ids);
+    free(vectors);
+    return status;
+}
+
+/*
+ * Reads an index written by ivf_save; the lists are copied out of the file
+ * so that they can keep growing. Rejects ids outside [0, count)
+ */
+ivf_t *ivf_load(const char *path)
+{
+    model_t *file = model_map(path);
+    const int *header, *sizes, *ids;
+    const double *centroids, *vectors;
+    int rows[5], cols[5];
+    long total = 0;
+    ivf_list_t *L;
+    ivf_t *ivf;
+    int c, i;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    header = (const int *) model_data(file, IvfNames[0], MODEL_I32, &rows[0], &cols[0]);
+    centroids = (const double *) model_data(file, IvfNames[1], MODEL_F64, &rows[1], &cols[1]);
+    sizes = (const int *) model_data(file, IvfNames[2], MODEL_I32, &rows[2], &cols[2]);
+    ids = (const int *) model_data(file, IvfNames[3], MODEL_I32, &rows[3], &cols[3]);
+    vectors = (const double *) model_data(file, IvfNames[4], MODEL_F64, &rows[4], &cols[4]);
+
+    if (header != NULL && centroids != NULL && sizes != NULL && ids != NULL && vectors != NULL
+            && cols[0] == IVF_HEADER && rows[1] == header[1] && cols[1] == header[0]
+            && rows[2] == header[1] && cols[4] == header[0] && rows[3] == rows[4]) {
+        for (c = 0; c < header[1] && total >= 0; c++) {
+            total = sizes[c] < 0 ? -1 : total + sizes[c];
+        }
+        for (i = 0; i < rows[3] && total > 0; i++) {
+            if (ids[i] < 0 || ids[i] >= header[3]) {
+                total = -1;
+            }
+        }
+    }
+    if (total == 0 || total != rows[3]) {
+        fprintf(stderr, "%s: not an IVF index\n", path);
+        model_unmap(file);
+        return NULL;
+    }
+
+    ivf = ivf_create(header[0], header[1], header[2], centroids);
+    ivf->count = header[3];
+    for (c = 0; c < ivf->nlist; c++) {
+        L = &ivf->lists[c];
+        L->size = L->capacity = sizes[c];
+        L->ids = (int *) malloc((L->size + 1) * sizeof(int));
+        L->vectors = (double *) malloc(((size_t) L->size * ivf->dims + 1) * sizeof(double));
+        memcpy(L->ids, ids, L->size * sizeof(int));
+        memcpy(L->vectors, vectors, (size_t) L->size * ivf->dims * sizeof(double));
+        ids += L->size;
+        vectors += (size_t) L->size * ivf->dims;
+    }
+
+    model_unmap(file);
+    return ivf;
+}
+
+void ivf_destroy(ivf_t *ivf)
+{
+    int c;
+
+    for (c = 0; c < ivf->nlist; c++) {
+        free(ivf->lists[c].ids);
+        free(ivf->lists[c].vectors);
+    }
+    free(ivf->lists);
+    free(ivf->centroids);
+    free(ivf);
+}
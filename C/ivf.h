@@ -0,0 +1,64 @@
+/*
+ * IVF (inverted file) index over the Fisher-space gallery
+ *
+ * k-means splits Fisher space into nlist cells. Every gallery vector is
+ * stored, with its gallery index, in the inverted list of its nearest cell,
+ * or of its `replicas` nearest cells so that vectors near a border are
+ * found from either side. A query scores the nlist centroids, then scans
+ * only the lists of its nprobe nearest cells: about P * nprobe / nlist
+ * vectors instead of P.
+ *
+ * Lists grow by doubling, so enrolling a new person (ivf_add) is one
+ * centroid scan and an append. The index is saved next to the model as
+ * ModelPath IVF_SUFFIX with model_write.
+ */
+
+#ifndef __IVF_H__
+#define __IVF_H__
+
+#include "matrix.h"
+#include "topk.h"
+
+// index file of a model is ModelPath IVF_SUFFIX
+#define IVF_SUFFIX ".ivf"
+
+// lists scanned per query unless the caller asks otherwise
+#define IVF_NPROBE 8
+
+// Lloyd iterations when training the centroids
+#define IVF_ITERATIONS 25
+
+typedef struct {
+    int size;
+    int capacity;
+    int *ids;                       // gallery index of each vector
+    double *vectors;                // size x dims
+} ivf_list_t;
+
+typedef struct {
+    int dims;
+    int nlist;                      // cells / inverted lists
+    int replicas;                   // lists each vector is stored in
+    int count;                      // vectors added
+    double *centroids;              // nlist x dims
+    ivf_list_t *lists;
+} ivf_t;
+
+// trains nlist centroids on the gallery with threads workers (<= 0 for one
+// per online CPU) and adds every gallery image
+ivf_t *ivf_build(const MATRIX *ProjectedImages_Fisher, int nlist, int replicas, int threads);
+
+// enrolls one more vector under gallery index id
+void ivf_add(ivf_t *ivf, const double *vector, int id);
+
+// k nearest vectors among the lists of the nprobe cells nearest to probe,
+// best first; returns the number of dimensions scored
+long ivf_search(const ivf_t *ivf, const double *probe, int k, int nprobe, match_t *matches);
+
+// writes / reads the index; 0 on success, NULL on error
+int ivf_save(const ivf_t *ivf, const char *path);
+ivf_t *ivf_load(const char *path);
+
+void ivf_destroy(ivf_t *ivf);
+
+#endif
@@ -0,0 +1,201 @@
+/*******************************************************************************
+ Parallel k-means
+
+ Initial centroids are k distinct points drawn with a fixed seed, so
+ training is reproducible. Every iteration starts one thread per slice of
+ the points; a thread assigns its points to the nearest centroid and
+ accumulates per-cluster sums and counts in its own buffers. The main
+ thread adds the buffers and divides. A cluster that ends up empty is
+ restarted at a random point, so all k stay in use.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <float.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kmeans.h"
+
+typedef struct {
+    const double *X;
+    const double *centroids;
+    int dims, k;
+    int start, end;                 // slice of points [start, end)
+    int *assignment;                // all n, only the slice is written
+    double *sums;                   // k x dims, this thread only
+    int *counts;                    // k
+    int changed;                    // points that moved to another cluster
+} kmeans_slice_t;
+
+static inline double kmeans_distance(const double *a, const double *b, int dims)
+{
+    double sum = 0, diff;
+    int d;
+
+    for (d = 0; d < dims; d++) {
+        diff = a[d] - b[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/*
+ * Nearest centroid by linear scan
+ */
+int kmeans_nearest(const double *centroids, int k, int dims, const double *x, double *distance)
+{
+    double best = DBL_MAX, d;
+    int nearest = 0;
+    int c;
+
+    for (c = 0; c < k; c++) {
+        d = kmeans_distance(x, &centroids[(size_t) c * dims], dims);
+        if (d < best) {
+            best = d;
+            nearest = c;
+        }
+    }
+    if (distance != NULL) {
+        *distance = best;
+    }
+    return nearest;
+}
+
+/*
+ * Assignment step over one slice of the points
+ */
+static void *kmeans_assign(void *arg)
+{
+    kmeans_slice_t *S = (kmeans_slice_t *) arg;
+    const double *x;
+    int i, c, d;
+
+    memset(S->sums, 0, (size_t) S->k * S->dims * sizeof(double));
+    memset(S->counts, 0, S->k * sizeof(int));
+    S->changed = 0;
+
+    for (i = S->start; i < S->end; i++) {
+        x = &S->X[(size_t) i * S->dims];
+        c = kmeans_nearest(S->centroids, S->k, S->dims, x, NULL);
+        if (c != S->assignment[i]) {
+            S->assignment[i] = c;
+            S->changed++;
+        }
+        S->counts[c]++;
+        for (d = 0; d < S->dims; d++) {
+            S->sums[(size_t) c * S->dims + d] += x[d];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Lloyd's algorithm
+ * X: n x dims points, row-major
+ * centroids: k x dims, written
+ */
+int kmeans(const double *X, int n, int dims, int k, int iterations, int threads,
+        double *centroids, int *assignment)
+{
+    kmeans_slice_t *slices;
+    pthread_t *workers;
+    int *assigned = (int *) malloc(n * sizeof(int));
+    int *counts = (int *) malloc(k * sizeof(int));
+    unsigned int seed = 42;
+    int it, t, c, d, i, j, changed;
+
+    if (n < k || k < 1) {
+        free(assigned);
+        free(counts);
+        return -1;
+    }
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > n) {
+        threads = n;
+    }
+
+    // k distinct points: a partial Fisher-Yates shuffle of the indices
+    for (i = 0; i < n; i++) {
+        assigned[i] = i;
+    }
+    for (c = 0; c < k; c++) {
+        j = c + rand_r(&seed) % (n - c);
+        i = assigned[c];
+        assigned[c] = assigned[j];
+        assigned[j] = i;
+        memcpy(&centroids[(size_t) c * dims], &X[(size_t) assigned[c] * dims], dims * sizeof(double));
+    }
+    for (i = 0; i < n; i++) {
+        assigned[i] = -1;
+    }
+
+    slices = (kmeans_slice_t *) malloc(threads * sizeof(kmeans_slice_t));
+    workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    for (t = 0; t < threads; t++) {
+        slices[t].X = X;
+        slices[t].centroids = centroids;
+        slices[t].dims = dims;
+        slices[t].k = k;
+        slices[t].start = (int) ((long) n * t / threads);
+        slices[t].end = (int) ((long) n * (t + 1) / threads);
+        slices[t].assignment = assigned;
+        slices[t].sums = (double *) malloc((size_t) k * dims * sizeof(double));
+        slices[t].counts = (int *) malloc(k * sizeof(int));
+    }
+
+    for (it = 0; it < iterations; it++) {
+        for (t = 0; t < threads; t++) {
+            pthread_create(&workers[t], NULL, kmeans_assign, &slices[t]);
+        }
+        for (t = 0; t < threads; t++) {
+            pthread_join(workers[t], NULL);
+        }
+
+        // reduce the per-thread sums into the new centroids
+        changed = 0;
+        memset(centroids, 0, (size_t) k * dims * sizeof(double));
+        memset(counts, 0, k * sizeof(int));
+        for (t = 0; t < threads; t++) {
+            changed += slices[t].changed;
+            for (c = 0; c < k; c++) {
+                counts[c] += slices[t].counts[c];
+                for (d = 0; d < dims; d++) {
+                    centroids[(size_t) c * dims + d] += slices[t].sums[(size_t) c * dims + d];
+                }
+            }
+        }
+        for (c = 0; c < k; c++) {
+            if (counts[c] == 0) {
+                memcpy(&centroids[(size_t) c * dims],
+                        &X[(size_t) (rand_r(&seed) % n) * dims], dims * sizeof(double));
+                changed++;
+                continue;
+            }
+            for (d = 0; d < dims; d++) {
+                centroids[(size_t) c * dims + d] /= counts[c];
+            }
+        }
+        if (changed == 0) {
+            it++;
+            break;
+        }
+    }
+
+    if (assignment != NULL) {
+        memcpy(assignment, assigned, n * sizeof(int));
+    }
+    for (t = 0; t < threads; t++) {
+        free(slices[t].sums);
+        free(slices[t].counts);
+    }
+    free(slices);
+    free(workers);
+    free(assigned);
+    free(counts);
+    return it;
+}
@@ -0,0 +1,26 @@
+/*
+ * Parallel k-means (Lloyd's algorithm)
+ *
+ * Shared by the gallery indexes that quantize Fisher space (ivf, pq). The
+ * points are split between threads for the assignment step; each thread
+ * sums its points per cluster in private buffers that are added up once
+ * per iteration, so threads never write to shared memory while assigning.
+ */
+
+#ifndef __KMEANS_H__
+#define __KMEANS_H__
+
+// clusters n points (row-major, n x dims) into k centroids (k x dims)
+// iterations: upper bound on Lloyd iterations; stops early once no point
+//             changes cluster
+// threads: <= 0 for one per online CPU
+// assignment: if not NULL, receives the cluster of every point
+// returns: iterations run, -1 if n < k
+int kmeans(const double *X, int n, int dims, int k, int iterations, int threads,
+        double *centroids, int *assignment);
+
+// index of the centroid nearest to x; its squared distance goes to
+// *distance if not NULL
+int kmeans_nearest(const double *centroids, int k, int dims, const double *x, double *distance);
+
+#endif
@@ -0,0 +1,171 @@
+/******************************************************************************
+ Load generator for fisherd
+
+ Usage: loadgen [-s socket] [-c clients] [-n requests] [-k k] [test_dir]
+
+ Starts clients threads, each with its own connection, that send requests
+ back to back as raw pixels, cycling through the test images (1.ppm ...
+ 30.ppm of test_dir, default ../LDAIMAGES/Test3). Reports throughput,
+ latency percentiles and the recognition rate of the answers.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "grayscale.h"
+#include "ppm.h"
+#include "protocol.h"
+
+#define TestDatabasePath "../LDAIMAGES/Test3"
+#define TestCount 30
+#define Class_population 4
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int correct;
+    int errors;
+    double *latency;                // seconds, one per request
+} client_t;
+
+static const char *socket_path = PROTO_SOCKET;
+static int requests = 1000;
+static int k = 1;
+static int width, height;
+static unsigned char *images[TestCount];
+static pthread_barrier_t start;
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void *client_main(void *arg)
+{
+    client_t *c = (client_t *) arg;
+    proto_match_t matches[PROTO_MAX_K];
+    proto_request_t req;
+    double t;
+    int fd, r, image;
+
+    memset(&req, 0, sizeof(req));
+    req.type = PROTO_PIXELS;
+    req.k = k;
+    req.width = width;
+    req.height = height;
+    req.length = width * height;
+
+    fd = proto_connect(socket_path);
+    pthread_barrier_wait(&start);
+    for (r = 0; r < requests; r++) {
+        image = (c->id + r) % TestCount;
+        t = now();
+        if (fd < 0 || proto_call(fd, &req, images[image], matches) < 1) {
+            c->errors++;
+            c->latency[r] = 0;
+            continue;
+        }
+        c->latency[r] = now() - t;
+        c->correct += image + 1 == matches[0].index / Class_population + 1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = TestDatabasePath;
+    int clients = 4;
+    char filename[PATH_MAX];
+    client_t *c;
+    PPMImage *img;
+    double t, *all;
+    long total, correct = 0, errors = 0;
+    int opt, i, j;
+
+    while ((opt = getopt(argc, argv, "s:c:n:k:")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'c': clients = atoi(optarg); break;
+        case 'n': requests = atoi(optarg); break;
+        case 'k': k = atoi(optarg); break;
+        default:
+            clients = 0;
+        }
+    }
+    if (optind < argc) {
+        dir = argv[optind];
+    }
+    if (clients < 1 || requests < 1 || k < 1 || k > PROTO_MAX_K) {
+        fprintf(stderr, "usage: %s [-s socket] [-c clients] [-n requests] [-k 1..%d] [test_dir]\n",
+                argv[0], PROTO_MAX_K);
+        return 1;
+    }
+
+    for (i = 0; i < TestCount; i++) {
+        snprintf(filename, sizeof(filename), "%s/%d.ppm", dir, i + 1);
+        img = ppm_image_constructor(filename);
+        grayscale(img);
+        width = img->width;
+        height = img->height;
+        images[i] = (unsigned char *) malloc(width * height);
+        for (j = 0; j < width * height; j++) {
+            images[i][j] = img->pixels[j].intensity;
+        }
+        ppm_image_destructor(img, 1);
+    }
+
+    c = (client_t *) calloc(clients, sizeof(client_t));
+    pthread_barrier_init(&start, NULL, clients + 1);
+    for (i = 0; i < clients; i++) {
+        c[i].id = i;
+        c[i].latency = (double *) malloc(requests * sizeof(double));
+        pthread_create(&c[i].thread, NULL, client_main, &c[i]);
+    }
+    pthread_barrier_wait(&start);
+    t = now();
+    for (i = 0; i < clients; i++) {
+        pthread_join(c[i].thread, NULL);
+    }
+    t = now() - t;
+
+    total = (long) clients * requests;
+    all = (double *) malloc(total * sizeof(double));
+    for (i = 0; i < clients; i++) {
+        memcpy(&all[(long) i * requests], c[i].latency, requests * sizeof(double));
+        correct += c[i].correct;
+        errors += c[i].errors;
+        free(c[i].latency);
+    }
+    qsort(all, total, sizeof(double), compare_double);
+
+    printf("%d clients x %d requests in %.3f s: %.1f requests/s\n", clients, requests, t, total / t);
+    printf("latency p50 %.1f us  p99 %.1f us  max %.1f us\n", all[total / 2] * 1e6,
+            all[total * 99 / 100] * 1e6, all[total - 1] * 1e6);
+    printf("%ld correct, %ld wrong, %ld errors\n", correct, total - correct - errors, errors);
+
+    free(all);
+    free(c);
+    for (i = 0; i < TestCount; i++) {
+        free(images[i]);
+    }
+    return errors != 0;
+}
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include "hugepage.h"
 #include "matrix.h"
 
 /*
@@ -11,7 +12,7 @@ MATRIX * matrix_constructor(int rows, int cols)
     int i;
     MATRIX * M = (MATRIX *) malloc(sizeof(MATRIX));
     double ** data = (double **) malloc(rows * sizeof(double *));
-    double * datap = (double *) malloc(rows * cols * sizeof(double));
+    double * datap = (double *) hugepage_alloc((size_t) rows * cols * sizeof(double));
     M->rows = rows;
     M->cols = cols;
 
@@ -71,12 +72,41 @@ MATRIX * matrix_mean(MATRIX * A)
  */
 void matrix_destructor(MATRIX * M)
 {
-    free(*M->data);
+    hugepage_free(*M->data);
     free(M->data);
     free(M);
     return;
 }
 
+/*
+ * Returns a MATRIX * whose rows point into memory owned by someone else
+ * (e.g., a mapped model file); no data is copied
+ * data: rows * cols contiguous doubles
+ */
+MATRIX * matrix_view(double *data, int rows, int cols)
+{
+    int i;
+    MATRIX * M = (MATRIX *) malloc(sizeof(MATRIX));
+    M->data = (double **) malloc(rows * sizeof(double *));
+    M->rows = rows;
+    M->cols = cols;
+
+    for (i = 0; i < rows; i++) {
+        M->data[i] = &data[i * cols];
+    }
+
+    return M;
+}
+
+/*
+ * Frees a MATRIX * created by matrix_view; the viewed data is left alone
+ */
+void matrix_view_destructor(MATRIX * M)
+{
+    free(M->data);
+    free(M);
+}
+
 
 /*matrix_bounded_mean
  * Arguments:   A           Matrix containing data to be averaged
@@ -90,16 +120,16 @@ void matrix_destructor(MATRIX * M)
 MATRIX *matrix_bounded_mean(MATRIX *A, int start_row, int end_row, int start_col, int end_col)
 {
     int i, j;
-    int sum;
+    double sum;
 
     MATRIX * B = matrix_constructor(end_row - start_row + 1, 1);
 
-    for (i = start_row; i <= end_row, i++) {
+    for (i = start_row; i <= end_row; i++) {
         sum = 0;
         for (j = start_col; j <= end_col; j++) {
             sum += (double) A->data[i][j];
         }
-        B->data[i][0] = (sum / (end_col - start_col + 1));
+        B->data[i - start_row][0] = (sum / (end_col - start_col + 1));
     }
 
     return B;
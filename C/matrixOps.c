@@ -8,6 +8,7 @@
 #include <math.h>
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_eigen.h>
+#include "hugepage.h"
 #include "matrixOps.h"
 
 
@@ -57,7 +58,8 @@ matrix_t * m_initialize (int mode, int numRows, int numCols) {
 	M->span = numCols;
 	M->type = PARENT; // not submatrix
 	if (mode == ZEROS || mode == IDENTITY) {
-		M->data = (precision *) calloc (numRows * numCols, sizeof (precision));
+		M->data = (precision *) hugepage_alloc ((size_t) numRows * numCols * sizeof (precision));
+		memset (M->data, 0, (size_t) numRows * numCols * sizeof (precision));
 		if (mode == IDENTITY) {
 			assert (numRows == numCols);
 			for (i = 0; i < numRows; i++) {
@@ -65,7 +67,7 @@ matrix_t * m_initialize (int mode, int numRows, int numCols) {
 			}
 		}
 	} else if (mode == UNDEFINED || mode == ONES || mode == FILL){
-		M->data = (precision *) malloc (numRows * numCols * sizeof (precision));
+		M->data = (precision *) hugepage_alloc ((size_t) numRows * numCols * sizeof (precision));
 		if (mode == ONES) {
 			for (i = 0; i < numRows * numCols; i++) {
 				M->data[i] = 1.0;
@@ -94,7 +96,7 @@ matrix_t * m_initialize (int mode, int numRows, int numCols) {
 *******************************************************************************/
 void m_free (matrix_t *M) {
 	if (M->type != SUBMATRIX) {
-		free (M->data);
+		hugepage_free (M->data);
 	}
 	free (M);
 }
@@ -199,7 +201,7 @@ matrix_t * m_copy (matrix_t *M) {
 	C->numRows = M->numRows;
 	C->numCols = M->numCols;
 	
-	C->data = (precision *) malloc (C->numRows * C->numCols * sizeof (precision));
+	C->data = (precision *) hugepage_alloc ((size_t) C->numRows * C->numCols * sizeof (precision));
 	if (M->numCols == M->span) {
 		memcpy(C->data, M->data, C->numRows * C->numCols * sizeof (precision));
 	} else {
@@ -0,0 +1,456 @@
+/*******************************************************************************
+ Trained model file
+
+ Replaces the "save output_faces.mat" step of the Matlab version and the
+ separate .mat files Recognition used to fread one double at a time. The
+ output of FisherfaceCore is written once after training; readers mmap the
+ file and get zero-copy views of the sections they use.
+
+ The mapping is MAP_SHARED and never written, so it is backed directly by
+ the page cache: N processes serving one model hold one copy of it, and a
+ new process finds the pages already resident. A file mapping only gets
+ huge pages when its address and file offset agree modulo the huge page
+ size and the kernel can back the file with them (tmpfs mounted with
+ huge=, or CONFIG_READ_ONLY_THP_FOR_FS, where khugepaged collapses
+ read-only file pages after MADV_HUGEPAGE); model_use_hugepages arranges
+ the alignment and the advice, and the kernel falls back to 4 KB pages
+ where it cannot.
+*******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matrix.h"
+#include "model.h"
+
+#define PAD(n) (((n) + MODEL_ALIGN - 1) & ~(unsigned long long) (MODEL_ALIGN - 1))
+
+static int use_hugepages = 0;
+
+static unsigned int crc32(const void *data, size_t bytes);
+static void *model_map_aligned(int fd, size_t length);
+static int model_write_padded(FILE *out, const void *data, unsigned long long bytes);
+
+/*
+ * Size of one element of a section type
+ */
+size_t model_dtype_size(int dtype)
+{
+    switch (dtype) {
+    case MODEL_F64: return sizeof(double);
+    case MODEL_F32: return sizeof(float);
+    case MODEL_I32: return sizeof(int);
+    case MODEL_I8: return sizeof(signed char);
+    case MODEL_U8: return sizeof(unsigned char);
+    case MODEL_U64: return sizeof(unsigned long long);
+    default: return 0;
+    }
+}
+
+/*
+ * Writes a model file. The file is written under a temporary name and
+ * renamed over path, so processes that have the old file mapped keep
+ * reading it intact and a reader never sees a half-written model
+ * path: file to create (replaced if it exists)
+ * entries: sections to save
+ * count: number of sections
+ * returns: 0 on success, -1 on error
+ */
+int model_write(const char *path, const model_entry_t *entries, int count)
+{
+    model_header_t header;
+    model_section_t *table;
+    unsigned long long offset;
+    char *temp;
+    FILE *out;
+    int i;
+    int ok = 1;
+
+    // lay out the file: header, table, then every data block aligned
+    table = (model_section_t *) calloc(count, sizeof(model_section_t));
+    offset = PAD(sizeof(header)) + PAD(count * sizeof(model_section_t));
+    for (i = 0; i < count; i++) {
+        if (model_dtype_size(entries[i].dtype) == 0
+                || strlen(entries[i].name) >= MODEL_NAMELEN) {
+            fprintf(stderr, "model_write: bad section %s\n", entries[i].name);
+            free(table);
+            return -1;
+        }
+        strncpy(table[i].name, entries[i].name, MODEL_NAMELEN - 1);
+        table[i].dtype = entries[i].dtype;
+        table[i].rows = entries[i].rows;
+        table[i].cols = entries[i].cols;
+        table[i].bytes = (unsigned long long) entries[i].rows * entries[i].cols
+                * model_dtype_size(entries[i].dtype);
+        table[i].checksum = crc32(entries[i].data, table[i].bytes);
+        table[i].offset = offset;
+        offset += PAD(table[i].bytes);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.byte_order = MODEL_BYTE_ORDER;
+    header.count = count;
+    header.table_offset = PAD(sizeof(header));
+    header.table_checksum = crc32(table, count * sizeof(model_section_t));
+    header.file_size = offset;
+
+    temp = (char *) malloc(strlen(path) + 5);
+    sprintf(temp, "%s.tmp", path);
+    out = fopen(temp, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Unable to write %s: %s\n", temp, strerror(errno));
+        free(table);
+        free(temp);
+        return -1;
+    }
+
+    ok &= model_write_padded(out, &header, sizeof(header));
+    ok &= model_write_padded(out, table, count * sizeof(model_section_t));
+    for (i = 0; ok && i < count; i++) {
+        ok &= model_write_padded(out, entries[i].data, table[i].bytes);
+    }
+
+    ok &= fclose(out) == 0;
+    ok = ok && rename(temp, path) == 0;
+    free(table);
+    if (!ok) {
+        fprintf(stderr, "Unable to write %s\n", path);
+        remove(temp);
+        free(temp);
+        return -1;
+    }
+
+    free(temp);
+    return 0;
+}
+
+/*
+ * Writes a model file of double matrices
+ * path: file to create (overwritten if it exists)
+ * M: matrices to save
+ * names: name of each matrix
+ * count: number of matrices
+ * returns: 0 on success, -1 on error
+ */
+int model_save(const char *path, MATRIX * const *M, const char * const *names,
+        int count)
+{
+    model_entry_t *entries = (model_entry_t *) malloc(count * sizeof(model_entry_t));
+    int i, ret;
+
+    for (i = 0; i < count; i++) {
+        entries[i].name = names[i];
+        entries[i].dtype = MODEL_F64;
+        entries[i].rows = M[i]->rows;
+        entries[i].cols = M[i]->cols;
+        entries[i].data = *M[i]->data; // MATRIX data is contiguous
+    }
+
+    ret = model_write(path, entries, count);
+    free(entries);
+    return ret;
+}
+
+/*
+ * Reads copies of double matrices from a model file
+ * path: file written by model_write
+ * names: matrices to read
+ * count: number of names
+ * returns: array of count matrices in the order of names, NULL on error;
+ *          the caller destroys each matrix and frees the array
+ */
+MATRIX **model_load(const char *path, const char * const *names, int count)
+{
+    model_t *model = model_map(path);
+    const double *data;
+    MATRIX **M;
+    int rows, cols;
+    int i, j;
+
+    if (model == NULL) {
+        return NULL;
+    }
+
+    M = (MATRIX **) calloc(count, sizeof(MATRIX *));
+    for (i = 0; i < count; i++) {
+        data = (const double *) model_data(model, names[i], MODEL_F64, &rows, &cols);
+        if (data == NULL) {
+            fprintf(stderr, "%s: missing %s\n", path, names[i]);
+            for (j = 0; j < i; j++) {
+                matrix_destructor(M[j]);
+            }
+            free(M);
+            model_unmap(model);
+            return NULL;
+        }
+        M[i] = matrix_constructor(rows, cols);
+        memcpy(*M[i]->data, data, (size_t) rows * cols * sizeof(double));
+    }
+
+    model_unmap(model);
+    return M;
+}
+
+/*
+ * Maps a model file read-only. Only the header and section table are read
+ * here; section data is paged in when it is first used.
+ * path: file written by model_write
+ * returns: NULL on error
+ */
+model_t *model_map(const char *path)
+{
+    const model_header_t *header;
+    model_t *model;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(model_header_t)) {
+        fprintf(stderr, "%s is not a model file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    if (use_hugepages) {
+        map = model_map_aligned(fd, st.st_size);
+    } else {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    header = (const model_header_t *) map;
+    if (memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not a model file\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if (header->byte_order != MODEL_BYTE_ORDER || header->version != MODEL_VERSION) {
+        fprintf(stderr, "%s: unsupported model version %u or byte order; retrain\n",
+                path, header->version);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if (header->file_size != (unsigned long long) st.st_size
+            || header->table_offset + header->count * sizeof(model_section_t)
+                    > (unsigned long long) st.st_size
+            || crc32((const char *) map + header->table_offset,
+                    header->count * sizeof(model_section_t)) != header->table_checksum) {
+        fprintf(stderr, "%s: truncated or corrupt section table\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    model = (model_t *) malloc(sizeof(model_t));
+    model->map = map;
+    model->length = st.st_size;
+    model->header = header;
+    model->table = (const model_section_t *) ((const char *) map + header->table_offset);
+    model->verified = (atomic_schar *) calloc(header->count, sizeof(atomic_schar));
+
+    return model;
+}
+
+/*
+ * Maps length bytes of fd shared at a MODEL_HUGEPAGE boundary, so that
+ * every 2 MB of the file can be backed by one huge page, and advises the
+ * kernel to do so. An address range with room for the alignment is
+ * reserved first and trimmed around the file mapping.
+ * returns: the mapping, MAP_FAILED on error
+ */
+static void *model_map_aligned(int fd, size_t length)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = (length + page - 1) / page * page;
+    char *reserve, *map;
+
+    reserve = (char *) mmap(NULL, end + MODEL_HUGEPAGE, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserve == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    map = (char *) (((size_t) reserve + MODEL_HUGEPAGE - 1) & ~(MODEL_HUGEPAGE - 1));
+    if (mmap(map, length, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(reserve, end + MODEL_HUGEPAGE);
+        return MAP_FAILED;
+    }
+    if (map > reserve) {
+        munmap(reserve, map - reserve);
+    }
+    if (reserve + end + MODEL_HUGEPAGE > map + end) {
+        munmap(map + end, reserve + end + MODEL_HUGEPAGE - (map + end));
+    }
+    madvise(map, length, MADV_HUGEPAGE);
+    return map;
+}
+
+void model_use_hugepages(int enable)
+{
+    use_hugepages = enable;
+}
+
+/*
+ * Unmaps a model
+ */
+void model_unmap(model_t *model)
+{
+    if (model == NULL) {
+        return;
+    }
+    munmap(model->map, model->length);
+    free(model->verified);
+    free(model);
+}
+
+/*
+ * Looks up a section by name
+ * returns: the section table entry, NULL if there is none
+ */
+const model_section_t *model_find(const model_t *model, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < model->header->count; i++) {
+        if (strncmp(model->table[i].name, name, MODEL_NAMELEN) == 0) {
+            return &model->table[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Zero-copy access to the data of a section. The checksum of a section is
+ * verified the first time it is asked for; this is the point where its
+ * pages are faulted in.
+ * model: the mapped model
+ * name: section name
+ * dtype: expected element type
+ * rows, cols: set to the dimensions of the section (may be NULL)
+ * returns: pointer into the mapping, NULL if missing, mistyped or corrupt
+ */
+const void *model_data(model_t *model, const char *name, int dtype,
+        int *rows, int *cols)
+{
+    const model_section_t *S = model_find(model, name);
+    const char *data;
+    int index, verified;
+
+    if (S == NULL || S->dtype != (unsigned int) dtype) {
+        return NULL;
+    }
+    if (S->offset % MODEL_ALIGN != 0 || S->offset + S->bytes > model->length
+            || S->bytes != (unsigned long long) S->rows * S->cols * model_dtype_size(dtype)) {
+        return NULL;
+    }
+
+    data = (const char *) model->map + S->offset;
+    index = S - model->table;
+    // several threads may check the same section at once; they compute
+    // the same result, so the last store winning is harmless
+    verified = atomic_load_explicit(&model->verified[index], memory_order_relaxed);
+    if (verified == 0) {
+        madvise((void *) ((size_t) data & ~(size_t) (sysconf(_SC_PAGESIZE) - 1)),
+                S->bytes + ((size_t) data & (sysconf(_SC_PAGESIZE) - 1)), MADV_WILLNEED);
+        verified = crc32(data, S->bytes) == S->checksum ? 1 : -1;
+        atomic_store_explicit(&model->verified[index], verified, memory_order_relaxed);
+        if (verified < 0) {
+            fprintf(stderr, "model: checksum mismatch in section %s\n", name);
+        }
+    }
+    if (verified < 0) {
+        return NULL;
+    }
+
+    if (rows != NULL) {
+        *rows = S->rows;
+    }
+    if (cols != NULL) {
+        *cols = S->cols;
+    }
+    return data;
+}
+
+/*
+ * Zero-copy MATRIX view of a double section
+ * returns: a view to be released with matrix_view_destructor, NULL on error
+ */
+MATRIX *model_matrix(model_t *model, const char *name)
+{
+    const double *data;
+    int rows, cols;
+
+    data = (const double *) model_data(model, name, MODEL_F64, &rows, &cols);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    // the mapping is read-only; MATRIX has no const flavour
+    return matrix_view((double *) data, rows, cols);
+}
+
+static unsigned int crc32_table[256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fills crc32_table; run once, by whichever thread computes a CRC first
+ */
+static void crc32_init(void)
+{
+    unsigned int c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+}
+
+/*
+ * CRC-32 (IEEE 802.3, reflected) of a block of memory
+ */
+static unsigned int crc32(const void *data, size_t bytes)
+{
+    const unsigned int *table = crc32_table;
+    const unsigned char *p = (const unsigned char *) data;
+    unsigned int crc = 0xFFFFFFFFu;
+
+    pthread_once(&crc32_once, crc32_init);
+
+    while (bytes--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/*
+ * Writes bytes of data followed by zeros up to the next MODEL_ALIGN boundary
+ * returns: 1 on success, 0 on error
+ */
+static int model_write_padded(FILE *out, const void *data, unsigned long long bytes)
+{
+    static const char zeros[MODEL_ALIGN];
+    unsigned long long pad = PAD(bytes) - bytes;
+
+    return fwrite(data, 1, bytes, out) == bytes
+            && fwrite(zeros, 1, pad, out) == pad;
+}
@@ -0,0 +1,123 @@
+/*
+ * Trained model file
+ *
+ * A model is a set of named, typed matrices in one binary file. The file
+ * starts with a header and a section table; every section starts on a 64
+ * byte boundary, so once the file is mmapped each matrix can be used in
+ * place without copying. Sections are only touched (and their checksum
+ * verified) the first time they are asked for, so matrices a program never
+ * uses are never paged in.
+ *
+ * File layout (version 2):
+ *     model_header_t                       - padded to MODEL_ALIGN
+ *     model_section_t[count]               - section table, 64 bytes each
+ *     section data                         - row-major, each block padded
+ *                                            to MODEL_ALIGN
+ *
+ * All integers and data are stored in the byte order of the host that
+ * wrote the file; byte_order lets a reader on another host detect that.
+ */
+
+#ifndef __MODEL_H__
+#define __MODEL_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "matrix.h"
+
+#define MODEL_MAGIC "LDAMODEL"
+#define MODEL_VERSION 2
+#define MODEL_BYTE_ORDER 0x01020304
+#define MODEL_ALIGN 64
+#define MODEL_NAMELEN 32
+
+// alignment of the mapping when huge pages are asked for (x86-64 PMD size)
+#define MODEL_HUGEPAGE (2UL << 20)
+
+// element types of a section
+#define MODEL_F64 1
+#define MODEL_F32 2
+#define MODEL_I32 3
+#define MODEL_I8 4
+#define MODEL_U8 5
+#define MODEL_U64 6
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order;        // MODEL_BYTE_ORDER as written by the host
+    unsigned int count;             // number of sections
+    unsigned int table_checksum;    // crc32 of the section table
+    unsigned long long table_offset;
+    unsigned long long file_size;
+} model_header_t;
+
+typedef struct {
+    char name[MODEL_NAMELEN];
+    unsigned int dtype;             // MODEL_F64, ...
+    unsigned int checksum;          // crc32 of the data block
+    int rows;
+    int cols;
+    unsigned long long offset;      // from the start of the file
+    unsigned long long bytes;       // size of the data block, without padding
+} model_section_t;
+
+// one section to be written by model_write
+typedef struct {
+    const char *name;               // at most MODEL_NAMELEN - 1 characters
+    int dtype;
+    int rows;
+    int cols;
+    const void *data;               // rows * cols contiguous elements
+} model_entry_t;
+
+// a mapped model file
+typedef struct {
+    void *map;
+    size_t length;
+    const model_header_t *header;
+    const model_section_t *table;
+    atomic_schar *verified;         // per section: 0 unchecked, 1 ok, -1 corrupt;
+                                    // threads may race to fill it (same result)
+} model_t;
+
+// size in bytes of one element of dtype, 0 if unknown
+size_t model_dtype_size(int dtype);
+
+// writes count sections to path (via a temporary file renamed over it, so
+// mappings of the old file stay valid); returns 0 on success
+int model_write(const char *path, const model_entry_t *entries, int count);
+
+// writes count double matrices, M[i] named names[i]; returns 0 on success
+int model_save(const char *path, MATRIX * const *M, const char * const *names,
+        int count);
+
+// reads copies of the matrices named names[0..count-1], in that order;
+// returns NULL if the file is unreadable or a matrix is missing
+MATRIX **model_load(const char *path, const char * const *names, int count);
+
+// maps a model file read-only and shared, so every process mapping the
+// same file uses the same physical pages; NULL on error
+model_t *model_map(const char *path);
+
+// makes later model_map calls align the mapping to MODEL_HUGEPAGE and ask
+// for transparent huge pages (0 to go back to normal pages)
+void model_use_hugepages(int enable);
+
+// unmaps a model; views into it become invalid
+void model_unmap(model_t *model);
+
+// section table entry of name, NULL if there is none
+const model_section_t *model_find(const model_t *model, const char *name);
+
+// zero-copy pointer to the data of a section of the given dtype; verifies
+// the checksum on first use. NULL if missing, of another type or corrupt
+const void *model_data(model_t *model, const char *name, int dtype,
+        int *rows, int *cols);
+
+// zero-copy MATRIX view of a MODEL_F64 section; release it with
+// matrix_view_destructor. NULL if missing or corrupt
+MATRIX *model_matrix(model_t *model, const char *name);
+
+#endif
@@ -0,0 +1,93 @@
+// Model file unit test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "matrix.h"
+#include "model.h"
+
+#define TEST_PATH "model_unit.model"
+
+int main()
+{
+    MATRIX *A = matrix_constructor(3, 5);
+    MATRIX *B = matrix_constructor(7, 1);
+    MATRIX *names_M[2];
+    const char *names[2] = { "A", "B" };
+    unsigned char bytes[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    model_entry_t entries[3];
+    model_t *model;
+    MATRIX *V;
+    MATRIX **L;
+    const unsigned char *u8;
+    int i, j, rows, cols;
+    FILE *f;
+
+    for (i = 0; i < A->rows; i++) {
+        for (j = 0; j < A->cols; j++) {
+            A->data[i][j] = i * 10 + j;
+        }
+    }
+    for (i = 0; i < B->rows; i++) {
+        B->data[i][0] = -i;
+    }
+
+    names_M[0] = A;
+    names_M[1] = B;
+    assert(model_save(TEST_PATH, names_M, names, 2) == 0); printf("save passed\n");
+
+    L = model_load(TEST_PATH, names, 2);
+    assert(L != NULL); printf("load passed\n");
+    assert(L[0]->rows == 3 && L[0]->cols == 5 && L[1]->rows == 7); printf("dimensions passed\n");
+    assert(memcmp(*L[0]->data, *A->data, 15 * sizeof(double)) == 0); printf("data passed\n");
+    matrix_destructor(L[0]);
+    matrix_destructor(L[1]);
+    free(L);
+
+    entries[0].name = "A"; entries[0].dtype = MODEL_F64;
+    entries[0].rows = 3; entries[0].cols = 5; entries[0].data = *A->data;
+    entries[1].name = "bytes"; entries[1].dtype = MODEL_U8;
+    entries[1].rows = 2; entries[1].cols = 5; entries[1].data = bytes;
+    entries[2].name = "B"; entries[2].dtype = MODEL_F64;
+    entries[2].rows = 7; entries[2].cols = 1; entries[2].data = *B->data;
+    assert(model_write(TEST_PATH, entries, 3) == 0); printf("write passed\n");
+
+    model = model_map(TEST_PATH);
+    assert(model != NULL); printf("map passed\n");
+    assert(model_find(model, "missing") == NULL); printf("find passed\n");
+    for (i = 0; i < 3; i++) {
+        assert(model->table[i].offset % MODEL_ALIGN == 0);
+    }
+    printf("alignment passed\n");
+    assert(model_data(model, "bytes", MODEL_F64, NULL, NULL) == NULL); printf("dtype check passed\n");
+    u8 = (const unsigned char *) model_data(model, "bytes", MODEL_U8, &rows, &cols);
+    assert(u8 != NULL && rows == 2 && cols == 5 && u8[9] == 9); printf("u8 section passed\n");
+    V = model_matrix(model, "B");
+    assert(V != NULL && V->rows == 7 && V->data[6][0] == -6); printf("view passed\n");
+    matrix_view_destructor(V);
+    model_unmap(model);
+
+    // flip one byte of the data of "B" and check it is caught
+    model = model_map(TEST_PATH);
+    i = (int) model->table[2].offset;
+    model_unmap(model);
+    f = fopen(TEST_PATH, "r+b");
+    fseek(f, i, SEEK_SET);
+    fputc(0x55, f);
+    fclose(f);
+    model = model_map(TEST_PATH);
+    assert(model != NULL);
+    V = model_matrix(model, "A");
+    assert(V != NULL);
+    matrix_view_destructor(V);
+    assert(model_matrix(model, "B") == NULL); printf("checksum passed\n");
+    model_unmap(model);
+
+    remove(TEST_PATH);
+    matrix_destructor(A);
+    matrix_destructor(B);
+
+    return 0;
+}
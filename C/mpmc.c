@@ -0,0 +1,180 @@
+/*******************************************************************************
+ Lock-free job queue and futex wake-ups
+
+ Cell i of lap L has sequence i + L * capacity while it is free and one
+ more once it holds an item. A producer that finds the cell at head free
+ claims it by advancing head with a compare-and-swap, copies the item in
+ and publishes it with a release store of the sequence; a consumer does
+ the mirror image at tail and frees the cell for the next lap. The
+ positions are on separate cache lines, so producers and consumers only
+ meet on the cells themselves.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "mpmc.h"
+
+#define CELL(Q, pos) ((atomic_size_t *) &(Q)->cells[((pos) & (Q)->mask) * (Q)->stride])
+
+static long futex(void *word, int op, int value)
+{
+    return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
+
+/*
+ * Allocates the cells
+ * capacity: rounded up to a power of two
+ * size: bytes copied per item
+ */
+int mpmc_init(mpmc_t *Q, size_t capacity, size_t size)
+{
+    size_t n = 2, i;
+
+    while (n < capacity) {
+        n *= 2;
+    }
+    Q->mask = n - 1;
+    Q->size = size;
+    Q->stride = (sizeof(atomic_size_t) + size + 7) / 8 * 8;
+    if (posix_memalign((void **) &Q->cells, 64, n * Q->stride) != 0) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        atomic_init(CELL(Q, i), i);
+    }
+    atomic_init(&Q->head, 0);
+    atomic_init(&Q->tail, 0);
+    return 0;
+}
+
+void mpmc_destroy(mpmc_t *Q)
+{
+    free(Q->cells);
+}
+
+int mpmc_push(mpmc_t *Q, const void *item)
+{
+    size_t pos = atomic_load_explicit(&Q->head, memory_order_relaxed);
+    atomic_size_t *cell;
+    size_t seq;
+    long diff;
+
+    for (;;) {
+        cell = CELL(Q, pos);
+        seq = atomic_load_explicit(cell, memory_order_acquire);
+        diff = (long) seq - (long) pos;
+        if (diff == 0) {
+            // free for this lap: claim it (pos is reloaded on failure)
+            if (atomic_compare_exchange_weak_explicit(&Q->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // still holds last lap's item: full
+        } else {
+            pos = atomic_load_explicit(&Q->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(cell + 1, item, Q->size);
+    atomic_store_explicit(cell, pos + 1, memory_order_release);
+    return 0;
+}
+
+int mpmc_pop(mpmc_t *Q, void *item)
+{
+    size_t pos = atomic_load_explicit(&Q->tail, memory_order_relaxed);
+    atomic_size_t *cell;
+    size_t seq;
+    long diff;
+
+    for (;;) {
+        cell = CELL(Q, pos);
+        seq = atomic_load_explicit(cell, memory_order_acquire);
+        diff = (long) seq - (long) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&Q->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // not filled yet: empty
+        } else {
+            pos = atomic_load_explicit(&Q->tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(item, cell + 1, Q->size);
+    atomic_store_explicit(cell, pos + Q->mask + 1, memory_order_release);
+    return 0;
+}
+
+void event_init(event_t *E)
+{
+    atomic_init(&E->count, 0);
+    atomic_init(&E->waiters, 0);
+    E->shared = 0;
+}
+
+void event_init_shared(event_t *E)
+{
+    event_init(E);
+    E->shared = 1;
+}
+
+unsigned event_prepare(event_t *E)
+{
+    return atomic_load(&E->count);
+}
+
+void event_wait(event_t *E, unsigned key)
+{
+    atomic_fetch_add(&E->waiters, 1);
+    // the kernel compares count with key before sleeping, so a signal
+    // after event_prepare makes this return at once
+    futex(&E->count, E->shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, key);
+    atomic_fetch_sub(&E->waiters, 1);
+}
+
+void event_signal(event_t *E)
+{
+    atomic_fetch_add(&E->count, 1);
+    if (atomic_load(&E->waiters) > 0) {
+        futex(&E->count, E->shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+void event_broadcast(event_t *E)
+{
+    atomic_fetch_add(&E->count, 1);
+    if (atomic_load(&E->waiters) > 0) {
+        futex(&E->count, E->shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+}
+
+void completion_init(completion_t *C, int jobs)
+{
+    atomic_init(&C->remaining, jobs);
+}
+
+void completion_done(completion_t *C)
+{
+    if (atomic_fetch_sub(&C->remaining, 1) == 1) {
+        futex(&C->remaining, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+}
+
+void completion_wait(completion_t *C)
+{
+    int remaining;
+
+    while ((remaining = atomic_load(&C->remaining)) != 0) {
+        futex(&C->remaining, FUTEX_WAIT_PRIVATE, remaining);
+    }
+}
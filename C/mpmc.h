@@ -0,0 +1,78 @@
+/*
+ * Lock-free job queue and futex wake-ups
+ *
+ * mpmc_t is a bounded multi-producer / multi-consumer ring (D. Vyukov's
+ * design). Every cell carries a sequence number that says whether it is
+ * free for the producer of a given lap or full for the consumer of that
+ * lap, so a push or pop is one compare-and-swap on the shared position
+ * plus a store to the cell; no thread ever holds a lock another one has
+ * to wait for. Items are copied in and out, size bytes each.
+ *
+ * event_t is an event count for sleeping while the queue is empty: a
+ * consumer reads the count, checks the queue once more and sleeps on the
+ * futex only if the count has not moved, so a push between the check and
+ * the sleep is never missed. Producers pay for a wake-up system call only
+ * when somebody sleeps.
+ *
+ * completion_t counts outstanding jobs; the thread that finishes the last
+ * one wakes the waiters through the same futex word.
+ */
+
+#ifndef __MPMC_H__
+#define __MPMC_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct {
+    size_t mask;                    // capacity - 1, capacity a power of 2
+    size_t size;                    // bytes per item
+    size_t stride;                  // bytes per cell (sequence + item)
+    unsigned char *cells;
+    _Alignas(64) atomic_size_t head; // next position to push
+    _Alignas(64) atomic_size_t tail; // next position to pop
+} mpmc_t;
+
+typedef struct {
+    atomic_uint count;              // futex word, bumped by every signal
+    atomic_int waiters;
+    int shared;                     // lives in memory shared between processes
+} event_t;
+
+typedef struct {
+    atomic_int remaining;           // futex word, jobs not finished yet
+} completion_t;
+
+// ring of at least capacity items of size bytes; 0 on success
+int mpmc_init(mpmc_t *Q, size_t capacity, size_t size);
+void mpmc_destroy(mpmc_t *Q);
+
+// 0 on success, -1 if the ring is full / empty
+int mpmc_push(mpmc_t *Q, const void *item);
+int mpmc_pop(mpmc_t *Q, void *item);
+
+void event_init(event_t *E);
+
+// event in a MAP_SHARED mapping, waited on and signalled from several
+// processes (the futex calls must not be process-private)
+void event_init_shared(event_t *E);
+
+// key to pass to event_wait, read before the last check of the condition
+unsigned event_prepare(event_t *E);
+
+// sleeps unless the event was signalled after event_prepare returned key
+void event_wait(event_t *E, unsigned key);
+
+// wakes one / every thread sleeping in event_wait
+void event_signal(event_t *E);
+void event_broadcast(event_t *E);
+
+void completion_init(completion_t *C, int jobs);
+
+// marks one job finished, waking the waiters after the last one
+void completion_done(completion_t *C);
+
+// blocks until every job has finished
+void completion_wait(completion_t *C);
+
+#endif
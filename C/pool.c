@@ -0,0 +1,243 @@
+/*******************************************************************************
+ Recognition worker pool
+
+ The model is shared read-only between the workers; everything a worker
+ writes while recognizing a probe lives in its own scratch_t, allocated once
+ in pool_create and 64 byte aligned so no two workers share a cache line.
+ Steady-state recognition therefore never touches the heap, and throughput
+ scales with the number of workers until memory bandwidth runs out.
+
+ Each worker allocates its scratch itself, after pinning itself if it is
+ pinned, so the pages it writes are on its own node.
+
+ Submitting and taking jobs goes through the lock-free ring, so producers
+ and workers never serialize on a mutex. A worker that finds the ring
+ empty spins briefly, then sleeps on the queued event; a full ring makes
+ the producer yield until a worker frees a cell.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Recognition.h"
+#include "mpmc.h"
+#include "pool.h"
+#include "topology.h"
+
+// empty polls before a worker goes to sleep
+#define POOL_SPIN 64
+
+struct pool_worker {
+    pthread_t thread;
+    pool_t *pool;
+    const recognizer_t *R;
+    int cpu;                        // -1 if not pinned
+    scratch_t *scratch;
+} __attribute__((aligned(64)));
+
+static pool_t *pool_alloc(int threads, int k);
+static void *pool_main(void *arg);
+
+/*
+ * Creates a pool and starts its workers
+ * R: the loaded model; must outlive the pool
+ * threads: number of workers, <= 0 for one per online CPU
+ * k: matches returned per probe
+ */
+pool_t *pool_create(const recognizer_t *R, int threads, int k)
+{
+    pool_t *pool;
+    int i;
+
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    pool = pool_alloc(threads, k);
+
+    for (i = 0; i < threads; i++) {
+        pool->workers[i].R = R;
+        pool->workers[i].cpu = -1;
+        pthread_create(&pool->workers[i].thread, NULL, pool_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+/*
+ * Creates a pool of workers pinned per NUMA node
+ * replicas: T->nodes recognizers, replicas[n] used on node n; they may be
+ *           the same one. They must outlive the pool
+ * T: the nodes and their CPUs
+ * threads: number of workers, <= 0 for one per CPU
+ * k: matches returned per probe
+ */
+pool_t *pool_create_pinned(const recognizer_t * const *replicas, const topology_t *T,
+        int threads, int k)
+{
+    pool_t *pool;
+    int i, node;
+
+    if (threads <= 0) {
+        for (threads = node = 0; node < T->nodes; node++) {
+            threads += T->count[node];
+        }
+    }
+    pool = pool_alloc(threads, k);
+
+    for (i = 0; i < threads; i++) {
+        node = i % T->nodes;
+        pool->workers[i].R = replicas[node];
+        pool->workers[i].cpu = topology_cpu(T, node, i / T->nodes);
+        pthread_create(&pool->workers[i].thread, NULL, pool_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+/*
+ * The pool and its queue, without workers
+ */
+static pool_t *pool_alloc(int threads, int k)
+{
+    pool_t *pool;
+    int i;
+
+    // the ring positions are cache-line aligned inside pool_t
+    if (posix_memalign((void **) &pool, 64, sizeof(pool_t)) != 0
+            || posix_memalign((void **) &pool->workers, 64, threads * sizeof(pool_worker_t)) != 0
+            || mpmc_init(&pool->queue, POOL_QUEUE, sizeof(pool_job_t)) != 0) {
+        fprintf(stderr, "pool_create: out of memory\n");
+        exit(1);
+    }
+    pool->k = k;
+    pool->threads = threads;
+    event_init(&pool->queued);
+    atomic_init(&pool->stop, 0);
+
+    for (i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+    }
+    return pool;
+}
+
+/*
+ * Queues one probe, yielding while the queue is full
+ * pixels, stride: the probe (see RecognizeProbe)
+ * matches: pool->k results, valid once the group has completed
+ * wait: group of the job, counting this job already
+ */
+void pool_submit(pool_t *pool, const unsigned char *pixels, int stride,
+        match_t *matches, pool_wait_t *wait)
+{
+    pool_job_t job;
+
+    job.pixels = pixels;
+    job.stride = stride;
+    job.matches = matches;
+    job.wait = wait;
+    while (mpmc_push(&pool->queue, &job) != 0) {
+        sched_yield();
+    }
+    event_signal(&pool->queued);
+}
+
+/*
+ * Blocks until every job of a group has been recognized
+ */
+void pool_wait(pool_t *pool, pool_wait_t *wait)
+{
+    completion_wait(wait);
+}
+
+/*
+ * Recognizes n probes on the pool and waits for them
+ * pixels: first intensity of each probe
+ * stride: bytes between intensities (same for all probes)
+ * n: number of probes
+ * matches: n * pool->k results
+ */
+void pool_recognize(pool_t *pool, const unsigned char * const *pixels, int stride,
+        int n, match_t *matches)
+{
+    pool_wait_t wait;
+    int j;
+
+    completion_init(&wait, n);
+    for (j = 0; j < n; j++) {
+        pool_submit(pool, pixels[j], stride, &matches[(size_t) j * pool->k], &wait);
+    }
+    pool_wait(pool, &wait);
+}
+
+/*
+ * Stops the workers once the queue is drained and frees the pool
+ */
+void pool_destroy(pool_t *pool)
+{
+    int i;
+
+    atomic_store(&pool->stop, 1);
+    event_broadcast(&pool->queued);
+
+    for (i = 0; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        DestroyScratch(pool->workers[i].scratch);
+    }
+
+    mpmc_destroy(&pool->queue);
+    free(pool->workers);
+    free(pool);
+}
+
+/*
+ * Takes the next job, sleeping while there is none
+ * returns: 0 with a job, -1 once the pool is stopped and drained
+ */
+static int pool_take(pool_t *pool, pool_job_t *job)
+{
+    unsigned key;
+    int spin;
+
+    for (;;) {
+        for (spin = 0; spin < POOL_SPIN; spin++) {
+            if (mpmc_pop(&pool->queue, job) == 0) {
+                return 0;
+            }
+        }
+        // read the event before the last look, so a push after it wakes us
+        key = event_prepare(&pool->queued);
+        if (mpmc_pop(&pool->queue, job) == 0) {
+            return 0;
+        }
+        if (atomic_load(&pool->stop)) {
+            return -1;
+        }
+        event_wait(&pool->queued, key);
+    }
+}
+
+/*
+ * Worker thread: takes jobs until the pool is stopped
+ */
+static void *pool_main(void *arg)
+{
+    pool_worker_t *self = (pool_worker_t *) arg;
+    pool_t *pool = self->pool;
+    pool_job_t job;
+
+    if (self->cpu >= 0) {
+        topology_pin(self->cpu);
+    }
+    self->scratch = CreateScratch(self->R);
+
+    while (pool_take(pool, &job) == 0) {
+        RecognizeProbe(self->R, job.pixels, job.stride, self->scratch, pool->k, job.matches);
+        completion_done(job.wait);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,75 @@
+/*
+ * Recognition worker pool
+ *
+ * A fixed set of threads shares one read-only recognizer_t. Each worker owns
+ * the scratch memory for a probe, allocated when the pool is created, so
+ * recognizing a probe does no heap allocation. Probes are handed to the
+ * workers through a bounded lock-free job queue (mpmc.h); idle workers
+ * sleep on a futex until a job is queued.
+ *
+ * pool_create_pinned is the NUMA form: workers are spread over the nodes,
+ * each pinned to a CPU of its node and recognizing with the recognizer
+ * given for that node, typically a ReplicateRecognizer copy placed there.
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdatomic.h>
+
+#include "Recognition.h"
+#include "mpmc.h"
+#include "topology.h"
+
+// jobs that can be queued before pool_submit has to wait
+#define POOL_QUEUE 1024
+
+// completion of a group of jobs
+typedef completion_t pool_wait_t;
+
+typedef struct {
+    const unsigned char *pixels;    // first intensity of the probe
+    int stride;                     // bytes between intensities
+    match_t *matches;               // k results, written by the worker
+    pool_wait_t *wait;              // group the job belongs to
+} pool_job_t;
+
+typedef struct pool_worker pool_worker_t;
+
+typedef struct {
+    int k;                          // matches per probe
+    int threads;
+    pool_worker_t *workers;
+
+    mpmc_t queue;                   // POOL_QUEUE pool_job_t
+    event_t queued;                 // signalled after every push
+    atomic_int stop;
+} pool_t;
+
+// starts threads workers over R, each returning k matches per probe;
+// threads <= 0 uses one per online CPU
+pool_t *pool_create(const recognizer_t *R, int threads, int k);
+
+// starts threads workers spread round-robin over the nodes of T; the
+// workers of node n are pinned to its CPUs and use replicas[n]. threads
+// <= 0 uses one per CPU of every node
+pool_t *pool_create_pinned(const recognizer_t * const *replicas, const topology_t *T,
+        int threads, int k);
+
+// queues one probe; the caller waits on wait after submitting the group.
+// wait must have been initialized with completion_init for the group
+void pool_submit(pool_t *pool, const unsigned char *pixels, int stride,
+        match_t *matches, pool_wait_t *wait);
+
+// blocks until every job of the group has finished
+void pool_wait(pool_t *pool, pool_wait_t *wait);
+
+// recognizes n probes (probe j at pixels[j]) and waits for all of them;
+// probe j's k matches go to matches[j*k]
+void pool_recognize(pool_t *pool, const unsigned char * const *pixels, int stride,
+        int n, match_t *matches);
+
+// stops and joins the workers
+void pool_destroy(pool_t *pool);
+
+#endif
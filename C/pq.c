@@ -0,0 +1,357 @@
+/*******************************************************************************
+ Product-quantized gallery
+
+ Each subspace has its own codebook, trained with the shared k-means on a
+ sample of the gallery. Scoring a probe builds the M x ksub distance table
+ in float once, then every block of PQ_LANES codes costs M table lookups
+ per vector and no arithmetic on the vectors themselves.
+
+ The classic in-register lookup (pshufb) only indexes 16-entry tables, so
+ it needs 4-bit codes; with one-byte codes the AVX2 kernel gathers the
+ PQ_LANES table entries of a subspace with one vpgatherdd-style gather
+ instead. The table is at most 16 x 256 floats, so the gathers hit L1.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "kmeans.h"
+#include "matrix.h"
+#include "model.h"
+#include "pq.h"
+#include "topk.h"
+
+// training points per subspace
+#define PQ_TRAIN 65536
+
+// Lloyd iterations per codebook
+#define PQ_ITERATIONS 25
+
+#define PQ_HEADER 4 // dims, M, ksub, count
+
+static const char * const PqNames[4] = {
+    "pq_header", "pq_start", "pq_codebooks", "pq_codes"
+};
+
+static void scan_c(const pq_t *pq, const unsigned char *codes, int blocks, const float *table,
+        float *distances);
+static void scan_avx2(const pq_t *pq, const unsigned char *codes, int blocks, const float *table,
+        float *distances);
+
+/*
+ * Chooses the widest kernel the CPU supports
+ */
+static void pq_pick(pq_t *pq)
+{
+    if (pq_use(pq, "avx2") != 0) {
+        pq_use(pq, "c");
+    }
+}
+
+/*
+ * Splits dims into M subspaces, the first dims % M one dimension longer;
+ * start[] also places each codebook
+ */
+static pq_t *pq_create(int dims, int M, int ksub, int count)
+{
+    pq_t *pq = (pq_t *) calloc(1, sizeof(pq_t));
+    int m;
+
+    pq->dims = dims;
+    pq->M = M;
+    pq->ksub = ksub;
+    pq->count = count;
+    pq->blocks = (count + PQ_LANES - 1) / PQ_LANES;
+    pq->start = (int *) malloc((M + 1) * sizeof(int));
+    for (m = 0; m <= M; m++) {
+        pq->start[m] = m * (dims / M) + (m < dims % M ? m : dims % M);
+    }
+    pq->codebooks = (double *) malloc((size_t) ksub * dims * sizeof(double));
+    pq->codes = (unsigned char *) calloc((size_t) pq->blocks * M * PQ_LANES, 1);
+    pq_pick(pq);
+    return pq;
+}
+
+/*
+ * Trains the codebooks and encodes the gallery
+ * ProjectedImages_Fisher: (C-1)xP gallery, one image per column
+ * M: subspaces, at most dims
+ * threads: k-means threads, <= 0 for one per online CPU
+ */
+pq_t *pq_build(const MATRIX *ProjectedImages_Fisher, int M, int threads)
+{
+    int dims = ProjectedImages_Fisher->rows;
+    int P = ProjectedImages_Fisher->cols;
+    int n = P < PQ_TRAIN ? P : PQ_TRAIN;
+    pq_t *pq;
+    double *sub, *codebook;
+    int m, len, i, d, code;
+
+    if (M > dims) {
+        M = dims;
+    }
+    pq = pq_create(dims, M, P < PQ_KSUB ? P : PQ_KSUB, P);
+    sub = (double *) malloc((size_t) P * dims * sizeof(double));
+
+    for (m = 0; m < M; m++) {
+        len = pq->start[m + 1] - pq->start[m];
+        codebook = &pq->codebooks[(size_t) pq->ksub * pq->start[m]];
+
+        // sample of this subspace (every (P / n)-th image), one row each;
+        // dimension d of subspace m is Fisher dimension m + d * M
+        for (i = 0; i < n; i++) {
+            for (d = 0; d < len; d++) {
+                sub[(size_t) i * len + d] =
+                        ProjectedImages_Fisher->data[m + d * M][(long) i * P / n];
+            }
+        }
+        kmeans(sub, n, len, pq->ksub, PQ_ITERATIONS, threads, codebook, NULL);
+
+        // encode every image against the trained codebook
+        for (i = 0; i < P; i++) {
+            for (d = 0; d < len; d++) {
+                sub[d] = ProjectedImages_Fisher->data[m + d * M][i];
+            }
+            code = kmeans_nearest(codebook, pq->ksub, len, sub, NULL);
+            pq->codes[((size_t) (i / PQ_LANES) * M + m) * PQ_LANES + i % PQ_LANES] = code;
+        }
+    }
+
+    free(sub);
+    return pq;
+}
+
+/*
+ * Asymmetric distance table: table[m * PQ_KSUB + c] is the squared
+ * distance from the probe's subspace m to centroid c of codebook m
+ */
+static void pq_table(const pq_t *pq, const double *probe, float *table)
+{
+    const double *centroid;
+    double sum, diff;
+    int m, c, d, len;
+
+    for (m = 0; m < pq->M; m++) {
+        len = pq->start[m + 1] - pq->start[m];
+        for (c = 0; c < pq->ksub; c++) {
+            centroid = &pq->codebooks[(size_t) pq->ksub * pq->start[m] + (size_t) c * len];
+            sum = 0;
+            for (d = 0; d < len; d++) {
+                diff = probe[m + d * pq->M] - centroid[d];
+                sum += diff * diff;
+            }
+            table[m * PQ_KSUB + c] = sum;
+        }
+    }
+}
+
+/*
+ * Approximate search, optionally re-ranked
+ * probe: dims values in Fisher space
+ * k: matches to return
+ * rerank: approximate candidates re-scored exactly; <= k for none
+ * ProjectedImages_Fisher: full gallery for the re-rank, may be NULL
+ * matches: k entries, best first
+ * returns: number of codes scanned
+ */
+long pq_search(const pq_t *pq, const double *probe, int k, int rerank,
+        const MATRIX *ProjectedImages_Fisher, match_t *matches)
+{
+    float table[pq->M * PQ_KSUB];
+    float distances[PQ_CHUNK * PQ_LANES];
+    int exact = rerank > k && ProjectedImages_Fisher != NULL;
+    match_t candidates[exact ? rerank : 1];
+    topk_t T;
+    double bound, sum, diff;
+    int b, n, j, i, d;
+
+    pq_table(pq, probe, table);
+
+    // PQ_CHUNK blocks per kernel call, then the heap sees their distances
+    topk_init(&T, exact ? candidates : matches, exact ? rerank : k);
+    for (b = 0; b < pq->blocks; b += n) {
+        n = pq->blocks - b < PQ_CHUNK ? pq->blocks - b : PQ_CHUNK;
+        pq->scan(pq, &pq->codes[(size_t) b * pq->M * PQ_LANES], n, table, distances);
+        bound = topk_bound(&T);
+        for (j = 0; j < n * PQ_LANES && b * PQ_LANES + j < pq->count; j++) {
+            if (distances[j] < bound) {
+                topk_push(&T, b * PQ_LANES + j, distances[j]);
+                bound = topk_bound(&T);
+            }
+        }
+    }
+    topk_sort(&T);
+
+    if (exact) {
+        topk_init(&T, matches, k);
+        for (i = 0; i < rerank && candidates[i].index >= 0; i++) {
+            sum = 0;
+            for (d = 0; d < pq->dims; d++) {
+                diff = probe[d] - ProjectedImages_Fisher->data[d][candidates[i].index];
+                sum += diff * diff;
+            }
+            topk_push(&T, candidates[i].index, sum);
+        }
+        topk_sort(&T);
+    }
+
+    return (long) pq->blocks * PQ_LANES;
+}
+
+/*
+ * Selects the table-scan kernel
+ * kernel: "c" or "avx2"
+ * returns: 0 on success, -1 if unknown or not supported by this CPU
+ */
+int pq_use(pq_t *pq, const char *kernel)
+{
+    __builtin_cpu_init();
+    if (strcmp(kernel, "c") == 0) {
+        pq->scan = scan_c;
+    } else if (strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        pq->scan = scan_avx2;
+    } else {
+        return -1;
+    }
+    pq->kernel = kernel;
+    return 0;
+}
+
+/*
+ * Portable kernel: M lookups per lane
+ */
+static void scan_c(const pq_t *pq, const unsigned char *codes, int blocks, const float *table,
+        float *distances)
+{
+    const unsigned char *block;
+    const float *sub;
+    int b, m, lane;
+
+    for (b = 0; b < blocks; b++, distances += PQ_LANES) {
+        block = codes + (size_t) b * pq->M * PQ_LANES;
+        for (lane = 0; lane < PQ_LANES; lane++) {
+            distances[lane] = 0;
+        }
+        for (m = 0, sub = table; m < pq->M; m++, block += PQ_LANES, sub += PQ_KSUB) {
+            for (lane = 0; lane < PQ_LANES; lane++) {
+                distances[lane] += sub[block[lane]];
+            }
+        }
+    }
+}
+
+/*
+ * AVX2: the 8 codes of a subspace are widened to 32-bit indices and their
+ * table entries fetched with one gather
+ */
+__attribute__((target("avx2")))
+static void scan_avx2(const pq_t *pq, const unsigned char *codes, int blocks, const float *table,
+        float *distances)
+{
+    size_t stride = (size_t) pq->M * PQ_LANES;
+    const unsigned char *block;
+    const float *sub;
+    __m256 acc0, acc1;
+    int b, m;
+
+    // two blocks at a time, so the gathers of one overlap those of the other
+    for (b = 0; b + 2 <= blocks; b += 2) {
+        block = codes + b * stride;
+        acc0 = _mm256_setzero_ps();
+        acc1 = _mm256_setzero_ps();
+        for (m = 0, sub = table; m < pq->M; m++, block += PQ_LANES, sub += PQ_KSUB) {
+            acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(sub,
+                    _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) block)), 4));
+            acc1 = _mm256_add_ps(acc1, _mm256_i32gather_ps(sub,
+                    _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (block + stride))), 4));
+        }
+        _mm256_storeu_ps(distances + b * PQ_LANES, acc0);
+        _mm256_storeu_ps(distances + (b + 1) * PQ_LANES, acc1);
+    }
+    if (b < blocks) {
+        scan_c(pq, codes + b * stride, 1, table, distances + b * PQ_LANES);
+    }
+}
+
+/*
+ * Writes the codebooks and the blocked codes as model sections
+ */
+int pq_save(const pq_t *pq, const char *path)
+{
+    int header[PQ_HEADER] = { pq->dims, pq->M, pq->ksub, pq->count };
+    model_entry_t entries[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        entries[i].name = PqNames[i];
+    }
+    entries[0].dtype = MODEL_I32;
+    entries[0].rows = 1;
+    entries[0].cols = PQ_HEADER;
+    entries[0].data = header;
+    entries[1].dtype = MODEL_I32;
+    entries[1].rows = pq->M + 1;
+    entries[1].cols = 1;
+    entries[1].data = pq->start;
+    entries[2].dtype = MODEL_F64;
+    entries[2].rows = pq->ksub;
+    entries[2].cols = pq->dims;
+    entries[2].data = pq->codebooks;
+    entries[3].dtype = MODEL_U8;
+    entries[3].rows = pq->blocks * pq->M;
+    entries[3].cols = PQ_LANES;
+    entries[3].data = pq->codes;
+
+    return model_write(path, entries, 4);
+}
+
+/*
+ * Reads a quantized gallery written by pq_save
+ */
+pq_t *pq_load(const char *path)
+{
+    model_t *file = model_map(path);
+    const int *header, *start;
+    const double *codebooks;
+    const unsigned char *codes;
+    int rows[4], cols[4];
+    pq_t *pq = NULL;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    header = (const int *) model_data(file, PqNames[0], MODEL_I32, &rows[0], &cols[0]);
+    start = (const int *) model_data(file, PqNames[1], MODEL_I32, &rows[1], &cols[1]);
+    codebooks = (const double *) model_data(file, PqNames[2], MODEL_F64, &rows[2], &cols[2]);
+    codes = (const unsigned char *) model_data(file, PqNames[3], MODEL_U8, &rows[3], &cols[3]);
+
+    if (header != NULL && start != NULL && codebooks != NULL && codes != NULL
+            && cols[0] == PQ_HEADER && header[1] > 0 && header[2] <= PQ_KSUB
+            && rows[1] == header[1] + 1 && rows[2] == header[2] && cols[2] == header[0]
+            && rows[3] == (header[3] + PQ_LANES - 1) / PQ_LANES * header[1]) {
+        pq = pq_create(header[0], header[1], header[2], header[3]);
+        if (memcmp(pq->start, start, (pq->M + 1) * sizeof(int)) == 0) {
+            memcpy(pq->codebooks, codebooks, (size_t) pq->ksub * pq->dims * sizeof(double));
+            memcpy(pq->codes, codes, (size_t) pq->blocks * pq->M * PQ_LANES);
+        } else {
+            pq_destroy(pq);
+            pq = NULL;
+        }
+    }
+    if (pq == NULL) {
+        fprintf(stderr, "%s: not a quantized gallery\n", path);
+    }
+
+    model_unmap(file);
+    return pq;
+}
+
+void pq_destroy(pq_t *pq)
+{
+    free(pq->start);
+    free(pq->codebooks);
+    free(pq->codes);
+    free(pq);
+}
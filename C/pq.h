@@ -0,0 +1,73 @@
+/*
+ * Product-quantized gallery
+ *
+ * The dims Fisher dimensions are split into M interleaved subspaces:
+ * subspace m holds dimensions m, m + M, m + 2M, ... Fisher dimensions come
+ * sorted by eigenvalue, so this spreads the discriminative ones evenly
+ * instead of spending most of the code on dimensions that barely vary
+ * (contiguous subspaces quantize markedly worse). k-means trains up to
+ * PQ_KSUB centroids per subspace, and a gallery vector is stored as the M
+ * one-byte numbers of its nearest centroid in each subspace: 16 bytes
+ * instead of 99 doubles for M = 16.
+ *
+ * A query computes, per subspace, its squared distance to every centroid
+ * (the asymmetric distance table, M x PQ_KSUB floats that stay in L1); the
+ * approximate distance to a gallery vector is then the sum of M table
+ * lookups. The codes are stored in blocks of PQ_LANES vectors,
+ *
+ *     codes[(b * M + m) * PQ_LANES + lane] = code of vector b * PQ_LANES + lane in subspace m
+ *
+ * so a SIMD kernel looks up a whole block per subspace.
+ *
+ * This saves memory (50x for M = 16), not time: a gathered table lookup
+ * per code and subspace costs more than the few dimensions the exact
+ * early-abandoning scan reads per template, so for a gallery that fits in
+ * memory gallery_search is as fast or faster.
+ */
+
+#ifndef __PQ_H__
+#define __PQ_H__
+
+#include "matrix.h"
+#include "topk.h"
+
+#define PQ_M 16         // default number of subspaces
+#define PQ_KSUB 256     // centroids per subspace (one byte per code)
+#define PQ_LANES 8      // vectors per code block
+#define PQ_CHUNK 64     // code blocks per call of the scan kernel
+
+typedef struct pq {
+    int dims;
+    int M;                          // subspaces
+    int ksub;                       // centroids per subspace, <= PQ_KSUB
+    int count;                      // vectors encoded
+    int blocks;                     // ceil(count / PQ_LANES)
+    int *start;                     // subspace m has start[m+1] - start[m] dims
+    double *codebooks;              // subspace m: ksub x (start[m+1] - start[m])
+                                    // at codebooks[ksub * start[m]]
+    unsigned char *codes;           // blocks x M x PQ_LANES
+    const char *kernel;             // name of the table-scan kernel in use
+    void (*scan)(const struct pq *pq, const unsigned char *codes, int blocks, const float *table,
+            float *distances);
+} pq_t;
+
+// trains the codebooks on the gallery with threads workers (<= 0 for one per
+// online CPU) and encodes every gallery image
+pq_t *pq_build(const MATRIX *ProjectedImages_Fisher, int M, int threads);
+
+// approximate k nearest neighbours, best first. With rerank > k and the
+// full gallery given, the rerank best approximate candidates are re-scored
+// exactly and the k best of those returned. Returns codes scanned
+long pq_search(const pq_t *pq, const double *probe, int k, int rerank,
+        const MATRIX *ProjectedImages_Fisher, match_t *matches);
+
+// forces a table-scan kernel ("c" or "avx2"); -1 if this CPU lacks it
+int pq_use(pq_t *pq, const char *kernel);
+
+// writes / reads the codebooks and codes; 0 on success, NULL on error
+int pq_save(const pq_t *pq, const char *path);
+pq_t *pq_load(const char *path);
+
+void pq_destroy(pq_t *pq);
+
+#endif
@@ -0,0 +1,136 @@
+/*******************************************************************************
+ Socket helpers shared by the daemon, the client and the load generator
+*******************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+
+int proto_read(int fd, void *buf, size_t n)
+{
+    char *p = (char *) buf;
+    ssize_t got;
+
+    while (n > 0) {
+        got = read(fd, p, n);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+        p += got;
+        n -= got;
+    }
+    return 0;
+}
+
+int proto_write(int fd, const void *buf, size_t n)
+{
+    const char *p = (const char *) buf;
+    ssize_t put;
+
+    while (n > 0) {
+        put = send(fd, p, n, MSG_NOSIGNAL);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return -1;
+        }
+        p += put;
+        n -= put;
+    }
+    return 0;
+}
+
+static int proto_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * Binds and listens on a Unix socket
+ * path: socket file; an existing one is removed first
+ */
+int proto_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (proto_address(path, &addr) != 0) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int proto_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (proto_address(path, &addr) != 0) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * One request / reply round trip
+ * req: filled in by the caller except magic
+ * payload: req->length bytes
+ * matches: room for req->k matches
+ */
+int proto_call(int fd, const proto_request_t *req, const void *payload, proto_match_t *matches)
+{
+    proto_request_t head = *req;
+    proto_reply_t reply;
+
+    head.magic = PROTO_MAGIC;
+    if (proto_write(fd, &head, sizeof(head)) != 0
+            || proto_write(fd, payload, head.length) != 0
+            || proto_read(fd, &reply, sizeof(reply)) != 0
+            || reply.magic != PROTO_MAGIC || reply.count > head.k) {
+        return -1;
+    }
+    if (reply.status != PROTO_OK) {
+        return -(int) reply.status;
+    }
+    if (proto_read(fd, matches, reply.count * sizeof(proto_match_t)) != 0) {
+        return -1;
+    }
+    return reply.count;
+}
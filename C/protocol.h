@@ -0,0 +1,73 @@
+/*
+ * Wire protocol of the recognition daemon (fisherd)
+ *
+ * Clients talk to the daemon over a Unix stream socket. A connection
+ * carries any number of requests, each answered before the next is read:
+ *
+ *     request:  proto_request_t, then length payload bytes
+ *               PROTO_PATH:   a NUL-terminated path to a PPM image the
+ *                             daemon can read
+ *               PROTO_PIXELS: width * height 8-bit grayscale intensities,
+ *                             row by row
+ *     reply:    proto_reply_t, then count proto_match_t, best first
+ *
+ * Both ends are on the same machine, so integers are in host byte order.
+ */
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROTO_MAGIC 0x3141444c      // "LDA1" in a little-endian dump
+#define PROTO_SOCKET "/tmp/fisherd.sock"
+
+// largest k a daemon returns
+#define PROTO_MAX_K 64
+
+// request types
+#define PROTO_PATH 1
+#define PROTO_PIXELS 2
+
+// reply status
+#define PROTO_OK 0
+#define PROTO_EREQUEST 1            // malformed request
+#define PROTO_EIMAGE 2              // image missing or unreadable
+#define PROTO_ESIZE 3               // image is not the size of the model
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;                  // PROTO_PATH or PROTO_PIXELS
+    uint16_t k;                     // matches wanted, 1 .. PROTO_MAX_K
+    uint32_t width;                 // PROTO_PIXELS only
+    uint32_t height;
+    uint32_t length;                // payload bytes that follow
+} proto_request_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t status;                // PROTO_OK or an error
+    uint32_t count;                 // matches that follow
+} proto_reply_t;
+
+typedef struct {
+    int32_t index;                  // training image, 0-based
+    float distance;                 // squared distance in Fisher space
+} proto_match_t;
+
+// reads / writes exactly n bytes; 0 on success, -1 on error or end of file
+int proto_read(int fd, void *buf, size_t n);
+int proto_write(int fd, const void *buf, size_t n);
+
+// listening socket at path, replacing a stale one; -1 on error
+int proto_listen(const char *path);
+
+// connected socket; -1 on error
+int proto_connect(const char *path);
+
+// sends a request and reads its reply; returns the number of matches
+// stored in matches (at most req->k), or -status / -1 on an error
+int proto_call(int fd, const proto_request_t *req, const void *payload, proto_match_t *matches);
+
+#endif
@@ -0,0 +1,339 @@
+/*******************************************************************************
+ Int8 recognition mode
+
+ Quantization is symmetric (zero maps to zero) so that padding and the
+ mean term need no correction beyond the per-row offset. Weights use a
+ per-row scale because the rows of the projection differ in magnitude;
+ the gallery uses a single scale so that an int8 distance is the true
+ distance times gallery_scale^2 and neighbours compare directly.
+
+ The AVX2 projection kernel multiplies 32 pixels by 32 weights per step
+ with pmaddubsw (u8 x s8 -> pairs added in int16) and widens the pairs to
+ int32 with pmaddwd against ones. The distance kernel widens both int8
+ vectors to int16, subtracts and squares-and-adds with pmaddwd.
+*******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "FisherfaceCore.h"
+#include "matrix.h"
+#include "model.h"
+#include "quant.h"
+#include "topk.h"
+
+static const char * const QuantNames[QUANT_SECTIONS] = {
+    PROJECTION_NAME "_i8", PROJECTION_NAME "_scale", PROJECTION_NAME "_offset",
+    "ProjectedImages_Fisher_i8", "ProjectedImages_Fisher_scale"
+};
+
+static int dot_c(const unsigned char *pixels, const signed char *weights, int n);
+static int dot_avx2(const unsigned char *pixels, const signed char *weights, int n);
+static int distance_c(const signed char *a, const signed char *b, int n);
+static int distance_avx2(const signed char *a, const signed char *b, int n);
+
+#define ROUND_UP(n) (((n) + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN)
+
+static void quant_pick(quant_t *Q)
+{
+    if (quant_use(Q, "avx2") != 0) {
+        quant_use(Q, "c");
+    }
+}
+
+/*
+ * Nearest integer to x / scale, clamped to +-max
+ */
+static signed char quant_value(double x, double scale, int max)
+{
+    double q = scale > 0 ? nearbyint(x / scale) : 0;
+
+    return q > max ? max : q < -max ? -max : (signed char) q;
+}
+
+/*
+ * Quantizes the projection (per-row scales) and the gallery (one scale)
+ * Projection: (C-1)x(M*N) fused projection
+ * m_database: (M*N)x1 mean image
+ * ProjectedImages_Fisher: (C-1)xP gallery
+ */
+quant_t *quant_create(const MATRIX *Projection, const MATRIX *m_database,
+        const MATRIX *ProjectedImages_Fisher)
+{
+    quant_t *Q = (quant_t *) calloc(1, sizeof(quant_t));
+    signed char *weights, *gallery;
+    double *scales, *offsets, *gallery_scale;
+    double max, sum;
+    int i, j;
+
+    Q->rows = Projection->rows;
+    Q->cols = Projection->cols;
+    Q->stride = ROUND_UP(Q->cols);
+    Q->count = ProjectedImages_Fisher->cols;
+    Q->gstride = ROUND_UP(Q->rows);
+    Q->owned = 1;
+
+    if (posix_memalign((void **) &weights, 64, (size_t) Q->rows * Q->stride) != 0
+            || posix_memalign((void **) &gallery, 64, (size_t) Q->count * Q->gstride) != 0) {
+        fprintf(stderr, "quant_create: out of memory\n");
+        exit(1);
+    }
+    memset(weights, 0, (size_t) Q->rows * Q->stride);
+    memset(gallery, 0, (size_t) Q->count * Q->gstride);
+    scales = (double *) malloc(Q->rows * sizeof(double));
+    offsets = (double *) malloc(Q->rows * sizeof(double));
+    gallery_scale = (double *) malloc(sizeof(double));
+
+    for (i = 0; i < Q->rows; i++) {
+        max = 0;
+        for (j = 0; j < Q->cols; j++) {
+            max = fmax(max, fabs(Projection->data[i][j]));
+        }
+        scales[i] = max / QUANT_WEIGHT_MAX;
+        sum = 0;
+        for (j = 0; j < Q->cols; j++) {
+            weights[(size_t) i * Q->stride + j] =
+                    quant_value(Projection->data[i][j], scales[i], QUANT_WEIGHT_MAX);
+            sum += weights[(size_t) i * Q->stride + j] * m_database->data[j][0];
+        }
+        // the mean is subtracted with the quantized weights, so that an
+        // image equal to the mean still projects to 0
+        offsets[i] = scales[i] * sum;
+    }
+
+    max = 0;
+    for (i = 0; i < Q->rows; i++) {
+        for (j = 0; j < Q->count; j++) {
+            max = fmax(max, fabs(ProjectedImages_Fisher->data[i][j]));
+        }
+    }
+    *gallery_scale = max / QUANT_GALLERY_MAX;
+    for (i = 0; i < Q->rows; i++) {
+        for (j = 0; j < Q->count; j++) {
+            gallery[(size_t) j * Q->gstride + i] = quant_value(ProjectedImages_Fisher->data[i][j],
+                    *gallery_scale, QUANT_GALLERY_MAX);
+        }
+    }
+
+    Q->weights = weights;
+    Q->scales = scales;
+    Q->offsets = offsets;
+    Q->gallery = gallery;
+    Q->gallery_scale = gallery_scale;
+    quant_pick(Q);
+    return Q;
+}
+
+/*
+ * Model sections of the int8 mode, in QuantNames order
+ */
+void quant_entries(const quant_t *Q, model_entry_t *entries)
+{
+    int i;
+
+    for (i = 0; i < QUANT_SECTIONS; i++) {
+        entries[i].name = QuantNames[i];
+        entries[i].dtype = MODEL_F64;
+        entries[i].cols = 1;
+    }
+    entries[0].dtype = MODEL_I8;
+    entries[0].rows = Q->rows;
+    entries[0].cols = Q->stride;
+    entries[0].data = Q->weights;
+    entries[1].rows = Q->rows;
+    entries[1].data = Q->scales;
+    entries[2].rows = Q->rows;
+    entries[2].data = Q->offsets;
+    entries[3].dtype = MODEL_I8;
+    entries[3].rows = Q->count;
+    entries[3].cols = Q->gstride;
+    entries[3].data = Q->gallery;
+    entries[4].rows = 1;
+    entries[4].data = Q->gallery_scale;
+}
+
+/*
+ * Zero-copy views of the int8 sections
+ * returns: NULL if the model was saved without them
+ */
+quant_t *quant_map(model_t *model)
+{
+    quant_t *Q = (quant_t *) calloc(1, sizeof(quant_t));
+    int rows[QUANT_SECTIONS], cols[QUANT_SECTIONS];
+
+    Q->weights = (const signed char *) model_data(model, QuantNames[0], MODEL_I8, &rows[0], &cols[0]);
+    Q->scales = (const double *) model_data(model, QuantNames[1], MODEL_F64, &rows[1], &cols[1]);
+    Q->offsets = (const double *) model_data(model, QuantNames[2], MODEL_F64, &rows[2], &cols[2]);
+    Q->gallery = (const signed char *) model_data(model, QuantNames[3], MODEL_I8, &rows[3], &cols[3]);
+    Q->gallery_scale = (const double *) model_data(model, QuantNames[4], MODEL_F64, &rows[4], &cols[4]);
+
+    if (Q->weights == NULL || Q->scales == NULL || Q->offsets == NULL || Q->gallery == NULL
+            || Q->gallery_scale == NULL || cols[0] % QUANT_ALIGN != 0
+            || cols[3] != ROUND_UP(rows[0]) || rows[1] != rows[0] || rows[2] != rows[0]) {
+        free(Q);
+        return NULL;
+    }
+
+    Q->rows = rows[0];
+    Q->stride = cols[0];
+    Q->cols = cols[0];
+    Q->count = rows[3];
+    Q->gstride = cols[3];
+    quant_pick(Q);
+    return Q;
+}
+
+/*
+ * Projects a probe
+ * pixels: Q->stride intensities, zero past the image
+ * projected: Q->rows values
+ */
+void quant_project(const quant_t *Q, const unsigned char *pixels, double *projected)
+{
+    int i;
+
+    for (i = 0; i < Q->rows; i++) {
+        projected[i] = Q->scales[i] * Q->dot(pixels, &Q->weights[(size_t) i * Q->stride], Q->stride)
+                - Q->offsets[i];
+    }
+}
+
+/*
+ * Nearest gallery images by int8 distance
+ * projected: Q->rows values, quantized here with the gallery scale
+ * matches: k entries, best first, with distances rescaled to Fisher space
+ */
+long quant_search(const quant_t *Q, const double *projected, int k, match_t *matches)
+{
+    signed char probe[Q->gstride] __attribute__((aligned(32)));
+    double scale = *Q->gallery_scale;
+    topk_t T;
+    int i, d;
+
+    memset(probe, 0, Q->gstride);
+    for (i = 0; i < Q->rows; i++) {
+        probe[i] = quant_value(projected[i], scale, QUANT_GALLERY_MAX);
+    }
+
+    topk_init(&T, matches, k);
+    for (i = 0; i < Q->count; i++) {
+        d = Q->distance(probe, &Q->gallery[(size_t) i * Q->gstride], Q->gstride);
+        if (d < topk_bound(&T)) {
+            topk_push(&T, i, d);
+        }
+    }
+    topk_sort(&T);
+    for (i = 0; i < k && matches[i].index >= 0; i++) {
+        matches[i].distance *= scale * scale;
+    }
+
+    return (long) Q->count * Q->rows;
+}
+
+/*
+ * Selects the kernels
+ * kernel: "c" or "avx2"
+ * returns: 0 on success, -1 if unknown or not supported by this CPU
+ */
+int quant_use(quant_t *Q, const char *kernel)
+{
+    __builtin_cpu_init();
+    if (strcmp(kernel, "c") == 0) {
+        Q->dot = dot_c;
+        Q->distance = distance_c;
+    } else if (strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        Q->dot = dot_avx2;
+        Q->distance = distance_avx2;
+    } else {
+        return -1;
+    }
+    Q->kernel = kernel;
+    return 0;
+}
+
+void quant_destroy(quant_t *Q)
+{
+    if (Q->owned) {
+        free((void *) Q->weights);
+        free((void *) Q->scales);
+        free((void *) Q->offsets);
+        free((void *) Q->gallery);
+        free((void *) Q->gallery_scale);
+    }
+    free(Q);
+}
+
+static int dot_c(const unsigned char *pixels, const signed char *weights, int n)
+{
+    int sum = 0;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        sum += pixels[j] * weights[j];
+    }
+    return sum;
+}
+
+static int distance_c(const signed char *a, const signed char *b, int n)
+{
+    int sum = 0;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        sum += (a[j] - b[j]) * (a[j] - b[j]);
+    }
+    return sum;
+}
+
+/*
+ * Horizontal sum of 8 int32
+ */
+__attribute__((target("avx2")))
+static inline int hsum_avx2(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+/*
+ * AVX2 u8 x s8 dot product; n is a multiple of QUANT_ALIGN
+ */
+__attribute__((target("avx2")))
+static int dot_avx2(const unsigned char *pixels, const signed char *weights, int n)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    __m256i pairs;
+    int j;
+
+    for (j = 0; j < n; j += 32) {
+        pairs = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *) &pixels[j]),
+                _mm256_loadu_si256((const __m256i *) &weights[j]));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+    }
+    return hsum_avx2(acc);
+}
+
+/*
+ * AVX2 squared distance of two int8 vectors; n is a multiple of QUANT_ALIGN
+ */
+__attribute__((target("avx2")))
+static int distance_avx2(const signed char *a, const signed char *b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m256i diff;
+    int j;
+
+    for (j = 0; j < n; j += 16) {
+        diff = _mm256_sub_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) &a[j])),
+                _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) &b[j])));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(diff, diff));
+    }
+    return hsum_avx2(acc);
+}
@@ -0,0 +1,76 @@
+/*
+ * Int8 recognition mode
+ *
+ * The fused projection v_fisherT_x_v_pcaT is stored as int8 with one scale
+ * per row, and the gallery as int8 with one scale for the whole gallery,
+ * cutting both to an eighth of their double size. A probe is projected
+ * straight from its 8-bit pixels:
+ *
+ *     y(i) = scale(i) * sum_j pixel(j) * W8(i, j) - offset(i)
+ *
+ * with offset(i) = scale(i) * W8(i, :) * m_database folding in the mean,
+ * and the sum accumulated exactly in int32. Weights are limited to
+ * +-QUANT_WEIGHT_MAX so that the AVX2 pmaddubsw step (two u8 x s8
+ * products added into int16) cannot saturate: 2 * 255 * 64 < 32767.
+ *
+ * The quantized matrices are written into the model by FisherfaceCore and
+ * mapped from it like the double sections, so a probe reads 1/8 of the
+ * bytes the double projection costs.
+ */
+
+#ifndef __QUANT_H__
+#define __QUANT_H__
+
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+#define QUANT_WEIGHT_MAX 64
+#define QUANT_GALLERY_MAX 127
+
+// rows of both int8 matrices are padded with zeros to this many bytes
+#define QUANT_ALIGN 32
+
+// number of model sections written by quant_entries
+#define QUANT_SECTIONS 5
+
+typedef struct quant {
+    int rows;                       // C-1
+    int cols;                       // M*N pixels
+    int stride;                     // cols rounded up to QUANT_ALIGN
+    const signed char *weights;     // rows x stride
+    const double *scales;           // rows
+    const double *offsets;          // rows
+    int count;                      // gallery images
+    int gstride;                    // rows rounded up to QUANT_ALIGN
+    const signed char *gallery;     // count x gstride, one image per row
+    const double *gallery_scale;    // 1 value
+    int owned;                      // buffers allocated by quant_create
+    const char *kernel;
+    int (*dot)(const unsigned char *pixels, const signed char *weights, int n);
+    int (*distance)(const signed char *a, const signed char *b, int n);
+} quant_t;
+
+// quantizes a model's projection and gallery
+quant_t *quant_create(const MATRIX *Projection, const MATRIX *m_database,
+        const MATRIX *ProjectedImages_Fisher);
+
+// fills QUANT_SECTIONS entries for model_write; they point into Q
+void quant_entries(const quant_t *Q, model_entry_t *entries);
+
+// views of the int8 sections of a mapped model; NULL if it has none
+quant_t *quant_map(model_t *model);
+
+// projects a probe given as Q->stride bytes (pixels past cols must be 0)
+void quant_project(const quant_t *Q, const unsigned char *pixels, double *projected);
+
+// k nearest gallery images by int8 distance, best first; returns the
+// number of dimensions scored
+long quant_search(const quant_t *Q, const double *projected, int k, match_t *matches);
+
+// forces a kernel ("c" or "avx2"); -1 if this CPU lacks it
+int quant_use(quant_t *Q, const char *kernel);
+
+void quant_destroy(quant_t *Q);
+
+#endif
@@ -0,0 +1,227 @@
+/*******************************************************************************
+ Model registry with hot reload
+
+ Why the epoch scan is enough: a reader stores its stamp and then loads
+ the pointer; the reloader swaps the pointer, then advances the epoch and
+ reads every stamp (all sequentially consistent). A slot read as 0 or as
+ the new epoch belongs to a reader whose pointer load comes after the
+ swap, so it has the new model; only slots still stamped with an older
+ epoch can hold the old one, and the reloader waits for those to exit.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Recognition.h"
+#include "ivf.h"
+#include "registry.h"
+
+/*
+ * Maps a model and applies the registry's modes to it
+ * current: model in use, whose image size the new one must match (may be NULL)
+ */
+static recognizer_t *registry_load(const registry_t *models, const char *path,
+        const recognizer_t *current)
+{
+    recognizer_t *R = LoadRecognizer(path);
+    char *index;
+
+    if (R == NULL) {
+        return NULL;
+    }
+    if (current != NULL && R->m_database->rows != current->m_database->rows) {
+        fprintf(stderr, "%s: images of %d pixels, serving %d\n", path,
+                R->m_database->rows, current->m_database->rows);
+        DestroyRecognizer(R);
+        return NULL;
+    }
+    if ((models->flags & REGISTRY_INT8) && AttachInt8(R) != 0) {
+        fprintf(stderr, "%s has no int8 sections\n", path);
+        DestroyRecognizer(R);
+        return NULL;
+    }
+    if (models->flags & REGISTRY_IVF) {
+        index = (char *) malloc(strlen(path) + sizeof(IVF_SUFFIX));
+        sprintf(index, "%s%s", path, IVF_SUFFIX);
+        if (AttachIVF(R, index, IVF_NPROBE) != 0) {
+            DestroyRecognizer(R);
+            R = NULL;
+        }
+        free(index);
+    }
+    return R;
+}
+
+/*
+ * Opens a registry on a model file
+ * path: model written by FisherfaceCore
+ * flags: REGISTRY_INT8 / REGISTRY_IVF modes, applied to every model loaded
+ */
+registry_t *registry_open(const char *path, int flags)
+{
+    registry_t *models;
+    recognizer_t *R;
+    int i;
+
+    if (posix_memalign((void **) &models, 64, sizeof(registry_t)) != 0) {
+        fprintf(stderr, "registry_open: out of memory\n");
+        exit(1);
+    }
+    memset(models, 0, sizeof(registry_t));
+    models->path = strdup(path);
+    models->flags = flags;
+
+    R = registry_load(models, path, NULL);
+    if (R == NULL) {
+        free(models->path);
+        free(models);
+        return NULL;
+    }
+
+    atomic_init(&models->current, R);
+    atomic_init(&models->epoch, 1);
+    atomic_init(&models->version, 1);
+    pthread_mutex_init(&models->reload, NULL);
+    for (i = 0; i < REGISTRY_READERS; i++) {
+        atomic_init(&models->readers[i].epoch, 0);
+        atomic_init(&models->readers[i].claimed, 0);
+        models->readers[i].registry = models;
+    }
+    return models;
+}
+
+registry_reader_t *registry_reader(registry_t *models)
+{
+    int i, free_slot;
+
+    for (i = 0; i < REGISTRY_READERS; i++) {
+        free_slot = 0;
+        if (atomic_compare_exchange_strong(&models->readers[i].claimed, &free_slot, 1)) {
+            return &models->readers[i];
+        }
+    }
+    fprintf(stderr, "registry_reader: all %d reader slots in use\n", REGISTRY_READERS);
+    return NULL;
+}
+
+void registry_reader_release(registry_reader_t *reader)
+{
+    if (reader->scratch != NULL) {
+        DestroyScratch(reader->scratch);
+        reader->scratch = NULL;
+    }
+    atomic_store(&reader->claimed, 0);
+}
+
+/*
+ * Starts a request
+ * S: set to the reader's scratch, reallocated if the model's dimensions
+ *    or image count differ from the last one this reader used
+ * returns: the recognizer to use until registry_exit
+ */
+const recognizer_t *registry_enter(registry_reader_t *reader, scratch_t **S)
+{
+    registry_t *models = reader->registry;
+    const recognizer_t *R;
+
+    atomic_store(&reader->epoch, atomic_load(&models->epoch));
+    R = atomic_load(&models->current);
+
+    if (reader->scratch == NULL || reader->pixels != R->m_database->rows
+            || reader->dims != R->ProjectedImages_Fisher->rows
+            || reader->images != R->ProjectedImages_Fisher->cols) {
+        if (reader->scratch != NULL) {
+            DestroyScratch(reader->scratch);
+        }
+        reader->scratch = CreateScratch(R);
+        reader->pixels = R->m_database->rows;
+        reader->dims = R->ProjectedImages_Fisher->rows;
+        reader->images = R->ProjectedImages_Fisher->cols;
+    }
+    *S = reader->scratch;
+    return R;
+}
+
+void registry_exit(registry_reader_t *reader)
+{
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+/*
+ * Replaces the model
+ * path: new model file, NULL to re-read the registry's path
+ * returns: 0 on success, -1 if the new model is unusable
+ */
+int registry_reload(registry_t *models, const char *path)
+{
+    recognizer_t *R, *old;
+    unsigned long epoch, stamp;
+    int i;
+
+    pthread_mutex_lock(&models->reload);
+
+    // everything slow happens here, before the swap
+    R = registry_load(models, path != NULL ? path : models->path, atomic_load(&models->current));
+    if (R == NULL) {
+        pthread_mutex_unlock(&models->reload);
+        return -1;
+    }
+
+    old = atomic_exchange(&models->current, R);
+    epoch = atomic_fetch_add(&models->epoch, 1) + 1;
+    atomic_fetch_add(&models->version, 1);
+
+    // wait for the requests that may still use the old model
+    for (i = 0; i < REGISTRY_READERS; i++) {
+        while ((stamp = atomic_load(&models->readers[i].epoch)) != 0 && stamp < epoch) {
+            sched_yield();
+        }
+    }
+    DestroyRecognizer(old);
+
+    pthread_mutex_unlock(&models->reload);
+    return 0;
+}
+
+static void *registry_reload_main(void *arg)
+{
+    registry_t *models = (registry_t *) arg;
+
+    if (registry_reload(models, NULL) == 0) {
+        printf("Model reloaded from %s\n", models->path);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+void registry_reload_async(registry_t *models)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, registry_reload_main, models);
+    pthread_attr_destroy(&attr);
+}
+
+void registry_close(registry_t *models)
+{
+    int i;
+
+    pthread_mutex_lock(&models->reload);
+    for (i = 0; i < REGISTRY_READERS; i++) {
+        if (models->readers[i].scratch != NULL) {
+            DestroyScratch(models->readers[i].scratch);
+        }
+    }
+    DestroyRecognizer(atomic_load(&models->current));
+    pthread_mutex_unlock(&models->reload);
+    pthread_mutex_destroy(&models->reload);
+    free(models->path);
+    free(models);
+}
@@ -0,0 +1,77 @@
+/*
+ * Model registry with hot reload
+ *
+ * Holds the recognizer in use and replaces it without stopping the
+ * threads that recognize with it. A reload maps and validates the new
+ * model off the request path, publishes it with one atomic pointer swap
+ * and frees the old recognizer only once every request that started
+ * before the swap has finished.
+ *
+ * Reclamation is epoch based. Each recognizing thread owns a reader slot;
+ * registry_enter stamps the slot with the global epoch before reading the
+ * pointer and registry_exit clears it. After a swap the reloader advances
+ * the epoch and waits until no slot still carries an older stamp. Readers
+ * never block or take a lock, so a swap does not show up in their latency.
+ */
+
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "Recognition.h"
+
+// most threads that can recognize through one registry at a time
+#define REGISTRY_READERS 256
+
+// recognizer modes re-applied to every model the registry loads
+#define REGISTRY_INT8 1             // AttachInt8
+#define REGISTRY_IVF 2              // AttachIVF with ModelPath IVF_SUFFIX
+
+typedef struct registry registry_t;
+
+typedef struct {
+    _Alignas(64) atomic_ulong epoch; // epoch entered at, 0 when outside
+    atomic_int claimed;
+    registry_t *registry;
+    scratch_t *scratch;             // sized for the last model entered
+    int pixels;
+    int dims;
+    int images;                     // gallery size (the Hamming buffers)
+} registry_reader_t;
+
+struct registry {
+    char *path;
+    int flags;                      // REGISTRY_INT8 | REGISTRY_IVF
+    _Atomic(recognizer_t *) current;
+    atomic_ulong epoch;
+    atomic_long version;            // models published so far
+    pthread_mutex_t reload;         // one reload at a time
+    registry_reader_t readers[REGISTRY_READERS];
+};
+
+// loads the model at path; NULL on error
+registry_t *registry_open(const char *path, int flags);
+
+// reader slot for the calling thread; NULL if all are taken
+registry_reader_t *registry_reader(registry_t *models);
+void registry_reader_release(registry_reader_t *reader);
+
+// the current recognizer, valid until registry_exit, and a scratch that
+// fits it
+const recognizer_t *registry_enter(registry_reader_t *reader, scratch_t **S);
+void registry_exit(registry_reader_t *reader);
+
+// loads path (the registry's own path if NULL), swaps it in and frees the
+// old model once no reader uses it. Returns 0 on success, -1 if the new
+// model is unusable (the old one stays)
+int registry_reload(registry_t *models, const char *path);
+
+// registry_reload(models, NULL) on a new detached thread
+void registry_reload_async(registry_t *models);
+
+// frees the registry; no reader may be inside it
+void registry_close(registry_t *models);
+
+#endif
@@ -0,0 +1,234 @@
+/*******************************************************************************
+ Sliding-window face search by FFT correlation
+
+ Arrays are ny rows of nx complex values. A 2-D transform is a 1-D
+ transform of every row, then of every column; rows that are known to be
+ zero (below the scene or the filter) are skipped on the way in, and on
+ the way out only the rows of grid positions are transformed back.
+
+ With a = filter d and b = filter d+1 packed as a + ib, the inverse
+ transform of scene * conj(spectrum) is corr(a) - i corr(b), both real.
+ The transforms are circular, but nx >= width and ny >= height, so the
+ correlation at a position whose window lies inside the scene never wraps.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Recognition.h"
+#include "fft.h"
+#include "scan.h"
+
+/*
+ * Computes the spectrum of filters 2*pair and 2*pair+1 into out
+ */
+static void filter_spectrum(const scan_t *S, int pair, double complex *out)
+{
+    const MATRIX *Projection = S->R->v_fisherT_x_v_pcaT;
+    const double *a = Projection->data[2 * pair];
+    const double *b = 2 * pair + 1 < S->dims ? Projection->data[2 * pair + 1] : NULL;
+    int i, x, y;
+
+    memset(out, 0, (size_t) S->nx * S->ny * sizeof(double complex));
+    for (i = 0; i < Projection->cols; i++) {
+        x = i % S->face_width;
+        y = i / S->face_width;
+        out[y * S->nx + x] = b != NULL ? a[i] + I * b[i] : a[i];
+    }
+    for (y = 0; y < S->face_height; y++) {
+        fft_run(S->fx, out + (long) y * S->nx, 1, FFT_FORWARD);
+    }
+    for (x = 0; x < S->nx; x++) {
+        fft_run(S->fy, out + x, S->nx, FFT_FORWARD);
+    }
+}
+
+/*
+ * Creates a scanner
+ * R: the loaded model, without int8 sections
+ * face_width: width of the training images (their height is rows / width)
+ * width, height: scene size
+ * step: spacing of the result grid, 1 for every position
+ * flags: 0 or SCAN_NORMALIZE
+ */
+scan_t *scan_create(const recognizer_t *R, int face_width, int width, int height, int step,
+        int flags)
+{
+    const MATRIX *Projection = R->v_fisherT_x_v_pcaT;
+    int face_height = face_width > 0 ? Projection->cols / face_width : 0;
+    size_t plane, pairs;
+    scan_t *S;
+    int d, i;
+
+    if (face_height * face_width != Projection->cols || width < face_width || height < face_height
+            || step < 1 || R->quant != NULL) {
+        fprintf(stderr, "scan_create: cannot scan %dx%d scenes for %dx%d faces%s\n", width, height,
+                face_width, face_height, R->quant != NULL ? " with the int8 model" : "");
+        return NULL;
+    }
+
+    S = (scan_t *) calloc(1, sizeof(scan_t));
+    S->R = R;
+    S->face_width = face_width;
+    S->face_height = face_height;
+    S->width = width;
+    S->height = height;
+    S->step = step;
+    S->flags = flags;
+    S->columns = (width - face_width) / step + 1;
+    S->rows = (height - face_height) / step + 1;
+    S->dims = Projection->rows;
+    S->features = (double *) malloc((size_t) S->rows * S->columns * S->dims * sizeof(double));
+    S->index = (int *) malloc((size_t) S->rows * S->columns * sizeof(int));
+    S->distance = (double *) malloc((size_t) S->rows * S->columns * sizeof(double));
+    S->scratch = CreateScratch(R);
+
+    S->nx = fft_size(width);
+    S->ny = fft_size(height);
+    S->fx = fft_create(S->nx);
+    S->fy = fft_create(S->ny);
+    plane = (size_t) S->nx * S->ny;
+    S->scene = (double complex *) malloc(plane * sizeof(double complex));
+    S->product = (double complex *) malloc(plane * sizeof(double complex));
+    S->integral = (double *) malloc((size_t) (width + 1) * (height + 1) * sizeof(double));
+
+    S->sums = (double *) calloc(S->dims, sizeof(double));
+    for (d = 0; d < S->dims; d++) {
+        for (i = 0; i < Projection->cols; i++) {
+            S->sums[d] += Projection->data[d][i];
+        }
+    }
+
+    // the spectra depend only on the model and the FFT size, so a scanner
+    // reused for a video computes them once if they fit
+    pairs = (S->dims + 1) / 2;
+    if (pairs * plane * sizeof(double complex) <= SCAN_CACHE) {
+        S->spectra = (double complex *) malloc(pairs * plane * sizeof(double complex));
+        for (i = 0; i < (int) pairs; i++) {
+            filter_spectrum(S, i, S->spectra + i * plane);
+        }
+    }
+    return S;
+}
+
+/*
+ * Sum of the scene over the window at (x, y), from the integral image
+ */
+static double window_sum(const scan_t *S, int x, int y)
+{
+    const double *ii = S->integral;
+    int w = S->width + 1;
+
+    return ii[(y + S->face_height) * w + x + S->face_width] - ii[y * w + x + S->face_width]
+            - ii[(y + S->face_height) * w + x] + ii[y * w + x];
+}
+
+void scan_image(scan_t *S, const unsigned char *pixels, int stride)
+{
+    const recognizer_t *R = S->R;
+    size_t plane = (size_t) S->nx * S->ny;
+    double complex *spectrum = S->spectra;
+    double scale = 1.0 / plane;
+    double mean_face = 0, shift, *f;
+    int pair, d, x, y, c, r;
+
+    memset(S->scene, 0, plane * sizeof(double complex));
+    for (y = 0; y < S->height; y++) {
+        for (x = 0; x < S->width; x++) {
+            S->scene[y * S->nx + x] = pixels[((size_t) y * S->width + x) * stride];
+        }
+        fft_run(S->fx, S->scene + (long) y * S->nx, 1, FFT_FORWARD);
+    }
+    for (x = 0; x < S->nx; x++) {
+        fft_run(S->fy, S->scene + x, S->nx, FFT_FORWARD);
+    }
+
+    if (S->spectra == NULL) {
+        spectrum = (double complex *) malloc(plane * sizeof(double complex));
+    }
+    for (pair = 0; 2 * pair < S->dims; pair++) {
+        if (S->spectra == NULL) {
+            filter_spectrum(S, pair, spectrum);
+        }
+        for (d = 0; d < (int) plane; d++) {
+            S->product[d] = S->scene[d] * conj(spectrum[d]);
+        }
+        for (x = 0; x < S->nx; x++) {
+            fft_run(S->fy, S->product + x, S->nx, FFT_INVERSE);
+        }
+        d = 2 * pair;
+        for (r = 0; r < S->rows; r++) {
+            y = r * S->step;
+            fft_run(S->fx, S->product + (long) y * S->nx, 1, FFT_INVERSE);
+            for (c = 0; c < S->columns; c++) {
+                f = S->features + ((size_t) r * S->columns + c) * S->dims;
+                f[d] = creal(S->product[y * S->nx + c * S->step]) * scale - R->projected_mean[d];
+                if (d + 1 < S->dims) {
+                    f[d + 1] = -cimag(S->product[y * S->nx + c * S->step]) * scale
+                            - R->projected_mean[d + 1];
+                }
+            }
+        }
+        if (S->spectra != NULL) {
+            spectrum += plane;
+        }
+    }
+    if (S->spectra == NULL) {
+        free(spectrum);
+    }
+
+    if (!(S->flags & SCAN_NORMALIZE)) {
+        return;
+    }
+    for (y = 0; y <= S->height; y++) {
+        for (x = 0; x <= S->width; x++) {
+            S->integral[y * (S->width + 1) + x] = y == 0 || x == 0 ? 0
+                    : pixels[((size_t) (y - 1) * S->width + x - 1) * stride]
+                    + S->integral[(y - 1) * (S->width + 1) + x]
+                    + S->integral[y * (S->width + 1) + x - 1]
+                    - S->integral[(y - 1) * (S->width + 1) + x - 1];
+        }
+    }
+    for (d = 0; d < R->m_database->rows; d++) {
+        mean_face += R->m_database->data[d][0];
+    }
+    mean_face /= R->m_database->rows;
+    for (r = 0; r < S->rows; r++) {
+        for (c = 0; c < S->columns; c++) {
+            shift = mean_face - window_sum(S, c * S->step, r * S->step) / R->m_database->rows;
+            f = S->features + ((size_t) r * S->columns + c) * S->dims;
+            for (d = 0; d < S->dims; d++) {
+                f[d] += shift * S->sums[d];
+            }
+        }
+    }
+}
+
+void scan_match(scan_t *S)
+{
+    match_t match;
+    long p;
+
+    for (p = 0; p < (long) S->rows * S->columns; p++) {
+        RecognizeProjected(S->R, S->features + p * S->dims, S->scratch, 1, &match);
+        S->index[p] = match.index;
+        S->distance[p] = match.distance;
+    }
+}
+
+void scan_destroy(scan_t *S)
+{
+    free(S->features);
+    free(S->index);
+    free(S->distance);
+    DestroyScratch(S->scratch);
+    fft_destroy(S->fx);
+    fft_destroy(S->fy);
+    free(S->scene);
+    free(S->product);
+    free(S->spectra);
+    free(S->sums);
+    free(S->integral);
+    free(S);
+}
@@ -0,0 +1,75 @@
+/*
+ * Sliding-window face search
+ *
+ * Projecting every face-sized window of a larger scene costs one
+ * (C-1) x (M*N) product per position. But row d of v_fisherT_x_v_pcaT,
+ * laid out as a face image, is a correlation filter: its inner product
+ * with the window at (x, y) is the cross-correlation of the scene with
+ * that filter at (x, y). All positions of one dimension come out of one
+ * FFT product, so a scan is one forward FFT of the scene and, per pair of
+ * dimensions, one filter spectrum and one inverse FFT; two real filters
+ * share a complex transform as its real and imaginary parts.
+ *
+ * The constant term of the projection, v_fisherT_x_v_pcaT * m_database,
+ * is subtracted per dimension as in RecognizeProbe. With SCAN_NORMALIZE
+ * each window's brightness is first shifted to that of the mean face,
+ * x - mean(x) + mean(m_database); its projection differs from the plain
+ * one by (mean(m_database) - mean(x)) times the sum of each filter, and
+ * mean(x) of every window comes from an integral image of the scene.
+ *
+ * Results are kept on a grid of positions step pixels apart: the feature
+ * vector of each (the input of RecognizeProjected) and, after scan_match,
+ * its best gallery match and distance.
+ */
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include "Recognition.h"
+#include "fft.h"
+
+// flags of scan_create
+#define SCAN_NORMALIZE 1            // match window brightness to the mean face
+
+// filter spectra are kept between scans up to this many bytes
+#define SCAN_CACHE (128L << 20)
+
+typedef struct {
+    const recognizer_t *R;
+    int face_width, face_height;    // window size
+    int width, height;              // scene size
+    int step;                       // grid spacing in pixels
+    int flags;
+    int columns, rows;              // grid: position (c, r) is the window
+                                    // at x = c*step, y = r*step
+    int dims;                       // C-1
+    double *features;               // rows*columns x dims, Fisher space
+    int *index;                     // best match per position (scan_match)
+    double *distance;               // and its squared distance
+    scratch_t *scratch;             // search working memory of scan_match
+
+    int nx, ny;                     // FFT size, >= the scene's
+    fft_t *fx, *fy;
+    double complex *scene;          // spectrum of the last scene
+    double complex *product;        // nx*ny working array
+    double complex *spectra;        // cached filter spectra, or NULL
+    double *sums;                   // sum of each filter's weights
+    double *integral;               // (width+1)*(height+1) prefix sums
+} scan_t;
+
+// scanner of width x height scenes for faces face_width pixels wide (the
+// height follows from the model), with results every step pixels. NULL if
+// the scene is smaller than a face or R has int8 sections attached
+scan_t *scan_create(const recognizer_t *R, int face_width, int width, int height, int step,
+        int flags);
+
+// computes the feature vectors of every grid position of a scene given as
+// 8-bit intensities stride bytes apart, row by row (see RecognizeProbe)
+void scan_image(scan_t *S, const unsigned char *pixels, int stride);
+
+// fills index and distance from the features of the last scan
+void scan_match(scan_t *S);
+
+void scan_destroy(scan_t *S);
+
+#endif
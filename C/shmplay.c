@@ -0,0 +1,135 @@
+/******************************************************************************
+ Reference frame producer for the shared-memory ring
+
+ Usage: shmplay [-n name] [-s slots] [-r fps] [-c frames] [-w] [dir ...]
+
+ Creates a frame ring (shmring.h) and replays the images 1.ppm, 2.ppm, ...
+ of each directory (default: the LDAIMAGES test sets) into it as grayscale
+ frames, the way a capture process would write camera frames. -r paces
+ the frames (default 30 per second, 0 for as fast as possible), -c sets
+ how many to send (default one pass over the images). Frames that find the
+ ring full are dropped, like a camera's; -w waits for the consumer instead
+ and, at the end, for it to take the last frame.
+
+ Read the ring with "fisherstream -S name". Paths only work if working in
+ the LDA/C folder.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "grayscale.h"
+#include "ppm.h"
+#include "shmring.h"
+
+#define MaxImages 1024
+
+int main(int argc, char *argv[])
+{
+    const char *default_dirs[] = { "../LDAIMAGES/Test2", "../LDAIMAGES/Test3" };
+    const char * const *dirs = default_dirs;
+    const char *name = SHMRING_NAME;
+    int ndirs = 2, slots = SHMRING_SLOTS, wait = 0;
+    long frames = -1, f, published = 0;
+    double fps = 30;
+    unsigned char *images[MaxImages], *slot;
+    int width = 0, height = 0, count = 0;
+    struct timespec next, t;
+    char filename[512];
+    shmring_t *ring;
+    PPMImage *img;
+    int opt, d, i;
+
+    while ((opt = getopt(argc, argv, "n:s:r:c:w")) != -1) {
+        switch (opt) {
+        case 'n': name = optarg; break;
+        case 's': slots = atoi(optarg); break;
+        case 'r': fps = atof(optarg); break;
+        case 'c': frames = atol(optarg); break;
+        case 'w': wait = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n name] [-s slots] [-r fps] [-c frames] [-w] [dir ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        dirs = (const char * const *) &argv[optind];
+        ndirs = argc - optind;
+    }
+
+    // decode everything up front so replaying costs only the copy
+    for (d = 0; d < ndirs; d++) {
+        for (i = 1; count < MaxImages; i++) {
+            snprintf(filename, sizeof(filename), "%s/%d.ppm", dirs[d], i);
+            if (access(filename, R_OK) != 0) {
+                break;
+            }
+            img = ppm_image_constructor(filename);
+            if (count == 0) {
+                width = img->width;
+                height = img->height;
+            }
+            if ((int) img->width != width || (int) img->height != height) {
+                fprintf(stderr, "%s: %dx%d, not %dx%d; skipped\n", filename,
+                        img->width, img->height, width, height);
+                ppm_image_destructor(img, 1);
+                continue;
+            }
+            grayscale(img);
+            images[count] = (unsigned char *) malloc(width * height);
+            for (f = 0; f < width * height; f++) {
+                images[count][f] = img->pixels[f].intensity;
+            }
+            ppm_image_destructor(img, 1);
+            count++;
+        }
+    }
+    if (count == 0) {
+        fprintf(stderr, "no images found\n");
+        return 1;
+    }
+    if (frames < 0) {
+        frames = count;
+    }
+
+    ring = shmring_create(name, width, height, slots);
+    if (ring == NULL) {
+        return 1;
+    }
+    printf("%s: %d images of %dx%d, %d slots\n", name, count, width, height, slots);
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (f = 0; f < frames; f++) {
+        slot = shmring_acquire(ring, wait);
+        if (slot != NULL) {
+            memcpy(slot, images[f % count], width * height);
+            shmring_publish(ring);
+            published++;
+        }
+        if (fps > 0) {
+            next.tv_nsec += (long) (1e9 / fps);
+            next.tv_sec += next.tv_nsec / 1000000000;
+            next.tv_nsec %= 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+
+    // with -w, the consumer gets every frame before the ring goes away
+    while (wait && atomic_load(&ring->header->tail) != atomic_load(&ring->header->head)) {
+        t.tv_sec = 0;
+        t.tv_nsec = 1000000;
+        nanosleep(&t, NULL);
+    }
+    printf("%ld frames published, %ld dropped\n", published, frames - published);
+
+    shmring_close(ring);
+    for (i = 0; i < count; i++) {
+        free(images[i]);
+    }
+    return 0;
+}
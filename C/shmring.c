@@ -0,0 +1,250 @@
+/*******************************************************************************
+ Shared-memory frame ring for camera ingest
+
+ Ordering: the producer fills a slot, then stores head + 1 (release); the
+ consumer loads head (acquire) before reading the slot. In the other
+ direction the consumer's store of tail + 1 (release) comes after its last
+ read of the slot, and the producer loads tail (acquire) before writing it
+ again. head - tail is never more than slots, so the producer never writes
+ the slot being read.
+
+ The consumer trusts nothing in the header but its own mapping: sizes are
+ checked against the object's length before any slot is touched, and
+ slots are found with the private copy of that checked geometry, never the
+ header's fields, which the producer could change afterwards. Positions
+ are reduced unsigned, so a corrupted head or tail still lands in a slot.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mpmc.h"
+#include "shmring.h"
+
+#define SLOT_HEADER 64
+
+static size_t header_bytes(void)
+{
+    return (sizeof(shmring_header_t) + 63) / 64 * 64;
+}
+
+static shmring_slot_t *slot_at(const shmring_t *ring, long position)
+{
+    return (shmring_slot_t *) ((char *) ring->header + header_bytes()
+            + (size_t) ((unsigned long) position % ring->slots) * ring->slot_bytes);
+}
+
+/*
+ * Maps bytes of the object open on fd for a ring of the given geometry,
+ * already checked to fit in them
+ */
+static shmring_t *shmring_map(const char *name, int fd, size_t bytes, int owner,
+        const shmring_header_t *geometry)
+{
+    shmring_t *ring;
+    void *memory;
+
+    memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        perror(name);
+        return NULL;
+    }
+    ring = (shmring_t *) malloc(sizeof(shmring_t));
+    ring->header = (shmring_header_t *) memory;
+    ring->bytes = bytes;
+    ring->name = strdup(name);
+    ring->owner = owner;
+    ring->width = geometry->width;
+    ring->height = geometry->height;
+    ring->slots = geometry->slots;
+    ring->slot_bytes = geometry->slot_bytes;
+    return ring;
+}
+
+/*
+ * Creates the ring a capture process writes to
+ * name: shared memory object, e.g. SHMRING_NAME
+ * width, height: frame size
+ * slots: frames the ring holds
+ */
+shmring_t *shmring_create(const char *name, int width, int height, int slots)
+{
+    size_t slot_bytes = (SLOT_HEADER + (size_t) width * height + 63) / 64 * 64;
+    size_t bytes = header_bytes() + slots * slot_bytes;
+    shmring_header_t *h, geometry = { 0 };
+    shmring_t *ring;
+    int fd;
+
+    if (width <= 0 || height <= 0 || slots <= 0) {
+        fprintf(stderr, "shmring_create: bad geometry %dx%d, %d slots\n", width, height, slots);
+        return NULL;
+    }
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, bytes) != 0) {
+        perror(name);
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+    geometry.width = width;
+    geometry.height = height;
+    geometry.slots = slots;
+    geometry.slot_bytes = slot_bytes;
+    ring = shmring_map(name, fd, bytes, 1, &geometry);
+    if (ring == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    h = ring->header;
+    h->version = SHMRING_VERSION;
+    h->width = width;
+    h->height = height;
+    h->slots = slots;
+    h->slot_bytes = slot_bytes;
+    atomic_init(&h->head, 0);
+    atomic_init(&h->dropped, 0);
+    atomic_init(&h->closed, 0);
+    event_init_shared(&h->published);
+    atomic_init(&h->tail, 0);
+    event_init_shared(&h->released);
+    // a consumer checks the magic first, so it goes last
+    atomic_thread_fence(memory_order_release);
+    h->magic = SHMRING_MAGIC;
+    return ring;
+}
+
+/*
+ * Attaches the recognizer to a ring created by a capture process
+ */
+shmring_t *shmring_attach(const char *name)
+{
+    shmring_header_t h;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < header_bytes()
+            || pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+        fprintf(stderr, "%s: not a frame ring\n", name);
+        close(fd);
+        return NULL;
+    }
+    if (h.magic != SHMRING_MAGIC || h.version != SHMRING_VERSION || h.width <= 0
+            || h.height <= 0 || h.slots <= 0
+            || h.slot_bytes < SLOT_HEADER + (size_t) h.width * h.height
+            || (size_t) st.st_size < header_bytes() + (size_t) h.slots * h.slot_bytes) {
+        fprintf(stderr, "%s: not a frame ring of version %d\n", name, SHMRING_VERSION);
+        close(fd);
+        return NULL;
+    }
+    return shmring_map(name, fd, st.st_size, 0, &h);
+}
+
+/*
+ * Producer: finds room for the next frame
+ * wait: 1 to sleep while the ring is full, 0 to drop the frame
+ * returns: width*height bytes to write the frame to, NULL if dropped
+ */
+unsigned char *shmring_acquire(shmring_t *ring, int wait)
+{
+    shmring_header_t *h = ring->header;
+    long head = atomic_load_explicit(&h->head, memory_order_relaxed);
+    unsigned key;
+
+    while (head - atomic_load_explicit(&h->tail, memory_order_acquire) >= ring->slots) {
+        if (!wait) {
+            atomic_fetch_add(&h->dropped, 1);
+            return NULL;
+        }
+        key = event_prepare(&h->released);
+        if (head - atomic_load(&h->tail) >= ring->slots) {
+            event_wait(&h->released, key);
+        }
+    }
+    return (unsigned char *) slot_at(ring, head) + SLOT_HEADER;
+}
+
+void shmring_publish(shmring_t *ring)
+{
+    shmring_header_t *h = ring->header;
+    long head = atomic_load_explicit(&h->head, memory_order_relaxed);
+    shmring_slot_t *slot = slot_at(ring, head);
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    slot->sequence = head + atomic_load(&h->dropped);
+    slot->timestamp = t.tv_sec + t.tv_nsec * 1e-9;
+    atomic_store_explicit(&h->head, head + 1, memory_order_release);
+    event_signal(&h->published);
+}
+
+/*
+ * Consumer: waits for a frame
+ * slot: receives the frame's sequence number and timestamp (may be NULL)
+ * returns: width*height intensities in the ring, NULL at the end
+ */
+const unsigned char *shmring_next(shmring_t *ring, shmring_slot_t *slot)
+{
+    shmring_header_t *h = ring->header;
+    long tail = atomic_load_explicit(&h->tail, memory_order_relaxed);
+    unsigned key;
+
+    for (;;) {
+        key = event_prepare(&h->published);
+        if (atomic_load_explicit(&h->head, memory_order_acquire) != tail) {
+            if (slot != NULL) {
+                *slot = *slot_at(ring, tail);
+            }
+            return (const unsigned char *) slot_at(ring, tail) + SLOT_HEADER;
+        }
+        // closed is set after the last head store, so seeing it with the
+        // ring still empty means the end
+        if (atomic_load(&h->closed)) {
+            if (atomic_load(&h->head) == tail) {
+                return NULL;
+            }
+            continue;
+        }
+        event_wait(&h->published, key);
+    }
+}
+
+void shmring_release(shmring_t *ring)
+{
+    shmring_header_t *h = ring->header;
+
+    atomic_fetch_add_explicit(&h->tail, 1, memory_order_release);
+    event_signal(&h->released);
+}
+
+/*
+ * Detaches; the creator also tells the consumer no more frames will come
+ * and removes the name (an attached consumer keeps its mapping)
+ */
+void shmring_close(shmring_t *ring)
+{
+    if (ring->owner) {
+        atomic_store(&ring->header->closed, 1);
+        event_broadcast(&ring->header->published);
+        shm_unlink(ring->name);
+    }
+    munmap(ring->header, ring->bytes);
+    free(ring->name);
+    free(ring);
+}
@@ -0,0 +1,95 @@
+/*
+ * Shared-memory frame ring for camera ingest
+ *
+ * A POSIX shared memory object (shm_open) holding a ring of fixed-size
+ * grayscale frame slots. A capture process creates it and writes frames
+ * straight into the slots; the recognizer attaches to it and projects
+ * each frame where it lies, so a frame crosses no pipe and is never
+ * copied after capture.
+ *
+ * There is one producer and one consumer. The producer owns head and the
+ * consumer owns tail; publishing or releasing a slot is one atomic store,
+ * and neither side ever takes a lock. A consumer with nothing to read
+ * sleeps on a process-shared futex (event_init_shared), as does a producer
+ * that chose to wait for a free slot instead of dropping the frame.
+ *
+ * Layout: shmring_header_t, then slots of slot_bytes each, 64 byte
+ * aligned: a shmring_slot_t followed by width*height intensities.
+ */
+
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mpmc.h"
+
+#define SHMRING_MAGIC 0x524d5246u  // "FRMR"
+#define SHMRING_VERSION 1
+
+// default object name (in /dev/shm) and slot count
+#define SHMRING_NAME "/fisher.frames"
+#define SHMRING_SLOTS 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width, height;          // of every frame
+    int32_t slots;
+    uint32_t slot_bytes;            // from one slot to the next
+
+    // producer side
+    _Alignas(64) atomic_long head;  // slots published so far
+    atomic_long dropped;            // frames that found the ring full
+    atomic_int closed;              // no more frames will be published
+    event_t published;
+
+    // consumer side
+    _Alignas(64) atomic_long tail;  // slots released so far
+    event_t released;
+} shmring_header_t;
+
+typedef struct {
+    long sequence;                  // frames offered before this one,
+                                    // dropped ones included
+    double timestamp;               // producer's CLOCK_MONOTONIC seconds
+} shmring_slot_t;
+
+// one process's mapping of a ring
+typedef struct {
+    shmring_header_t *header;
+    size_t bytes;
+    int width, height;              // private copies of the geometry,
+    int slots;                      // checked against the mapping once;
+    size_t slot_bytes;              // the header's may change under us
+    char *name;
+    int owner;                      // created it: unlinks it on close
+} shmring_t;
+
+// creates (replacing any old one) and maps a ring; NULL on error
+shmring_t *shmring_create(const char *name, int width, int height, int slots);
+
+// maps an existing ring after checking its header; NULL on error
+shmring_t *shmring_attach(const char *name);
+
+// producer: the pixels of the next free slot, or NULL if the ring is full
+// (the frame is then counted as dropped). wait: sleep until a slot is
+// free instead
+unsigned char *shmring_acquire(shmring_t *ring, int wait);
+
+// producer: makes the slot returned by shmring_acquire readable
+void shmring_publish(shmring_t *ring);
+
+// consumer: waits for the next frame and returns its pixels, valid until
+// shmring_release; NULL once the producer has closed and the ring is empty
+const unsigned char *shmring_next(shmring_t *ring, shmring_slot_t *slot);
+
+// consumer: gives the frame back to the producer
+void shmring_release(shmring_t *ring);
+
+// unmaps the ring; the owner first marks it closed and removes the name
+void shmring_close(shmring_t *ring);
+
+#endif
@@ -0,0 +1,353 @@
+/*******************************************************************************
+ Sign-random-projection prefilter
+
+ The directions come from a xorshift generator and Box-Muller, not rand(),
+ so they depend only on SRP_SEED and are the same on every platform that
+ trains a model. Encoding is one GEMV (SRP_BITS x dims) and a sign test.
+
+ The C Hamming kernel XORs the four words of a code and adds their bit
+ counts; the popcnt kernel is the same loop compiled for the instruction.
+ The AVX2 kernel holds a whole 256-bit code in one register: after the XOR,
+ the bits set in each byte are counted with two pshufb lookups (low and
+ high nibble, Mula's method) and psadbw adds the bytes into four 64-bit
+ lanes. Four codes go through at a time and their lanes are combined with
+ unpack / permute adds instead of a horizontal sum per code. The kernel
+ used is the fastest of those the CPU supports on the first codes.
+
+ The candidates are selected with a histogram of the distances (they are
+ 0 .. SRP_BITS): one pass counts, the cumulative counts give the largest
+ distance admitted, and a second pass collects the indices.
+*******************************************************************************/
+
+#include <cblas.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <immintrin.h>
+
+#include "gallery.h"
+#include "matrix.h"
+#include "model.h"
+#include "srp.h"
+#include "topk.h"
+
+static const char * const SrpNames[SRP_SECTIONS] = { "srp_planes", "srp_codes" };
+
+static void hamming_c(const srp_code_t *codes, int count, const srp_code_t code,
+        unsigned short *distances);
+static void hamming_popcnt(const srp_code_t *codes, int count, const srp_code_t code,
+        unsigned short *distances);
+static void hamming_avx2(const srp_code_t *codes, int count, const srp_code_t code,
+        unsigned short *distances);
+
+/*
+ * Seconds the current Hamming kernel takes over the first n codes, best
+ * of three
+ */
+static double srp_time(const srp_t *S, int n, unsigned short *distances)
+{
+    struct timespec start, end;
+    double t, best = 0;
+    int r;
+
+    for (r = 0; r < 3; r++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        S->hamming(S->codes, n, S->codes[0], distances);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        best = r == 0 || t < best ? t : best;
+    }
+    return best;
+}
+
+/*
+ * Keeps the fastest Hamming kernel this CPU supports, timed on the first
+ * SRP_CALIBRATE codes: whether AVX2 beats popcnt depends on the build as
+ * much as on the CPU (unoptimized, its intrinsics go through the stack)
+ */
+static void srp_pick(srp_t *S)
+{
+    const char * const kernels[] = { "c", "popcnt", "avx2" };
+    unsigned short distances[SRP_CALIBRATE];
+    int n = S->count < SRP_CALIBRATE ? S->count : SRP_CALIBRATE;
+    int e, fastest = 0;
+    double t, best = 0;
+
+    for (e = 0; n > 0 && e < (int) (sizeof(kernels) / sizeof(kernels[0])); e++) {
+        if (srp_use(S, kernels[e]) == 0 && ((t = srp_time(S, n, distances)) < best || e == 0)) {
+            best = t;
+            fastest = e;
+        }
+    }
+    srp_use(S, kernels[fastest]);
+}
+
+/*
+ * Next standard normal value of a xorshift64 stream
+ */
+static double gaussian(unsigned long long *state)
+{
+    double u[2];
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        u[i] = ((*state >> 11) + 0.5) / 9007199254740992.0; // (0, 1)
+    }
+    return sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]);
+}
+
+/*
+ * Draws the directions and encodes the gallery
+ * ProjectedImages_Fisher: (C-1)xP gallery
+ */
+srp_t *srp_create(const MATRIX *ProjectedImages_Fisher)
+{
+    const MATRIX *Y = ProjectedImages_Fisher;
+    srp_t *S = (srp_t *) calloc(1, sizeof(srp_t));
+    unsigned long long state = SRP_SEED;
+    double *planes, *vector;
+    srp_code_t *codes;
+    int b, d, i;
+
+    S->dims = Y->rows;
+    S->count = Y->cols;
+    S->owned = 1;
+    planes = (double *) malloc((size_t) SRP_BITS * S->dims * sizeof(double));
+    for (b = 0; b < SRP_BITS * S->dims; b++) {
+        planes[b] = gaussian(&state);
+    }
+    S->planes = planes;
+
+    if (posix_memalign((void **) &codes, 64, (size_t) S->count * sizeof(srp_code_t)) != 0) {
+        fprintf(stderr, "srp_create: out of memory\n");
+        exit(1);
+    }
+    vector = (double *) malloc(S->dims * sizeof(double));
+    for (i = 0; i < S->count; i++) {
+        for (d = 0; d < S->dims; d++) {
+            vector[d] = Y->data[d][i];
+        }
+        srp_encode(S, vector, codes[i]);
+    }
+    free(vector);
+    S->codes = (const srp_code_t *) codes;
+    srp_pick(S);
+    return S;
+}
+
+void srp_entries(const srp_t *S, model_entry_t *entries)
+{
+    entries[0].name = SrpNames[0];
+    entries[0].dtype = MODEL_F64;
+    entries[0].rows = SRP_BITS;
+    entries[0].cols = S->dims;
+    entries[0].data = S->planes;
+    entries[1].name = SrpNames[1];
+    entries[1].dtype = MODEL_U64;
+    entries[1].rows = S->count;
+    entries[1].cols = SRP_WORDS;
+    entries[1].data = S->codes;
+}
+
+/*
+ * Zero-copy view of the codes saved with a model
+ * dims, count: shape of the model's ProjectedImages_Fisher
+ * returns: NULL if the model was saved without them or for another shape
+ */
+srp_t *srp_map(model_t *model, int dims, int count)
+{
+    srp_t *S = (srp_t *) calloc(1, sizeof(srp_t));
+    int rows[SRP_SECTIONS], cols[SRP_SECTIONS];
+
+    S->dims = dims;
+    S->count = count;
+    S->planes = (const double *) model_data(model, SrpNames[0], MODEL_F64, &rows[0], &cols[0]);
+    S->codes = (const srp_code_t *) model_data(model, SrpNames[1], MODEL_U64, &rows[1], &cols[1]);
+    if (S->planes == NULL || S->codes == NULL || rows[0] != SRP_BITS || cols[0] != dims
+            || rows[1] != count || cols[1] != SRP_WORDS) {
+        free(S);
+        return NULL;
+    }
+    srp_pick(S);
+    return S;
+}
+
+void srp_encode(const srp_t *S, const double *vector, srp_code_t code)
+{
+    double projected[SRP_BITS];
+    int b;
+
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, SRP_BITS, S->dims, 1, S->planes, S->dims, vector, 1,
+                0, projected, 1);
+    memset(code, 0, sizeof(srp_code_t));
+    for (b = 0; b < SRP_BITS; b++) {
+        code[b / 64] |= (unsigned long long) (projected[b] > 0) << (b % 64);
+    }
+}
+
+void srp_distances(const srp_t *S, const double *probe, unsigned short *distances)
+{
+    srp_code_t code __attribute__((aligned(32)));
+
+    srp_encode(S, probe, code);
+    S->hamming(S->codes, S->count, code, distances);
+}
+
+/*
+ * Hamming prefilter, then exact re-rank
+ * G: the gallery the codes were made from
+ * probe: (C-1) values in Fisher space
+ * candidates: images re-ranked
+ * k, matches: the k best, best first
+ * distances, ids: working memory of S->count values each, or NULL to
+ *                 allocate it for this call
+ * returns: dimensions scored in the re-rank
+ */
+long srp_search(const srp_t *S, const gallery_t *G, const double *probe, int candidates, int k,
+        match_t *matches, unsigned short *distances, int *ids)
+{
+    int owned = distances == NULL || ids == NULL;
+    int histogram[SRP_BITS + 1] = { 0 };
+    int limit, below, n, i;
+    topk_t T;
+    long work;
+
+    if (owned) {
+        distances = (unsigned short *) malloc(S->count * sizeof(unsigned short));
+        ids = (int *) malloc(S->count * sizeof(int));
+    }
+
+    srp_distances(S, probe, distances);
+    for (i = 0; i < S->count; i++) {
+        histogram[distances[i]]++;
+    }
+    // every image closer than limit, and as many at limit as still fit
+    for (limit = 0, below = 0; limit < SRP_BITS && below + histogram[limit] < candidates; limit++) {
+        below += histogram[limit];
+    }
+    for (i = 0, n = 0; i < S->count && n < candidates; i++) {
+        if (distances[i] < limit || (distances[i] == limit && below++ < candidates)) {
+            ids[n++] = i;
+        }
+    }
+
+    topk_init(&T, matches, k);
+    work = gallery_rerank(G, probe, ids, n, &T);
+    topk_sort(&T);
+    if (owned) {
+        free(distances);
+        free(ids);
+    }
+    return work;
+}
+
+/*
+ * Selects the Hamming kernel
+ * kernel: "c", "popcnt" or "avx2"
+ * returns: 0 on success, -1 if unknown or not supported by this CPU
+ */
+int srp_use(srp_t *S, const char *kernel)
+{
+    __builtin_cpu_init();
+    if (strcmp(kernel, "c") == 0) {
+        S->hamming = hamming_c;
+    } else if (strcmp(kernel, "popcnt") == 0 && __builtin_cpu_supports("popcnt")) {
+        S->hamming = hamming_popcnt;
+    } else if (strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        S->hamming = hamming_avx2;
+    } else {
+        return -1;
+    }
+    S->kernel = kernel;
+    return 0;
+}
+
+void srp_destroy(srp_t *S)
+{
+    if (S->owned) {
+        free((void *) S->planes);
+        free((void *) S->codes);
+    }
+    free(S);
+}
+
+static void hamming_c(const srp_code_t *codes, int count, const srp_code_t code,
+        unsigned short *distances)
+{
+    int i, w, sum;
+
+    for (i = 0; i < count; i++) {
+        for (w = 0, sum = 0; w < SRP_WORDS; w++) {
+            sum += __builtin_popcountll(codes[i][w] ^ code[w]);
+        }
+        distances[i] = sum;
+    }
+}
+
+__attribute__((target("popcnt")))
+static void hamming_popcnt(const srp_code_t *codes, int count, const srp_code_t code,
+        unsigned short *distances)
+{
+    int i, w, sum;
+
+    for (i = 0; i < count; i++) {
+        for (w = 0, sum = 0; w < SRP_WORDS; w++) {
+            sum += __builtin_popcountll(codes[i][w] ^ code[w]);
+        }
+        distances[i] = sum;
+    }
+}
+
+/*
+ * Bits set in each 64-bit lane of the XOR of a code with the probe's;
+ * lut holds the bit counts of the 16 nibble values, low masks a nibble
+ */
+__attribute__((target("avx2"), always_inline))
+static inline __m256i popcount_avx2(const srp_code_t code, __m256i probe, __m256i lut, __m256i low)
+{
+    __m256i x = _mm256_xor_si256(_mm256_load_si256((const __m256i *) code), probe);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+            _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+
+    return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+/*
+ * AVX2 Hamming distances; codes are 32 byte aligned
+ */
+__attribute__((target("avx2")))
+static void hamming_avx2(const srp_code_t *codes, int count, const srp_code_t code,
+        unsigned short *distances)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i pack = _mm256_setr_epi8(0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i halves = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+    __m256i probe = _mm256_loadu_si256((const __m256i *) code);
+    __m256i s0, s1, s2, s3, t01, t23, sums;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        s0 = popcount_avx2(codes[i], probe, lut, low);
+        s1 = popcount_avx2(codes[i + 1], probe, lut, low);
+        s2 = popcount_avx2(codes[i + 2], probe, lut, low);
+        s3 = popcount_avx2(codes[i + 3], probe, lut, low);
+        // (s0 lanes 0+1, s1 lanes 0+1, s0 lanes 2+3, s1 lanes 2+3), then the halves added
+        t01 = _mm256_add_epi64(_mm256_unpacklo_epi64(s0, s1), _mm256_unpackhi_epi64(s0, s1));
+        t23 = _mm256_add_epi64(_mm256_unpacklo_epi64(s2, s3), _mm256_unpackhi_epi64(s2, s3));
+        sums = _mm256_add_epi64(_mm256_permute2x128_si256(t01, t23, 0x20),
+                _mm256_permute2x128_si256(t01, t23, 0x31));
+        // the low 16 bits of each sum into the low dword of its half, the two
+        // dwords side by side, then four distances stored at once
+        sums = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(sums, pack), halves);
+        _mm_storel_epi64((__m128i *) (distances + i), _mm256_castsi256_si128(sums));
+    }
+    hamming_popcnt(codes + i, count - i, code, distances + i);
+}
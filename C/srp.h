@@ -0,0 +1,88 @@
+/*
+ * Sign-random-projection codes for a Hamming prefilter
+ *
+ * Each gallery vector y also gets a SRP_BITS-bit code: bit b is the sign
+ * of h_b . y for SRP_BITS fixed random Gaussian directions h_b. The
+ * fraction of bits in which two codes differ estimates the angle between
+ * the vectors (Charikar's SimHash), so a probe's nearest gallery images
+ * are, with high probability, among those whose codes are closest to its
+ * own in Hamming distance.
+ *
+ * A search encodes the probe, computes the Hamming distance to every code
+ * (XOR and popcount; 32 bytes per image instead of (C-1) doubles, about
+ * 25x fewer for 99 dimensions), keeps the candidates closest and re-ranks
+ * only those with exact distances from the gallery.
+ *
+ * The directions are drawn from a fixed seed, and both they and the codes
+ * are written into the model by FisherfaceCore; an image enrolled later is
+ * encoded with srp_encode against the same directions.
+ */
+
+#ifndef __SRP_H__
+#define __SRP_H__
+
+#include "gallery.h"
+#include "matrix.h"
+#include "model.h"
+#include "topk.h"
+
+#define SRP_BITS 256
+#define SRP_WORDS (SRP_BITS / 64)
+
+// seed of the random directions
+#define SRP_SEED 0x5eed5eedu
+
+// candidates re-ranked when no count is given
+#define SRP_CANDIDATES 64
+
+// codes the Hamming kernels are timed on when one is picked
+#define SRP_CALIBRATE 4096
+
+// model sections written by srp_entries: the directions and the codes
+#define SRP_SECTIONS 2
+
+typedef unsigned long long srp_code_t[SRP_WORDS];
+
+typedef struct srp {
+    int dims;                       // C-1
+    int count;                      // P, number of codes
+    const double *planes;           // SRP_BITS x dims directions
+    const srp_code_t *codes;        // count codes, 32 byte aligned
+    int owned;                      // allocated by srp_create
+    const char *kernel;             // fastest Hamming kernel on this CPU
+                                    // and build, timed at creation
+    void (*hamming)(const srp_code_t *codes, int count, const srp_code_t code,
+            unsigned short *distances);
+} srp_t;
+
+// random directions for dims-dimensional vectors and the codes of the
+// (C-1)xP gallery
+srp_t *srp_create(const MATRIX *ProjectedImages_Fisher);
+
+// model sections holding S; entries must have room for SRP_SECTIONS
+void srp_entries(const srp_t *S, model_entry_t *entries);
+
+// zero-copy codes from a model, which must outlive them; NULL if the model
+// has none for a dims x count gallery
+srp_t *srp_map(model_t *model, int dims, int count);
+
+// code of a vector in Fisher space (a probe, or an image to enroll)
+void srp_encode(const srp_t *S, const double *vector, srp_code_t code);
+
+// Hamming distance from probe's code to every code; distances holds
+// S->count values
+void srp_distances(const srp_t *S, const double *probe, unsigned short *distances);
+
+// k best gallery images among the candidates whose codes are nearest to
+// probe's, by exact distance from G, best first. distances and ids are
+// working memory of S->count values each (see scratch_t), NULL to allocate
+// it per call. Returns the dimensions scored in the re-rank
+long srp_search(const srp_t *S, const gallery_t *G, const double *probe, int candidates, int k,
+        match_t *matches, unsigned short *distances, int *ids);
+
+// forces a Hamming kernel ("c", "popcnt" or "avx2"); -1 if this CPU lacks it
+int srp_use(srp_t *S, const char *kernel);
+
+void srp_destroy(srp_t *S);
+
+#endif
@@ -0,0 +1,370 @@
+/*******************************************************************************
+ Streaming front end for back-to-back PPM / PGM frames
+
+ The ring is single-producer / single-consumer: only the decoder advances
+ head and only the consumer advances tail, so each side publishes a slot
+ with one atomic store. A slot is written only while it lies outside
+ tail .. head, which the consumer cannot enter before head moves past it.
+
+ The input is read through one buffer of STREAM_READ bytes. A P5 payload
+ is copied out of it, a P6 payload is converted three bytes at a time;
+ both go straight into the slot, so a frame is never stored twice.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mpmc.h"
+#include "stream.h"
+
+// the weights of grayscale.c, rounded to the nearest intensity
+#define GREY(r, g, b) ((unsigned char) (.2989 * (r) + .5870 * (g) + .1140 * (b) + .5))
+
+static void *stream_main(void *arg);
+
+/*
+ * Opens the input and starts the decoder
+ * path: file or FIFO to read, "-" or NULL for stdin
+ * pixels: size of the frames to recognize; other sizes are rejected
+ * flags: STREAM_BLOCK to wait for the consumer instead of dropping
+ */
+stream_t *stream_open(const char *path, int pixels, int flags)
+{
+    stream_t *s;
+    int fd = 0, i;
+
+    if (path != NULL && strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+            return NULL;
+        }
+    }
+    if (posix_memalign((void **) &s, 64, sizeof(stream_t)) != 0) {
+        fprintf(stderr, "stream_open: out of memory\n");
+        exit(1);
+    }
+    memset(s, 0, sizeof(stream_t));
+    s->fd = fd;
+    s->pixels = pixels;
+    s->flags = flags;
+    s->buffer = (unsigned char *) malloc(STREAM_READ);
+    for (i = 0; i < STREAM_FRAMES; i++) {
+        if (posix_memalign((void **) &s->frames[i].pixels, 64, pixels) != 0) {
+            fprintf(stderr, "stream_open: out of memory\n");
+            exit(1);
+        }
+    }
+    atomic_init(&s->head, 0);
+    atomic_init(&s->tail, 0);
+    event_init(&s->filled);
+    event_init(&s->freed);
+    atomic_init(&s->done, 0);
+    atomic_init(&s->decoded, 0);
+    atomic_init(&s->dropped, 0);
+    atomic_init(&s->rejected, 0);
+    atomic_init(&s->corrupt, 0);
+
+    pthread_create(&s->decoder, NULL, stream_main, s);
+    return s;
+}
+
+/*
+ * Makes sure the buffer holds at least one unread byte
+ * returns: 0, or -1 at the end of the input
+ */
+static int stream_fill(stream_t *s)
+{
+    ssize_t n;
+
+    if (s->position < s->length) {
+        return 0;
+    }
+    do {
+        n = read(s->fd, s->buffer, STREAM_READ);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return -1;
+    }
+    s->position = 0;
+    s->length = n;
+    return 0;
+}
+
+static int stream_byte(stream_t *s)
+{
+    return stream_fill(s) == 0 ? s->buffer[s->position++] : -1;
+}
+
+/*
+ * Discards n bytes of input
+ * returns: 0, or -1 if the input ends first
+ */
+static int stream_skip(stream_t *s, size_t n)
+{
+    size_t take;
+
+    while (n > 0) {
+        if (stream_fill(s) != 0) {
+            return -1;
+        }
+        take = s->length - s->position < n ? s->length - s->position : n;
+        s->position += take;
+        n -= take;
+    }
+    return 0;
+}
+
+/*
+ * Reads a header number, skipping whitespace and comments before it
+ * returns: the byte after the digits, -1 at the end of the input, or -2
+ *          if something other than a number comes first
+ */
+static int stream_number(stream_t *s, int *value)
+{
+    int c = stream_byte(s);
+
+    while (c == '#' || (c >= 0 && isspace(c))) {
+        if (c == '#') {
+            while (c >= 0 && c != '\n') {
+                c = stream_byte(s);
+            }
+        }
+        c = stream_byte(s);
+    }
+    if (c < 0) {
+        return -1;
+    }
+    if (!isdigit(c)) {
+        return -2;
+    }
+    for (*value = 0; c >= 0 && isdigit(c) && *value < 1 << 24; c = stream_byte(s)) {
+        *value = *value * 10 + c - '0';
+    }
+    return c;
+}
+
+/*
+ * Finds and parses the next header
+ * magic: '5' or '6'
+ * returns: 0, or -1 at the end of the input
+ */
+static int stream_header(stream_t *s, int *magic, int *width, int *height, int *maxval)
+{
+    int c, skipped = 0, end;
+
+    for (;;) {
+        // anything but whitespace before "P5" / "P6" is garbage
+        c = stream_byte(s);
+        while (c >= 0) {
+            if (c == 'P') {
+                c = stream_byte(s);
+                if (c == '5' || c == '6') {
+                    break;
+                }
+                skipped++;
+            } else {
+                skipped += !isspace(c);
+                c = stream_byte(s);
+            }
+        }
+        if (c < 0) {
+            break;
+        }
+        *magic = c;
+
+        if ((end = stream_number(s, width)) >= 0 && isspace(end)
+                && (end = stream_number(s, height)) >= 0 && isspace(end)
+                && (end = stream_number(s, maxval)) >= 0 && isspace(end)
+                && *width > 0 && *height > 0 && *maxval > 0 && *maxval < 65536) {
+            // the single whitespace byte after maxval has been read
+            if (skipped > 0) {
+                atomic_fetch_add(&s->corrupt, 1);
+            }
+            return 0;
+        }
+        if (end == -1) {
+            break;
+        }
+        skipped++;
+    }
+    if (skipped > 0) {
+        atomic_fetch_add(&s->corrupt, 1);
+    }
+    return -1;
+}
+
+/*
+ * Converts a payload into intensities
+ * returns: 0, or -1 if the input ends inside it
+ */
+static int stream_decode(stream_t *s, int magic, unsigned char *out)
+{
+    const unsigned char *p;
+    int i, n, j, r, g, b;
+
+    for (i = 0; i < s->pixels; i += n) {
+        if (stream_fill(s) != 0) {
+            return -1;
+        }
+        n = s->length - s->position;
+        if (magic == '6') {
+            n /= 3;
+        }
+        if (n > s->pixels - i) {
+            n = s->pixels - i;
+        }
+        p = s->buffer + s->position;
+
+        if (magic == '5') {
+            memcpy(out + i, p, n);
+            s->position += n;
+        } else if (n > 0) {
+            for (j = 0; j < n; j++, p += 3) {
+                out[i + j] = GREY(p[0], p[1], p[2]);
+            }
+            s->position += 3 * n;
+        } else {
+            // a pixel split across two reads
+            r = stream_byte(s);
+            g = stream_byte(s);
+            b = stream_byte(s);
+            if (b < 0) {
+                return -1;
+            }
+            out[i] = GREY(r, g, b);
+            n = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Decoder thread: fills the ring until the input ends
+ */
+static void *stream_main(void *arg)
+{
+    stream_t *s = (stream_t *) arg;
+    int magic, width, height, maxval;
+    long sequence = 0, head;
+    size_t payload;
+    unsigned key;
+    frame_t *frame;
+
+    while (!atomic_load(&s->done) && stream_header(s, &magic, &width, &height, &maxval) == 0) {
+        payload = (size_t) width * height * (magic == '6' ? 3 : 1) * (maxval > 255 ? 2 : 1);
+        if ((long) width * height != s->pixels || maxval > 255) {
+            atomic_fetch_add(&s->rejected, 1);
+            sequence++;
+            if (stream_skip(s, payload) != 0) {
+                break;
+            }
+            continue;
+        }
+
+        head = atomic_load_explicit(&s->head, memory_order_relaxed);
+        while (head - atomic_load(&s->tail) >= STREAM_FRAMES && (s->flags & STREAM_BLOCK)
+                && !atomic_load(&s->done)) {
+            key = event_prepare(&s->freed);
+            if (head - atomic_load(&s->tail) >= STREAM_FRAMES) {
+                event_wait(&s->freed, key);
+            }
+        }
+        if (head - atomic_load(&s->tail) >= STREAM_FRAMES) {
+            // every slot is waiting: skipping is cheaper than decoding
+            atomic_fetch_add(&s->dropped, 1);
+            sequence++;
+            if (stream_skip(s, payload) != 0) {
+                break;
+            }
+            continue;
+        }
+
+        frame = &s->frames[head % STREAM_FRAMES];
+        if (stream_decode(s, magic, frame->pixels) != 0) {
+            atomic_fetch_add(&s->corrupt, 1);
+            break;
+        }
+        frame->width = width;
+        frame->height = height;
+        frame->sequence = sequence++;
+        atomic_fetch_add(&s->decoded, 1);
+        atomic_store_explicit(&s->head, head + 1, memory_order_release);
+        event_signal(&s->filled);
+    }
+
+    atomic_store(&s->done, 1);
+    event_broadcast(&s->filled);
+    return NULL;
+}
+
+/*
+ * Waits for the next frame
+ * frame: set to the frame at the tail of the ring
+ * returns: 0, or -1 once the input has ended and the ring is empty
+ */
+int stream_next(stream_t *s, frame_t **frame)
+{
+    long tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    unsigned key;
+
+    for (;;) {
+        key = event_prepare(&s->filled);
+        if (atomic_load_explicit(&s->head, memory_order_acquire) != tail) {
+            *frame = &s->frames[tail % STREAM_FRAMES];
+            return 0;
+        }
+        if (atomic_load(&s->done)) {
+            // the decoder may have published a last frame before finishing
+            if (atomic_load(&s->head) != tail) {
+                continue;
+            }
+            return -1;
+        }
+        event_wait(&s->filled, key);
+    }
+}
+
+void stream_release(stream_t *s)
+{
+    atomic_fetch_add_explicit(&s->tail, 1, memory_order_release);
+    event_signal(&s->freed);
+}
+
+void stream_stats(stream_t *s, stream_stats_t *stats)
+{
+    stats->decoded = atomic_load(&s->decoded);
+    stats->dropped = atomic_load(&s->dropped);
+    stats->rejected = atomic_load(&s->rejected);
+    stats->corrupt = atomic_load(&s->corrupt);
+}
+
+/*
+ * Stops the decoder, which may be blocked reading the input, and frees
+ * the stream
+ */
+void stream_close(stream_t *s)
+{
+    int i;
+
+    atomic_store(&s->done, 1);
+    event_broadcast(&s->freed);
+    pthread_cancel(s->decoder);
+    pthread_join(s->decoder, NULL);
+
+    if (s->fd != 0) {
+        close(s->fd);
+    }
+    for (i = 0; i < STREAM_FRAMES; i++) {
+        free(s->frames[i].pixels);
+    }
+    free(s->buffer);
+    free(s);
+}
@@ -0,0 +1,89 @@
+/*
+ * Streaming front end for back-to-back PPM / PGM frames
+ *
+ * Reads a byte stream of concatenated binary P6 (RGB) or P5 (grayscale)
+ * images, as written by "ffmpeg -f image2pipe -vcodec ppm", from stdin or
+ * a FIFO. A decoder thread parses each header, converts the pixels to 8-bit
+ * intensities (the weights of grayscale.c) straight into a slot of a ring
+ * of frame buffers, and hands the slot to the consumer, which recognizes
+ * it in place while the next frame is decoded.
+ *
+ * When every slot is still waiting to be recognized the decoder skips the
+ * frame's payload instead of decoding it (a drop), so a slow consumer sees
+ * the camera at a lower frame rate rather than an ever older one. With
+ * STREAM_BLOCK it waits for a free slot instead, for replaying files.
+ *
+ * Malformed input never ends the process: frames of the wrong size or with
+ * 16-bit samples are skipped whole, and garbage between frames is skipped
+ * up to the next "P5" / "P6".
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mpmc.h"
+
+// frame buffers in the ring
+#define STREAM_FRAMES 4
+
+// bytes read from the input per system call
+#define STREAM_READ (64 << 10)
+
+// flags of stream_open
+#define STREAM_BLOCK 1              // wait for a free slot, never drop
+
+typedef struct {
+    unsigned char *pixels;          // width*height intensities, row by row
+    int width, height;
+    long sequence;                  // position in the input, from 0,
+                                    // counting dropped frames
+} frame_t;
+
+typedef struct {
+    long decoded;                   // frames handed to the consumer
+    long dropped;                   // skipped because the ring was full
+    long rejected;                  // skipped: wrong size or 16-bit samples
+    long corrupt;                   // stretches of garbage skipped
+} stream_stats_t;
+
+typedef struct {
+    int fd;
+    int pixels;                     // width*height every frame must have
+    int flags;
+    frame_t frames[STREAM_FRAMES];
+
+    unsigned char *buffer;          // STREAM_READ bytes read ahead
+    int position, length;
+
+    // decoder-owned head, consumer-owned tail; frames head-tail are ready
+    _Alignas(64) atomic_long head;
+    _Alignas(64) atomic_long tail;
+    event_t filled;                 // signalled after a frame or at the end
+    event_t freed;                  // signalled after stream_release
+    atomic_int done;                // input exhausted or stream closing
+
+    atomic_long decoded, dropped, rejected, corrupt;
+    pthread_t decoder;
+} stream_t;
+
+// starts decoding path ("-" or NULL for stdin) into frames of width*height
+// == pixels; NULL if path cannot be opened
+stream_t *stream_open(const char *path, int pixels, int flags);
+
+// waits for the next decoded frame; 0 with *frame set, -1 once the input
+// has ended and every frame has been returned. The frame stays valid
+// until stream_release
+int stream_next(stream_t *s, frame_t **frame);
+
+// gives the frame returned by stream_next back to the decoder
+void stream_release(stream_t *s);
+
+void stream_stats(stream_t *s, stream_stats_t *stats);
+
+// stops the decoder and closes the input
+void stream_close(stream_t *s);
+
+#endif
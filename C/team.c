@@ -0,0 +1,266 @@
+/*******************************************************************************
+ Latency-mode recognition on a thread team
+
+ One probe goes through two phases separated by a barrier. In the first,
+ every member converts its pixel block to doubles and multiplies it by
+ the matching columns of the projection, writing a partial vector into its
+ own cache lines. The barrier is the projected counter. In the second,
+ every member adds up all the partials in the same order (so they agree
+ bit for bit on the projected probe) and searches its gallery shard.
+
+ Redoing the (C-1)-long sum on every member costs less than a second
+ hand-off through the caller would. Pixel blocks are multiples of 8
+ doubles, so no two members write the same cache line of team->pixels.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <cblas.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "Recognition.h"
+#include "gallery.h"
+#include "mpmc.h"
+#include "team.h"
+#include "topk.h"
+#include "topology.h"
+
+struct team_member {
+    pthread_t thread;
+    team_t *team;
+    int cpu;                        // -1 for the caller
+    int first, last;                // pixel block: projection columns
+    gallery_t *shard;               // gallery blocks searched by this member
+    int base;                       // gallery index of the shard's image 0
+    double *partial;                // (C-1) projection of the pixel block
+    match_t *matches;               // k best of the shard
+    long work;
+} __attribute__((aligned(64)));
+
+static void *team_main(void *arg);
+
+/*
+ * Waits until a counter reaches a value, spinning first
+ */
+static void team_wait(atomic_ulong *counter, unsigned long target)
+{
+    int spin = 0;
+
+    while (atomic_load_explicit(counter, memory_order_acquire) < target) {
+        if (spin < TEAM_SPIN) {
+            _mm_pause();
+            spin++;
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/*
+ * Creates a team and starts its members
+ * R: the loaded model; must outlive the team
+ * T: the machine's nodes; the members run on node 0
+ * threads: members including the caller, <= 0 for every CPU of node 0
+ * k: matches returned per probe
+ */
+team_t *team_create(const recognizer_t *R, const topology_t *T, int threads, int k)
+{
+    const MATRIX *Projection = R->v_fisherT_x_v_pcaT;
+    int dims = Projection->rows;
+    int pixels = Projection->cols;
+    int block, blocks = R->gallery->blocks;
+    team_member_t *m;
+    team_t *team;
+    int i;
+
+    if (threads <= 0) {
+        threads = T->count[0] > 0 ? T->count[0] : 1;
+    }
+    // columns per member, rounded up to whole cache lines
+    block = ((pixels + threads - 1) / threads + 7) / 8 * 8;
+
+    if (posix_memalign((void **) &team, 64, sizeof(team_t)) != 0
+            || posix_memalign((void **) &team->members, 64, threads * sizeof(team_member_t)) != 0
+            || posix_memalign((void **) &team->pixels, 64, pixels * sizeof(double)) != 0) {
+        fprintf(stderr, "team_create: out of memory\n");
+        exit(1);
+    }
+    team->R = R;
+    team->threads = threads;
+    team->k = k;
+    team->scratch = CreateScratch(R);
+    atomic_init(&team->go, 0);
+    atomic_init(&team->projected, 0);
+    atomic_init(&team->searched, 0);
+    atomic_init(&team->stop, 0);
+    event_init(&team->wake);
+
+    for (i = 0; i < threads; i++) {
+        m = &team->members[i];
+        m->team = team;
+        m->cpu = i == 0 ? -1 : topology_cpu(T, 0, i);
+        m->first = i * block < pixels ? i * block : pixels;
+        m->last = m->first + block < pixels ? m->first + block : pixels;
+        m->shard = gallery_shard(R->gallery, (long) i * blocks / threads,
+                (long) (i + 1) * blocks / threads - (long) i * blocks / threads);
+        m->base = (long) i * blocks / threads * GALLERY_LANES;
+        if (posix_memalign((void **) &m->partial, 64, dims * sizeof(double)) != 0
+                || posix_memalign((void **) &m->matches, 64, k * sizeof(match_t)) != 0) {
+            fprintf(stderr, "team_create: out of memory\n");
+            exit(1);
+        }
+        memset(m->partial, 0, dims * sizeof(double));
+    }
+    for (i = 1; i < threads; i++) {
+        pthread_create(&team->members[i].thread, NULL, team_main, &team->members[i]);
+    }
+
+    return team;
+}
+
+/*
+ * One member's share of probe n
+ */
+static void team_work(team_member_t *m, unsigned long n)
+{
+    team_t *team = m->team;
+    const recognizer_t *R = team->R;
+    const MATRIX *Projection = R->v_fisherT_x_v_pcaT;
+    int dims = Projection->rows;
+    double y[dims];
+    topk_t T;
+    int i, d;
+
+    // partial = Projection(:, first:last) * x(first:last)
+    for (i = m->first; i < m->last; i++) {
+        team->pixels[i] = team->probe[(size_t) i * team->stride];
+    }
+    if (m->last > m->first) {
+        cblas_dgemv(CblasRowMajor, CblasNoTrans, dims, m->last - m->first,
+                1, *Projection->data + m->first, Projection->cols,
+                team->pixels + m->first, 1, 0, m->partial, 1);
+    }
+    atomic_fetch_add_explicit(&team->projected, 1, memory_order_release);
+    team_wait(&team->projected, n * team->threads);
+
+    // y = sum of the partials - projected_mean
+    for (d = 0; d < dims; d++) {
+        y[d] = -R->projected_mean[d];
+    }
+    for (i = 0; i < team->threads; i++) {
+        for (d = 0; d < dims; d++) {
+            y[d] += team->members[i].partial[d];
+        }
+    }
+
+    topk_init(&T, m->matches, team->k);
+    m->work = gallery_search(m->shard, y, &T);
+    topk_sort(&T);
+    atomic_fetch_add_explicit(&team->searched, 1, memory_order_release);
+}
+
+/*
+ * Recognizes one probe, the caller acting as member 0
+ * pixels, stride: the probe (see RecognizeProbe)
+ * matches: team->k results, best first
+ * returns: dimensions scored by the search
+ */
+long team_recognize(team_t *team, const unsigned char *pixels, int stride, match_t *matches)
+{
+    const recognizer_t *R = team->R;
+    team_member_t *m;
+    unsigned long n;
+    long work = 0;
+    topk_t T;
+    int i, j;
+
+    if (R->quant != NULL || R->ivf != NULL || R->centroids != NULL || R->srp != NULL) {
+        return RecognizeProbe(R, pixels, stride, team->scratch, team->k, matches);
+    }
+
+    // the probe is published by the increment of go
+    team->probe = pixels;
+    team->stride = stride;
+    n = atomic_fetch_add(&team->go, 1) + 1;
+    event_broadcast(&team->wake);
+    team_work(&team->members[0], n);
+    team_wait(&team->searched, n * team->threads);
+
+    // merge the shards' matches
+    topk_init(&T, matches, team->k);
+    for (i = 0; i < team->threads; i++) {
+        m = &team->members[i];
+        for (j = 0; j < team->k && m->matches[j].index >= 0; j++) {
+            topk_push(&T, m->base + m->matches[j].index, m->matches[j].distance);
+        }
+        work += m->work;
+    }
+    topk_sort(&T);
+
+    return work;
+}
+
+/*
+ * Stops the members and frees the team
+ */
+void team_destroy(team_t *team)
+{
+    int i;
+
+    atomic_store(&team->stop, 1);
+    event_broadcast(&team->wake);
+    for (i = 0; i < team->threads; i++) {
+        if (i > 0) {
+            pthread_join(team->members[i].thread, NULL);
+        }
+        gallery_destroy(team->members[i].shard);
+        free(team->members[i].partial);
+        free(team->members[i].matches);
+    }
+    DestroyScratch(team->scratch);
+    free(team->members);
+    free(team->pixels);
+    free(team);
+}
+
+/*
+ * Member thread: spins until a probe is published or the team is stopped,
+ * then parks on the wake event
+ */
+static void *team_main(void *arg)
+{
+    team_member_t *self = (team_member_t *) arg;
+    team_t *team = self->team;
+    unsigned long seen = 0, n;
+    unsigned key;
+    int spin = 0;
+
+    topology_pin(self->cpu);
+
+    while (!atomic_load_explicit(&team->stop, memory_order_relaxed)) {
+        n = atomic_load_explicit(&team->go, memory_order_acquire);
+        if (n == seen) {
+            if (spin < TEAM_SPIN) {
+                _mm_pause();
+                spin++;
+                continue;
+            }
+            // go and stop are checked again after the key is taken, so a
+            // probe published in between makes event_wait return at once
+            key = event_prepare(&team->wake);
+            if (atomic_load(&team->go) == seen && !atomic_load(&team->stop)) {
+                event_wait(&team->wake, key);
+            }
+            continue;
+        }
+        seen = n;
+        spin = 0;
+        team_work(self, n);
+    }
+
+    return NULL;
+}
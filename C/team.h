@@ -0,0 +1,72 @@
+/*
+ * Latency-mode recognition on a thread team
+ *
+ * The worker pool (pool.h) runs many probes side by side, one per thread;
+ * a single probe still takes one core for the whole projection and gallery
+ * scan. A team splits one probe over threads instead: member i projects the
+ * pixel block i (a column slice of v_fisherT_x_v_pcaT) into a partial
+ * vector, every member sums the partials once all have arrived, then
+ * searches gallery shard i for its own k best; the caller merges the
+ * shards' matches.
+ *
+ * The caller's thread is member 0. The other members are started with the
+ * team, pinned to CPUs of one node, and spin-wait for the next probe, so a
+ * hand-off in a busy stream costs a cache-line transfer rather than a futex
+ * wake-up. After TEAM_SPIN polls with no probe a member parks on the wake
+ * event, so an idle team gives its cores back; the next probe then pays
+ * one wake-up.
+ *
+ * Only the exact double path is split; with int8, IVF, centroids or the
+ * Hamming prefilter attached the caller recognizes the probe alone.
+ */
+
+#ifndef __TEAM_H__
+#define __TEAM_H__
+
+#include <stdatomic.h>
+
+#include "Recognition.h"
+#include "mpmc.h"
+#include "topology.h"
+
+// polls of a hand-off flag before a waiting member yields (within a
+// probe) or parks on the wake event (between probes)
+#define TEAM_SPIN 4096
+
+typedef struct team_member team_member_t;
+
+typedef struct {
+    const recognizer_t *R;
+    int threads;                    // members, the caller included
+    int k;                          // matches per probe
+    team_member_t *members;
+    double *pixels;                 // the probe as doubles, written in blocks
+    scratch_t *scratch;             // for probes the team does not split
+
+    const unsigned char *probe;     // current probe (see RecognizeProbe)
+    int stride;
+
+    // hand-off counters, each on its own cache line; they only grow, so
+    // probe n is started when go reaches n and complete when searched
+    // reaches n * threads
+    atomic_ulong go __attribute__((aligned(64)));
+    atomic_ulong projected __attribute__((aligned(64)));
+    atomic_ulong searched __attribute__((aligned(64)));
+    atomic_int stop __attribute__((aligned(64)));
+    event_t wake;                   // signalled with every go and at stop
+} team_t;
+
+// starts a team of threads members over R (which must outlive it), pinned
+// to CPUs 1 .. threads-1 of node 0 of T; the caller should run on CPU 0
+// of that node. threads <= 0 uses every CPU of node 0
+team_t *team_create(const recognizer_t *R, const topology_t *T, int threads, int k);
+
+// recognizes one probe with the whole team; fills team->k matches, best
+// first. Returns the work done as RecognizeProbe does. Only one thread
+// may call it at a time
+long team_recognize(team_t *team, const unsigned char *pixels, int stride, match_t *matches);
+
+// stops and joins the members
+void team_destroy(team_t *team);
+
+#endif
@@ -0,0 +1,96 @@
+/*******************************************************************************
+ Bounded top-k selection
+
+ A max-heap of k entries replaces "compute every distance, then scan for the
+ minimum": a candidate costs O(1) when it does not beat the root and
+ O(log k) when it does, and the root is the bound early abandoning needs.
+*******************************************************************************/
+
+#include <math.h>
+
+#include "topk.h"
+
+/*
+ * Starts an empty selection
+ * storage: k entries owned by the caller; holds the result after topk_sort
+ */
+void topk_init(topk_t *T, match_t *storage, int k)
+{
+    T->heap = storage;
+    T->k = k;
+    T->size = 0;
+}
+
+/*
+ * The k-th best distance so far, or HUGE_VAL while fewer than k were seen
+ */
+double topk_bound(const topk_t *T)
+{
+    return T->size < T->k ? HUGE_VAL : T->heap[0].distance;
+}
+
+/*
+ * Moves the entry at i down until the heap property holds again
+ */
+static void topk_sift_down(match_t *heap, int size, int i)
+{
+    match_t temp = heap[i];
+    int child;
+
+    while ((child = 2 * i + 1) < size) {
+        if (child + 1 < size && heap[child + 1].distance > heap[child].distance) {
+            child++;
+        }
+        if (heap[child].distance <= temp.distance) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = temp;
+}
+
+/*
+ * Offers a candidate to the selection
+ */
+void topk_push(topk_t *T, int index, double distance)
+{
+    int i, parent;
+
+    if (T->size < T->k) {
+        // sift up from the end
+        for (i = T->size++; i > 0; i = parent) {
+            parent = (i - 1) / 2;
+            if (T->heap[parent].distance >= distance) {
+                break;
+            }
+            T->heap[i] = T->heap[parent];
+        }
+        T->heap[i].index = index;
+        T->heap[i].distance = distance;
+    } else if (distance < T->heap[0].distance) {
+        T->heap[0].index = index;
+        T->heap[0].distance = distance;
+        topk_sift_down(T->heap, T->size, 0);
+    }
+}
+
+/*
+ * Heap sort in place: repeatedly moves the largest entry to the end
+ */
+void topk_sort(topk_t *T)
+{
+    match_t temp;
+    int i;
+
+    for (i = T->size - 1; i > 0; i--) {
+        temp = T->heap[0];
+        T->heap[0] = T->heap[i];
+        T->heap[i] = temp;
+        topk_sift_down(T->heap, i, 0);
+    }
+    for (i = T->size; i < T->k; i++) {
+        T->heap[i].index = -1;
+        T->heap[i].distance = HUGE_VAL;
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Bounded top-k selection
+ *
+ * Keeps the k smallest distances seen so far in a max-heap, so the current
+ * k-th best distance (the bound a new candidate has to beat) is always at
+ * the root. Searches use the bound to abandon candidates early.
+ */
+
+#ifndef __TOPK_H__
+#define __TOPK_H__
+
+// one candidate returned by a search
+typedef struct {
+    int index;                      // gallery image (column of ProjectedImages_Fisher)
+    double distance;                // squared Euclidean distance
+} match_t;
+
+typedef struct {
+    match_t *heap;                  // k entries, max-heap on distance
+    int k;
+    int size;                       // entries filled so far
+} topk_t;
+
+// starts an empty selection of k entries stored in storage
+void topk_init(topk_t *T, match_t *storage, int k);
+
+// distance a candidate must beat to enter the selection
+double topk_bound(const topk_t *T);
+
+// offers a candidate; kept if it is among the k best so far
+void topk_push(topk_t *T, int index, double distance);
+
+// turns the heap into a list sorted best first; unfilled entries get
+// index -1. The selection cannot be pushed to afterwards
+void topk_sort(topk_t *T);
+
+#endif
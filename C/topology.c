@@ -0,0 +1,163 @@
+/*******************************************************************************
+ NUMA topology and memory placement
+
+ sysfs lists node and CPU sets as ranges ("0-3,8-11"); parse_list turns
+ one into ids. mbind is called through syscall() with the MPOL_* values of
+ linux/mempolicy.h, which is all libnuma does for a binding like this.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "topology.h"
+
+#define NODE_PATH "/sys/devices/system/node"
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+/*
+ * Reads a range list such as "0-3,8-11" from a sysfs file
+ * ids: receives up to max ids
+ * returns: the number of ids, -1 if the file cannot be read
+ */
+static int parse_list(const char *path, int *ids, int max)
+{
+    FILE *in = fopen(path, "r");
+    int n = 0, first, last, i;
+    char separator;
+
+    if (in == NULL) {
+        return -1;
+    }
+    while (fscanf(in, "%d", &first) == 1) {
+        last = first;
+        separator = fgetc(in);
+        if (separator == '-') {
+            if (fscanf(in, "%d", &last) != 1) {
+                break;
+            }
+            separator = fgetc(in);
+        }
+        for (i = first; i <= last && n < max; i++) {
+            ids[n++] = i;
+        }
+        if (separator != ',') {
+            break;
+        }
+    }
+    fclose(in);
+    return n;
+}
+
+/*
+ * Finds the online nodes and the CPUs of each
+ */
+topology_t *topology_detect(void)
+{
+    topology_t *T = (topology_t *) calloc(1, sizeof(topology_t));
+    int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    int ids[TOPOLOGY_MAX_NODES];
+    char path[128];
+    int i, n;
+
+    if (ncpus < 1) {
+        ncpus = 1;
+    }
+    n = parse_list(NODE_PATH "/online", ids, TOPOLOGY_MAX_NODES);
+    if (n < 1) {
+        // no NUMA support: one node with every CPU
+        n = 1;
+        ids[0] = -1;
+    }
+
+    T->nodes = n;
+    T->ids = (int *) malloc(n * sizeof(int));
+    T->count = (int *) malloc(n * sizeof(int));
+    T->cpus = (int **) malloc(n * sizeof(int *));
+    for (i = 0; i < n; i++) {
+        T->ids[i] = ids[i];
+        T->cpus[i] = (int *) malloc(ncpus * sizeof(int));
+        snprintf(path, sizeof(path), NODE_PATH "/node%d/cpulist", ids[i]);
+        T->count[i] = ids[i] < 0 ? -1 : parse_list(path, T->cpus[i], ncpus);
+        if (T->count[i] < 0) {
+            for (T->count[i] = 0; T->count[i] < ncpus; T->count[i]++) {
+                T->cpus[i][T->count[i]] = T->count[i];
+            }
+        }
+    }
+    return T;
+}
+
+void topology_destroy(topology_t *T)
+{
+    int i;
+
+    for (i = 0; i < T->nodes; i++) {
+        free(T->cpus[i]);
+    }
+    free(T->cpus);
+    free(T->count);
+    free(T->ids);
+    free(T);
+}
+
+int topology_cpu(const topology_t *T, int node, int i)
+{
+    // memory-only nodes have no CPUs; use the first node's
+    if (T->count[node] == 0) {
+        node = 0;
+    }
+    return T->count[node] > 0 ? T->cpus[node][i % T->count[node]] : 0;
+}
+
+int topology_pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Maps memory placed on one node or interleaved over all of them
+ * node: index into T->ids, or TOPOLOGY_INTERLEAVE
+ */
+void *topology_alloc(const topology_t *T, size_t bytes, int node)
+{
+    unsigned long mask[TOPOLOGY_MAX_NODES / LONG_BITS];
+    void *memory;
+    int i, bits = 0;
+
+    memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+    memset(mask, 0, sizeof(mask));
+    for (i = 0; i < T->nodes; i++) {
+        if (T->ids[i] >= 0 && (node == TOPOLOGY_INTERLEAVE || node == i)) {
+            mask[T->ids[i] / LONG_BITS] |= 1UL << (T->ids[i] % LONG_BITS);
+            bits++;
+        }
+    }
+    // nothing is touched yet, so the policy decides where every page goes;
+    // if it is refused the pages simply land where they are first written
+    if (bits > 0) {
+        syscall(SYS_mbind, memory, bytes, node == TOPOLOGY_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_BIND,
+                mask, (unsigned long) TOPOLOGY_MAX_NODES + 1, 0);
+    }
+    return memory;
+}
+
+void topology_free(void *memory, size_t bytes)
+{
+    munmap(memory, bytes);
+}
@@ -0,0 +1,46 @@
+/*
+ * NUMA topology and memory placement
+ *
+ * Reads the nodes and their CPUs from sysfs (/sys/devices/system/node), so
+ * no libnuma is needed; a machine without that directory is one node
+ * holding every online CPU. Memory for a node is mapped anonymously and
+ * bound to it with the mbind system call before it is first touched, so
+ * its pages are allocated there whichever thread fills them. Where mbind
+ * is not available (single-node kernels, seccomp) the memory is still
+ * usable and placement falls back to first touch.
+ */
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <stddef.h>
+
+// most nodes a node mask covers
+#define TOPOLOGY_MAX_NODES 64
+
+// node argument of topology_alloc: pages spread round-robin over all nodes
+#define TOPOLOGY_INTERLEAVE -1
+
+typedef struct {
+    int nodes;                      // online nodes, numbered 0 .. nodes-1
+    int *ids;                       // kernel node id of each of them
+    int *count;                     // CPUs of each node
+    int **cpus;                     // CPU ids of each node, ascending
+} topology_t;
+
+// the machine's nodes; never NULL
+topology_t *topology_detect(void);
+void topology_destroy(topology_t *T);
+
+// CPU i of node (taken modulo the node's CPU count)
+int topology_cpu(const topology_t *T, int node, int i);
+
+// pins the calling thread to one CPU; 0 on success
+int topology_pin(int cpu);
+
+// bytes of zeroed memory whose pages live on node (an index into T), or
+// are interleaved over all nodes for TOPOLOGY_INTERLEAVE; NULL on error
+void *topology_alloc(const topology_t *T, size_t bytes, int node);
+void topology_free(void *memory, size_t bytes);
+
+#endif